@@ -26,10 +26,18 @@
 #include <errno.h>
 #include <string.h>
 #include <stdio.h>
+#include <signal.h>
+#include <unistd.h>
+#ifdef HAVE_MALLOC_TRIM
+#include <malloc.h>
+#endif
 
 #include <glib/gi18n.h>
 #include <glib.h>
+#include <glib/gstdio.h>
 #include <gio/gio.h>
+#include <gio/gunixsocketaddress.h>
+#include <glib-unix.h>
 #include <glib-object.h>
 #include <gtk/gtk.h>
 
@@ -43,10 +51,42 @@
 #include "daemon.h"
 #include "nd-notification.h"
 #include "nd-queue.h"
+#include "nd-filter.h"
+#include "nd-outbox.h"
+#include "nd-rules.h"
+#include "nd-log.h"
+#include "nd-clock.h"
+#include "nd-memory.h"
+#include "nd-pressure.h"
+#include "nd-usage.h"
 
 #define MAX_NOTIFICATIONS 20
+/* per client */
+#define MAX_TEMPLATES 64
+#define MAX_PAGE_SIZE 100
+#define MAX_SUBSCRIPTIONS 64
+/* stored notifications brought back per idle on startup */
+#define REPLAY_BATCH_SIZE 256
+/* how often to try for a log the old instance still holds */
+#define LOG_RETRY_MSEC 200
+/* how long changes to stored notifications are gathered before they
+ * are written */
+#define LOG_FLUSH_MSEC 500
+/* how long a new instance waits for the old one's state */
+#define HANDOVER_TIMEOUT_SECONDS 2
+#define MAX_HANDOVER_SIZE (64 * 1024 * 1024)
+/* how long the old instance waits for the new one to take the name */
+#define HANDOVER_GRACE_SECONDS 10
+/* the queue state, the templates by handle and the subscriptions by
+ * id with the filter they were made with */
+#define HANDOVER_STATE_TYPE G_VARIANT_TYPE ("(va(u(sssssasa{sv}iu))a(usa{sv}))")
 
 #define IDLE_SECONDS 30
+/* quiet time after which rebuildable state is dropped, and the least
+ * time between two trims on memory pressure */
+#define TRIM_IDLE_SECONDS 300
+#define TRIM_INTERVAL_SECONDS 10
+#define DUPLICATE_WINDOW_SECONDS 10
 #define NOTIFICATION_BUS_NAME      "org.freedesktop.Notifications"
 #define NOTIFICATION_BUS_PATH      "/org/freedesktop/Notifications"
 
@@ -58,10 +98,86 @@
 struct _NotifyDaemonPrivate
 {
         GDBusConnection *connection;
+        NdOutbox        *outbox;
         NdQueue         *queue;
+        NdRules         *rules;
+
+        NdLog           *log;
+        /* notification -> LogChange, written out on log_flush */
+        GHashTable      *log_changes;
+        NdClockWakeup   *log_flush;
+        /* set while a repeat is counted on it */
+        NdNotification  *counting;
+        guint            log_retry_id;
+        guint            replay_id;
+        guint            compact_id;
+
+        GSocketService  *handover_service;
+        /* set while a replacing instance waits for the name */
+        GSocketConnection *handover_to;
+        guint            handover_id;
+        /* the instance we replace, until we have the name */
+        GSocketConnection *handover_from;
+
+        guint            owner_id;
+        guint            idle_timeout;
+        NdClockWakeup   *idle_wakeup;
+
+        NdPressure      *pressure;
+        NdClockWakeup   *trim_wakeup;
+        gint64           last_trim;
+
+        GHashTable      *templates;
+        guint            next_template;
+        /* sender -> TemplateOwner */
+        GHashTable      *template_owners;
+
+        GHashTable      *subscriptions;
+        guint            next_subscription;
 };
 
+typedef enum
+{
+        LOG_CHANGE_COUNT = 1,
+        LOG_CHANGE_RECORD
+} LogChange;
+
+typedef struct
+{
+        guint            id;
+        char            *sender;
+        NdFilter        *filter;
+        GVariant        *filter_dict;
+        guint            watch_id;
+} Subscription;
+
+typedef struct
+{
+        guint            n_templates;
+        guint            watch_id;
+} TemplateOwner;
+
+static void
+template_owner_free (TemplateOwner *owner)
+{
+        g_bus_unwatch_name (owner->watch_id);
+        g_slice_free (TemplateOwner, owner);
+}
+
+static void
+subscription_free (Subscription *subscription)
+{
+        g_bus_unwatch_name (subscription->watch_id);
+        nd_filter_free (subscription->filter);
+        g_variant_unref (subscription->filter_dict);
+        g_free (subscription->sender);
+        g_slice_free (Subscription, subscription);
+}
+
 static void notify_daemon_finalize (GObject *object);
+static void flush_log (NotifyDaemon *daemon);
+static void on_idle_timeout (NotifyDaemon *daemon);
+static void on_trim_timeout (NotifyDaemon *daemon);
 
 G_DEFINE_TYPE (NotifyDaemon, notify_daemon, G_TYPE_OBJECT);
 
@@ -83,6 +199,56 @@ notify_daemon_init (NotifyDaemon *daemon)
                                                     NotifyDaemonPrivate);
 
         daemon->priv->queue = nd_queue_new ();
+        daemon->priv->templates = g_hash_table_new_full (g_direct_hash,
+                                                         g_direct_equal,
+                                                         NULL,
+                                                         g_object_unref);
+        daemon->priv->next_template = 1;
+        daemon->priv->template_owners = g_hash_table_new_full (g_str_hash,
+                                                               g_str_equal,
+                                                               g_free,
+                                                               (GDestroyNotify) template_owner_free);
+        daemon->priv->subscriptions = g_hash_table_new_full (g_direct_hash,
+                                                             g_direct_equal,
+                                                             NULL,
+                                                             (GDestroyNotify) subscription_free);
+        daemon->priv->next_subscription = 1;
+        daemon->priv->log_changes = g_hash_table_new_full (g_direct_hash,
+                                                           g_direct_equal,
+                                                           g_object_unref,
+                                                           NULL);
+        daemon->priv->log_flush = nd_clock_wakeup_new (nd_clock_get_default (),
+                                                       (NdClockWakeupFunc) flush_log,
+                                                       daemon);
+        /* moved on every call, so they are kept rather than re-created */
+        daemon->priv->idle_wakeup = nd_clock_wakeup_new (nd_clock_get_default (),
+                                                         (NdClockWakeupFunc) on_idle_timeout,
+                                                         daemon);
+        daemon->priv->trim_wakeup = nd_clock_wakeup_new (nd_clock_get_default (),
+                                                         (NdClockWakeupFunc) on_trim_timeout,
+                                                         daemon);
+}
+
+static void
+close_log (NotifyDaemon *daemon)
+{
+        /* what is still pending goes in first */
+        flush_log (daemon);
+
+        if (daemon->priv->log_retry_id > 0) {
+                nd_clock_source_remove (nd_clock_get_default (), daemon->priv->log_retry_id);
+                daemon->priv->log_retry_id = 0;
+        }
+        if (daemon->priv->replay_id > 0) {
+                nd_clock_source_remove (nd_clock_get_default (), daemon->priv->replay_id);
+                daemon->priv->replay_id = 0;
+        }
+        if (daemon->priv->compact_id > 0) {
+                nd_clock_source_remove (nd_clock_get_default (), daemon->priv->compact_id);
+                daemon->priv->compact_id = 0;
+        }
+        nd_log_close (daemon->priv->log);
+        daemon->priv->log = NULL;
 }
 
 static void
@@ -93,173 +259,1455 @@ notify_daemon_finalize (GObject *object)
         daemon = NOTIFY_DAEMON (object);
 
         g_object_unref (daemon->priv->queue);
+        g_hash_table_destroy (daemon->priv->templates);
+        g_hash_table_destroy (daemon->priv->template_owners);
+        g_hash_table_destroy (daemon->priv->subscriptions);
+        if (daemon->priv->outbox != NULL) {
+                g_object_unref (daemon->priv->outbox);
+        }
+        if (daemon->priv->rules != NULL) {
+                g_object_unref (daemon->priv->rules);
+        }
+        nd_clock_wakeup_free (nd_clock_get_default (), daemon->priv->idle_wakeup);
+        nd_clock_wakeup_free (nd_clock_get_default (), daemon->priv->trim_wakeup);
+        if (daemon->priv->pressure != NULL) {
+                nd_pressure_free (daemon->priv->pressure);
+        }
+        if (daemon->priv->handover_id > 0) {
+                nd_clock_source_remove (nd_clock_get_default (), daemon->priv->handover_id);
+        }
+        if (daemon->priv->handover_to != NULL) {
+                g_object_unref (daemon->priv->handover_to);
+        }
+        if (daemon->priv->handover_from != NULL) {
+                g_object_unref (daemon->priv->handover_from);
+        }
+        close_log (daemon);
+        nd_clock_wakeup_free (nd_clock_get_default (), daemon->priv->log_flush);
+        g_hash_table_destroy (daemon->priv->log_changes);
+        if (daemon->priv->handover_service != NULL) {
+                g_socket_service_stop (daemon->priv->handover_service);
+                g_object_unref (daemon->priv->handover_service);
+        }
 
         g_free (daemon->priv);
 
-        G_OBJECT_CLASS (notify_daemon_parent_class)->finalize (object);
+        G_OBJECT_CLASS (notify_daemon_parent_class)->finalize (object);
+}
+
+static gboolean
+compact_log (NotifyDaemon *daemon)
+{
+        GError *error;
+
+        daemon->priv->compact_id = 0;
+
+        error = NULL;
+        if (! nd_log_compact (daemon->priv->log, &error)) {
+                g_warning ("Unable to compact the notification log: %s", error->message);
+                g_error_free (error);
+        }
+
+        return FALSE;
+}
+
+static void
+schedule_compaction (NotifyDaemon *daemon)
+{
+        if (daemon->priv->compact_id == 0 && nd_log_needs_compaction (daemon->priv->log)) {
+                daemon->priv->compact_id = nd_clock_idle_add (nd_clock_get_default (),
+                                                              (GSourceFunc) compact_log,
+                                                              daemon);
+        }
+}
+
+static void
+store_notification (NotifyDaemon   *daemon,
+                    NdNotification *notification)
+{
+        GTimeVal tv;
+
+        /* transient notifications are not meant to be kept */
+        if (nd_notification_get_is_transient (notification)) {
+                nd_log_delete (daemon->priv->log, nd_notification_get_id (notification));
+                return;
+        }
+
+        nd_notification_get_update_time (notification, &tv);
+        nd_log_put (daemon->priv->log,
+                    nd_notification_get_id (notification),
+                    (gint64) tv.tv_sec * G_USEC_PER_SEC + tv.tv_usec,
+                    nd_notification_to_record (notification));
+}
+
+static void
+flush_log (NotifyDaemon *daemon)
+{
+        GHashTableIter iter;
+        gpointer       key;
+        gpointer       value;
+        GTimeVal       tv;
+
+        nd_clock_wakeup_set (nd_clock_get_default (), daemon->priv->log_flush, -1);
+
+        if (daemon->priv->log == NULL) {
+                g_hash_table_remove_all (daemon->priv->log_changes);
+                return;
+        }
+
+        g_hash_table_iter_init (&iter, daemon->priv->log_changes);
+        while (g_hash_table_iter_next (&iter, &key, &value)) {
+                NdNotification *notification = key;
+
+                if (GPOINTER_TO_INT (value) == LOG_CHANGE_RECORD) {
+                        store_notification (daemon, notification);
+                        continue;
+                }
+
+                nd_notification_get_update_time (notification, &tv);
+                nd_log_set_count (daemon->priv->log,
+                                  nd_notification_get_id (notification),
+                                  (gint64) tv.tv_sec * G_USEC_PER_SEC + tv.tv_usec,
+                                  nd_notification_get_occurrences (notification));
+        }
+        g_hash_table_remove_all (daemon->priv->log_changes);
+
+        /* replacing leaves the old record behind as garbage too */
+        schedule_compaction (daemon);
+}
+
+/* Every change to a stored notification is written to the log so it
+ * survives a restart.  Changes are gathered for LOG_FLUSH_MSEC so a
+ * burst of them costs one write per notification, and a repeat that
+ * only bumps the count does not write the record again. */
+static void
+on_notification_changed (NdNotification *notification,
+                         NotifyDaemon   *daemon)
+{
+        LogChange change;
+        gpointer  value;
+
+        if (daemon->priv->log == NULL)
+                return;
+
+        change = notification == daemon->priv->counting ? LOG_CHANGE_COUNT : LOG_CHANGE_RECORD;
+        value = g_hash_table_lookup (daemon->priv->log_changes, notification);
+        if (value != NULL && GPOINTER_TO_INT (value) >= (int) change)
+                return;
+
+        if (g_hash_table_size (daemon->priv->log_changes) == 0) {
+                nd_clock_wakeup_set (nd_clock_get_default (),
+                                     daemon->priv->log_flush,
+                                     nd_clock_get_monotonic_time (nd_clock_get_default ())
+                                     + LOG_FLUSH_MSEC * G_TIME_SPAN_MILLISECOND);
+        }
+        g_hash_table_insert (daemon->priv->log_changes,
+                             g_object_ref (notification),
+                             GINT_TO_POINTER (change));
+}
+
+/* notifications brought back from the log have no one to tell */
+static gboolean
+has_sender (NdNotification *notification)
+{
+        const char *sender;
+
+        sender = nd_notification_get_sender (notification);
+
+        return sender != NULL && *sender != '\0';
+}
+
+static void
+on_notification_close (NdNotification *notification,
+                       int             reason,
+                       NotifyDaemon   *daemon)
+{
+        g_hash_table_remove (daemon->priv->log_changes, notification);
+        if (daemon->priv->log != NULL) {
+                nd_log_delete (daemon->priv->log, nd_notification_get_id (notification));
+                schedule_compaction (daemon);
+        }
+
+        if (daemon->priv->outbox == NULL
+            || ! has_sender (notification))
+                return;
+
+        /* a client that is behind only needs the last word on each */
+        nd_outbox_send (daemon->priv->outbox,
+                        nd_notification_get_sender (notification),
+                        "NotificationClosed",
+                        g_variant_new ("(uu)", nd_notification_get_id (notification), reason),
+                        ND_OUTBOX_COALESCE,
+                        nd_notification_get_id (notification));
+}
+
+static void
+on_notification_action_invoked (NdNotification *notification,
+                                const char     *action,
+                                NotifyDaemon   *daemon)
+{
+        if (daemon->priv->outbox != NULL && has_sender (notification)) {
+                nd_outbox_send (daemon->priv->outbox,
+                                nd_notification_get_sender (notification),
+                                "ActionInvoked",
+                                g_variant_new ("(us)", nd_notification_get_id (notification), action),
+                                ND_OUTBOX_COALESCE,
+                                0);
+        }
+
+        /* resident notifications don't close when actions are invoked */
+        if (! nd_notification_get_is_resident (notification)) {
+                nd_notification_close (notification, ND_NOTIFICATION_CLOSED_USER);
+        }
+}
+
+static void
+watch_notification (NotifyDaemon   *daemon,
+                    NdNotification *notification)
+{
+        g_signal_connect (notification, "closed", G_CALLBACK (on_notification_close), daemon);
+        g_signal_connect (notification, "action-invoked", G_CALLBACK (on_notification_action_invoked), daemon);
+        g_signal_connect (notification, "changed", G_CALLBACK (on_notification_changed), daemon);
+}
+
+static void
+restore_notification_from_handover (NdNotification *notification,
+                                    NotifyDaemon   *daemon)
+{
+        watch_notification (daemon, notification);
+}
+
+static void
+restore_notification (guint32       id,
+                      gint64        update_time,
+                      GVariant     *record,
+                      guint32       count,
+                      NotifyDaemon *daemon)
+{
+        NdNotification *notification;
+
+        /* already taken over from the previous instance */
+        if (nd_queue_lookup (daemon->priv->queue, id) != NULL)
+                return;
+
+        notification = nd_notification_new_from_record (record, id, update_time);
+        if (count > 0) {
+                nd_notification_set_occurrences (notification, count);
+        }
+
+        /* unique names are reused across sessions, the one in the
+         * record may belong to an unrelated client by now */
+        nd_notification_set_sender (notification, "");
+
+        watch_notification (daemon, notification);
+
+        /* they were shown before, now they wait in the dock */
+        nd_queue_add_to_history (daemon->priv->queue, notification);
+        g_object_unref (notification);
+}
+
+static gboolean
+replay_log (NotifyDaemon *daemon)
+{
+        guint n;
+
+        n = nd_log_replay (daemon->priv->log,
+                           REPLAY_BATCH_SIZE,
+                           (NdLogReplayFunc) restore_notification,
+                           daemon);
+        if (n > 0)
+                return TRUE;
+
+        daemon->priv->replay_id = 0;
+        schedule_compaction (daemon);
+
+        return FALSE;
+}
+
+static char *
+get_log_path (void)
+{
+        const char *state_dir;
+
+        /* g_get_user_state_dir() is too new for us */
+        state_dir = g_getenv ("XDG_STATE_HOME");
+        if (state_dir != NULL && g_path_is_absolute (state_dir)) {
+                return g_build_filename (state_dir, "notification-daemon", "history.log", NULL);
+        }
+
+        return g_build_filename (g_get_home_dir (), ".local", "state",
+                                 "notification-daemon", "history.log", NULL);
+}
+
+static gboolean open_log (NotifyDaemon *daemon);
+
+static gboolean
+retry_open_log (NotifyDaemon *daemon)
+{
+        GList *page;
+        GList *l;
+
+        if (! open_log (daemon))
+                return TRUE;
+
+        daemon->priv->log_retry_id = 0;
+
+        /* whatever came in while the old instance held the log */
+        page = nd_queue_get_page (daemon->priv->queue, G_MININT64, 0, G_MAXUINT, NULL, NULL, NULL);
+        for (l = page; l != NULL; l = l->next) {
+                store_notification (daemon, l->data);
+        }
+        g_list_free (page);
+
+        return FALSE;
+}
+
+/* Opens the log and brings back what it holds a batch per idle, so
+ * startup only pays for reading the record headers.  While an
+ * instance we are replacing still has it, tries again until that one
+ * lets go.  Returns FALSE while the log is not open. */
+static gboolean
+open_log (NotifyDaemon *daemon)
+{
+        GError *error;
+        char   *path;
+
+        path = get_log_path ();
+
+        error = NULL;
+        daemon->priv->log = nd_log_open (path, ND_NOTIFICATION_RECORD_TYPE, &error);
+        g_free (path);
+        if (daemon->priv->log == NULL) {
+                if (g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_AGAIN)) {
+                        if (daemon->priv->log_retry_id == 0) {
+                                g_debug ("%s, waiting for it", error->message);
+                                daemon->priv->log_retry_id = nd_clock_timeout_add (nd_clock_get_default (),
+                                                                                   LOG_RETRY_MSEC,
+                                                                                   (GSourceFunc) retry_open_log,
+                                                                                   daemon);
+                        }
+                } else {
+                        g_warning ("Unable to open the notification log: %s", error->message);
+                }
+                g_error_free (error);
+                return FALSE;
+        }
+
+        nd_notification_skip_ids (nd_log_get_last_id (daemon->priv->log));
+
+        daemon->priv->replay_id = nd_clock_idle_add (nd_clock_get_default (),
+                                                     (GSourceFunc) replay_log,
+                                                     daemon);
+
+        return TRUE;
+}
+
+/* Sends a new or replaced notification to every subscriber whose
+ * filter accepts it.  The body is built once and shared by all the
+ * messages, only the destination differs. */
+static void
+publish_notification (NotifyDaemon   *daemon,
+                      NdNotification *notification)
+{
+        GHashTableIter iter;
+        gpointer       value;
+        GVariant      *body;
+        const char    *category;
+        GTimeVal       tv;
+
+        if (daemon->priv->outbox == NULL
+            || g_hash_table_size (daemon->priv->subscriptions) == 0)
+                return;
+
+        body = NULL;
+        g_hash_table_iter_init (&iter, daemon->priv->subscriptions);
+        while (g_hash_table_iter_next (&iter, NULL, &value)) {
+                Subscription *subscription = value;
+
+                if (! nd_filter_matches (subscription->filter, notification))
+                        continue;
+
+                if (body == NULL) {
+                        nd_notification_get_update_time (notification, &tv);
+                        category = nd_notification_get_category (notification);
+                        body = g_variant_ref_sink (g_variant_new ("(ussssyx)",
+                                                                  nd_notification_get_id (notification),
+                                                                  nd_notification_get_app_name (notification),
+                                                                  nd_notification_get_summary (notification),
+                                                                  nd_notification_get_body (notification),
+                                                                  category ? category : "",
+                                                                  (guchar) nd_notification_get_urgency (notification),
+                                                                  (gint64) tv.tv_sec * G_USEC_PER_SEC + tv.tv_usec));
+                }
+
+                /* the stream is best effort, a slow reader misses events */
+                nd_outbox_send (daemon->priv->outbox,
+                                subscription->sender,
+                                "NotificationPosted",
+                                body,
+                                ND_OUTBOX_DROP,
+                                0);
+        }
+
+        if (body != NULL) {
+                g_variant_unref (body);
+        }
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* for measuring activation to first reply */
+static gint64 start_time = 0;
+static gboolean first_call = TRUE;
+
+/* The interface we export, kept static so nothing has to be parsed
+ * before the name can be requested. */
+#define ARG(name, signature) \
+        &(GDBusArgInfo) { -1, (gchar *) name, (gchar *) signature, NULL }
+#define ARGS(...) \
+        (GDBusArgInfo *[]) { __VA_ARGS__, NULL }
+#define NO_ARGS NULL
+#define METHOD(name, in_args, out_args) \
+        &(GDBusMethodInfo) { -1, (gchar *) name, in_args, out_args, NULL }
+#define SIGNAL(name, args) \
+        &(GDBusSignalInfo) { -1, (gchar *) name, args, NULL }
+
+static GDBusMethodInfo *notifications_methods[] = {
+        METHOD ("Notify",
+                ARGS (ARG ("app_name", "s"),
+                      ARG ("id", "u"),
+                      ARG ("icon", "s"),
+                      ARG ("summary", "s"),
+                      ARG ("body", "s"),
+                      ARG ("actions", "as"),
+                      ARG ("hints", "a{sv}"),
+                      ARG ("timeout", "i")),
+                ARGS (ARG ("return_id", "u"))),
+        METHOD ("RegisterTemplate",
+                ARGS (ARG ("app_name", "s"),
+                      ARG ("icon", "s"),
+                      ARG ("actions", "as"),
+                      ARG ("hints", "a{sv}")),
+                ARGS (ARG ("return_template", "u"))),
+        METHOD ("UnregisterTemplate",
+                ARGS (ARG ("template", "u")),
+                NO_ARGS),
+        METHOD ("NotifyFromTemplate",
+                ARGS (ARG ("template", "u"),
+                      ARG ("id", "u"),
+                      ARG ("summary", "s"),
+                      ARG ("body", "s"),
+                      ARG ("hints", "a{sv}"),
+                      ARG ("timeout", "i")),
+                ARGS (ARG ("return_id", "u"))),
+        METHOD ("CloseNotification",
+                ARGS (ARG ("id", "u")),
+                NO_ARGS),
+        METHOD ("CloseNotifications",
+                ARGS (ARG ("ids", "au")),
+                ARGS (ARG ("closed", "ab"))),
+        METHOD ("CloseNotificationsByTag",
+                ARGS (ARG ("app_name", "s"),
+                      ARG ("tag", "s")),
+                ARGS (ARG ("n_closed", "u"))),
+        METHOD ("CloseNotificationsByApp",
+                ARGS (ARG ("app_name", "s")),
+                ARGS (ARG ("n_closed", "u"))),
+        METHOD ("GetNotifications",
+                ARGS (ARG ("cursor", "s"),
+                      ARG ("limit", "u"),
+                      ARG ("filter", "a{sv}")),
+                ARGS (ARG ("notifications", "a(ussssx)"),
+                      ARG ("next_cursor", "s"))),
+        METHOD ("Subscribe",
+                ARGS (ARG ("filter", "a{sv}")),
+                ARGS (ARG ("return_subscription", "u"))),
+        METHOD ("Unsubscribe",
+                ARGS (ARG ("subscription", "u")),
+                NO_ARGS),
+        METHOD ("GetRuleStats",
+                NO_ARGS,
+                ARGS (ARG ("rule_hits", "a(st)"),
+                      ARG ("n_evaluations", "t"),
+                      ARG ("evaluation_usec", "t"))),
+        METHOD ("GetMemoryStats",
+                NO_ARGS,
+                ARGS (ARG ("categories", "a(stt)"))),
+        METHOD ("GetUsageStats",
+                NO_ARGS,
+                ARGS (ARG ("senders", "a(ssttttttttt)"))),
+        METHOD ("GetCapabilities",
+                NO_ARGS,
+                ARGS (ARG ("return_caps", "as"))),
+        METHOD ("GetServerInformation",
+                NO_ARGS,
+                ARGS (ARG ("return_name", "s"),
+                      ARG ("return_vendor", "s"),
+                      ARG ("return_version", "s"),
+                      ARG ("return_spec_version", "s"))),
+        NULL
+};
+
+static GDBusSignalInfo *notifications_signals[] = {
+        SIGNAL ("NotificationPosted",
+                ARGS (ARG ("id", "u"),
+                      ARG ("app_name", "s"),
+                      ARG ("summary", "s"),
+                      ARG ("body", "s"),
+                      ARG ("category", "s"),
+                      ARG ("urgency", "y"),
+                      ARG ("update_time", "x"))),
+        NULL
+};
+
+static GDBusInterfaceInfo notifications_interface = {
+        -1,
+        (gchar *) "org.freedesktop.Notifications",
+        notifications_methods,
+        notifications_signals,
+        NULL, /* properties */
+        NULL  /* annotations */
+};
+
+static const char *
+lookup_tag_hint (GVariant *hints)
+{
+        const char *tag;
+
+        if (! g_variant_lookup (hints, "x-dunst-stack-tag", "&s", &tag)
+            && ! g_variant_lookup (hints, "x-canonical-private-synchronous", "&s", &tag)) {
+                tag = NULL;
+        }
+
+        return tag;
+}
+
+/* The stored notification a Notify replaces: the one it names by id
+ * or, for clients that lost the id, the one carrying its tag. */
+static NdNotification *
+lookup_replaced (NotifyDaemon *daemon,
+                 const char   *sender,
+                 const char   *app_name,
+                 guint         id,
+                 const char   *tag)
+{
+        NdNotification *notification;
+
+        notification = NULL;
+        if (id > 0) {
+                notification = nd_queue_lookup (daemon->priv->queue, id);
+        }
+
+        if (notification == NULL && tag != NULL) {
+                notification = nd_queue_lookup_tag (daemon->priv->queue, sender, app_name, tag);
+                if (notification != NULL) {
+                        /* a restarted client gets the signals from now on */
+                        nd_notification_set_sender (notification, sender);
+                }
+        }
+
+        return notification;
+}
+
+/* Returns a new, empty notification for the content, or NULL once the
+ * call has been answered because it folded into a duplicate or the
+ * queue is full. */
+static NdNotification *
+create_notification (NotifyDaemon          *daemon,
+                     const char            *sender,
+                     const char            *app_name,
+                     const char            *icon_name,
+                     const char            *summary,
+                     const char            *body,
+                     GDBusMethodInvocation *invocation)
+{
+        NdNotification *notification;
+
+        notification = nd_queue_lookup_duplicate (daemon->priv->queue,
+                                                  sender,
+                                                  app_name,
+                                                  icon_name,
+                                                  summary,
+                                                  body);
+        if (notification != NULL) {
+                /* a repeat only bumps the count on the original, and
+                 * only the count goes to the log */
+                daemon->priv->counting = notification;
+                nd_notification_add_occurrence (notification);
+                daemon->priv->counting = NULL;
+                g_dbus_method_invocation_return_value (invocation,
+                                                       g_variant_new ("(u)", nd_notification_get_id (notification)));
+                return NULL;
+        }
+
+        /* the history is not bounded by this, it never expires */
+        if (nd_queue_length_active (daemon->priv->queue) > MAX_NOTIFICATIONS) {
+                g_dbus_method_invocation_return_dbus_error (invocation,
+                                                            "org.freedesktop.Notifications.MaxNotificationsExceeded",
+                                                            _("Exceeded maximum number of notifications"));
+                return NULL;
+        }
+
+        notification = nd_notification_new (sender);
+        watch_notification (daemon, notification);
+
+        return notification;
+}
+
+static GVariant *
+replace_urgency (GVariant *hints,
+                 int       urgency)
+{
+        GVariantBuilder builder;
+        GVariantIter    iter;
+        const char     *key;
+        GVariant       *value;
+
+        g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
+
+        g_variant_iter_init (&iter, hints);
+        while (g_variant_iter_next (&iter, "{&sv}", &key, &value)) {
+                if (g_strcmp0 (key, "urgency") != 0) {
+                        g_variant_builder_add (&builder, "{sv}", key, value);
+                }
+                g_variant_unref (value);
+        }
+        g_variant_builder_add (&builder, "{sv}", "urgency", g_variant_new_byte (urgency));
+
+        return g_variant_ref_sink (g_variant_builder_end (&builder));
+}
+
+/* Runs the site rules on a notification before it is built.  Returns
+ * FALSE once the call has been answered because a rule dropped it;
+ * otherwise an urgency rewrite has been applied to @hints and
+ * @hints_iter and @result tells the caller what else to do. */
+static gboolean
+apply_rules (NotifyDaemon          *daemon,
+             const char            *app_name,
+             const char            *category,
+             const char            *summary,
+             const char            *body,
+             GVariant             **hints,
+             GVariantIter         **hints_iter,
+             NdRuleResult          *result,
+             GDBusMethodInvocation *invocation)
+{
+        GVariant *rewritten;
+
+        result->action = ND_RULE_ACCEPT;
+        result->urgency = -1;
+        result->icon = NULL;
+
+        if (daemon->priv->rules == NULL)
+                return TRUE;
+
+        nd_rules_evaluate (daemon->priv->rules, app_name, category, summary, body, result);
+
+        if (result->action == ND_RULE_DROP) {
+                /* there is nothing the client could refer to later */
+                g_dbus_method_invocation_return_value (invocation, g_variant_new ("(u)", 0));
+                return FALSE;
+        }
+
+        if (result->action == ND_RULE_REWRITE && result->urgency >= 0) {
+                rewritten = replace_urgency (*hints, result->urgency);
+                g_variant_unref (*hints);
+                *hints = rewritten;
+
+                g_variant_iter_free (*hints_iter);
+                *hints_iter = g_variant_iter_new (rewritten);
+        }
+
+        return TRUE;
+}
+
+/* Charges what a notify call brought in, and the time it took to
+ * take apart, to its sender. */
+static void
+account_received (const char  *sender,
+                  const char  *app_name,
+                  const char  *summary,
+                  const char  *body,
+                  const char **actions,
+                  GVariant    *hints,
+                  gboolean     replaced,
+                  gint64       start)
+{
+        static const char *image_hints[] = { "image-data", "image_data", "icon_data" };
+        GVariant          *value;
+        gsize              text_bytes;
+        gsize              hint_bytes;
+        gsize              image_bytes;
+        guint              i;
+
+        text_bytes = strlen (summary) + strlen (body);
+        for (i = 0; actions != NULL && actions[i] != NULL; i++) {
+                text_bytes += strlen (actions[i]);
+        }
+
+        image_bytes = 0;
+        for (i = 0; i < G_N_ELEMENTS (image_hints); i++) {
+                value = g_variant_lookup_value (hints, image_hints[i], NULL);
+                if (value != NULL) {
+                        image_bytes += g_variant_get_size (value);
+                        g_variant_unref (value);
+                }
+        }
+        hint_bytes = g_variant_get_size (hints);
+        hint_bytes -= MIN (hint_bytes, image_bytes);
+
+        nd_usage_add_received (sender,
+                               app_name,
+                               replaced,
+                               text_bytes,
+                               hint_bytes,
+                               image_bytes,
+                               nd_usage_get_cpu_time () - start);
+}
+
+static void
+handle_notify (NotifyDaemon          *daemon,
+               const char            *sender,
+               GVariant              *parameters,
+               GDBusMethodInvocation *invocation)
+{
+        NdNotification *notification;
+        const char     *app_name;
+        guint           id;
+        const char     *icon_name;
+        const char     *summary;
+        const char     *body;
+        const char    **actions;
+        GVariantIter   *hints_iter;
+        GVariant       *hints;
+        const char     *category;
+        NdRuleResult    rule;
+        gboolean        is_new;
+        gboolean        replaced;
+        int             timeout;
+        gint64          start;
+
+        start = nd_usage_get_cpu_time ();
+        replaced = FALSE;
+
+        g_variant_get (parameters,
+                       "(&su&s&s&s^a&sa{sv}i)",
+                       &app_name,
+                       &id,
+                       &icon_name,
+                       &summary,
+                       &body,
+                       &actions,
+                       &hints_iter,
+                       &timeout);
+
+        hints = g_variant_get_child_value (parameters, 6);
+
+        if (! g_variant_lookup (hints, "category", "&s", &category))
+                category = NULL;
+
+        if (! apply_rules (daemon, app_name, category, summary, body, &hints, &hints_iter, &rule, invocation))
+                goto out;
+        if (rule.icon != NULL)
+                icon_name = rule.icon;
+
+        notification = lookup_replaced (daemon, sender, app_name, id, lookup_tag_hint (hints));
+        is_new = (notification == NULL);
+        replaced = ! is_new;
+        if (is_new) {
+                notification = create_notification (daemon,
+                                                    sender,
+                                                    app_name,
+                                                    icon_name,
+                                                    summary,
+                                                    body,
+                                                    invocation);
+                if (notification == NULL) {
+                        goto out;
+                }
+        } else {
+                g_object_ref (notification);
+        }
+
+        nd_notification_update (notification,
+                                app_name,
+                                icon_name,
+                                summary,
+                                body,
+                                actions,
+                                hints_iter,
+                                timeout);
+
+        if (is_new && rule.action == ND_RULE_HISTORY) {
+                nd_queue_add_to_history (daemon->priv->queue, notification);
+        } else if (is_new) {
+                nd_queue_add (daemon->priv->queue, notification);
+        }
+
+        publish_notification (daemon, notification);
+
+        g_dbus_method_invocation_return_value (invocation,
+                                               g_variant_new ("(u)", nd_notification_get_id (notification)));
+
+        g_object_unref (notification);
+ out:
+        account_received (sender, app_name, summary, body, actions, hints, replaced, start);
+
+        g_variant_unref (hints);
+        g_free (actions);
+        g_variant_iter_free (hints_iter);
+}
+
+/* templates go away with their client */
+static void
+on_template_owner_vanished (GDBusConnection *connection,
+                            const char      *name,
+                            gpointer         user_data)
+{
+        NotifyDaemon  *daemon = user_data;
+        GHashTableIter iter;
+        gpointer       value;
+
+        g_hash_table_iter_init (&iter, daemon->priv->templates);
+        while (g_hash_table_iter_next (&iter, NULL, &value)) {
+                if (g_strcmp0 (nd_notification_get_sender (ND_NOTIFICATION (value)), name) == 0) {
+                        g_hash_table_iter_remove (&iter);
+                }
+        }
+
+        g_hash_table_remove (daemon->priv->template_owners, name);
+}
+
+static void
+remove_template (NotifyDaemon *daemon,
+                 guint         handle)
+{
+        NdNotification *template;
+        TemplateOwner  *owner;
+        const char     *sender;
+
+        template = g_hash_table_lookup (daemon->priv->templates, GUINT_TO_POINTER (handle));
+        sender = nd_notification_get_sender (template);
+
+        owner = g_hash_table_lookup (daemon->priv->template_owners, sender);
+        if (owner != NULL && --owner->n_templates == 0) {
+                g_hash_table_remove (daemon->priv->template_owners, sender);
+        }
+
+        /* instances still showing keep their own reference */
+        g_hash_table_remove (daemon->priv->templates, GUINT_TO_POINTER (handle));
+}
+
+/* Takes @template into the table under @handle and watches its
+ * client, the first time it registers one. */
+static void
+add_template (NotifyDaemon    *daemon,
+              GDBusConnection *connection,
+              guint            handle,
+              NdNotification  *template)
+{
+        TemplateOwner *owner;
+        const char    *sender;
+
+        sender = nd_notification_get_sender (template);
+
+        owner = g_hash_table_lookup (daemon->priv->template_owners, sender);
+        if (owner == NULL) {
+                owner = g_slice_new0 (TemplateOwner);
+                owner->watch_id = g_bus_watch_name_on_connection (connection,
+                                                                  sender,
+                                                                  G_BUS_NAME_WATCHER_FLAGS_NONE,
+                                                                  NULL,
+                                                                  on_template_owner_vanished,
+                                                                  daemon,
+                                                                  NULL);
+                g_hash_table_insert (daemon->priv->template_owners, g_strdup (sender), owner);
+        }
+        owner->n_templates++;
+
+        g_hash_table_insert (daemon->priv->templates, GUINT_TO_POINTER (handle), template);
+        if (handle >= daemon->priv->next_template) {
+                daemon->priv->next_template = handle + 1;
+        }
+}
+
+static void
+handle_register_template (NotifyDaemon          *daemon,
+                          const char            *sender,
+                          GVariant              *parameters,
+                          GDBusMethodInvocation *invocation)
+{
+        NdNotification *template;
+        TemplateOwner  *owner;
+        const char     *app_name;
+        const char     *icon_name;
+        const char    **actions;
+        GVariantIter   *hints_iter;
+        guint           handle;
+
+        owner = g_hash_table_lookup (daemon->priv->template_owners, sender);
+        if (owner != NULL && owner->n_templates >= MAX_TEMPLATES) {
+                g_dbus_method_invocation_return_dbus_error (invocation,
+                                                            "org.freedesktop.Notifications.MaxTemplatesExceeded",
+                                                            _("Exceeded maximum number of templates"));
+                return;
+        }
+
+        g_variant_get (parameters,
+                       "(&s&s^a&sa{sv})",
+                       &app_name,
+                       &icon_name,
+                       &actions,
+                       &hints_iter);
+
+        template = nd_notification_new_template (sender,
+                                                 app_name,
+                                                 icon_name,
+                                                 actions,
+                                                 hints_iter);
+
+        do {
+                handle = daemon->priv->next_template++;
+        } while (handle == 0
+                 || g_hash_table_lookup (daemon->priv->templates, GUINT_TO_POINTER (handle)) != NULL);
+
+        add_template (daemon,
+                      g_dbus_method_invocation_get_connection (invocation),
+                      handle,
+                      template);
+
+        g_dbus_method_invocation_return_value (invocation,
+                                               g_variant_new ("(u)", handle));
+
+        g_free (actions);
+        g_variant_iter_free (hints_iter);
+}
+
+/* Templates are private to the client that registered them. */
+static NdNotification *
+lookup_template (NotifyDaemon          *daemon,
+                 const char            *sender,
+                 guint                  handle,
+                 GDBusMethodInvocation *invocation)
+{
+        NdNotification *template;
+
+        template = g_hash_table_lookup (daemon->priv->templates, GUINT_TO_POINTER (handle));
+        if (template == NULL
+            || g_strcmp0 (nd_notification_get_sender (template), sender) != 0) {
+                g_dbus_method_invocation_return_dbus_error (invocation,
+                                                            "org.freedesktop.Notifications.InvalidTemplate",
+                                                            _("Invalid template identifier"));
+                return NULL;
+        }
+
+        return template;
+}
+
+static void
+handle_unregister_template (NotifyDaemon          *daemon,
+                            const char            *sender,
+                            GVariant              *parameters,
+                            GDBusMethodInvocation *invocation)
+{
+        guint handle;
+
+        g_variant_get (parameters, "(u)", &handle);
+
+        if (lookup_template (daemon, sender, handle, invocation) == NULL) {
+                return;
+        }
+
+        remove_template (daemon, handle);
+
+        g_dbus_method_invocation_return_value (invocation, NULL);
+}
+
+static void
+handle_notify_from_template (NotifyDaemon          *daemon,
+                             const char            *sender,
+                             GVariant              *parameters,
+                             GDBusMethodInvocation *invocation)
+{
+        NdNotification *notification;
+        NdNotification *template;
+        guint           handle;
+        guint           id;
+        const char     *summary;
+        const char     *body;
+        GVariantIter   *hints_iter;
+        GVariant       *hints;
+        const char     *tag;
+        const char     *category;
+        NdRuleResult    rule;
+        gboolean        is_new;
+        gboolean        replaced;
+        int             timeout;
+        gint64          start;
+
+        start = nd_usage_get_cpu_time ();
+        replaced = FALSE;
+
+        g_variant_get (parameters,
+                       "(uu&s&sa{sv}i)",
+                       &handle,
+                       &id,
+                       &summary,
+                       &body,
+                       &hints_iter,
+                       &timeout);
+
+        hints = g_variant_get_child_value (parameters, 4);
+
+        template = lookup_template (daemon, sender, handle, invocation);
+        if (template == NULL) {
+                goto out;
+        }
+
+        if (! g_variant_lookup (hints, "category", "&s", &category))
+                category = nd_notification_get_category (template);
+
+        /* the icon belongs to the template, only urgency can be rewritten */
+        if (! apply_rules (daemon,
+                           nd_notification_get_app_name (template),
+                           category,
+                           summary,
+                           body,
+                           &hints,
+                           &hints_iter,
+                           &rule,
+                           invocation))
+                goto out;
+
+        tag = lookup_tag_hint (hints);
+        if (tag == NULL) {
+                tag = nd_notification_get_tag (template);
+        }
+
+        notification = lookup_replaced (daemon,
+                                        sender,
+                                        nd_notification_get_app_name (template),
+                                        id,
+                                        tag);
+        is_new = (notification == NULL);
+        replaced = ! is_new;
+        if (is_new) {
+                notification = create_notification (daemon,
+                                                    sender,
+                                                    nd_notification_get_app_name (template),
+                                                    nd_notification_get_icon (template),
+                                                    summary,
+                                                    body,
+                                                    invocation);
+                if (notification == NULL) {
+                        goto out;
+                }
+        } else {
+                g_object_ref (notification);
+        }
+
+        nd_notification_update_from_template (notification,
+                                              template,
+                                              summary,
+                                              body,
+                                              hints_iter,
+                                              timeout);
+
+        if (is_new && rule.action == ND_RULE_HISTORY) {
+                nd_queue_add_to_history (daemon->priv->queue, notification);
+        } else if (is_new) {
+                nd_queue_add (daemon->priv->queue, notification);
+        }
+
+        publish_notification (daemon, notification);
+
+        g_dbus_method_invocation_return_value (invocation,
+                                               g_variant_new ("(u)", nd_notification_get_id (notification)));
+
+        g_object_unref (notification);
+ out:
+        account_received (sender,
+                          template != NULL ? nd_notification_get_app_name (template) : NULL,
+                          summary,
+                          body,
+                          NULL,
+                          hints,
+                          replaced,
+                          start);
+
+        g_variant_unref (hints);
+        g_variant_iter_free (hints_iter);
+}
+
+static void
+handle_close_notification (NotifyDaemon          *daemon,
+                           const char            *sender,
+                           GVariant              *parameters,
+                           GDBusMethodInvocation *invocation)
+{
+        NdNotification *notification;
+        guint           id;
+
+        g_variant_get (parameters, "(u)", &id);
+
+        if (id == 0) {
+                g_dbus_method_invocation_return_dbus_error (invocation,
+                                                            "org.freedesktop.Notifications.InvalidId",
+                                                            _("Invalid notification identifier"));
+                return;
+        }
+
+        notification = nd_queue_lookup (daemon->priv->queue, id);
+        if (notification != NULL) {
+                nd_notification_close (notification, ND_NOTIFICATION_CLOSED_API);
+        }
+
+        g_dbus_method_invocation_return_value (invocation, NULL);
+}
+
+static void
+handle_close_notifications (NotifyDaemon          *daemon,
+                            const char            *sender,
+                            GVariant              *parameters,
+                            GDBusMethodInvocation *invocation)
+{
+        GVariantIter    *iter;
+        GVariantBuilder *builder;
+        guint            id;
+
+        g_variant_get (parameters, "(au)", &iter);
+
+        builder = g_variant_builder_new (G_VARIANT_TYPE ("ab"));
+
+        /* one ::changed for the whole batch */
+        nd_queue_freeze_changed (daemon->priv->queue);
+        while (g_variant_iter_next (iter, "u", &id)) {
+                NdNotification *notification;
+
+                notification = NULL;
+                if (id > 0) {
+                        notification = nd_queue_lookup (daemon->priv->queue, id);
+                }
+                if (notification != NULL) {
+                        nd_notification_close (notification, ND_NOTIFICATION_CLOSED_API);
+                }
+
+                g_variant_builder_add (builder, "b", notification != NULL);
+        }
+        nd_queue_thaw_changed (daemon->priv->queue);
+
+        g_dbus_method_invocation_return_value (invocation,
+                                               g_variant_new ("(ab)", builder));
+        g_variant_builder_unref (builder);
+        g_variant_iter_free (iter);
+}
+
+static void
+handle_close_notifications_by_tag (NotifyDaemon          *daemon,
+                                   const char            *sender,
+                                   GVariant              *parameters,
+                                   GDBusMethodInvocation *invocation)
+{
+        const char *app_name;
+        const char *tag;
+        guint       n_closed;
+
+        g_variant_get (parameters, "(&s&s)", &app_name, &tag);
+
+        n_closed = nd_queue_close_by_tag (daemon->priv->queue, sender, app_name, tag);
+
+        g_dbus_method_invocation_return_value (invocation,
+                                               g_variant_new ("(u)", n_closed));
+}
+
+static void
+handle_close_notifications_by_app (NotifyDaemon          *daemon,
+                                   const char            *sender,
+                                   GVariant              *parameters,
+                                   GDBusMethodInvocation *invocation)
+{
+        const char *app_name;
+        guint       n_closed;
+
+        g_variant_get (parameters, "(&s)", &app_name);
+
+        n_closed = nd_queue_close_by_app (daemon->priv->queue, sender, app_name);
+
+        g_dbus_method_invocation_return_value (invocation,
+                                               g_variant_new ("(u)", n_closed));
+}
+
+/* Cursors are opaque to clients, they are the update time and id of
+ * the last notification returned.  The empty cursor is the start. */
+static gboolean
+parse_history_cursor (const char *cursor,
+                      gint64     *update_time,
+                      guint      *id)
+{
+        char   *end;
+        guint64 value;
+
+        *update_time = 0;
+        *id = 0;
+
+        if (*cursor == '\0')
+                return TRUE;
+
+        *update_time = g_ascii_strtoll (cursor, &end, 10);
+        if (end == cursor || *end != ':')
+                return FALSE;
+
+        cursor = end + 1;
+        value = g_ascii_strtoull (cursor, &end, 10);
+        if (end == cursor || *end != '\0' || value > G_MAXUINT)
+                return FALSE;
+        *id = value;
+
+        return TRUE;
+}
+
+static void
+handle_get_notifications (NotifyDaemon          *daemon,
+                          const char            *sender,
+                          GVariant              *parameters,
+                          GDBusMethodInvocation *invocation)
+{
+        const char      *cursor;
+        guint            limit;
+        GVariant        *filter_dict;
+        NdFilter        *filter;
+        GVariantBuilder *builder;
+        GList           *page;
+        GList           *l;
+        gint64           after_time;
+        gint64           since;
+        guint            after_id;
+        gboolean         more;
+        char            *next_cursor;
+
+        g_variant_get (parameters, "(&su@a{sv})", &cursor, &limit, &filter_dict);
+
+        if (! parse_history_cursor (cursor, &after_time, &after_id)) {
+                g_dbus_method_invocation_return_dbus_error (invocation,
+                                                            "org.freedesktop.DBus.Error.InvalidArgs",
+                                                            _("Invalid cursor"));
+                g_variant_unref (filter_dict);
+                return;
+        }
+
+        filter = nd_filter_new (filter_dict);
+        if (filter == NULL) {
+                g_dbus_method_invocation_return_dbus_error (invocation,
+                                                            "org.freedesktop.DBus.Error.InvalidArgs",
+                                                            _("Invalid filter"));
+                g_variant_unref (filter_dict);
+                return;
+        }
+
+        /* "since" is a wall clock time in microseconds */
+        if (g_variant_lookup (filter_dict, "since", "x", &since) && since > after_time) {
+                after_time = since;
+                after_id = 0;
+        }
+
+        if (limit == 0 || limit > MAX_PAGE_SIZE)
+                limit = MAX_PAGE_SIZE;
+
+        page = nd_queue_get_page (daemon->priv->queue,
+                                  after_time,
+                                  after_id,
+                                  limit,
+                                  (NdQueueFilterFunc) nd_filter_matches,
+                                  filter,
+                                  &more);
+
+        builder = g_variant_builder_new (G_VARIANT_TYPE ("a(ussssx)"));
+        next_cursor = NULL;
+        for (l = page; l != NULL; l = l->next) {
+                NdNotification *notification = l->data;
+                const char     *category;
+                GTimeVal        tv;
+                gint64          update_time;
+
+                nd_notification_get_update_time (notification, &tv);
+                update_time = (gint64) tv.tv_sec * G_USEC_PER_SEC + tv.tv_usec;
+                category = nd_notification_get_category (notification);
+
+                g_variant_builder_add (builder,
+                                       "(ussssx)",
+                                       nd_notification_get_id (notification),
+                                       nd_notification_get_app_name (notification),
+                                       nd_notification_get_summary (notification),
+                                       nd_notification_get_body (notification),
+                                       category ? category : "",
+                                       update_time);
+
+                if (l->next == NULL && more) {
+                        next_cursor = g_strdup_printf ("%" G_GINT64_FORMAT ":%u",
+                                                       update_time,
+                                                       nd_notification_get_id (notification));
+                }
+        }
+
+        g_dbus_method_invocation_return_value (invocation,
+                                               g_variant_new ("(a(ussssx)s)",
+                                                              builder,
+                                                              next_cursor ? next_cursor : ""));
+
+        g_free (next_cursor);
+        g_list_free (page);
+        g_variant_builder_unref (builder);
+        nd_filter_free (filter);
+        g_variant_unref (filter_dict);
 }
 
 static void
-on_notification_close (NdNotification *notification,
-                       int             reason,
-                       NotifyDaemon   *daemon)
+on_subscriber_vanished (GDBusConnection *connection,
+                        const char      *name,
+                        gpointer         user_data)
 {
-        g_dbus_connection_emit_signal (daemon->priv->connection,
-                                       nd_notification_get_sender (notification),
-                                       "/org/freedesktop/Notifications",
-                                       "org.freedesktop.Notifications",
-                                       "NotificationClosed",
-                                       g_variant_new ("(uu)", nd_notification_get_id (notification), reason),
-                                       NULL);
+        NotifyDaemon  *daemon = user_data;
+        GHashTableIter iter;
+        gpointer       value;
+
+        g_hash_table_iter_init (&iter, daemon->priv->subscriptions);
+        while (g_hash_table_iter_next (&iter, NULL, &value)) {
+                Subscription *subscription = value;
+
+                if (g_strcmp0 (subscription->sender, name) == 0) {
+                        g_hash_table_iter_remove (&iter);
+                }
+        }
 }
 
+/* subscriptions go away with their client */
 static void
-on_notification_action_invoked (NdNotification *notification,
-                                const char     *action,
-                                NotifyDaemon   *daemon)
+add_subscription (NotifyDaemon    *daemon,
+                  GDBusConnection *connection,
+                  Subscription    *subscription)
 {
-        g_dbus_connection_emit_signal (daemon->priv->connection,
-                                       nd_notification_get_sender (notification),
-                                       "/org/freedesktop/Notifications",
-                                       "org.freedesktop.Notifications",
-                                       "ActionInvoked",
-                                       g_variant_new ("(us)", nd_notification_get_id (notification), action),
-                                       NULL);
-
-        /* resident notifications don't close when actions are invoked */
-        if (! nd_notification_get_is_resident (notification)) {
-                nd_notification_close (notification, ND_NOTIFICATION_CLOSED_USER);
+        subscription->watch_id = g_bus_watch_name_on_connection (connection,
+                                                                 subscription->sender,
+                                                                 G_BUS_NAME_WATCHER_FLAGS_NONE,
+                                                                 NULL,
+                                                                 on_subscriber_vanished,
+                                                                 daemon,
+                                                                 NULL);
+
+        g_hash_table_insert (daemon->priv->subscriptions,
+                             GUINT_TO_POINTER (subscription->id),
+                             subscription);
+        if (subscription->id >= daemon->priv->next_subscription) {
+                daemon->priv->next_subscription = subscription->id + 1;
         }
 }
 
-/* ---------------------------------------------------------------------------------------------- */
-
-static GDBusNodeInfo *introspection_data = NULL;
-
-/* Introspection data for the service we are exporting */
-static const char introspection_xml[] =
-        "<node>"
-        "  <interface name='org.freedesktop.Notifications'>"
-        "    <method name='Notify'>"
-        "      <arg type='s' name='app_name' direction='in' />"
-        "      <arg type='u' name='id' direction='in' />"
-        "      <arg type='s' name='icon' direction='in' />"
-        "      <arg type='s' name='summary' direction='in' />"
-        "      <arg type='s' name='body' direction='in' />"
-        "      <arg type='as' name='actions' direction='in' />"
-        "      <arg type='a{sv}' name='hints' direction='in' />"
-        "      <arg type='i' name='timeout' direction='in' />"
-        "      <arg type='u' name='return_id' direction='out' />"
-        "    </method>"
-        "    <method name='CloseNotification'>"
-        "      <arg type='u' name='id' direction='in' />"
-        "    </method>"
-        "    <method name='GetCapabilities'>"
-        "      <arg type='as' name='return_caps' direction='out'/>"
-        "    </method>"
-        "    <method name='GetServerInformation'>"
-        "      <arg type='s' name='return_name' direction='out'/>"
-        "      <arg type='s' name='return_vendor' direction='out'/>"
-        "      <arg type='s' name='return_version' direction='out'/>"
-        "      <arg type='s' name='return_spec_version' direction='out'/>"
-        "    </method>"
-        "  </interface>"
-        "</node>";
-
 static void
-handle_notify (NotifyDaemon          *daemon,
-               const char            *sender,
-               GVariant              *parameters,
-               GDBusMethodInvocation *invocation)
+handle_subscribe (NotifyDaemon          *daemon,
+                  const char            *sender,
+                  GVariant              *parameters,
+                  GDBusMethodInvocation *invocation)
 {
-        NdNotification *notification;
-        const char     *app_name;
-        guint           id;
-        const char     *icon_name;
-        const char     *summary;
-        const char     *body;
-        const char    **actions;
-        GVariantIter   *hints_iter;
-        int             timeout;
+        Subscription *subscription;
+        GVariant     *filter_dict;
+        NdFilter     *filter;
 
-        if (nd_queue_length (daemon->priv->queue) > MAX_NOTIFICATIONS) {
+        if (g_hash_table_size (daemon->priv->subscriptions) >= MAX_SUBSCRIPTIONS) {
                 g_dbus_method_invocation_return_dbus_error (invocation,
-                                                            "org.freedesktop.Notifications.MaxNotificationsExceeded",
-                                                            _("Exceeded maximum number of notifications"));
+                                                            "org.freedesktop.Notifications.MaxSubscriptionsExceeded",
+                                                            _("Exceeded maximum number of subscriptions"));
                 return;
         }
 
-        g_variant_get (parameters,
-                       "(&su&s&s&s^a&sa{sv}i)",
-                       &app_name,
-                       &id,
-                       &icon_name,
-                       &summary,
-                       &body,
-                       &actions,
-                       &hints_iter,
-                       &timeout);
-
-        if (id > 0) {
-                notification = nd_queue_lookup (daemon->priv->queue, id);
-                if (notification == NULL) {
-                        id = 0;
-                } else {
-                        g_object_ref (notification);
-                }
-        }
+        g_variant_get (parameters, "(@a{sv})", &filter_dict);
+        filter = nd_filter_new (filter_dict);
 
-        if (id == 0) {
-                notification = nd_notification_new (sender);
-                g_signal_connect (notification, "closed", G_CALLBACK (on_notification_close), daemon);
-                g_signal_connect (notification, "action-invoked", G_CALLBACK (on_notification_action_invoked), daemon);
+        if (filter == NULL) {
+                g_variant_unref (filter_dict);
+                g_dbus_method_invocation_return_dbus_error (invocation,
+                                                            "org.freedesktop.DBus.Error.InvalidArgs",
+                                                            _("Invalid filter"));
+                return;
         }
 
-        nd_notification_update (notification,
-                                app_name,
-                                icon_name,
-                                summary,
-                                body,
-                                actions,
-                                hints_iter,
-                                timeout);
+        subscription = g_slice_new0 (Subscription);
+        subscription->sender = g_strdup (sender);
+        subscription->filter = filter;
+        subscription->filter_dict = filter_dict;
+        do {
+                subscription->id = daemon->priv->next_subscription++;
+        } while (subscription->id == 0
+                 || g_hash_table_lookup (daemon->priv->subscriptions, GUINT_TO_POINTER (subscription->id)) != NULL);
 
-        if (id == 0) {
-                nd_queue_add (daemon->priv->queue, notification);
-        }
+        add_subscription (daemon,
+                          g_dbus_method_invocation_get_connection (invocation),
+                          subscription);
 
         g_dbus_method_invocation_return_value (invocation,
-                                               g_variant_new ("(u)", nd_notification_get_id (notification)));
-
-        g_object_unref (notification);
+                                               g_variant_new ("(u)", subscription->id));
 }
 
 static void
-handle_close_notification (NotifyDaemon          *daemon,
-                           const char            *sender,
-                           GVariant              *parameters,
-                           GDBusMethodInvocation *invocation)
+handle_unsubscribe (NotifyDaemon          *daemon,
+                    const char            *sender,
+                    GVariant              *parameters,
+                    GDBusMethodInvocation *invocation)
 {
-        NdNotification *notification;
-        guint           id;
+        Subscription *subscription;
+        guint         id;
 
         g_variant_get (parameters, "(u)", &id);
 
-        if (id == 0) {
+        subscription = g_hash_table_lookup (daemon->priv->subscriptions, GUINT_TO_POINTER (id));
+        if (subscription == NULL
+            || g_strcmp0 (subscription->sender, sender) != 0) {
                 g_dbus_method_invocation_return_dbus_error (invocation,
-                                                            "org.freedesktop.Notifications.InvalidId",
-                                                            _("Invalid notification identifier"));
+                                                            "org.freedesktop.Notifications.InvalidSubscription",
+                                                            _("Invalid subscription identifier"));
                 return;
         }
 
-        notification = nd_queue_lookup (daemon->priv->queue, id);
-        if (notification != NULL) {
-                nd_notification_close (notification, ND_NOTIFICATION_CLOSED_API);
-        }
+        g_hash_table_remove (daemon->priv->subscriptions, GUINT_TO_POINTER (id));
 
         g_dbus_method_invocation_return_value (invocation, NULL);
 }
 
+static void
+handle_get_rule_stats (NotifyDaemon          *daemon,
+                       const char            *sender,
+                       GVariant              *parameters,
+                       GDBusMethodInvocation *invocation)
+{
+        if (daemon->priv->rules == NULL) {
+                g_dbus_method_invocation_return_value (invocation,
+                                                       g_variant_new ("(a(st)tt)", NULL, (guint64) 0, (guint64) 0));
+                return;
+        }
+
+        g_dbus_method_invocation_return_value (invocation,
+                                               nd_rules_get_stats (daemon->priv->rules));
+}
+
+static void
+handle_get_memory_stats (NotifyDaemon          *daemon,
+                         const char            *sender,
+                         GVariant              *parameters,
+                         GDBusMethodInvocation *invocation)
+{
+        g_dbus_method_invocation_return_value (invocation,
+                                               g_variant_new ("(@a(stt))", nd_memory_get_stats ()));
+}
+
+static void
+handle_get_usage_stats (NotifyDaemon          *daemon,
+                        const char            *sender,
+                        GVariant              *parameters,
+                        GDBusMethodInvocation *invocation)
+{
+        g_dbus_method_invocation_return_value (invocation,
+                                               g_variant_new ("(@a(ssttttttttt))", nd_usage_get_stats ()));
+}
+
 static void
 handle_get_capabilities (NotifyDaemon          *daemon,
                          const char            *sender,
@@ -277,6 +1725,9 @@ handle_get_capabilities (NotifyDaemon          *daemon,
         g_variant_builder_add (builder, "s", "sound");
         g_variant_builder_add (builder, "s", "persistence");
         g_variant_builder_add (builder, "s", "action-icons");
+        g_variant_builder_add (builder, "s", "x-canonical-private-synchronous");
+        g_variant_builder_add (builder, "s", "x-dunst-stack-tag");
+        g_variant_builder_add (builder, "s", "x-templates");
 
         g_dbus_method_invocation_return_value (invocation,
                                                g_variant_new ("(as)", builder));
@@ -297,6 +1748,116 @@ handle_get_server_information (NotifyDaemon          *daemon,
                                                               NOTIFICATION_SPEC_VERSION));
 }
 
+/* Nothing would be lost by exiting: D-Bus activation brings the
+ * daemon back for the next notification, and the log has nothing to
+ * restore. */
+static gboolean
+is_idle (NotifyDaemon *daemon)
+{
+        return nd_queue_length (daemon->priv->queue) == 0
+                && g_hash_table_size (daemon->priv->templates) == 0
+                && g_hash_table_size (daemon->priv->subscriptions) == 0
+                && daemon->priv->replay_id == 0
+                && daemon->priv->handover_id == 0;
+}
+
+static void
+set_wakeup_in (NdClockWakeup *wakeup,
+               guint          seconds)
+{
+        NdClock *clock;
+
+        clock = nd_clock_get_default ();
+        nd_clock_wakeup_set (clock,
+                             wakeup,
+                             nd_clock_get_monotonic_time (clock) + seconds * G_USEC_PER_SEC);
+}
+
+static void
+on_idle_timeout (NotifyDaemon *daemon)
+{
+        if (! is_idle (daemon)) {
+                set_wakeup_in (daemon->priv->idle_wakeup, daemon->priv->idle_timeout);
+                return;
+        }
+
+        g_debug ("Idle for %u seconds, exiting", daemon->priv->idle_timeout);
+
+        /* give up the name first so that anything sent from now on
+         * activates a new instance instead of waiting on this one */
+        g_bus_unown_name (daemon->priv->owner_id);
+        daemon->priv->owner_id = 0;
+        gtk_main_quit ();
+}
+
+/* Drops what can be rebuilt on demand.  The intern tables free
+ * their strings as soon as the last user goes, so there is nothing
+ * to trim in them. */
+static void
+trim_memory (NotifyDaemon *daemon,
+             const char   *reason)
+{
+        GHashTableIter iter;
+        gpointer       value;
+        gsize          before;
+        gsize          after;
+
+        before = nd_memory_get_total ();
+
+        nd_queue_trim (daemon->priv->queue);
+
+        g_hash_table_iter_init (&iter, daemon->priv->templates);
+        while (g_hash_table_iter_next (&iter, NULL, &value)) {
+                nd_notification_drop_image (ND_NOTIFICATION (value));
+        }
+
+#ifdef HAVE_MALLOC_TRIM
+        malloc_trim (0);
+#endif
+
+        after = nd_memory_get_total ();
+        daemon->priv->last_trim = nd_clock_get_monotonic_time (nd_clock_get_default ());
+
+        g_message ("Trimmed on %s: %" G_GSIZE_FORMAT " bytes reclaimed, %" G_GSIZE_FORMAT " in use",
+                   reason,
+                   before > after ? before - after : 0,
+                   after);
+}
+
+static void
+on_trim_timeout (NotifyDaemon *daemon)
+{
+        trim_memory (daemon, "idle");
+}
+
+static void
+on_memory_pressure (NotifyDaemon *daemon)
+{
+        gint64 now;
+
+        now = nd_clock_get_monotonic_time (nd_clock_get_default ());
+        if (daemon->priv->last_trim > 0
+            && now - daemon->priv->last_trim < TRIM_INTERVAL_SECONDS * G_USEC_PER_SEC) {
+                return;
+        }
+
+        trim_memory (daemon, "memory pressure");
+}
+
+/* Called on any activity; moves both the trim and the exit timer
+ * out again. */
+static void
+reset_idle_timeout (NotifyDaemon *daemon)
+{
+        set_wakeup_in (daemon->priv->trim_wakeup, TRIM_IDLE_SECONDS);
+
+        if (daemon->priv->idle_timeout == 0 || daemon->priv->owner_id == 0) {
+                return;
+        }
+
+        set_wakeup_in (daemon->priv->idle_wakeup, daemon->priv->idle_timeout);
+}
+
 static void
 handle_method_call (GDBusConnection       *connection,
                     const char            *sender,
@@ -309,10 +1870,43 @@ handle_method_call (GDBusConnection       *connection,
 {
         NotifyDaemon *daemon = user_data;
 
+        if (first_call) {
+                first_call = FALSE;
+                g_debug ("First call %s answered %" G_GINT64_FORMAT " ms after startup",
+                         method_name,
+                         (g_get_monotonic_time () - start_time) / 1000);
+        }
+
+        reset_idle_timeout (daemon);
+
         if (g_strcmp0 (method_name, "Notify") == 0) {
                 handle_notify (daemon, sender, parameters, invocation);
+        } else if (g_strcmp0 (method_name, "RegisterTemplate") == 0) {
+                handle_register_template (daemon, sender, parameters, invocation);
+        } else if (g_strcmp0 (method_name, "UnregisterTemplate") == 0) {
+                handle_unregister_template (daemon, sender, parameters, invocation);
+        } else if (g_strcmp0 (method_name, "NotifyFromTemplate") == 0) {
+                handle_notify_from_template (daemon, sender, parameters, invocation);
         } else if (g_strcmp0 (method_name, "CloseNotification") == 0) {
                 handle_close_notification (daemon, sender, parameters, invocation);
+        } else if (g_strcmp0 (method_name, "CloseNotifications") == 0) {
+                handle_close_notifications (daemon, sender, parameters, invocation);
+        } else if (g_strcmp0 (method_name, "CloseNotificationsByTag") == 0) {
+                handle_close_notifications_by_tag (daemon, sender, parameters, invocation);
+        } else if (g_strcmp0 (method_name, "CloseNotificationsByApp") == 0) {
+                handle_close_notifications_by_app (daemon, sender, parameters, invocation);
+        } else if (g_strcmp0 (method_name, "GetNotifications") == 0) {
+                handle_get_notifications (daemon, sender, parameters, invocation);
+        } else if (g_strcmp0 (method_name, "Subscribe") == 0) {
+                handle_subscribe (daemon, sender, parameters, invocation);
+        } else if (g_strcmp0 (method_name, "Unsubscribe") == 0) {
+                handle_unsubscribe (daemon, sender, parameters, invocation);
+        } else if (g_strcmp0 (method_name, "GetRuleStats") == 0) {
+                handle_get_rule_stats (daemon, sender, parameters, invocation);
+        } else if (g_strcmp0 (method_name, "GetMemoryStats") == 0) {
+                handle_get_memory_stats (daemon, sender, parameters, invocation);
+        } else if (g_strcmp0 (method_name, "GetUsageStats") == 0) {
+                handle_get_usage_stats (daemon, sender, parameters, invocation);
         } else if (g_strcmp0 (method_name, "GetCapabilities") == 0) {
                 handle_get_capabilities (daemon, sender, parameters, invocation);
         } else if (g_strcmp0 (method_name, "GetServerInformation") == 0) {
@@ -338,7 +1932,7 @@ on_bus_acquired (GDBusConnection *connection,
 
         registration_id = g_dbus_connection_register_object (connection,
                                                              "/org/freedesktop/Notifications",
-                                                             introspection_data->interfaces[0],
+                                                             &notifications_interface,
                                                              &interface_vtable,
                                                              daemon,
                                                              NULL,  /* user_data_free_func */
@@ -346,13 +1940,388 @@ on_bus_acquired (GDBusConnection *connection,
         g_assert (registration_id > 0);
 }
 
+static char *
+get_handover_path (void)
+{
+        return g_build_filename (g_get_user_runtime_dir (), "notification-daemon-handover", NULL);
+}
+
+/* The replacing instance never took the name, so we carry on as
+ * before. */
+static gboolean
+on_handover_expired (NotifyDaemon *daemon)
+{
+        g_message ("The replacing instance did not take over, carrying on");
+
+        daemon->priv->handover_id = 0;
+        g_io_stream_close (G_IO_STREAM (daemon->priv->handover_to), NULL, NULL);
+        g_object_unref (daemon->priv->handover_to);
+        daemon->priv->handover_to = NULL;
+        reset_idle_timeout (daemon);
+
+        return FALSE;
+}
+
+static gboolean
+peer_is_us (GSocketConnection *connection)
+{
+        GCredentials *credentials;
+        GError       *error;
+        gboolean      ret;
+
+        error = NULL;
+        credentials = g_socket_get_credentials (g_socket_connection_get_socket (connection), &error);
+        if (credentials == NULL) {
+                g_warning ("Unable to check who asks for a handover: %s", error->message);
+                g_error_free (error);
+                return FALSE;
+        }
+
+        ret = g_credentials_get_unix_user (credentials, NULL) == getuid ();
+        g_object_unref (credentials);
+
+        return ret;
+}
+
+static GVariant *
+save_handover_state (NotifyDaemon *daemon)
+{
+        GVariantBuilder templates;
+        GVariantBuilder subscriptions;
+        GHashTableIter  iter;
+        gpointer        key;
+        gpointer        value;
+
+        g_variant_builder_init (&templates, G_VARIANT_TYPE ("a(u(sssssasa{sv}iu))"));
+        g_hash_table_iter_init (&iter, daemon->priv->templates);
+        while (g_hash_table_iter_next (&iter, &key, &value)) {
+                g_variant_builder_add (&templates,
+                                       "(u@(sssssasa{sv}iu))",
+                                       GPOINTER_TO_UINT (key),
+                                       nd_notification_to_record (ND_NOTIFICATION (value)));
+        }
+
+        g_variant_builder_init (&subscriptions, G_VARIANT_TYPE ("a(usa{sv})"));
+        g_hash_table_iter_init (&iter, daemon->priv->subscriptions);
+        while (g_hash_table_iter_next (&iter, NULL, &value)) {
+                Subscription *subscription = value;
+
+                g_variant_builder_add (&subscriptions,
+                                       "(us@a{sv})",
+                                       subscription->id,
+                                       subscription->sender,
+                                       subscription->filter_dict);
+        }
+
+        return g_variant_new ("(va(u(sssssasa{sv}iu))a(usa{sv}))",
+                              nd_queue_save_state (daemon->priv->queue),
+                              &templates,
+                              &subscriptions);
+}
+
+/* The templates and subscriptions come back under their old handles
+ * and ids, and their clients are watched anew.  One that went away
+ * in the meantime is dropped as soon as the watch starts. */
+static void
+restore_handover_state (NotifyDaemon *daemon,
+                        GVariant     *state)
+{
+        GVariant     *queue_state;
+        GVariantIter *templates;
+        GVariantIter *subscriptions;
+        GVariant     *record;
+        GVariant     *filter_dict;
+        const char   *sender;
+        guint         id;
+
+        g_variant_get (state,
+                       "(va(u(sssssasa{sv}iu))a(usa{sv}))",
+                       &queue_state,
+                       &templates,
+                       &subscriptions);
+
+        if (g_variant_is_of_type (queue_state, ND_QUEUE_STATE_TYPE)) {
+                nd_queue_restore_state (daemon->priv->queue,
+                                        queue_state,
+                                        (NdQueueRestoreFunc) restore_notification_from_handover,
+                                        daemon);
+        }
+        g_variant_unref (queue_state);
+
+        while (g_variant_iter_next (templates, "(u@(sssssasa{sv}iu))", &id, &record)) {
+                NdNotification *template;
+                GVariantIter   *hints_iter;
+                const char     *app_name;
+                const char     *icon;
+                const char    **actions;
+
+                g_variant_get (record,
+                               "(&s&s&s&s&s^a&sa{sv}iu)",
+                               &sender,
+                               &app_name,
+                               &icon,
+                               NULL,
+                               NULL,
+                               &actions,
+                               &hints_iter,
+                               NULL,
+                               NULL);
+
+                template = nd_notification_new_template (sender, app_name, icon, actions, hints_iter);
+                add_template (daemon, daemon->priv->connection, id, template);
+
+                g_free (actions);
+                g_variant_iter_free (hints_iter);
+                g_variant_unref (record);
+        }
+        g_variant_iter_free (templates);
+
+        while (g_variant_iter_next (subscriptions, "(u&s@a{sv})", &id, &sender, &filter_dict)) {
+                Subscription *subscription;
+                NdFilter     *filter;
+
+                filter = nd_filter_new (filter_dict);
+                if (filter == NULL
+                    || id == 0
+                    || g_hash_table_lookup (daemon->priv->subscriptions, GUINT_TO_POINTER (id)) != NULL) {
+                        nd_filter_free (filter);
+                        g_variant_unref (filter_dict);
+                        continue;
+                }
+
+                subscription = g_slice_new0 (Subscription);
+                subscription->id = id;
+                subscription->sender = g_strdup (sender);
+                subscription->filter = filter;
+                subscription->filter_dict = filter_dict;
+                add_subscription (daemon, daemon->priv->connection, subscription);
+        }
+        g_variant_iter_free (subscriptions);
+}
+
+/* A new instance started with --replace connects before it asks for
+ * the bus name.  We keep serving until the name is actually lost and
+ * only then send everything over, see on_name_lost(), so no call that
+ * reached us is left out.  If the new instance does not take the
+ * name within HANDOVER_GRACE_SECONDS we carry on as before. */
+static gboolean
+on_handover_incoming (GSocketService    *service,
+                      GSocketConnection *connection,
+                      GObject           *source_object,
+                      NotifyDaemon      *daemon)
+{
+        if (! peer_is_us (connection)) {
+                g_io_stream_close (G_IO_STREAM (connection), NULL, NULL);
+                return TRUE;
+        }
+
+        /* only the latest one gets the state */
+        if (daemon->priv->handover_to != NULL) {
+                g_io_stream_close (G_IO_STREAM (daemon->priv->handover_to), NULL, NULL);
+                g_object_unref (daemon->priv->handover_to);
+        }
+        daemon->priv->handover_to = g_object_ref (connection);
+
+        if (daemon->priv->handover_id > 0) {
+                nd_clock_source_remove (nd_clock_get_default (), daemon->priv->handover_id);
+        }
+        daemon->priv->handover_id = nd_clock_timeout_add (nd_clock_get_default (),
+                                                          HANDOVER_GRACE_SECONDS * 1000,
+                                                          (GSourceFunc) on_handover_expired,
+                                                          daemon);
+
+        return TRUE;
+}
+
+/* Called once the name is gone, so nothing changes after this. */
+static void
+send_handover (NotifyDaemon *daemon)
+{
+        GOutputStream *output;
+        GVariant      *state;
+        GVariant      *normal;
+        guint32        length;
+        GError        *error;
+
+        state = g_variant_ref_sink (save_handover_state (daemon));
+        normal = g_variant_get_normal_form (state);
+        length = g_variant_get_size (normal);
+
+        output = g_io_stream_get_output_stream (G_IO_STREAM (daemon->priv->handover_to));
+
+        error = NULL;
+        if (g_output_stream_write_all (output, &length, sizeof (length), NULL, NULL, &error)
+            && g_output_stream_write_all (output, g_variant_get_data (normal), length, NULL, NULL, &error)) {
+                g_debug ("Handed over %u notifications", nd_queue_length (daemon->priv->queue));
+        } else {
+                g_warning ("Unable to hand over: %s", error->message);
+                g_error_free (error);
+        }
+
+        g_io_stream_close (G_IO_STREAM (daemon->priv->handover_to), NULL, NULL);
+
+        g_variant_unref (normal);
+        g_variant_unref (state);
+}
+
+static void
+start_handover_service (NotifyDaemon *daemon)
+{
+        GSocketAddress *address;
+        GError         *error;
+        char           *path;
+
+        path = get_handover_path ();
+
+        /* whoever had it before gave the name up */
+        g_unlink (path);
+        address = g_unix_socket_address_new (path);
+
+        daemon->priv->handover_service = g_socket_service_new ();
+        error = NULL;
+        if (! g_socket_listener_add_address (G_SOCKET_LISTENER (daemon->priv->handover_service),
+                                             address,
+                                             G_SOCKET_TYPE_STREAM,
+                                             G_SOCKET_PROTOCOL_DEFAULT,
+                                             NULL,
+                                             NULL,
+                                             &error)) {
+                g_warning ("Unable to listen for handover on %s: %s", path, error->message);
+                g_error_free (error);
+        } else {
+                g_signal_connect (daemon->priv->handover_service,
+                                  "incoming",
+                                  G_CALLBACK (on_handover_incoming),
+                                  daemon);
+                g_socket_service_start (daemon->priv->handover_service);
+        }
+
+        g_object_unref (address);
+        g_free (path);
+}
+
+/* Connects to the running instance, if there is one, which sends
+ * its state once we have taken the name from it. */
+static void
+connect_handover (NotifyDaemon *daemon)
+{
+        GSocketClient  *client;
+        GSocketAddress *address;
+        GError         *error;
+        char           *path;
+
+        path = get_handover_path ();
+        address = g_unix_socket_address_new (path);
+        g_free (path);
+
+        client = g_socket_client_new ();
+        g_socket_client_set_timeout (client, HANDOVER_TIMEOUT_SECONDS);
+
+        error = NULL;
+        daemon->priv->handover_from = g_socket_client_connect (client,
+                                                               G_SOCKET_CONNECTABLE (address),
+                                                               NULL,
+                                                               &error);
+        g_object_unref (address);
+        g_object_unref (client);
+
+        if (daemon->priv->handover_from == NULL) {
+                g_debug ("No instance to take over from: %s", error->message);
+                g_error_free (error);
+        }
+}
+
+/* Reads the state the old instance sends when it loses the name. */
+static void
+receive_handover (NotifyDaemon *daemon)
+{
+        GInputStream      *input;
+        GVariant          *state;
+        GBytes            *bytes;
+        guint32            length;
+        gsize              n_read;
+        guchar            *data;
+        gboolean           ok;
+        GError            *error;
+
+        input = g_io_stream_get_input_stream (G_IO_STREAM (daemon->priv->handover_from));
+        ok = FALSE;
+        data = NULL;
+        error = NULL;
+        if (! g_input_stream_read_all (input, &length, sizeof (length), &n_read, NULL, &error)
+            || n_read != sizeof (length)
+            || length > MAX_HANDOVER_SIZE) {
+                goto out;
+        }
+
+        data = g_malloc (length);
+        if (! g_input_stream_read_all (input, data, length, &n_read, NULL, &error)
+            || n_read != length) {
+                goto out;
+        }
+
+        bytes = g_bytes_new_take (data, length);
+        data = NULL;
+        ok = TRUE;
+        state = g_variant_ref_sink (g_variant_new_from_bytes (HANDOVER_STATE_TYPE, bytes, FALSE));
+        g_bytes_unref (bytes);
+
+        restore_handover_state (daemon, state);
+        g_debug ("Took over %u notifications, %u templates and %u subscriptions",
+                 nd_queue_length (daemon->priv->queue),
+                 g_hash_table_size (daemon->priv->templates),
+                 g_hash_table_size (daemon->priv->subscriptions));
+
+        g_variant_unref (state);
+
+ out:
+        if (! ok) {
+                g_warning ("Unable to take over from the running instance: %s",
+                           error ? error->message : "short read");
+        }
+        if (error != NULL) {
+                g_error_free (error);
+        }
+        g_free (data);
+        g_object_unref (daemon->priv->handover_from);
+        daemon->priv->handover_from = NULL;
+}
+
 static void
 on_name_acquired (GDBusConnection *connection,
                   const char      *name,
                   gpointer         user_data)
 {
         NotifyDaemon *daemon = user_data;
+
+        g_debug ("Name acquired %" G_GINT64_FORMAT " ms after startup",
+                 (g_get_monotonic_time () - start_time) / 1000);
+
         daemon->priv->connection = connection;
+        daemon->priv->outbox = nd_outbox_new (connection,
+                                              NOTIFICATION_BUS_PATH,
+                                              NOTIFICATION_BUS_NAME);
+
+        /* calls to the name are only dispatched after this, so they
+         * find everything the old instance had */
+        if (daemon->priv->handover_from != NULL) {
+                receive_handover (daemon);
+        }
+        start_handover_service (daemon);
+
+        g_signal_connect_swapped (daemon->priv->queue,
+                                  "changed",
+                                  G_CALLBACK (reset_idle_timeout),
+                                  daemon);
+        reset_idle_timeout (daemon);
+}
+
+static gboolean
+on_sigusr1 (gpointer data)
+{
+        nd_memory_dump ();
+
+        return TRUE;
 }
 
 static void
@@ -360,38 +2329,142 @@ on_name_lost (GDBusConnection *connection,
               const char      *name,
               gpointer         user_data)
 {
+        NotifyDaemon *daemon = user_data;
+
+        /* replaced by an instance that waits for our state; the log
+         * goes first so it can be opened there as soon as it arrives */
+        if (daemon->priv->handover_to != NULL) {
+                close_log (daemon);
+                send_handover (daemon);
+                exit (0);
+        }
+
         exit (1);
 }
 
 
+static int duplicate_window = DUPLICATE_WINDOW_SECONDS;
+static char *rules_file = NULL;
+static gboolean replace = FALSE;
+static int idle_timeout = IDLE_SECONDS;
+static gboolean single_surface = FALSE;
+static NdQueuePlacement placement = ND_QUEUE_PLACEMENT_POINTER;
+
+static gboolean
+parse_placement (const char *option_name,
+                 const char *value,
+                 gpointer    data,
+                 GError    **error)
+{
+        if (strcmp (value, "pointer") == 0) {
+                placement = ND_QUEUE_PLACEMENT_POINTER;
+        } else if (strcmp (value, "focus") == 0) {
+                placement = ND_QUEUE_PLACEMENT_FOCUS;
+        } else if (strcmp (value, "primary") == 0) {
+                placement = ND_QUEUE_PLACEMENT_PRIMARY;
+        } else {
+                g_set_error (error,
+                             G_OPTION_ERROR,
+                             G_OPTION_ERROR_BAD_VALUE,
+                             _("Unknown placement \"%s\", expected pointer, focus or primary"),
+                             value);
+                return FALSE;
+        }
+
+        return TRUE;
+}
+
+static GOptionEntry entries[] = {
+        { "duplicate-window", 0, 0, G_OPTION_ARG_INT, &duplicate_window,
+          N_("Fold repeats of a notification sent within SECONDS into it, 0 to disable"), N_("SECONDS") },
+        { "rules", 0, 0, G_OPTION_ARG_FILENAME, &rules_file,
+          N_("Read notification rules from FILE"), N_("FILE") },
+        { "replace", 0, 0, G_OPTION_ARG_NONE, &replace,
+          N_("Take over from the running daemon, keeping its notifications"), NULL },
+        { "idle-timeout", 0, 0, G_OPTION_ARG_INT, &idle_timeout,
+          N_("Exit after SECONDS with nothing to show, 0 to keep running"), N_("SECONDS") },
+        { "single-surface", 0, 0, G_OPTION_ARG_NONE, &single_surface,
+          N_("Show all notifications of a monitor in one window"), NULL },
+        { "placement", 0, 0, G_OPTION_ARG_CALLBACK, parse_placement,
+          N_("Show notifications on the monitor with the pointer, the focused window or the primary monitor"),
+          N_("pointer|focus|primary") },
+        { NULL }
+};
+
 int
 main (int argc, char **argv)
 {
-        NotifyDaemon *daemon;
-        guint         owner_id;
+        NotifyDaemon   *daemon;
+        GOptionContext *context;
+        GError         *error;
 
-        g_log_set_always_fatal (G_LOG_LEVEL_ERROR | G_LOG_LEVEL_CRITICAL);
+        start_time = g_get_monotonic_time ();
 
-        gtk_init (&argc, &argv);
+        g_log_set_always_fatal (G_LOG_LEVEL_ERROR | G_LOG_LEVEL_CRITICAL);
 
-        introspection_data = g_dbus_node_info_new_for_xml (introspection_xml, NULL);
-        g_assert (introspection_data != NULL);
+        /* this initializes GTK but leaves opening the display until
+         * the name request is on its way */
+        context = g_option_context_new (NULL);
+        g_option_context_add_main_entries (context, entries, GETTEXT_PACKAGE);
+        g_option_context_add_group (context, gtk_get_option_group (FALSE));
+
+        error = NULL;
+        if (! g_option_context_parse (context, &argc, &argv, &error)) {
+                g_printerr ("%s\n", error->message);
+                g_error_free (error);
+                g_option_context_free (context);
+                return 1;
+        }
+        g_option_context_free (context);
 
         daemon = g_object_new (NOTIFY_TYPE_DAEMON, NULL);
+        nd_queue_set_duplicate_window (daemon->priv->queue, MAX (duplicate_window, 0));
+        nd_queue_set_single_surface (daemon->priv->queue, single_surface);
+        nd_queue_set_placement (daemon->priv->queue, placement);
+        daemon->priv->idle_timeout = MAX (idle_timeout, 0);
+
+        if (rules_file == NULL) {
+                rules_file = g_build_filename (g_get_user_config_dir (),
+                                               "notification-daemon",
+                                               "rules.conf",
+                                               NULL);
+        }
+        daemon->priv->rules = nd_rules_new (rules_file);
+
+        /* the old instance holds the log until it has handed over,
+         * open_log() keeps trying until then */
+        if (replace) {
+                connect_handover (daemon);
+        }
+        open_log (daemon);
+
+        daemon->priv->owner_id = g_bus_own_name (G_BUS_TYPE_SESSION,
+                                                 "org.freedesktop.Notifications",
+                                                 G_BUS_NAME_OWNER_FLAGS_ALLOW_REPLACEMENT
+                                                 | (replace ? G_BUS_NAME_OWNER_FLAGS_REPLACE : 0),
+                                                 on_bus_acquired,
+                                                 on_name_acquired,
+                                                 on_name_lost,
+                                                 daemon,
+                                                 NULL);
+
+        if (gdk_display_open_default_libgtk_only () == NULL) {
+                g_printerr ("Cannot open display\n");
+                return 1;
+        }
+        nd_queue_warm_up (daemon->priv->queue);
 
-        owner_id = g_bus_own_name (G_BUS_TYPE_SESSION,
-                                   "org.freedesktop.Notifications",
-                                   G_BUS_NAME_OWNER_FLAGS_NONE,
-                                   on_bus_acquired,
-                                   on_name_acquired,
-                                   on_name_lost,
-                                   daemon,
-                                   NULL);
+        /* kill -USR1 writes the memory accounting to the log */
+        g_unix_signal_add (SIGUSR1, on_sigusr1, NULL);
+
+        daemon->priv->pressure = nd_pressure_new ((NdPressureFunc) on_memory_pressure,
+                                                  daemon);
 
         gtk_main ();
 
-        g_bus_unown_name (owner_id);
-        g_dbus_node_info_unref (introspection_data);
+        if (daemon->priv->owner_id > 0) {
+                g_bus_unown_name (daemon->priv->owner_id);
+        }
 
         g_object_unref (daemon);
 
@@ -26,11 +26,11 @@
 
 #include "nd-notification.h"
 #include "nd-bubble.h"
+#include "nd-memory.h"
+#include "nd-usage.h"
 
 #define ND_BUBBLE_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), ND_TYPE_BUBBLE, NdBubblePrivate))
 
-#define TIMEOUT_SEC   5
-
 #define WIDTH         400
 #define DEFAULT_X0    0
 #define DEFAULT_Y0    0
@@ -45,6 +45,7 @@ struct NdBubblePrivate
 {
         NdNotification *notification;
 
+        GtkWidget      *content;
         GtkWidget      *main_hbox;
         GtkWidget      *iconbox;
         GtkWidget      *icon;
@@ -67,8 +68,9 @@ struct NdBubblePrivate
         gboolean        url_clicked_lock;
 
         gboolean        composited;
-        glong           remaining;
-        guint           timeout_id;
+
+        /* what is accounted for in nd-memory */
+        gsize           accounted;
 };
 
 static void     nd_bubble_class_init  (NdBubbleClass *klass);
@@ -87,6 +89,17 @@ nd_bubble_get_notification (NdBubble *bubble)
         return bubble->priv->notification;
 }
 
+/* Everything inside the bubble's window.  A host that shows the
+ * content in a window of its own reparents it and forwards crossing
+ * and button events to the bubble, which is then never shown. */
+GtkWidget *
+nd_bubble_get_content (NdBubble *bubble)
+{
+        g_return_val_if_fail (ND_IS_BUBBLE (bubble), NULL);
+
+        return bubble->priv->content;
+}
+
 static gboolean
 nd_bubble_configure_event (GtkWidget         *widget,
                            GdkEventConfigure *event)
@@ -267,15 +280,62 @@ draw_round_rect (cairo_t *cr,
 }
 
 static void
-paint_bubble (NdBubble *bubble,
-              cairo_t  *cr)
+fill_background (NdBubble *bubble,
+                 cairo_t  *cr,
+                 int       width,
+                 int       height)
 {
         GdkColor         color;
         double           r, g, b;
+        GtkStyle        *style;
+
+        draw_round_rect (cr,
+                         1.0f,
+                         DEFAULT_X0 + 1,
+                         DEFAULT_Y0 + 1,
+                         DEFAULT_RADIUS,
+                         width - 2,
+                         height - 2);
+
+        style = gtk_widget_get_style (GTK_WIDGET (bubble));
+        color = style->bg [GTK_STATE_NORMAL];
+        r = (float)color.red / 65535.0;
+        g = (float)color.green / 65535.0;
+        b = (float)color.blue / 65535.0;
+        cairo_set_source_rgba (cr, r, g, b, BACKGROUND_ALPHA);
+        cairo_fill_preserve (cr);
+
+        color = style->text_aa [GTK_STATE_NORMAL];
+        r = (float) color.red / 65535.0;
+        g = (float) color.green / 65535.0;
+        b = (float) color.blue / 65535.0;
+        cairo_set_source_rgba (cr, r, g, b, BACKGROUND_ALPHA / 2);
+        cairo_set_line_width (cr, 2);
+        cairo_stroke (cr);
+}
+
+/* Paints the rounded bubble background for content shown elsewhere,
+ * see nd_bubble_get_content(). */
+void
+nd_bubble_paint_background (NdBubble *bubble,
+                            cairo_t  *cr,
+                            int       width,
+                            int       height)
+{
+        g_return_if_fail (ND_IS_BUBBLE (bubble));
+
+        cairo_save (cr);
+        fill_background (bubble, cr, width, height);
+        cairo_restore (cr);
+}
+
+static void
+paint_bubble (NdBubble *bubble,
+              cairo_t  *cr)
+{
         cairo_t         *cr2;
         cairo_surface_t *surface;
         cairo_region_t  *region;
-        GtkStyle        *style;
         GtkAllocation    allocation;
 
         gtk_widget_get_allocation (GTK_WIDGET (bubble), &allocation);
@@ -295,29 +355,7 @@ paint_bubble (NdBubble *bubble,
         cairo_set_source_rgba (cr2, 0.0, 0.0, 0.0, 0.0);
         cairo_fill (cr2);
 
-        draw_round_rect (cr2,
-                         1.0f,
-                         DEFAULT_X0 + 1,
-                         DEFAULT_Y0 + 1,
-                         DEFAULT_RADIUS,
-                         allocation.width - 2,
-                         allocation.height - 2);
-
-        style = gtk_widget_get_style (GTK_WIDGET (bubble));
-        color = style->bg [GTK_STATE_NORMAL];
-        r = (float)color.red / 65535.0;
-        g = (float)color.green / 65535.0;
-        b = (float)color.blue / 65535.0;
-        cairo_set_source_rgba (cr2, r, g, b, BACKGROUND_ALPHA);
-        cairo_fill_preserve (cr2);
-
-        color = style->text_aa [GTK_STATE_NORMAL];
-        r = (float) color.red / 65535.0;
-        g = (float) color.green / 65535.0;
-        b = (float) color.blue / 65535.0;
-        cairo_set_source_rgba (cr2, r, g, b, BACKGROUND_ALPHA / 2);
-        cairo_set_line_width (cr2, 2);
-        cairo_stroke (cr2);
+        fill_background (bubble, cr2, allocation.width, allocation.height);
 
         cairo_destroy (cr2);
 
@@ -355,11 +393,16 @@ nd_bubble_draw (GtkWidget *widget,
                 cairo_t   *cr)
 {
         NdBubble *bubble = ND_BUBBLE (widget);
+        gint64    start;
+
+        start = nd_usage_get_cpu_time ();
 
         paint_bubble (bubble, cr);
 
         GTK_WIDGET_CLASS (nd_bubble_parent_class)->draw (widget, cr);
 
+        nd_usage_charge (bubble->priv->notification, ND_USAGE_RENDER, start);
+
         return FALSE;
 }
 
@@ -374,67 +417,16 @@ nd_bubble_button_release_event (GtkWidget      *widget,
                 return FALSE;
         }
 
+        /* invoking the action may close the notification, which
+           withdraws the bubble already */
+        g_object_ref (bubble);
         nd_notification_action_invoked (bubble->priv->notification, "default");
         gtk_widget_destroy (GTK_WIDGET (bubble));
+        g_object_unref (bubble);
 
         return FALSE;
 }
 
-static gboolean
-timeout_bubble (NdBubble *bubble)
-{
-        bubble->priv->timeout_id = 0;
-
-        /* FIXME: if transient also close it */
-
-        gtk_widget_destroy (GTK_WIDGET (bubble));
-
-        return FALSE;
-}
-
-static void
-add_timeout (NdBubble *bubble)
-{
-        if (bubble->priv->timeout_id != 0) {
-                g_source_remove (bubble->priv->timeout_id);
-        }
-        bubble->priv->timeout_id = g_timeout_add_seconds (TIMEOUT_SEC,
-                                                          (GSourceFunc)timeout_bubble,
-                                                          bubble);
-}
-
-static void
-nd_bubble_realize (GtkWidget *widget)
-{
-        NdBubble *bubble = ND_BUBBLE (widget);
-
-        add_timeout (bubble);
-
-        GTK_WIDGET_CLASS (nd_bubble_parent_class)->realize (widget);
-}
-
-static gboolean
-nd_bubble_enter_notify_event (GtkWidget        *widget,
-                              GdkEventCrossing *event)
-{
-        NdBubble *bubble = ND_BUBBLE (widget);
-        if (bubble->priv->timeout_id != 0) {
-                g_source_remove (bubble->priv->timeout_id);
-        }
-
-        return FALSE;
-}
-
-static gboolean
-nd_bubble_leave_notify_event (GtkWidget        *widget,
-                              GdkEventCrossing *event)
-{
-        NdBubble *bubble = ND_BUBBLE (widget);
-
-        add_timeout (bubble);
-        return FALSE;
-}
-
 static void
 nd_bubble_class_init (NdBubbleClass *klass)
 {
@@ -447,9 +439,6 @@ nd_bubble_class_init (NdBubbleClass *klass)
         widget_class->configure_event = nd_bubble_configure_event;
         widget_class->composited_changed = nd_bubble_composited_changed;
         widget_class->button_release_event = nd_bubble_button_release_event;
-        widget_class->enter_notify_event = nd_bubble_enter_notify_event;
-        widget_class->leave_notify_event = nd_bubble_leave_notify_event;
-        widget_class->realize = nd_bubble_realize;
 
         g_type_class_add_private (klass, sizeof (NdBubblePrivate));
 }
@@ -491,8 +480,10 @@ static void
 on_close_button_clicked (GtkButton *button,
                          NdBubble  *bubble)
 {
+        g_object_ref (bubble);
         nd_notification_close (bubble->priv->notification, ND_NOTIFICATION_CLOSED_USER);
         gtk_widget_destroy (GTK_WIDGET (bubble));
+        g_object_unref (bubble);
 }
 
 static void
@@ -550,6 +541,7 @@ nd_bubble_init (NdBubble *bubble)
                           bubble);
         gtk_widget_show (main_vbox);
         gtk_container_add (GTK_CONTAINER (bubble), main_vbox);
+        bubble->priv->content = main_vbox;
         gtk_container_set_border_width (GTK_CONTAINER (main_vbox), 12);
 
         bubble->priv->main_hbox = gtk_hbox_new (FALSE, 0);
@@ -673,14 +665,12 @@ nd_bubble_finalize (GObject *object)
 
         g_return_if_fail (bubble->priv != NULL);
 
-        if (bubble->priv->timeout_id != 0) {
-                g_source_remove (bubble->priv->timeout_id);
-        }
-
         g_signal_handlers_disconnect_by_func (bubble->priv->notification, G_CALLBACK (on_notification_changed), bubble);
 
         g_object_unref (bubble->priv->notification);
 
+        nd_memory_resize (ND_MEMORY_BUBBLES, &bubble->priv->accounted, 0);
+
         G_OBJECT_CLASS (nd_bubble_parent_class)->finalize (object);
 }
 
@@ -698,21 +688,14 @@ update_content_hbox_visibility (NdBubble *bubble)
 
 static void
 set_notification_text (NdBubble   *bubble,
-                       const char *summary,
+                       const char *summary_markup,
                        const char *body)
 {
-        char          *str;
-        char          *quoted;
         GtkRequisition req;
         int            summary_width;
 
-        quoted = g_markup_escape_text (summary, -1);
-        str = g_strdup_printf ("<b><big>%s</big></b>", quoted);
-        g_free (quoted);
-
-        gtk_label_set_markup (GTK_LABEL (bubble->priv->summary_label), str);
+        gtk_label_set_markup (GTK_LABEL (bubble->priv->summary_label), summary_markup);
 
-        g_free (str);
         gtk_widget_show_all (GTK_WIDGET (bubble));
         gtk_label_set_markup (GTK_LABEL (bubble->priv->body_label), body);
 
@@ -825,9 +808,11 @@ on_action_clicked (GtkButton      *button,
 {
         const char *key = g_object_get_data (G_OBJECT (button), "_action_key");
 
+        g_object_ref (bubble);
         nd_notification_action_invoked (bubble->priv->notification,
                                         key);
         gtk_widget_destroy (GTK_WIDGET (bubble));
+        g_object_unref (bubble);
 }
 
 static void
@@ -969,13 +954,28 @@ update_image (NdBubble *bubble)
 static void
 update_bubble (NdBubble *bubble)
 {
+        gint64  start;
+        char   *summary;
+
+        /* decoding the image is charged on its own */
+        start = nd_usage_get_cpu_time ();
+        summary = nd_notification_get_summary_markup (bubble->priv->notification);
         set_notification_text (bubble,
-                               nd_notification_get_summary (bubble->priv->notification),
+                               summary,
                                nd_notification_get_body (bubble->priv->notification));
+        g_free (summary);
         clear_actions (bubble);
         add_actions (bubble);
+        nd_usage_charge (bubble->priv->notification, ND_USAGE_RENDER, start);
+
         update_image (bubble);
+
+        start = nd_usage_get_cpu_time ();
         update_content_hbox_visibility (bubble);
+        nd_memory_resize (ND_MEMORY_BUBBLES,
+                          &bubble->priv->accounted,
+                          nd_memory_widget_size (GTK_WIDGET (bubble)));
+        nd_usage_charge (bubble->priv->notification, ND_USAGE_RENDER, start);
 }
 
 static void
@@ -999,6 +999,7 @@ nd_bubble_new_for_notification (NdNotification *notification)
                                NULL);
         bubble->priv->notification = g_object_ref (notification);
         g_signal_connect (notification, "changed", G_CALLBACK (on_notification_changed), bubble);
+        nd_usage_add_window (notification);
         update_bubble (bubble);
 
         return bubble;
@@ -54,6 +54,11 @@ GType               nd_bubble_get_type                      (void);
 NdBubble *          nd_bubble_new_for_notification          (NdNotification *notification);
 
 NdNotification *    nd_bubble_get_notification              (NdBubble       *bubble);
+GtkWidget *         nd_bubble_get_content                   (NdBubble       *bubble);
+void                nd_bubble_paint_background              (NdBubble       *bubble,
+                                                             cairo_t        *cr,
+                                                             int             width,
+                                                             int             height);
 
 G_END_DECLS
 
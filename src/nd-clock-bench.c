@@ -0,0 +1,305 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+
+#include "config.h"
+
+#include <stdlib.h>
+
+#include <glib/gi18n.h>
+#include <glib.h>
+#include <gtk/gtk.h>
+
+#include "nd-clock.h"
+#include "nd-virtual-clock.h"
+#include "nd-timer-wheel.h"
+#include "nd-notification.h"
+#include "nd-queue.h"
+
+/* Replays timer traffic on the virtual clock: first a large number
+ * of timers straight on a timer wheel, some of them paused for a
+ * while, then notifications with timeouts through a real queue.
+ * Every expiry is checked against when it was due and the wall time
+ * it took is printed.  Exits non-zero if anything fired early, late
+ * or not exactly once. */
+
+#define SEED            20100101
+#define STEP_MSEC       10
+#define MAX_TIMEOUT_MSEC (60 * 1000)
+#define PAUSE_MSEC      5000
+
+/* a wheel tick plus one step of the replay */
+#define SLACK_USEC      ((100 + STEP_MSEC) * G_TIME_SPAN_MILLISECOND)
+
+typedef struct
+{
+        NdTimer *timer;
+        gint64   due;
+        gint64   fired;
+        guint    n_fired;
+} Probe;
+
+static NdClock *clock_ = NULL;
+static int      n_timers = 100000;
+static int      n_notifications = 200;
+
+static GOptionEntry entries[] = {
+        { "timers", 't', 0, G_OPTION_ARG_INT, &n_timers,
+          N_("Number of timers to run on the wheel"), N_("N") },
+        { "notifications", 'n', 0, G_OPTION_ARG_INT, &n_notifications,
+          N_("Number of notifications to expire through the queue, 0 to skip"), N_("N") },
+        { NULL }
+};
+
+static void
+on_probe_fired (Probe *probe)
+{
+        probe->fired = nd_clock_get_monotonic_time (clock_);
+        probe->n_fired++;
+        probe->timer = NULL;
+}
+
+static guint
+check_probes (Probe *probes,
+              int    n_probes)
+{
+        guint n_bad;
+        int   i;
+
+        n_bad = 0;
+        for (i = 0; i < n_probes; i++) {
+                Probe *probe = &probes[i];
+
+                if (probe->n_fired != 1
+                    || probe->fired < probe->due
+                    || probe->fired > probe->due + SLACK_USEC) {
+                        if (n_bad < 10) {
+                                g_printerr ("timer %d: fired %u times, %" G_GINT64_FORMAT " us after it was due\n",
+                                            i,
+                                            probe->n_fired,
+                                            probe->fired - probe->due);
+                        }
+                        n_bad++;
+                }
+        }
+
+        return n_bad;
+}
+
+static gboolean
+run_wheel (void)
+{
+        NdVirtualClock *vclock = ND_VIRTUAL_CLOCK (clock_);
+        NdTimerWheel   *wheel;
+        GRand          *rand;
+        Probe          *probes;
+        GTimer         *timer;
+        gint64          start;
+        guint           n_dispatched;
+        guint           n_bad;
+        int             i;
+
+        rand = g_rand_new_with_seed (SEED);
+        probes = g_new0 (Probe, n_timers);
+        wheel = nd_timer_wheel_new (clock_);
+        timer = g_timer_new ();
+
+        start = nd_clock_get_monotonic_time (clock_);
+        for (i = 0; i < n_timers; i++) {
+                guint msec;
+
+                msec = g_rand_int_range (rand, 1, MAX_TIMEOUT_MSEC);
+                probes[i].due = start + (gint64) msec * G_TIME_SPAN_MILLISECOND;
+                probes[i].timer = nd_timer_wheel_add (wheel,
+                                                      msec,
+                                                      (NdTimerFunc) on_probe_fired,
+                                                      &probes[i]);
+        }
+
+        /* run a second, hold every fourth timer still pending for a
+           while as a hovered bubble would, then let them go */
+        n_dispatched = nd_virtual_clock_advance (vclock, G_TIME_SPAN_SECOND);
+        for (i = 0; i < n_timers; i += 4) {
+                if (probes[i].timer != NULL) {
+                        nd_timer_wheel_pause (wheel, probes[i].timer);
+                        probes[i].due += PAUSE_MSEC * G_TIME_SPAN_MILLISECOND;
+                }
+        }
+        n_dispatched += nd_virtual_clock_advance (vclock, PAUSE_MSEC * G_TIME_SPAN_MILLISECOND);
+        for (i = 0; i < n_timers; i += 4) {
+                if (probes[i].timer != NULL)
+                        nd_timer_wheel_resume (wheel, probes[i].timer);
+        }
+
+        while (nd_timer_wheel_get_n_timers (wheel) > 0) {
+                n_dispatched += nd_virtual_clock_advance (vclock,
+                                                          STEP_MSEC * G_TIME_SPAN_MILLISECOND);
+        }
+
+        g_timer_stop (timer);
+        n_bad = check_probes (probes, n_timers);
+
+        g_print ("wheel: %d timers, %u clock dispatches, %.1f virtual s in %.3f s, %u wrong\n",
+                 n_timers,
+                 n_dispatched,
+                 (double) (nd_clock_get_monotonic_time (clock_) - start) / G_TIME_SPAN_SECOND,
+                 g_timer_elapsed (timer, NULL),
+                 n_bad);
+
+        g_timer_destroy (timer);
+        nd_timer_wheel_free (wheel);
+        g_free (probes);
+        g_rand_free (rand);
+
+        return n_bad == 0;
+}
+
+static void
+on_notification_closed (NdNotification *notification,
+                        int             reason,
+                        Probe          *probe)
+{
+        if (reason == ND_NOTIFICATION_CLOSED_EXPIRED)
+                on_probe_fired (probe);
+}
+
+static gboolean
+run_queue (void)
+{
+        NdVirtualClock *vclock = ND_VIRTUAL_CLOCK (clock_);
+        NdQueue        *queue;
+        GVariant       *no_hints;
+        GRand          *rand;
+        Probe          *probes;
+        GTimer         *timer;
+        gint64          start;
+        guint           n_dispatched;
+        guint           n_bad;
+        int             i;
+
+        rand = g_rand_new_with_seed (SEED);
+        probes = g_new0 (Probe, n_notifications);
+        queue = nd_queue_new ();
+        no_hints = g_variant_ref_sink (g_variant_new_array (G_VARIANT_TYPE ("{sv}"), NULL, 0));
+        timer = g_timer_new ();
+
+        start = nd_clock_get_monotonic_time (clock_);
+        for (i = 0; i < n_notifications; i++) {
+                NdNotification *notification;
+                GVariantIter   *hints_iter;
+                const char     *actions[] = { NULL };
+                char           *app_name;
+                char           *summary;
+                guint           msec;
+
+                msec = g_rand_int_range (rand, 1000, MAX_TIMEOUT_MSEC);
+                probes[i].due = start + (gint64) msec * G_TIME_SPAN_MILLISECOND;
+
+                /* one app each, so none of them get folded into a digest */
+                app_name = g_strdup_printf ("nd-clock-bench-%d", i);
+                summary = g_strdup_printf ("Notification %d", i);
+                hints_iter = g_variant_iter_new (no_hints);
+
+                notification = nd_notification_new (":1.0");
+                nd_notification_update (notification,
+                                        app_name,
+                                        "",
+                                        summary,
+                                        "",
+                                        actions,
+                                        hints_iter,
+                                        msec);
+                g_signal_connect (notification,
+                                  "closed",
+                                  G_CALLBACK (on_notification_closed),
+                                  &probes[i]);
+                nd_queue_add (queue, notification);
+
+                g_object_unref (notification);
+                g_variant_iter_free (hints_iter);
+                g_free (summary);
+                g_free (app_name);
+        }
+
+        n_dispatched = 0;
+        while (nd_clock_get_monotonic_time (clock_) - start
+               <= MAX_TIMEOUT_MSEC * G_TIME_SPAN_MILLISECOND + SLACK_USEC) {
+                n_dispatched += nd_virtual_clock_advance (vclock,
+                                                          STEP_MSEC * G_TIME_SPAN_MILLISECOND);
+
+                /* let GTK map and unmap the bubbles as it would */
+                while (g_main_context_iteration (NULL, FALSE))
+                        ;
+        }
+
+        g_timer_stop (timer);
+        n_bad = check_probes (probes, n_notifications);
+
+        g_print ("queue: %d notifications, %u clock dispatches, %.1f virtual s in %.3f s, %u wrong\n",
+                 n_notifications,
+                 n_dispatched,
+                 (double) (nd_clock_get_monotonic_time (clock_) - start) / G_TIME_SPAN_SECOND,
+                 g_timer_elapsed (timer, NULL),
+                 n_bad);
+
+        g_timer_destroy (timer);
+        g_variant_unref (no_hints);
+        g_object_unref (queue);
+        g_free (probes);
+        g_rand_free (rand);
+
+        return n_bad == 0;
+}
+
+int
+main (int argc, char **argv)
+{
+        GOptionContext *context;
+        GError         *error;
+        gboolean        ok;
+
+        context = g_option_context_new (NULL);
+        g_option_context_set_summary (context, _("Replay timer and expiry traffic on a virtual clock."));
+        g_option_context_add_main_entries (context, entries, GETTEXT_PACKAGE);
+
+        error = NULL;
+        if (! g_option_context_parse (context, &argc, &argv, &error)) {
+                g_printerr ("%s\n", error->message);
+                g_error_free (error);
+                g_option_context_free (context);
+                return 1;
+        }
+        g_option_context_free (context);
+
+        clock_ = nd_virtual_clock_new ();
+        nd_clock_set_default (clock_);
+
+        ok = run_wheel ();
+
+        if (n_notifications > 0) {
+                /* bubbles need a display, the wheel alone does not */
+                if (gtk_init_check (&argc, &argv))
+                        ok = run_queue () && ok;
+                else
+                        g_print ("queue: skipped, cannot open display\n");
+        }
+
+        g_object_unref (clock_);
+
+        return ok ? 0 : 1;
+}
@@ -0,0 +1,263 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include "config.h"
+
+#include <glib.h>
+
+#include "nd-clock.h"
+
+/* The base class is the real clock, backed by the system clocks and
+ * the default main context.  NdVirtualClock overrides all of it. */
+
+typedef struct
+{
+        GSource           source;
+        NdClockWakeupFunc func;
+        gpointer          data;
+} WakeupSource;
+
+static void     nd_clock_class_init  (NdClockClass *klass);
+static void     nd_clock_init        (NdClock      *clock);
+
+static NdClock *default_clock = NULL;
+
+G_DEFINE_TYPE (NdClock, nd_clock, G_TYPE_OBJECT)
+
+static gint64
+nd_clock_real_get_monotonic_time (NdClock *clock)
+{
+        return g_get_monotonic_time ();
+}
+
+static gint64
+nd_clock_real_get_real_time (NdClock *clock)
+{
+        return g_get_real_time ();
+}
+
+static guint
+nd_clock_real_timeout_add (NdClock    *clock,
+                           guint       interval,
+                           GSourceFunc func,
+                           gpointer    data)
+{
+        return g_timeout_add (interval, func, data);
+}
+
+static guint
+nd_clock_real_idle_add (NdClock    *clock,
+                        GSourceFunc func,
+                        gpointer    data)
+{
+        return g_idle_add (func, data);
+}
+
+static void
+nd_clock_real_source_remove (NdClock *clock,
+                             guint    id)
+{
+        g_source_remove (id);
+}
+
+static gboolean
+wakeup_source_dispatch (GSource     *source,
+                        GSourceFunc  callback,
+                        gpointer     user_data)
+{
+        WakeupSource *wakeup = (WakeupSource *) source;
+
+        g_source_set_ready_time (source, -1);
+        wakeup->func (wakeup->data);
+
+        return TRUE;
+}
+
+static GSourceFuncs wakeup_source_funcs = {
+        NULL, /* prepare */
+        NULL, /* check */
+        wakeup_source_dispatch,
+        NULL  /* finalize */
+};
+
+static NdClockWakeup *
+nd_clock_real_wakeup_new (NdClock          *clock,
+                          NdClockWakeupFunc func,
+                          gpointer          data)
+{
+        GSource *source;
+
+        source = g_source_new (&wakeup_source_funcs, sizeof (WakeupSource));
+        ((WakeupSource *) source)->func = func;
+        ((WakeupSource *) source)->data = data;
+        g_source_set_ready_time (source, -1);
+        g_source_attach (source, NULL);
+
+        return (NdClockWakeup *) source;
+}
+
+static void
+nd_clock_real_wakeup_set (NdClock       *clock,
+                          NdClockWakeup *wakeup,
+                          gint64         ready_time)
+{
+        g_source_set_ready_time ((GSource *) wakeup, ready_time);
+}
+
+static void
+nd_clock_real_wakeup_free (NdClock       *clock,
+                           NdClockWakeup *wakeup)
+{
+        g_source_destroy ((GSource *) wakeup);
+        g_source_unref ((GSource *) wakeup);
+}
+
+static void
+nd_clock_class_init (NdClockClass *klass)
+{
+        klass->get_monotonic_time = nd_clock_real_get_monotonic_time;
+        klass->get_real_time = nd_clock_real_get_real_time;
+        klass->timeout_add = nd_clock_real_timeout_add;
+        klass->idle_add = nd_clock_real_idle_add;
+        klass->source_remove = nd_clock_real_source_remove;
+        klass->wakeup_new = nd_clock_real_wakeup_new;
+        klass->wakeup_set = nd_clock_real_wakeup_set;
+        klass->wakeup_free = nd_clock_real_wakeup_free;
+}
+
+static void
+nd_clock_init (NdClock *clock)
+{
+}
+
+NdClock *
+nd_clock_new (void)
+{
+        return g_object_new (ND_TYPE_CLOCK, NULL);
+}
+
+/* The clock every timing user in the daemon schedules against.  This
+ * is the real clock unless nd_clock_set_default() installed another
+ * one.  The returned clock is not referenced. */
+NdClock *
+nd_clock_get_default (void)
+{
+        if (default_clock == NULL) {
+                default_clock = nd_clock_new ();
+        }
+
+        return default_clock;
+}
+
+/* Objects pick up the default clock when they are created, so this
+ * has to be called before the queue is created to take effect. */
+void
+nd_clock_set_default (NdClock *clock)
+{
+        g_return_if_fail (ND_IS_CLOCK (clock));
+
+        g_object_ref (clock);
+        if (default_clock != NULL) {
+                g_object_unref (default_clock);
+        }
+        default_clock = clock;
+}
+
+/* monotonic time in microseconds, as g_get_monotonic_time() */
+gint64
+nd_clock_get_monotonic_time (NdClock *clock)
+{
+        g_return_val_if_fail (ND_IS_CLOCK (clock), 0);
+
+        return ND_CLOCK_GET_CLASS (clock)->get_monotonic_time (clock);
+}
+
+/* wall clock time in microseconds, as g_get_real_time() */
+gint64
+nd_clock_get_real_time (NdClock *clock)
+{
+        g_return_val_if_fail (ND_IS_CLOCK (clock), 0);
+
+        return ND_CLOCK_GET_CLASS (clock)->get_real_time (clock);
+}
+
+guint
+nd_clock_timeout_add (NdClock    *clock,
+                      guint       interval,
+                      GSourceFunc func,
+                      gpointer    data)
+{
+        g_return_val_if_fail (ND_IS_CLOCK (clock), 0);
+        g_return_val_if_fail (func != NULL, 0);
+
+        return ND_CLOCK_GET_CLASS (clock)->timeout_add (clock, interval, func, data);
+}
+
+guint
+nd_clock_idle_add (NdClock    *clock,
+                   GSourceFunc func,
+                   gpointer    data)
+{
+        g_return_val_if_fail (ND_IS_CLOCK (clock), 0);
+        g_return_val_if_fail (func != NULL, 0);
+
+        return ND_CLOCK_GET_CLASS (clock)->idle_add (clock, func, data);
+}
+
+void
+nd_clock_source_remove (NdClock *clock,
+                        guint    id)
+{
+        g_return_if_fail (ND_IS_CLOCK (clock));
+        g_return_if_fail (id > 0);
+
+        ND_CLOCK_GET_CLASS (clock)->source_remove (clock, id);
+}
+
+NdClockWakeup *
+nd_clock_wakeup_new (NdClock          *clock,
+                     NdClockWakeupFunc func,
+                     gpointer          data)
+{
+        g_return_val_if_fail (ND_IS_CLOCK (clock), NULL);
+        g_return_val_if_fail (func != NULL, NULL);
+
+        return ND_CLOCK_GET_CLASS (clock)->wakeup_new (clock, func, data);
+}
+
+/* @ready_time is in the clock's monotonic time base, -1 disarms */
+void
+nd_clock_wakeup_set (NdClock       *clock,
+                     NdClockWakeup *wakeup,
+                     gint64         ready_time)
+{
+        g_return_if_fail (ND_IS_CLOCK (clock));
+        g_return_if_fail (wakeup != NULL);
+
+        ND_CLOCK_GET_CLASS (clock)->wakeup_set (clock, wakeup, ready_time);
+}
+
+void
+nd_clock_wakeup_free (NdClock       *clock,
+                      NdClockWakeup *wakeup)
+{
+        g_return_if_fail (ND_IS_CLOCK (clock));
+        g_return_if_fail (wakeup != NULL);
+
+        ND_CLOCK_GET_CLASS (clock)->wakeup_free (clock, wakeup);
+}
@@ -0,0 +1,103 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef __ND_CLOCK_H
+#define __ND_CLOCK_H
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define ND_TYPE_CLOCK         (nd_clock_get_type ())
+#define ND_CLOCK(o)           (G_TYPE_CHECK_INSTANCE_CAST ((o), ND_TYPE_CLOCK, NdClock))
+#define ND_CLOCK_CLASS(k)     (G_TYPE_CHECK_CLASS_CAST((k), ND_TYPE_CLOCK, NdClockClass))
+#define ND_IS_CLOCK(o)        (G_TYPE_CHECK_INSTANCE_TYPE ((o), ND_TYPE_CLOCK))
+#define ND_IS_CLOCK_CLASS(k)  (G_TYPE_CHECK_CLASS_TYPE ((k), ND_TYPE_CLOCK))
+#define ND_CLOCK_GET_CLASS(o) (G_TYPE_INSTANCE_GET_CLASS ((o), ND_TYPE_CLOCK, NdClockClass))
+
+typedef struct NdClockWakeup NdClockWakeup;
+
+/* A wakeup is a persistent, re-armable one-shot: it fires once each
+ * time its ready time is reached and then stays disarmed until it is
+ * set again.  Unlike a timeout it costs no allocation to move. */
+typedef void (* NdClockWakeupFunc) (gpointer data);
+
+typedef struct
+{
+        GObject         parent;
+} NdClock;
+
+typedef struct
+{
+        GObjectClass    parent_class;
+
+        gint64          (* get_monotonic_time) (NdClock          *clock);
+        gint64          (* get_real_time)      (NdClock          *clock);
+
+        guint           (* timeout_add)        (NdClock          *clock,
+                                                guint             interval,
+                                                GSourceFunc       func,
+                                                gpointer          data);
+        guint           (* idle_add)           (NdClock          *clock,
+                                                GSourceFunc       func,
+                                                gpointer          data);
+        void            (* source_remove)      (NdClock          *clock,
+                                                guint             id);
+
+        NdClockWakeup * (* wakeup_new)         (NdClock          *clock,
+                                                NdClockWakeupFunc func,
+                                                gpointer          data);
+        void            (* wakeup_set)         (NdClock          *clock,
+                                                NdClockWakeup    *wakeup,
+                                                gint64            ready_time);
+        void            (* wakeup_free)        (NdClock          *clock,
+                                                NdClockWakeup    *wakeup);
+} NdClockClass;
+
+GType               nd_clock_get_type                       (void);
+
+NdClock *           nd_clock_new                            (void);
+
+NdClock *           nd_clock_get_default                    (void);
+void                nd_clock_set_default                    (NdClock          *clock);
+
+gint64              nd_clock_get_monotonic_time             (NdClock          *clock);
+gint64              nd_clock_get_real_time                  (NdClock          *clock);
+
+guint               nd_clock_timeout_add                    (NdClock          *clock,
+                                                             guint             interval,
+                                                             GSourceFunc       func,
+                                                             gpointer          data);
+guint               nd_clock_idle_add                       (NdClock          *clock,
+                                                             GSourceFunc       func,
+                                                             gpointer          data);
+void                nd_clock_source_remove                  (NdClock          *clock,
+                                                             guint             id);
+
+NdClockWakeup *     nd_clock_wakeup_new                     (NdClock          *clock,
+                                                             NdClockWakeupFunc func,
+                                                             gpointer          data);
+void                nd_clock_wakeup_set                     (NdClock          *clock,
+                                                             NdClockWakeup    *wakeup,
+                                                             gint64            ready_time);
+void                nd_clock_wakeup_free                    (NdClock          *clock,
+                                                             NdClockWakeup    *wakeup);
+
+G_END_DECLS
+
+#endif /* __ND_CLOCK_H */
@@ -0,0 +1,169 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+
+#include "config.h"
+
+#include <string.h>
+#include <glib.h>
+
+#include "nd-filter.h"
+#include "nd-intern.h"
+
+/* A filter is parsed once from the a{sv} a client sends and then
+ * matched against every notification, so everything that can be
+ * worked out up front is. */
+
+struct NdFilter
+{
+        /* interned, compared by pointer */
+        const char     *app_name;
+        char           *category;
+        /* -1 for any */
+        int             min_urgency;
+        /* casefolded, matched against summary and body */
+        char           *text;
+};
+
+static gboolean
+lookup_string (GVariant    *dict,
+               const char  *key,
+               char       **value)
+{
+        GVariant *item;
+
+        *value = NULL;
+
+        item = g_variant_lookup_value (dict, key, NULL);
+        if (item == NULL)
+                return TRUE;
+
+        if (g_variant_is_of_type (item, G_VARIANT_TYPE_STRING)) {
+                *value = g_variant_dup_string (item, NULL);
+        }
+        g_variant_unref (item);
+
+        return *value != NULL;
+}
+
+/* Recognises "app-name" (s), "category" (s), "urgency" (y, the least
+ * urgency to match) and "text" (s, a case insensitive substring of
+ * the summary or body).  Other keys are ignored.  Returns NULL when a
+ * known key has the wrong type. */
+NdFilter *
+nd_filter_new (GVariant *dict)
+{
+        NdFilter *filter;
+        GVariant *item;
+        char     *app_name;
+        char     *text;
+
+        g_return_val_if_fail (g_variant_is_of_type (dict, G_VARIANT_TYPE_VARDICT), NULL);
+
+        filter = g_slice_new0 (NdFilter);
+        filter->min_urgency = -1;
+
+        if (! lookup_string (dict, "app-name", &app_name)) {
+                nd_filter_free (filter);
+                return NULL;
+        }
+        filter->app_name = nd_intern (app_name);
+        g_free (app_name);
+
+        if (! lookup_string (dict, "category", &filter->category)
+            || ! lookup_string (dict, "text", &text)) {
+                nd_filter_free (filter);
+                return NULL;
+        }
+
+        if (text != NULL) {
+                filter->text = g_utf8_casefold (text, -1);
+                g_free (text);
+        }
+
+        item = g_variant_lookup_value (dict, "urgency", NULL);
+        if (item != NULL) {
+                if (! g_variant_is_of_type (item, G_VARIANT_TYPE_BYTE)) {
+                        g_variant_unref (item);
+                        nd_filter_free (filter);
+                        return NULL;
+                }
+                filter->min_urgency = g_variant_get_byte (item);
+                g_variant_unref (item);
+        }
+
+        return filter;
+}
+
+void
+nd_filter_free (NdFilter *filter)
+{
+        if (filter == NULL)
+                return;
+
+        nd_intern_release (filter->app_name);
+        g_free (filter->category);
+        g_free (filter->text);
+        g_slice_free (NdFilter, filter);
+}
+
+static gboolean
+contains_text (const char *haystack,
+               const char *needle)
+{
+        char     *folded;
+        gboolean  ret;
+
+        if (haystack == NULL)
+                return FALSE;
+
+        folded = g_utf8_casefold (haystack, -1);
+        ret = strstr (folded, needle) != NULL;
+        g_free (folded);
+
+        return ret;
+}
+
+/* The cheap exact comparisons go first so most notifications are
+ * turned down before any text is folded. */
+gboolean
+nd_filter_matches (NdFilter       *filter,
+                   NdNotification *notification)
+{
+        g_return_val_if_fail (filter != NULL, FALSE);
+        g_return_val_if_fail (ND_IS_NOTIFICATION (notification), FALSE);
+
+        if (filter->app_name != NULL
+            && filter->app_name != nd_notification_get_app_name (notification))
+                return FALSE;
+
+        if (filter->category != NULL
+            && g_strcmp0 (filter->category, nd_notification_get_category (notification)) != 0)
+                return FALSE;
+
+        if (filter->min_urgency >= 0
+            && nd_notification_get_urgency (notification) < filter->min_urgency)
+                return FALSE;
+
+        if (filter->text != NULL
+            && ! contains_text (nd_notification_get_summary (notification), filter->text)
+            && ! contains_text (nd_notification_get_body (notification), filter->text))
+                return FALSE;
+
+        return TRUE;
+}
@@ -0,0 +1,39 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+
+#ifndef __ND_FILTER_H
+#define __ND_FILTER_H
+
+#include <glib.h>
+
+#include "nd-notification.h"
+
+G_BEGIN_DECLS
+
+typedef struct NdFilter NdFilter;
+
+NdFilter *          nd_filter_new                           (GVariant       *dict);
+void                nd_filter_free                          (NdFilter       *filter);
+
+gboolean            nd_filter_matches                       (NdFilter       *filter,
+                                                             NdNotification *notification);
+
+G_END_DECLS
+
+#endif /* __ND_FILTER_H */
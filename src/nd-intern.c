@@ -0,0 +1,117 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+
+#include "config.h"
+
+#include <string.h>
+#include <glib.h>
+
+#include "nd-intern.h"
+#include "nd-memory.h"
+
+/* The same few senders, app names, icons and hint keys repeat across
+ * every stored notification.  Each distinct string is kept once here
+ * with a count of its users, so two interned strings are equal
+ * exactly when they are the same pointer.  Only used from the main
+ * thread. */
+
+typedef struct
+{
+        guint           ref_count;
+        char            str[1];
+} InternedString;
+
+#define INTERNED_STRING(s) \
+        ((InternedString *) ((s) - G_STRUCT_OFFSET (InternedString, str)))
+
+static GHashTable *strings = NULL;
+static guint       n_refs = 0;
+static gsize       n_bytes = 0;
+
+/* Returns the shared copy of @str with a reference taken, to be given
+ * back with nd_intern_release().  NULL stays NULL. */
+const char *
+nd_intern (const char *str)
+{
+        InternedString *interned;
+        gsize           len;
+
+        if (str == NULL)
+                return NULL;
+
+        if (strings == NULL) {
+                strings = g_hash_table_new (g_str_hash, g_str_equal);
+        }
+
+        interned = g_hash_table_lookup (strings, str);
+        if (interned == NULL) {
+                len = strlen (str);
+                interned = g_malloc (G_STRUCT_OFFSET (InternedString, str) + len + 1);
+                interned->ref_count = 0;
+                memcpy (interned->str, str, len + 1);
+                g_hash_table_insert (strings, interned->str, interned);
+                n_bytes += len + 1;
+                nd_memory_add (ND_MEMORY_CACHES, G_STRUCT_OFFSET (InternedString, str) + len + 1);
+        }
+
+        interned->ref_count++;
+        n_refs++;
+
+        return interned->str;
+}
+
+void
+nd_intern_release (const char *str)
+{
+        InternedString *interned;
+        gsize           len;
+
+        if (str == NULL)
+                return;
+
+        interned = INTERNED_STRING (str);
+        g_return_if_fail (interned->ref_count > 0);
+
+        n_refs--;
+        if (--interned->ref_count > 0)
+                return;
+
+        len = strlen (interned->str);
+        g_hash_table_remove (strings, interned->str);
+        n_bytes -= len + 1;
+        nd_memory_remove (ND_MEMORY_CACHES, G_STRUCT_OFFSET (InternedString, str) + len + 1);
+        g_free (interned);
+}
+
+/* @n_bytes counts the characters kept, not the table itself. */
+void
+nd_intern_get_stats (guint *n_strings_out,
+                     guint *n_refs_out,
+                     gsize *n_bytes_out)
+{
+        if (n_strings_out != NULL) {
+                *n_strings_out = strings != NULL ? g_hash_table_size (strings) : 0;
+        }
+        if (n_refs_out != NULL) {
+                *n_refs_out = n_refs;
+        }
+        if (n_bytes_out != NULL) {
+                *n_bytes_out = n_bytes;
+        }
+}
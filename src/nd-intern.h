@@ -0,0 +1,36 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+
+#ifndef __ND_INTERN_H
+#define __ND_INTERN_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+const char *        nd_intern                               (const char     *str);
+void                nd_intern_release                       (const char     *str);
+
+void                nd_intern_get_stats                     (guint          *n_strings,
+                                                             guint          *n_refs,
+                                                             gsize          *n_bytes);
+
+G_END_DECLS
+
+#endif /* __ND_INTERN_H */
@@ -0,0 +1,806 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "nd-log.h"
+
+/* An append-only log of records keyed by id.  Storing a record appends
+ * it, deleting one appends a tombstone, and compaction rewrites the
+ * file with only the live records once enough of it is garbage.
+ *
+ * The file is a magic followed by records, each a fixed header and a
+ * serialized GVariant padded to 8 bytes.  The header carries its own
+ * checksum so opening only reads headers; a payload is checked when
+ * it is replayed.  Replay reads from a mapping of the file, so the
+ * variants handed out share its pages and nothing is copied or
+ * decoded before it is needed.  The data is in host byte order and
+ * only meant for the machine that wrote it.
+ *
+ * A record cut short by a crash, or a header that does not check out,
+ * ends the log: it is truncated there on open.
+ *
+ * Each record has a count beside it that can be set without writing
+ * the record again.  A count is a bare header, the last one for an id
+ * wins and a new record starts over without one.
+ *
+ * Only one process has the log open at a time.  An instance being
+ * replaced keeps writing until it lets go of its name, so the lock is
+ * held on a file next to the log for as long as it is open, rather
+ * than on the log itself, which compaction swaps for a new one. */
+
+#define LOG_MAGIC           "NDLOG001"
+#define LOG_MAGIC_LEN       8
+
+#define RECORD_PUT          1
+#define RECORD_DELETE       2
+#define RECORD_COUNT        3
+
+#define ALIGN8(n)           (((n) + 7) & ~((gsize) 7))
+
+/* compact when there is this much garbage and more of it than data */
+#define COMPACT_MIN_GARBAGE (256 * 1024)
+
+typedef struct
+{
+        /* over the rest of the header */
+        guint32         header_crc;
+        guint32         payload_crc;
+        guint32         kind;
+        guint32         id;
+        gint64          update_time;
+        guint32         length;
+        /* RECORD_COUNT only, 0 otherwise */
+        guint32         count;
+} RecordHeader;
+
+typedef struct
+{
+        goffset         offset;
+        gsize           size;
+        guint32         id;
+        gint64          update_time;
+        guint32         payload_crc;
+        guint32         length;
+        /* 0 until a count is set */
+        guint32         count;
+} Entry;
+
+/* a set count takes a header of its own */
+#define ENTRY_LIVE_SIZE(entry) ((entry)->size + ((entry)->count > 0 ? sizeof (RecordHeader) : 0))
+
+struct NdLog
+{
+        char           *path;
+        GVariantType   *record_type;
+        int             fd;
+        int             lock_fd;
+
+        /* end of the last complete record */
+        goffset         size;
+        goffset         live_size;
+
+        GHashTable     *entries;
+        guint32         last_id;
+
+        /* the file as it was opened, and the records still to replay
+         * from it in file order */
+        GMappedFile    *map;
+        GBytes         *bytes;
+        GArray         *replay;
+        guint           replay_pos;
+};
+
+static guint32 crc_table[256];
+
+static void
+init_crc_table (void)
+{
+        static gsize initialized = 0;
+        guint32      c;
+        guint        i;
+        guint        k;
+
+        if (! g_once_init_enter (&initialized))
+                return;
+
+        for (i = 0; i < 256; i++) {
+                c = i;
+                for (k = 0; k < 8; k++)
+                        c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+                crc_table[i] = c;
+        }
+
+        g_once_init_leave (&initialized, 1);
+}
+
+/* CRC-32 as in zlib and PNG */
+static guint32
+log_crc32 (const guchar *data,
+       gsize         len)
+{
+        guint32 c;
+        gsize   i;
+
+        c = 0xffffffff;
+        for (i = 0; i < len; i++)
+                c = crc_table[(c ^ data[i]) & 0xff] ^ (c >> 8);
+
+        return c ^ 0xffffffff;
+}
+
+static guint32
+header_crc (const RecordHeader *header)
+{
+        return log_crc32 ((const guchar *) header + sizeof (header->header_crc),
+                      sizeof (RecordHeader) - sizeof (header->header_crc));
+}
+
+static gboolean
+write_all (int           fd,
+           const guchar *data,
+           gsize         len,
+           GError      **error)
+{
+        while (len > 0) {
+                gssize written;
+
+                written = write (fd, data, len);
+                if (written < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+                                     "%s", g_strerror (errno));
+                        return FALSE;
+                }
+                data += written;
+                len -= written;
+        }
+
+        return TRUE;
+}
+
+static void
+remove_entry (NdLog   *log,
+              guint32  id)
+{
+        Entry *entry;
+
+        entry = g_hash_table_lookup (log->entries, GUINT_TO_POINTER (id));
+        if (entry != NULL) {
+                log->live_size -= ENTRY_LIVE_SIZE (entry);
+                g_hash_table_remove (log->entries, GUINT_TO_POINTER (id));
+        }
+}
+
+static void
+add_entry (NdLog              *log,
+           const RecordHeader *header,
+           goffset             offset)
+{
+        Entry *entry;
+
+        remove_entry (log, header->id);
+
+        entry = g_slice_new (Entry);
+        entry->offset = offset;
+        entry->size = sizeof (RecordHeader) + ALIGN8 (header->length);
+        entry->id = header->id;
+        entry->update_time = header->update_time;
+        entry->payload_crc = header->payload_crc;
+        entry->length = header->length;
+        entry->count = 0;
+
+        g_hash_table_insert (log->entries, GUINT_TO_POINTER (header->id), entry);
+        log->live_size += entry->size;
+}
+
+static void
+set_entry_count (NdLog              *log,
+                 const RecordHeader *header)
+{
+        Entry *entry;
+
+        entry = g_hash_table_lookup (log->entries, GUINT_TO_POINTER (header->id));
+        if (entry == NULL)
+                return;
+
+        log->live_size -= ENTRY_LIVE_SIZE (entry);
+        entry->count = header->count;
+        entry->update_time = header->update_time;
+        log->live_size += ENTRY_LIVE_SIZE (entry);
+}
+
+static void
+entry_free (Entry *entry)
+{
+        g_slice_free (Entry, entry);
+}
+
+static int
+compare_entries_by_offset (gconstpointer a,
+                           gconstpointer b)
+{
+        const Entry *entry_a = a;
+        const Entry *entry_b = b;
+
+        if (entry_a->offset == entry_b->offset)
+                return 0;
+        return entry_a->offset < entry_b->offset ? -1 : 1;
+}
+
+/* live entries in file order */
+static GArray *
+get_sorted_entries (NdLog *log)
+{
+        GHashTableIter iter;
+        gpointer       value;
+        GArray        *entries;
+
+        entries = g_array_sized_new (FALSE, FALSE, sizeof (Entry), g_hash_table_size (log->entries));
+        g_hash_table_iter_init (&iter, log->entries);
+        while (g_hash_table_iter_next (&iter, NULL, &value)) {
+                g_array_append_vals (entries, value, 1);
+        }
+        g_array_sort (entries, compare_entries_by_offset);
+
+        return entries;
+}
+
+static gboolean
+start_file (NdLog   *log,
+            GError **error)
+{
+        if (ftruncate (log->fd, 0) < 0
+            || ! write_all (log->fd, (const guchar *) LOG_MAGIC, LOG_MAGIC_LEN, error)) {
+                if (error != NULL && *error == NULL) {
+                        g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+                                     "%s", g_strerror (errno));
+                }
+                return FALSE;
+        }
+        log->size = LOG_MAGIC_LEN;
+
+        return TRUE;
+}
+
+/* Reads the record headers of the file, leaving the payloads alone. */
+static gboolean
+scan (NdLog   *log,
+      GError **error)
+{
+        const guchar *data;
+        gsize         length;
+        goffset       offset;
+
+        log->map = g_mapped_file_new_from_fd (log->fd, FALSE, error);
+        if (log->map == NULL)
+                return FALSE;
+
+        data = (const guchar *) g_mapped_file_get_contents (log->map);
+        length = g_mapped_file_get_length (log->map);
+
+        if (length < LOG_MAGIC_LEN || memcmp (data, LOG_MAGIC, LOG_MAGIC_LEN) != 0) {
+                g_warning ("%s is not a notification log, starting over", log->path);
+                g_mapped_file_unref (log->map);
+                log->map = NULL;
+                return start_file (log, error);
+        }
+
+        offset = LOG_MAGIC_LEN;
+        while (offset + sizeof (RecordHeader) <= length) {
+                RecordHeader header;
+                goffset      end;
+
+                memcpy (&header, data + offset, sizeof (RecordHeader));
+                end = offset + sizeof (RecordHeader) + ALIGN8 ((gsize) header.length);
+
+                if (header.header_crc != header_crc (&header)
+                    || end > (goffset) length
+                    || header.kind < RECORD_PUT
+                    || header.kind > RECORD_COUNT)
+                        break;
+
+                if (header.kind == RECORD_PUT) {
+                        add_entry (log, &header, offset);
+                } else if (header.kind == RECORD_COUNT) {
+                        set_entry_count (log, &header);
+                } else {
+                        remove_entry (log, header.id);
+                }
+                log->last_id = MAX (log->last_id, header.id);
+
+                offset = end;
+        }
+
+        if (offset < (goffset) length) {
+                g_warning ("Dropping %" G_GINT64_FORMAT " damaged bytes at the end of %s",
+                           (gint64) (length - offset), log->path);
+                if (ftruncate (log->fd, offset) < 0) {
+                        g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+                                     "%s", g_strerror (errno));
+                        return FALSE;
+                }
+        }
+        log->size = offset;
+
+        log->bytes = g_mapped_file_get_bytes (log->map);
+        log->replay = get_sorted_entries (log);
+
+        return TRUE;
+}
+
+static gboolean
+lock_log (NdLog   *log,
+          GError **error)
+{
+        char *lock_path;
+
+        lock_path = g_strconcat (log->path, ".lock", NULL);
+        log->lock_fd = g_open (lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        if (log->lock_fd < 0) {
+                g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+                             "%s: %s", lock_path, g_strerror (errno));
+                g_free (lock_path);
+                return FALSE;
+        }
+
+        while (flock (log->lock_fd, LOCK_EX | LOCK_NB) < 0) {
+                if (errno == EINTR)
+                        continue;
+                if (errno == EWOULDBLOCK) {
+                        g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_AGAIN,
+                                     "%s is in use by another instance", log->path);
+                } else {
+                        g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+                                     "%s: %s", lock_path, g_strerror (errno));
+                }
+                g_free (lock_path);
+                return FALSE;
+        }
+
+        g_free (lock_path);
+
+        return TRUE;
+}
+
+/* Opens the log at @path, creating it if needed, and reads what it
+ * holds.  Every record is a @record_type.  Fails with
+ * %G_FILE_ERROR_AGAIN while another process has it open. */
+NdLog *
+nd_log_open (const char         *path,
+             const GVariantType *record_type,
+             GError            **error)
+{
+        NdLog      *log;
+        char       *dirname;
+        struct stat st;
+
+        g_return_val_if_fail (path != NULL, NULL);
+        g_return_val_if_fail (record_type != NULL, NULL);
+
+        init_crc_table ();
+
+        dirname = g_path_get_dirname (path);
+        g_mkdir_with_parents (dirname, 0700);
+        g_free (dirname);
+
+        log = g_slice_new0 (NdLog);
+        log->path = g_strdup (path);
+        log->record_type = g_variant_type_copy (record_type);
+        log->entries = g_hash_table_new_full (NULL, NULL, NULL, (GDestroyNotify) entry_free);
+        log->fd = -1;
+
+        if (! lock_log (log, error)) {
+                nd_log_close (log);
+                return NULL;
+        }
+
+        log->fd = g_open (path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+        if (log->fd < 0) {
+                g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+                             "%s: %s", path, g_strerror (errno));
+                nd_log_close (log);
+                return NULL;
+        }
+
+        if (fstat (log->fd, &st) < 0
+            || (st.st_size == 0 ? ! start_file (log, error) : ! scan (log, error))) {
+                if (error != NULL && *error == NULL) {
+                        g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+                                     "%s: %s", path, g_strerror (errno));
+                }
+                nd_log_close (log);
+                return NULL;
+        }
+
+        return log;
+}
+
+static void
+finish_replay (NdLog *log)
+{
+        if (log->replay != NULL) {
+                g_array_free (log->replay, TRUE);
+                log->replay = NULL;
+        }
+        if (log->bytes != NULL) {
+                g_bytes_unref (log->bytes);
+                log->bytes = NULL;
+        }
+        if (log->map != NULL) {
+                g_mapped_file_unref (log->map);
+                log->map = NULL;
+        }
+}
+
+void
+nd_log_close (NdLog *log)
+{
+        if (log == NULL)
+                return;
+
+        finish_replay (log);
+        if (log->fd >= 0) {
+                close (log->fd);
+        }
+        /* closing drops the lock */
+        if (log->lock_fd >= 0) {
+                close (log->lock_fd);
+        }
+        g_hash_table_destroy (log->entries);
+        g_variant_type_free (log->record_type);
+        g_free (log->path);
+        g_slice_free (NdLog, log);
+}
+
+/* the highest id the log has seen, so new ids do not clash */
+guint32
+nd_log_get_last_id (NdLog *log)
+{
+        g_return_val_if_fail (log != NULL, 0);
+
+        return log->last_id;
+}
+
+guint
+nd_log_get_n_records (NdLog *log)
+{
+        g_return_val_if_fail (log != NULL, 0);
+
+        return g_hash_table_size (log->entries);
+}
+
+/* Hands up to @max of the records found on open to @func, oldest
+ * first, so a large log can be replayed a slice at a time.  Returns
+ * the number of records looked at, 0 once all have been.  Records
+ * that fail their checksum are dropped. */
+guint
+nd_log_replay (NdLog          *log,
+               guint           max,
+               NdLogReplayFunc func,
+               gpointer        data)
+{
+        guint n;
+
+        g_return_val_if_fail (log != NULL, 0);
+        g_return_val_if_fail (func != NULL, 0);
+
+        if (log->replay == NULL)
+                return 0;
+
+        for (n = 0; n < max && log->replay_pos < log->replay->len; n++) {
+                Entry        *item;
+                Entry        *entry;
+                const guchar *payload;
+                GBytes       *bytes;
+                GVariant     *record;
+
+                item = &g_array_index (log->replay, Entry, log->replay_pos++);
+
+                /* stored again or deleted since */
+                entry = g_hash_table_lookup (log->entries, GUINT_TO_POINTER (item->id));
+                if (entry == NULL || entry->offset != item->offset)
+                        continue;
+
+                payload = (const guchar *) g_bytes_get_data (log->bytes, NULL)
+                        + item->offset + sizeof (RecordHeader);
+                if (log_crc32 (payload, item->length) != item->payload_crc) {
+                        g_warning ("Dropping damaged record %u from %s", item->id, log->path);
+                        nd_log_delete (log, item->id);
+                        continue;
+                }
+
+                bytes = g_bytes_new_from_bytes (log->bytes,
+                                                item->offset + sizeof (RecordHeader),
+                                                item->length);
+                record = g_variant_ref_sink (g_variant_new_from_bytes (log->record_type, bytes, FALSE));
+                g_bytes_unref (bytes);
+
+                func (item->id, entry->update_time, record, entry->count, data);
+
+                g_variant_unref (record);
+        }
+
+        if (log->replay_pos >= log->replay->len) {
+                finish_replay (log);
+        }
+
+        return n;
+}
+
+static void
+append (NdLog        *log,
+        RecordHeader *header,
+        const guchar *payload)
+{
+        guchar *buffer;
+        gsize   size;
+        goffset offset;
+        GError *error;
+
+        header->header_crc = header_crc (header);
+
+        size = sizeof (RecordHeader) + ALIGN8 ((gsize) header->length);
+        buffer = g_malloc0 (size);
+        memcpy (buffer, header, sizeof (RecordHeader));
+        if (header->length > 0) {
+                memcpy (buffer + sizeof (RecordHeader), payload, header->length);
+        }
+
+        /* the write lands at the end of the file whatever we think
+           it is, so that is where the record is */
+        offset = lseek (log->fd, 0, SEEK_END);
+        if (offset < 0) {
+                g_warning ("Unable to write to %s: %s", log->path, g_strerror (errno));
+                g_free (buffer);
+                return;
+        }
+
+        error = NULL;
+        if (write_all (log->fd, buffer, size, &error)) {
+                if (header->kind == RECORD_PUT) {
+                        add_entry (log, header, offset);
+                } else if (header->kind == RECORD_COUNT) {
+                        set_entry_count (log, header);
+                } else {
+                        remove_entry (log, header->id);
+                }
+                log->size = offset + size;
+        } else {
+                g_warning ("Unable to write to %s: %s", log->path, error->message);
+                g_error_free (error);
+                /* keep a torn record from hiding later ones */
+                if (ftruncate (log->fd, offset) < 0) {
+                        g_warning ("Unable to truncate %s: %s", log->path, g_strerror (errno));
+                }
+        }
+
+        g_free (buffer);
+}
+
+/* Stores @record as the current state of @id.  A floating @record is
+ * consumed. */
+void
+nd_log_put (NdLog    *log,
+            guint32   id,
+            gint64    update_time,
+            GVariant *record)
+{
+        RecordHeader header;
+        GVariant    *normal;
+
+        g_return_if_fail (log != NULL);
+        g_return_if_fail (g_variant_is_of_type (record, log->record_type));
+
+        g_variant_ref_sink (record);
+        normal = g_variant_get_normal_form (record);
+
+        header.kind = RECORD_PUT;
+        header.id = id;
+        header.update_time = update_time;
+        header.length = g_variant_get_size (normal);
+        header.count = 0;
+        header.payload_crc = log_crc32 (g_variant_get_data (normal), header.length);
+
+        append (log, &header, g_variant_get_data (normal));
+        log->last_id = MAX (log->last_id, id);
+
+        g_variant_unref (normal);
+        g_variant_unref (record);
+}
+
+void
+nd_log_delete (NdLog   *log,
+               guint32  id)
+{
+        RecordHeader header;
+
+        g_return_if_fail (log != NULL);
+
+        if (g_hash_table_lookup (log->entries, GUINT_TO_POINTER (id)) == NULL)
+                return;
+
+        header.kind = RECORD_DELETE;
+        header.id = id;
+        header.update_time = 0;
+        header.length = 0;
+        header.count = 0;
+        header.payload_crc = log_crc32 (NULL, 0);
+
+        append (log, &header, NULL);
+}
+
+/* Sets the count kept beside the record of @id, and its update time,
+ * for the price of a header.  @count must not be 0.  Does nothing if
+ * @id is not stored. */
+void
+nd_log_set_count (NdLog   *log,
+                  guint32  id,
+                  gint64   update_time,
+                  guint32  count)
+{
+        RecordHeader header;
+
+        g_return_if_fail (log != NULL);
+        g_return_if_fail (count > 0);
+
+        if (g_hash_table_lookup (log->entries, GUINT_TO_POINTER (id)) == NULL)
+                return;
+
+        header.kind = RECORD_COUNT;
+        header.id = id;
+        header.update_time = update_time;
+        header.length = 0;
+        header.count = count;
+        header.payload_crc = log_crc32 (NULL, 0);
+
+        append (log, &header, NULL);
+}
+
+gboolean
+nd_log_needs_compaction (NdLog *log)
+{
+        goffset garbage;
+
+        g_return_val_if_fail (log != NULL, FALSE);
+
+        /* replay still reads from the file as it was */
+        if (log->replay != NULL)
+                return FALSE;
+
+        garbage = log->size - LOG_MAGIC_LEN - log->live_size;
+
+        return garbage >= COMPACT_MIN_GARBAGE && garbage > log->live_size;
+}
+
+/* Rewrites the log with only its live records and swaps it in. */
+gboolean
+nd_log_compact (NdLog   *log,
+                GError **error)
+{
+        GMappedFile  *map;
+        const guchar *data;
+        GArray       *entries;
+        char         *tmp_path;
+        int           fd;
+        goffset       offset;
+        guint         i;
+
+        g_return_val_if_fail (log != NULL, FALSE);
+        g_return_val_if_fail (log->replay == NULL, FALSE);
+
+        map = g_mapped_file_new_from_fd (log->fd, FALSE, error);
+        if (map == NULL)
+                return FALSE;
+        data = (const guchar *) g_mapped_file_get_contents (map);
+
+        tmp_path = g_strconcat (log->path, ".tmp", NULL);
+        fd = g_open (tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (fd < 0) {
+                g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+                             "%s: %s", tmp_path, g_strerror (errno));
+                g_free (tmp_path);
+                g_mapped_file_unref (map);
+                return FALSE;
+        }
+
+        entries = get_sorted_entries (log);
+        offset = LOG_MAGIC_LEN;
+        if (! write_all (fd, (const guchar *) LOG_MAGIC, LOG_MAGIC_LEN, error))
+                goto fail;
+        for (i = 0; i < entries->len; i++) {
+                Entry *entry = &g_array_index (entries, Entry, i);
+
+                if (! write_all (fd, data + entry->offset, entry->size, error))
+                        goto fail;
+                offset += entry->size;
+
+                if (entry->count > 0) {
+                        RecordHeader header;
+
+                        memset (&header, 0, sizeof (header));
+                        header.kind = RECORD_COUNT;
+                        header.id = entry->id;
+                        header.update_time = entry->update_time;
+                        header.count = entry->count;
+                        header.payload_crc = log_crc32 (NULL, 0);
+                        header.header_crc = header_crc (&header);
+
+                        if (! write_all (fd, (const guchar *) &header, sizeof (header), error))
+                                goto fail;
+                        offset += sizeof (header);
+                }
+        }
+
+        if (fsync (fd) < 0 || g_rename (tmp_path, log->path) < 0) {
+                g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+                             "%s: %s", log->path, g_strerror (errno));
+                goto fail;
+        }
+        close (fd);
+
+        /* the records moved, point the entries at their new place */
+        offset = LOG_MAGIC_LEN;
+        for (i = 0; i < entries->len; i++) {
+                Entry *copy = &g_array_index (entries, Entry, i);
+                Entry *entry;
+
+                entry = g_hash_table_lookup (log->entries, GUINT_TO_POINTER (copy->id));
+                entry->offset = offset;
+                offset += ENTRY_LIVE_SIZE (copy);
+        }
+
+        close (log->fd);
+        log->fd = g_open (log->path, O_RDWR | O_APPEND | O_CLOEXEC, 0600);
+        log->size = offset;
+
+        g_debug ("Compacted %s to %" G_GINT64_FORMAT " bytes", log->path, (gint64) offset);
+
+        g_array_free (entries, TRUE);
+        g_mapped_file_unref (map);
+        g_free (tmp_path);
+
+        if (log->fd < 0) {
+                g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+                             "%s: %s", log->path, g_strerror (errno));
+                return FALSE;
+        }
+
+        return TRUE;
+
+ fail:
+        close (fd);
+        g_unlink (tmp_path);
+        g_array_free (entries, TRUE);
+        g_mapped_file_unref (map);
+        g_free (tmp_path);
+
+        return FALSE;
+}
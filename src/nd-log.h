@@ -0,0 +1,68 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+
+#ifndef __ND_LOG_H
+#define __ND_LOG_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct NdLog NdLog;
+
+/* Called for each stored record on replay.  @record is only valid for
+ * the duration of the call unless it is referenced.  @count is 0 if
+ * none was set since it was stored. */
+typedef void (* NdLogReplayFunc) (guint32   id,
+                                  gint64    update_time,
+                                  GVariant *record,
+                                  guint32   count,
+                                  gpointer  data);
+
+NdLog *             nd_log_open                             (const char      *path,
+                                                             const GVariantType *record_type,
+                                                             GError         **error);
+void                nd_log_close                            (NdLog           *log);
+
+guint32             nd_log_get_last_id                      (NdLog           *log);
+guint               nd_log_get_n_records                    (NdLog           *log);
+
+guint               nd_log_replay                           (NdLog           *log,
+                                                             guint            max,
+                                                             NdLogReplayFunc  func,
+                                                             gpointer         data);
+
+void                nd_log_put                              (NdLog           *log,
+                                                             guint32          id,
+                                                             gint64           update_time,
+                                                             GVariant        *record);
+void                nd_log_delete                           (NdLog           *log,
+                                                             guint32          id);
+void                nd_log_set_count                        (NdLog           *log,
+                                                             guint32          id,
+                                                             gint64           update_time,
+                                                             guint32          count);
+
+gboolean            nd_log_needs_compaction                 (NdLog           *log);
+gboolean            nd_log_compact                          (NdLog           *log,
+                                                             GError         **error);
+
+G_END_DECLS
+
+#endif /* __ND_LOG_H */
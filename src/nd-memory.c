@@ -0,0 +1,180 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+
+#include "config.h"
+
+#include <gtk/gtk.h>
+
+#include "nd-memory.h"
+
+/* Running byte counts of what each part of the daemon holds, kept by
+ * the code that allocates and frees it.  The numbers are what the
+ * daemon itself asked for: allocator overhead and what GTK and the X
+ * server keep on its behalf are not included, so they are a lower
+ * bound meant for spotting growth, not for matching RSS. */
+
+typedef struct
+{
+        gsize           bytes;
+        guint64         n_allocations;
+} Counter;
+
+static Counter counters[ND_MEMORY_N_CATEGORIES];
+
+static const char *category_names[ND_MEMORY_N_CATEGORIES] = {
+        "store",
+        "hints",
+        "images",
+        "text",
+        "dock",
+        "bubbles",
+        "caches"
+};
+
+void
+nd_memory_add (NdMemoryCategory category,
+               gsize            bytes)
+{
+        g_return_if_fail (category < ND_MEMORY_N_CATEGORIES);
+
+        counters[category].bytes += bytes;
+        counters[category].n_allocations++;
+}
+
+void
+nd_memory_remove (NdMemoryCategory category,
+                  gsize            bytes)
+{
+        g_return_if_fail (category < ND_MEMORY_N_CATEGORIES);
+        g_return_if_fail (counters[category].bytes >= bytes);
+        g_return_if_fail (counters[category].n_allocations > 0);
+
+        counters[category].bytes -= bytes;
+        counters[category].n_allocations--;
+}
+
+/* For something accounted as one allocation whose size changes:
+ * @accounted is what was added for it before, 0 if nothing was. */
+void
+nd_memory_resize (NdMemoryCategory category,
+                  gsize           *accounted,
+                  gsize            bytes)
+{
+        g_return_if_fail (category < ND_MEMORY_N_CATEGORIES);
+        g_return_if_fail (accounted != NULL);
+
+        if (*accounted > 0) {
+                nd_memory_remove (category, *accounted);
+        }
+        if (bytes > 0) {
+                nd_memory_add (category, bytes);
+        }
+        *accounted = bytes;
+}
+
+gsize
+nd_memory_pixbuf_size (GdkPixbuf *pixbuf)
+{
+        if (pixbuf == NULL)
+                return 0;
+
+        return (gsize) gdk_pixbuf_get_rowstride (pixbuf) * gdk_pixbuf_get_height (pixbuf);
+}
+
+static void
+add_widget_size (GtkWidget *widget,
+                 gsize     *size)
+{
+        *size += nd_memory_widget_size (widget);
+}
+
+/* The instances in the tree under @widget plus any pixbufs shown in
+ * it.  Style, layout and server side resources are not counted. */
+gsize
+nd_memory_widget_size (GtkWidget *widget)
+{
+        GTypeQuery query;
+        gsize      size;
+
+        g_return_val_if_fail (GTK_IS_WIDGET (widget), 0);
+
+        g_type_query (G_OBJECT_TYPE (widget), &query);
+        size = query.instance_size;
+
+        if (GTK_IS_IMAGE (widget)
+            && gtk_image_get_storage_type (GTK_IMAGE (widget)) == GTK_IMAGE_PIXBUF) {
+                size += nd_memory_pixbuf_size (gtk_image_get_pixbuf (GTK_IMAGE (widget)));
+        }
+
+        if (GTK_IS_CONTAINER (widget)) {
+                gtk_container_forall (GTK_CONTAINER (widget),
+                                      (GtkCallback) add_widget_size,
+                                      &size);
+        }
+
+        return size;
+}
+
+gsize
+nd_memory_get_total (void)
+{
+        gsize total;
+        int   i;
+
+        total = 0;
+        for (i = 0; i < ND_MEMORY_N_CATEGORIES; i++) {
+                total += counters[i].bytes;
+        }
+
+        return total;
+}
+
+/* ND_MEMORY_STATS_TYPE: name, bytes and live allocations of each
+ * category. */
+GVariant *
+nd_memory_get_stats (void)
+{
+        GVariantBuilder builder;
+        int             i;
+
+        g_variant_builder_init (&builder, ND_MEMORY_STATS_TYPE);
+        for (i = 0; i < ND_MEMORY_N_CATEGORIES; i++) {
+                g_variant_builder_add (&builder,
+                                       "(stt)",
+                                       category_names[i],
+                                       (guint64) counters[i].bytes,
+                                       counters[i].n_allocations);
+        }
+
+        return g_variant_builder_end (&builder);
+}
+
+void
+nd_memory_dump (void)
+{
+        int i;
+
+        for (i = 0; i < ND_MEMORY_N_CATEGORIES; i++) {
+                g_message ("%-8s %10" G_GSIZE_FORMAT " bytes in %" G_GUINT64_FORMAT " allocations",
+                           category_names[i],
+                           counters[i].bytes,
+                           counters[i].n_allocations);
+        }
+        g_message ("total    %10" G_GSIZE_FORMAT " bytes", nd_memory_get_total ());
+}
@@ -0,0 +1,58 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+
+#ifndef __ND_MEMORY_H
+#define __ND_MEMORY_H
+
+#include <gtk/gtk.h>
+
+G_BEGIN_DECLS
+
+typedef enum
+{
+        ND_MEMORY_STORE,
+        ND_MEMORY_HINTS,
+        ND_MEMORY_IMAGES,
+        ND_MEMORY_TEXT,
+        ND_MEMORY_DOCK,
+        ND_MEMORY_BUBBLES,
+        ND_MEMORY_CACHES,
+        ND_MEMORY_N_CATEGORIES
+} NdMemoryCategory;
+
+#define ND_MEMORY_STATS_TYPE G_VARIANT_TYPE ("a(stt)")
+
+void                nd_memory_add                           (NdMemoryCategory category,
+                                                             gsize            bytes);
+void                nd_memory_remove                        (NdMemoryCategory category,
+                                                             gsize            bytes);
+void                nd_memory_resize                        (NdMemoryCategory category,
+                                                             gsize           *accounted,
+                                                             gsize            bytes);
+
+gsize               nd_memory_pixbuf_size                   (GdkPixbuf       *pixbuf);
+gsize               nd_memory_widget_size                   (GtkWidget       *widget);
+
+gsize               nd_memory_get_total                     (void);
+GVariant *          nd_memory_get_stats                     (void);
+void                nd_memory_dump                          (void);
+
+G_END_DECLS
+
+#endif /* __ND_MEMORY_H */
@@ -26,6 +26,8 @@
 
 #include "nd-notification.h"
 #include "nd-notification-box.h"
+#include "nd-memory.h"
+#include "nd-usage.h"
 
 #define ND_NOTIFICATION_BOX_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), ND_TYPE_NOTIFICATION_BOX, NdNotificationBoxPrivate))
 
@@ -47,6 +49,9 @@ struct NdNotificationBoxPrivate
         GtkWidget      *content_hbox;
         GtkWidget      *actions_box;
         GtkWidget      *last_sep;
+
+        /* what is accounted for in nd-memory */
+        gsize           accounted;
 };
 
 static void     nd_notification_box_class_init  (NdNotificationBoxClass *klass);
@@ -183,9 +188,9 @@ update_notification_box (NdNotificationBox *notification_box)
         char         **actions;
         int            i;
         char          *str;
-        char          *quoted;
         GtkRequisition req;
         int            summary_width;
+        gint64         start;
 
         /* Add content */
 
@@ -193,8 +198,9 @@ update_notification_box (NdNotificationBox *notification_box)
         have_body = FALSE;
         have_actions = FALSE;
 
-        /* image */
+        /* image, decoding is charged on its own */
         pixbuf = nd_notification_load_image (notification_box->priv->notification, IMAGE_SIZE);
+        start = nd_usage_get_cpu_time ();
         if (pixbuf != NULL) {
                 gtk_image_set_from_pixbuf (GTK_IMAGE (notification_box->priv->icon), pixbuf);
 
@@ -203,10 +209,7 @@ update_notification_box (NdNotificationBox *notification_box)
         }
 
         /* summary */
-        quoted = g_markup_escape_text (nd_notification_get_summary (notification_box->priv->notification), -1);
-        str = g_strdup_printf ("<b><big>%s</big></b>", quoted);
-        g_free (quoted);
-
+        str = nd_notification_get_summary_markup (notification_box->priv->notification);
         gtk_label_set_markup (GTK_LABEL (notification_box->priv->summary_label), str);
         g_free (str);
 
@@ -263,6 +266,10 @@ update_notification_box (NdNotificationBox *notification_box)
         } else {
                 gtk_widget_hide (notification_box->priv->content_hbox);
         }
+        nd_memory_resize (ND_MEMORY_DOCK,
+                          &notification_box->priv->accounted,
+                          nd_memory_widget_size (GTK_WIDGET (notification_box)));
+        nd_usage_charge (notification_box->priv->notification, ND_USAGE_RENDER, start);
 }
 
 static void
@@ -391,6 +398,8 @@ nd_notification_box_finalize (GObject *object)
 
         g_object_unref (notification_box->priv->notification);
 
+        nd_memory_resize (ND_MEMORY_DOCK, &notification_box->priv->accounted, 0);
+
         G_OBJECT_CLASS (nd_notification_box_parent_class)->finalize (object);
 }
 
@@ -24,6 +24,10 @@
 #include <gtk/gtk.h>
 
 #include "nd-notification.h"
+#include "nd-clock.h"
+#include "nd-intern.h"
+#include "nd-memory.h"
+#include "nd-usage.h"
 
 #define ND_NOTIFICATION_CLASS(klass) (G_TYPE_CHECK_CLASS_CAST ((klass), ND_TYPE_NOTIFICATION, NdNotificationClass))
 #define ND_IS_NOTIFICATION_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass), ND_TYPE_NOTIFICATION))
@@ -43,15 +47,31 @@ struct _NdNotification {
 
         GTimeVal      update_time;
 
-        char         *sender;
+        /* interned, see nd-intern.c */
+        const char   *sender;
         guint32       id;
-        char         *app_name;
-        char         *icon;
+        const char   *app_name;
+        const char   *icon;
         char         *summary;
         char         *body;
         char        **actions;
         GHashTable   *hints;
         int           timeout;
+
+        guint         occurrences;
+
+        /* content not sent with the notification comes from here */
+        NdNotification *template;
+
+        /* templates keep their decoded image for every instance */
+        gboolean      is_template;
+        GdkPixbuf    *image;
+        int           image_size;
+
+        /* what is accounted for in nd-memory */
+        gsize         text_bytes;
+        gsize         hints_bytes;
+        gsize         image_bytes;
 };
 
 static void nd_notification_finalize     (GObject      *object);
@@ -76,6 +96,16 @@ get_next_notification_serial (void)
         return serial;
 }
 
+/* Makes sure new notifications get ids above @last_id, for ids that
+ * were handed out by an earlier run. */
+void
+nd_notification_skip_ids (guint32 last_id)
+{
+        if (last_id >= notification_serial && (gint32) (last_id + 1) > 0) {
+                notification_serial = last_id + 1;
+        }
+}
+
 static void
 nd_notification_class_init (NdNotificationClass *class)
 {
@@ -121,10 +151,13 @@ nd_notification_init (NdNotification *notification)
         notification->summary = NULL;
         notification->body = NULL;
         notification->actions = NULL;
+        notification->occurrences = 1;
         notification->hints = g_hash_table_new_full (g_str_hash,
                                                      g_str_equal,
-                                                     g_free,
+                                                     (GDestroyNotify) nd_intern_release,
                                                      (GDestroyNotify) g_variant_unref);
+
+        nd_memory_add (ND_MEMORY_STORE, sizeof (NdNotification));
 }
 
 static void
@@ -134,21 +167,147 @@ nd_notification_finalize (GObject *object)
 
         notification = ND_NOTIFICATION (object);
 
-        g_free (notification->sender);
-        g_free (notification->app_name);
-        g_free (notification->icon);
+        nd_intern_release (notification->sender);
+        nd_intern_release (notification->app_name);
+        nd_intern_release (notification->icon);
         g_free (notification->summary);
         g_free (notification->body);
         g_strfreev (notification->actions);
 
+        if (notification->template != NULL) {
+                g_object_unref (notification->template);
+        }
+
+        if (notification->image != NULL) {
+                g_object_unref (notification->image);
+        }
+
         if (notification->hints != NULL) {
                 g_hash_table_destroy (notification->hints);
         }
 
+        nd_memory_resize (ND_MEMORY_TEXT, &notification->text_bytes, 0);
+        nd_memory_resize (ND_MEMORY_HINTS, &notification->hints_bytes, 0);
+        nd_memory_resize (ND_MEMORY_IMAGES, &notification->image_bytes, 0);
+        nd_memory_remove (ND_MEMORY_STORE, sizeof (NdNotification));
+
         if (G_OBJECT_CLASS (nd_notification_parent_class)->finalize)
                 (*G_OBJECT_CLASS (nd_notification_parent_class)->finalize) (object);
 }
 
+static void
+stamp_update_time (NdNotification *notification)
+{
+        gint64 now;
+
+        now = nd_clock_get_real_time (nd_clock_get_default ());
+        notification->update_time.tv_sec = now / G_USEC_PER_SEC;
+        notification->update_time.tv_usec = now % G_USEC_PER_SEC;
+}
+
+static void
+set_interned (const char **field,
+              const char  *value)
+{
+        const char *old;
+
+        /* intern first, @value may be the string being replaced */
+        old = *field;
+        *field = nd_intern (value);
+        nd_intern_release (old);
+}
+
+static void
+set_hints (NdNotification *notification,
+           GVariantIter   *hints_iter)
+{
+        GVariant *item;
+
+        g_hash_table_remove_all (notification->hints);
+
+        while ((item = g_variant_iter_next_value (hints_iter))) {
+                const char *key;
+                GVariant   *value;
+
+                g_variant_get (item,
+                               "{&sv}",
+                               &key,
+                               &value);
+
+                g_hash_table_insert (notification->hints,
+                                     (char *) nd_intern (key),
+                                     value); /* steals value */
+                g_variant_unref (item);
+        }
+}
+
+static gsize
+string_size (const char *str)
+{
+        return str != NULL ? strlen (str) + 1 : 0;
+}
+
+/* Brings the text and hints accounted for up to date after the
+ * content changed. */
+static void
+account_content (NdNotification *notification)
+{
+        GHashTableIter iter;
+        gpointer       value;
+        gsize          size;
+        int            i;
+
+        size = string_size (notification->summary) + string_size (notification->body);
+        if (notification->actions != NULL) {
+                for (i = 0; notification->actions[i] != NULL; i++) {
+                        size += string_size (notification->actions[i]);
+                }
+                size += (i + 1) * sizeof (char *);
+        }
+        nd_memory_resize (ND_MEMORY_TEXT, &notification->text_bytes, size);
+
+        size = 0;
+        g_hash_table_iter_init (&iter, notification->hints);
+        while (g_hash_table_iter_next (&iter, NULL, &value)) {
+                size += g_variant_get_size (value);
+        }
+        nd_memory_resize (ND_MEMORY_HINTS, &notification->hints_bytes, size);
+}
+
+static void
+set_image (NdNotification *notification,
+           GdkPixbuf      *image,
+           int             size)
+{
+        if (image != NULL) {
+                g_object_ref (image);
+        }
+        if (notification->image != NULL) {
+                g_object_unref (notification->image);
+        }
+        notification->image = image;
+        notification->image_size = size;
+
+        nd_memory_resize (ND_MEMORY_IMAGES,
+                          &notification->image_bytes,
+                          nd_memory_pixbuf_size (image));
+}
+
+static void
+set_template (NdNotification *notification,
+              NdNotification *template)
+{
+        if (template != NULL) {
+                g_object_ref (template);
+        }
+        if (notification->template != NULL) {
+                g_object_unref (notification->template);
+        }
+        notification->template = template;
+
+        set_image (notification, NULL, 0);
+}
+
 gboolean
 nd_notification_update (NdNotification *notification,
                         const char     *app_name,
@@ -159,15 +318,12 @@ nd_notification_update (NdNotification *notification,
                         GVariantIter   *hints_iter,
                         int             timeout)
 {
-        GVariant *item;
-
         g_return_val_if_fail (ND_IS_NOTIFICATION (notification), FALSE);
 
-        g_free (notification->app_name);
-        notification->app_name = g_strdup (app_name);
+        set_template (notification, NULL);
 
-        g_free (notification->icon);
-        notification->icon = g_strdup (icon);
+        set_interned (&notification->app_name, app_name);
+        set_interned (&notification->icon, icon);
 
         g_free (notification->summary);
         notification->summary = g_strdup (summary);
@@ -178,29 +334,92 @@ nd_notification_update (NdNotification *notification,
         g_strfreev (notification->actions);
         notification->actions = g_strdupv ((char **)actions);
 
-        g_hash_table_remove_all (notification->hints);
+        notification->timeout = timeout;
+        notification->occurrences = 1;
 
-        while ((item = g_variant_iter_next_value (hints_iter))) {
-                const char *key;
-                GVariant   *value;
+        set_hints (notification, hints_iter);
+        account_content (notification);
 
-                g_variant_get (item,
-                               "{sv}",
-                               &key,
-                               &value);
-
-                g_hash_table_insert (notification->hints,
-                                     g_strdup (key),
-                                     value); /* steals value */
-        }
+        stamp_update_time (notification);
 
         g_signal_emit (notification, signals[CHANGED], 0);
 
-        g_get_current_time (&notification->update_time);
+        return TRUE;
+}
+
+/* Like nd_notification_update() but the app name, icon, actions and
+ * any hint not in @hints_iter are shared with @template instead of
+ * being copied per notification. */
+gboolean
+nd_notification_update_from_template (NdNotification *notification,
+                                      NdNotification *template,
+                                      const char     *summary,
+                                      const char     *body,
+                                      GVariantIter   *hints_iter,
+                                      int             timeout)
+{
+        g_return_val_if_fail (ND_IS_NOTIFICATION (notification), FALSE);
+        g_return_val_if_fail (ND_IS_NOTIFICATION (template), FALSE);
+        g_return_val_if_fail (template->is_template, FALSE);
+
+        set_template (notification, template);
+
+        set_interned (&notification->app_name, NULL);
+        set_interned (&notification->icon, NULL);
+
+        g_strfreev (notification->actions);
+        notification->actions = NULL;
+
+        g_free (notification->summary);
+        notification->summary = g_strdup (summary);
+
+        g_free (notification->body);
+        notification->body = g_strdup (body);
+
+        notification->timeout = timeout;
+        notification->occurrences = 1;
+
+        set_hints (notification, hints_iter);
+        account_content (notification);
+
+        stamp_update_time (notification);
+
+        g_signal_emit (notification, signals[CHANGED], 0);
 
         return TRUE;
 }
 
+/* Counts a repeat of the same content instead of a new notification. */
+void
+nd_notification_add_occurrence (NdNotification *notification)
+{
+        g_return_if_fail (ND_IS_NOTIFICATION (notification));
+
+        notification->occurrences++;
+        stamp_update_time (notification);
+
+        g_signal_emit (notification, signals[CHANGED], 0);
+}
+
+/* For a notification being brought back, does not emit "changed". */
+void
+nd_notification_set_occurrences (NdNotification *notification,
+                                 guint           occurrences)
+{
+        g_return_if_fail (ND_IS_NOTIFICATION (notification));
+        g_return_if_fail (occurrences > 0);
+
+        notification->occurrences = occurrences;
+}
+
+guint
+nd_notification_get_occurrences (NdNotification *notification)
+{
+        g_return_val_if_fail (ND_IS_NOTIFICATION (notification), 0);
+
+        return notification->occurrences;
+}
+
 void
 nd_notification_get_update_time (NdNotification *notification,
                                  GTimeVal       *tvp)
@@ -223,6 +442,20 @@ nd_notification_get_is_closed (NdNotification *notification)
         return notification->is_closed;
 }
 
+static GVariant *
+lookup_hint (NdNotification *notification,
+             const char     *name)
+{
+        GVariant *value;
+
+        value = g_hash_table_lookup (notification->hints, name);
+        if (value == NULL && notification->template != NULL) {
+                value = g_hash_table_lookup (notification->template->hints, name);
+        }
+
+        return value;
+}
+
 gboolean
 nd_notification_get_is_transient (NdNotification *notification)
 {
@@ -232,7 +465,7 @@ nd_notification_get_is_transient (NdNotification *notification)
         ret = FALSE;
         g_return_val_if_fail (ND_IS_NOTIFICATION (notification), FALSE);
 
-        value = g_hash_table_lookup (notification->hints, "transient");
+        value = lookup_hint (notification, "transient");
         if (value != NULL) {
                 ret = g_variant_get_boolean (value);
         }
@@ -249,7 +482,7 @@ nd_notification_get_is_resident (NdNotification *notification)
         ret = FALSE;
         g_return_val_if_fail (ND_IS_NOTIFICATION (notification), FALSE);
 
-        value = g_hash_table_lookup (notification->hints, "resident");
+        value = lookup_hint (notification, "resident");
         if (value != NULL) {
                 ret = g_variant_get_boolean (value);
         }
@@ -257,6 +490,63 @@ nd_notification_get_is_resident (NdNotification *notification)
         return ret;
 }
 
+static const char *
+get_string_hint (NdNotification *notification,
+                 const char     *name)
+{
+        GVariant *value;
+
+        value = lookup_hint (notification, name);
+        if (value == NULL
+            || ! g_variant_is_of_type (value, G_VARIANT_TYPE_STRING)) {
+                return NULL;
+        }
+
+        return g_variant_get_string (value, NULL);
+}
+
+/* The stack tag a client uses to replace its own notification
+ * without knowing the id. */
+const char *
+nd_notification_get_tag (NdNotification *notification)
+{
+        const char *tag;
+
+        g_return_val_if_fail (ND_IS_NOTIFICATION (notification), NULL);
+
+        tag = get_string_hint (notification, "x-dunst-stack-tag");
+        if (tag == NULL) {
+                tag = get_string_hint (notification, "x-canonical-private-synchronous");
+        }
+
+        return tag;
+}
+
+const char *
+nd_notification_get_category (NdNotification *notification)
+{
+        g_return_val_if_fail (ND_IS_NOTIFICATION (notification), NULL);
+
+        return get_string_hint (notification, "category");
+}
+
+/* 0 low, 1 normal, 2 critical */
+int
+nd_notification_get_urgency (NdNotification *notification)
+{
+        GVariant *value;
+
+        g_return_val_if_fail (ND_IS_NOTIFICATION (notification), 1);
+
+        value = lookup_hint (notification, "urgency");
+        if (value == NULL
+            || ! g_variant_is_of_type (value, G_VARIANT_TYPE_BYTE)) {
+                return 1;
+        }
+
+        return g_variant_get_byte (value);
+}
+
 gboolean
 nd_notification_get_action_icons (NdNotification *notification)
 {
@@ -266,7 +556,7 @@ nd_notification_get_action_icons (NdNotification *notification)
         ret = FALSE;
         g_return_val_if_fail (ND_IS_NOTIFICATION (notification), FALSE);
 
-        value = g_hash_table_lookup (notification->hints, "action-icons");
+        value = lookup_hint (notification, "action-icons");
         if (value != NULL) {
                 ret = g_variant_get_boolean (value);
         }
@@ -295,9 +585,33 @@ nd_notification_get_actions (NdNotification *notification)
 {
         g_return_val_if_fail (ND_IS_NOTIFICATION (notification), NULL);
 
+        if (notification->template != NULL) {
+                return notification->template->actions;
+        }
+
         return notification->actions;
 }
 
+int
+nd_notification_get_timeout (NdNotification *notification)
+{
+        g_return_val_if_fail (ND_IS_NOTIFICATION (notification), -1);
+
+        return notification->timeout;
+}
+
+const char *
+nd_notification_get_app_name (NdNotification *notification)
+{
+        g_return_val_if_fail (ND_IS_NOTIFICATION (notification), NULL);
+
+        if (notification->template != NULL) {
+                return notification->template->app_name;
+        }
+
+        return notification->app_name;
+}
+
 const char *
 nd_notification_get_sender (NdNotification *notification)
 {
@@ -306,6 +620,16 @@ nd_notification_get_sender (NdNotification *notification)
         return notification->sender;
 }
 
+/* Moves the notification over to a new owner, signals go there. */
+void
+nd_notification_set_sender (NdNotification *notification,
+                            const char     *sender)
+{
+        g_return_if_fail (ND_IS_NOTIFICATION (notification));
+
+        set_interned (&notification->sender, sender);
+}
+
 const char *
 nd_notification_get_summary (NdNotification *notification)
 {
@@ -314,6 +638,29 @@ nd_notification_get_summary (NdNotification *notification)
         return notification->summary;
 }
 
+/* The summary as the bubble and the dock show it, with the count of
+ * repeats folded into it.  Free with g_free(). */
+char *
+nd_notification_get_summary_markup (NdNotification *notification)
+{
+        char *quoted;
+        char *markup;
+
+        g_return_val_if_fail (ND_IS_NOTIFICATION (notification), NULL);
+
+        quoted = g_markup_escape_text (notification->summary ? notification->summary : "", -1);
+        if (notification->occurrences > 1) {
+                markup = g_strdup_printf ("<b><big>%s</big></b> <small>(\303\227%u)</small>",
+                                          quoted,
+                                          notification->occurrences);
+        } else {
+                markup = g_strdup_printf ("<b><big>%s</big></b>", quoted);
+        }
+        g_free (quoted);
+
+        return markup;
+}
+
 const char *
 nd_notification_get_body (NdNotification *notification)
 {
@@ -327,6 +674,10 @@ nd_notification_get_icon (NdNotification *notification)
 {
         g_return_val_if_fail (ND_IS_NOTIFICATION (notification), NULL);
 
+        if (notification->template != NULL) {
+                return notification->template->icon;
+        }
+
         return notification->icon;
 }
 
@@ -480,20 +831,46 @@ _notify_daemon_pixbuf_from_path (const char *path,
         return pixbuf;
 }
 
+static gboolean
+has_own_image (NdNotification *notification)
+{
+        return g_hash_table_lookup (notification->hints, "image-data") != NULL
+                || g_hash_table_lookup (notification->hints, "image_data") != NULL
+                || g_hash_table_lookup (notification->hints, "image-path") != NULL
+                || g_hash_table_lookup (notification->hints, "image_path") != NULL
+                || g_hash_table_lookup (notification->hints, "icon_data") != NULL;
+}
+
 GdkPixbuf *
 nd_notification_load_image (NdNotification *notification,
                             int             size)
 {
-        GVariant  *data;
-        GdkPixbuf *pixbuf;
+        GVariant   *data;
+        GdkPixbuf  *pixbuf;
+        const char *icon;
+        gint64      start;
+
+        g_return_val_if_fail (ND_IS_NOTIFICATION (notification), NULL);
+
+        if (notification->image != NULL && notification->image_size == size) {
+                return g_object_ref (notification->image);
+        }
 
+        /* instances that bring no image of their own show the
+         * template's, decoded once for all of them */
+        if (notification->template != NULL && ! has_own_image (notification)) {
+                return nd_notification_load_image (notification->template, size);
+        }
+
+        start = nd_usage_get_cpu_time ();
         pixbuf = NULL;
+        icon = nd_notification_get_icon (notification);
 
-        if ((data = (GVariant *) g_hash_table_lookup (notification->hints, "image-data"))
-            || (data = (GVariant *) g_hash_table_lookup (notification->hints, "image_data"))) {
+        if ((data = lookup_hint (notification, "image-data"))
+            || (data = lookup_hint (notification, "image_data"))) {
                 pixbuf = _notify_daemon_pixbuf_from_data_hint (data, size);
-        } else if ((data = (GVariant *) g_hash_table_lookup (notification->hints, "image-path"))
-                   || (data = (GVariant *) g_hash_table_lookup (notification->hints, "image_path"))) {
+        } else if ((data = lookup_hint (notification, "image-path"))
+                   || (data = lookup_hint (notification, "image_path"))) {
                 if (g_variant_is_of_type (data, G_VARIANT_TYPE ("(s)"))) {
                         const char *path;
                         path = g_variant_get_string (data, NULL);
@@ -501,16 +878,36 @@ nd_notification_load_image (NdNotification *notification,
                 } else {
                         g_warning ("Expected image_path hint to be of type string");
                 }
-        } else if (*notification->icon != '\0') {
-                pixbuf = _notify_daemon_pixbuf_from_path (notification->icon, size);
-        } else if ((data = (GVariant *) g_hash_table_lookup (notification->hints, "icon_data"))) {
+        } else if (icon != NULL && *icon != '\0') {
+                pixbuf = _notify_daemon_pixbuf_from_path (icon, size);
+        } else if ((data = lookup_hint (notification, "icon_data"))) {
                 g_warning("\"icon_data\" hint is deprecated, please use \"image_data\" instead");
                 pixbuf = _notify_daemon_pixbuf_from_data_hint (data, size);
         }
 
+        if (notification->is_template && pixbuf != NULL) {
+                set_image (notification, pixbuf, size);
+        }
+
+        nd_usage_charge (notification, ND_USAGE_DECODE, start);
+
         return pixbuf;
 }
 
+/* Drops the decoded image a template keeps for its instances, also
+ * when called on an instance; the next nd_notification_load_image()
+ * decodes it again. */
+void
+nd_notification_drop_image (NdNotification *notification)
+{
+        g_return_if_fail (ND_IS_NOTIFICATION (notification));
+
+        set_image (notification, NULL, 0);
+        if (notification->template != NULL) {
+                set_image (notification->template, NULL, 0);
+        }
+}
+
 void
 nd_notification_close (NdNotification            *notification,
                        NdNotificationClosedReason reason)
@@ -541,7 +938,120 @@ nd_notification_new (const char *sender)
         NdNotification *notification;
 
         notification = (NdNotification *) g_object_new (ND_TYPE_NOTIFICATION, NULL);
-        notification->sender = g_strdup (sender);
+        notification->sender = nd_intern (sender);
+
+        return notification;
+}
+
+static void
+add_hints (GVariantBuilder *builder,
+           GHashTable      *hints,
+           GHashTable      *skip)
+{
+        GHashTableIter iter;
+        gpointer       key, value;
+
+        g_hash_table_iter_init (&iter, hints);
+        while (g_hash_table_iter_next (&iter, &key, &value)) {
+                if (skip == NULL || ! g_hash_table_contains (skip, key)) {
+                        g_variant_builder_add (builder, "{sv}", key, value);
+                }
+        }
+}
+
+/* The whole notification as a ND_NOTIFICATION_RECORD_TYPE, with what
+ * comes from a template folded in, for nd_notification_new_from_record(). */
+GVariant *
+nd_notification_to_record (NdNotification *notification)
+{
+        GVariantBuilder hints;
+        const char     *empty[] = { NULL };
+        char          **actions;
+
+        g_return_val_if_fail (ND_IS_NOTIFICATION (notification), NULL);
+
+        g_variant_builder_init (&hints, G_VARIANT_TYPE_VARDICT);
+        add_hints (&hints, notification->hints, NULL);
+        if (notification->template != NULL) {
+                add_hints (&hints, notification->template->hints, notification->hints);
+        }
+
+        actions = nd_notification_get_actions (notification);
+
+        return g_variant_new ("(sssss^asa{sv}iu)",
+                              notification->sender ? notification->sender : "",
+                              nd_notification_get_app_name (notification) ? nd_notification_get_app_name (notification) : "",
+                              nd_notification_get_icon (notification) ? nd_notification_get_icon (notification) : "",
+                              notification->summary ? notification->summary : "",
+                              notification->body ? notification->body : "",
+                              actions ? actions : (char **) empty,
+                              &hints,
+                              notification->timeout,
+                              notification->occurrences);
+}
+
+/* Brings back a notification saved with nd_notification_to_record()
+ * under its old id.  Hint values keep pointing into @record. */
+NdNotification *
+nd_notification_new_from_record (GVariant *record,
+                                 guint32   id,
+                                 gint64    update_time)
+{
+        NdNotification *notification;
+        GVariantIter   *hints_iter;
+        const char     *sender;
+        const char     *app_name;
+        const char     *icon;
+
+        g_return_val_if_fail (g_variant_is_of_type (record, ND_NOTIFICATION_RECORD_TYPE), NULL);
+
+        notification = (NdNotification *) g_object_new (ND_TYPE_NOTIFICATION, NULL);
+        notification->id = id;
+        nd_notification_skip_ids (id);
+
+        g_variant_get (record,
+                       "(&s&s&sss^asa{sv}iu)",
+                       &sender,
+                       &app_name,
+                       &icon,
+                       &notification->summary,
+                       &notification->body,
+                       &notification->actions,
+                       &hints_iter,
+                       &notification->timeout,
+                       &notification->occurrences);
+        notification->sender = nd_intern (sender);
+        notification->app_name = nd_intern (app_name);
+        notification->icon = nd_intern (icon);
+        set_hints (notification, hints_iter);
+        account_content (notification);
+        g_variant_iter_free (hints_iter);
+
+        notification->update_time.tv_sec = update_time / G_USEC_PER_SEC;
+        notification->update_time.tv_usec = update_time % G_USEC_PER_SEC;
+
+        return notification;
+}
+
+/* A template holds what a client's notifications have in common.  It
+ * is never queued or shown itself; instances made from it with
+ * nd_notification_update_from_template() share its content. */
+NdNotification *
+nd_notification_new_template (const char    *sender,
+                              const char    *app_name,
+                              const char    *icon,
+                              const char   **actions,
+                              GVariantIter  *hints_iter)
+{
+        NdNotification *notification;
+
+        notification = nd_notification_new (sender);
+        notification->is_template = TRUE;
+        notification->app_name = nd_intern (app_name);
+        notification->icon = nd_intern (icon);
+        notification->actions = g_strdupv ((char **)actions);
+        set_hints (notification, hints_iter);
+        account_content (notification);
 
         return notification;
 }
@@ -44,9 +44,17 @@ typedef enum
         ND_NOTIFICATION_CLOSED_RESERVED = 4
 } NdNotificationClosedReason;
 
+/* sender, app name, icon, summary, body, actions, hints, timeout, occurrences */
+#define ND_NOTIFICATION_RECORD_TYPE G_VARIANT_TYPE ("(sssssasa{sv}iu)")
+
 GType                 nd_notification_get_type            (void) G_GNUC_CONST;
 
 NdNotification *      nd_notification_new                 (const char     *sender);
+NdNotification *      nd_notification_new_template        (const char     *sender,
+                                                           const char     *app_name,
+                                                           const char     *icon,
+                                                           const char    **actions,
+                                                           GVariantIter   *hints_iter);
 gboolean              nd_notification_update              (NdNotification *notification,
                                                            const char     *app_name,
                                                            const char     *icon,
@@ -55,6 +63,21 @@ gboolean              nd_notification_update              (NdNotification *notif
                                                            const char    **actions,
                                                            GVariantIter   *hints_iter,
                                                            int             timeout);
+gboolean              nd_notification_update_from_template (NdNotification *notification,
+                                                           NdNotification *template,
+                                                           const char     *summary,
+                                                           const char     *body,
+                                                           GVariantIter   *hints_iter,
+                                                           int             timeout);
+void                  nd_notification_add_occurrence      (NdNotification *notification);
+void                  nd_notification_set_occurrences     (NdNotification *notification,
+                                                           guint           occurrences);
+
+GVariant *            nd_notification_to_record           (NdNotification *notification);
+NdNotification *      nd_notification_new_from_record     (GVariant       *record,
+                                                           guint32         id,
+                                                           gint64          update_time);
+void                  nd_notification_skip_ids            (guint32         last_id);
 
 gboolean              nd_notification_get_is_closed       (NdNotification *notification);
 void                  nd_notification_get_update_time     (NdNotification *notification,
@@ -63,15 +86,23 @@ void                  nd_notification_get_update_time     (NdNotification *notif
 guint                 nd_notification_get_id              (NdNotification *notification);
 int                   nd_notification_get_timeout         (NdNotification *notification);
 const char *          nd_notification_get_sender          (NdNotification *notification);
+void                  nd_notification_set_sender          (NdNotification *notification,
+                                                           const char     *sender);
 const char *          nd_notification_get_app_name        (NdNotification *notification);
 const char *          nd_notification_get_icon            (NdNotification *notification);
 const char *          nd_notification_get_summary         (NdNotification *notification);
+char *                nd_notification_get_summary_markup  (NdNotification *notification);
 const char *          nd_notification_get_body            (NdNotification *notification);
 char **               nd_notification_get_actions         (NdNotification *notification);
 GHashTable *          nd_notification_get_hints           (NdNotification *notification);
+guint                 nd_notification_get_occurrences     (NdNotification *notification);
+const char *          nd_notification_get_tag             (NdNotification *notification);
+const char *          nd_notification_get_category        (NdNotification *notification);
+int                   nd_notification_get_urgency         (NdNotification *notification);
 
 GdkPixbuf *           nd_notification_load_image          (NdNotification *notification,
                                                            int             size);
+void                  nd_notification_drop_image          (NdNotification *notification);
 gboolean              nd_notification_get_is_resident     (NdNotification *notification);
 gboolean              nd_notification_get_is_transient    (NdNotification *notification);
 gboolean              nd_notification_get_action_icons    (NdNotification *notification);
@@ -0,0 +1,543 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+
+#include "config.h"
+
+#include <string.h>
+
+#include <gio/gio.h>
+
+#include "nd-clock.h"
+#include "nd-outbox.h"
+
+#define ND_OUTBOX_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), ND_TYPE_OUTBOX, NdOutboxPrivate))
+
+/* Unicast signals are written to the bus whether or not the client
+ * reads them, so a client that stopped reading makes the queues on
+ * our side and in the bus daemon grow without bound.
+ *
+ * A client's signals are followed by a Peer.Ping, one at a time, so a
+ * burst costs a single round trip.  The bus keeps messages in order,
+ * so when the reply comes back the client has read everything sent
+ * before the ping.  Signals sent
+ * since the last answered ping are outstanding.  Once a client has
+ * too many of them, further signals are held or dropped according to
+ * their policy until the next reply shows it caught up.
+ *
+ * Held signals are never shed: a bulk close sends more signals in one
+ * go than a client can have answered a ping for, and that is no
+ * reason to lose any of them.  Memory is bounded instead by giving up
+ * on a client that leaves MAX_PING_TIMEOUTS pings in a row
+ * unanswered.  It gets nothing more until it answers one of the pings
+ * still sent every ABANDONED_PING_SECONDS, or leaves the bus. */
+
+/* outstanding signals before a client counts as behind */
+#define MAX_OUTSTANDING    64
+#define PING_TIMEOUT_MSEC  10000
+#define MAX_PING_TIMEOUTS  3
+#define ABANDONED_PING_SECONDS 60
+
+typedef struct
+{
+        char           *signal_name;
+        GVariant       *body;
+        guint           key;
+} HeldSignal;
+
+typedef struct
+{
+        NdOutbox       *outbox;
+        char           *name;
+
+        guint           n_sent;
+        guint           n_acked;
+
+        /* n_sent when the ping in flight was sent */
+        gboolean        ping_pending;
+        guint           ping_mark;
+
+        GQueue         *held;
+        /* held signals with a key, by signal name and key */
+        GHashTable     *held_index;
+        guint           n_dropped;
+
+        guint           n_timeouts;
+        gboolean        abandoned;
+        guint           retry_id;
+
+        /* NameOwnerChanged for this name only, once it is behind */
+        guint           name_owner_id;
+} Destination;
+
+typedef struct
+{
+        NdOutbox       *outbox;
+        char           *destination;
+        guint           mark;
+} PingData;
+
+struct NdOutboxPrivate
+{
+        GDBusConnection *connection;
+        char            *object_path;
+        char            *interface_name;
+
+        GHashTable      *destinations;
+        guint            n_dropped;
+};
+
+static void     nd_outbox_class_init  (NdOutboxClass *klass);
+static void     nd_outbox_init        (NdOutbox      *outbox);
+static void     nd_outbox_finalize    (GObject       *object);
+
+G_DEFINE_TYPE (NdOutbox, nd_outbox, G_TYPE_OBJECT)
+
+static guint
+held_signal_hash (const HeldSignal *held)
+{
+        return g_str_hash (held->signal_name) ^ held->key;
+}
+
+static gboolean
+held_signal_equal (const HeldSignal *a,
+                   const HeldSignal *b)
+{
+        return a->key == b->key && strcmp (a->signal_name, b->signal_name) == 0;
+}
+
+static void
+held_signal_free (HeldSignal *held)
+{
+        g_free (held->signal_name);
+        g_variant_unref (held->body);
+        g_slice_free (HeldSignal, held);
+}
+
+static void
+destination_free (Destination *destination)
+{
+        if (destination->retry_id > 0) {
+                nd_clock_source_remove (nd_clock_get_default (), destination->retry_id);
+        }
+        if (destination->name_owner_id > 0) {
+                g_dbus_connection_signal_unsubscribe (destination->outbox->priv->connection,
+                                                      destination->name_owner_id);
+        }
+        g_hash_table_destroy (destination->held_index);
+        g_queue_free_full (destination->held, (GDestroyNotify) held_signal_free);
+        g_free (destination->name);
+        g_slice_free (Destination, destination);
+}
+
+static void
+nd_outbox_class_init (NdOutboxClass *klass)
+{
+        GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+        object_class->finalize = nd_outbox_finalize;
+
+        g_type_class_add_private (klass, sizeof (NdOutboxPrivate));
+}
+
+static void
+nd_outbox_init (NdOutbox *outbox)
+{
+        outbox->priv = ND_OUTBOX_GET_PRIVATE (outbox);
+
+        outbox->priv->destinations = g_hash_table_new_full (g_str_hash,
+                                                            g_str_equal,
+                                                            NULL,
+                                                            (GDestroyNotify) destination_free);
+}
+
+static void
+nd_outbox_finalize (GObject *object)
+{
+        NdOutbox *outbox;
+
+        g_return_if_fail (object != NULL);
+        g_return_if_fail (ND_IS_OUTBOX (object));
+
+        outbox = ND_OUTBOX (object);
+
+        g_return_if_fail (outbox->priv != NULL);
+
+        g_hash_table_destroy (outbox->priv->destinations);
+        g_object_unref (outbox->priv->connection);
+        g_free (outbox->priv->object_path);
+        g_free (outbox->priv->interface_name);
+
+        G_OBJECT_CLASS (nd_outbox_parent_class)->finalize (object);
+}
+
+static gboolean
+is_behind (Destination *destination)
+{
+        return destination->n_sent - destination->n_acked >= MAX_OUTSTANDING;
+}
+
+static void
+send_signal (NdOutbox    *outbox,
+             Destination *destination,
+             const char  *signal_name,
+             GVariant    *body)
+{
+        GDBusMessage *message;
+
+        message = g_dbus_message_new_signal (outbox->priv->object_path,
+                                             outbox->priv->interface_name,
+                                             signal_name);
+        g_dbus_message_set_destination (message, destination->name);
+        g_dbus_message_set_body (message, body);
+        g_dbus_connection_send_message (outbox->priv->connection,
+                                        message,
+                                        G_DBUS_SEND_MESSAGE_FLAGS_NONE,
+                                        NULL,
+                                        NULL);
+        g_object_unref (message);
+
+        destination->n_sent++;
+}
+
+static void maybe_ping (NdOutbox    *outbox,
+                        Destination *destination);
+static void send_ping  (NdOutbox    *outbox,
+                        Destination *destination);
+
+static gboolean
+on_retry_timeout (Destination *destination)
+{
+        destination->retry_id = 0;
+        send_ping (destination->outbox, destination);
+
+        return FALSE;
+}
+
+/* an abandoned client is still asked now and then */
+static void
+schedule_retry (Destination *destination)
+{
+        destination->retry_id = nd_clock_timeout_add (nd_clock_get_default (),
+                                                      ABANDONED_PING_SECONDS * 1000,
+                                                      (GSourceFunc) on_retry_timeout,
+                                                      destination);
+}
+
+static void
+abandon (NdOutbox    *outbox,
+         Destination *destination)
+{
+        guint n_held;
+
+        n_held = g_queue_get_length (destination->held);
+        g_hash_table_remove_all (destination->held_index);
+        g_queue_foreach (destination->held, (GFunc) held_signal_free, NULL);
+        g_queue_clear (destination->held);
+
+        g_debug ("%s stopped answering, dropping %u signals and anything after",
+                 destination->name, n_held);
+
+        destination->n_dropped += n_held;
+        outbox->priv->n_dropped += n_held;
+        destination->abandoned = TRUE;
+        schedule_retry (destination);
+}
+
+static void
+on_ping_finished (GObject      *source,
+                  GAsyncResult *result,
+                  PingData     *data)
+{
+        NdOutbox    *outbox;
+        Destination *destination;
+        GVariant    *reply;
+        GError      *error;
+        gboolean     gone;
+
+        outbox = data->outbox;
+        destination = g_hash_table_lookup (outbox->priv->destinations, data->destination);
+
+        error = NULL;
+        gone = FALSE;
+        reply = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source), result, &error);
+        if (reply != NULL) {
+                g_variant_unref (reply);
+        } else {
+                /* a client without Peer still read up to the error */
+                gone = g_error_matches (error, G_DBUS_ERROR, G_DBUS_ERROR_SERVICE_UNKNOWN)
+                        || g_error_matches (error, G_DBUS_ERROR, G_DBUS_ERROR_NAME_HAS_NO_OWNER);
+        }
+
+        if (destination == NULL
+            || ! destination->ping_pending
+            || destination->ping_mark != data->mark) {
+                goto out;
+        }
+
+        destination->ping_pending = FALSE;
+
+        if (gone) {
+                g_hash_table_remove (outbox->priv->destinations, data->destination);
+                goto out;
+        }
+
+        /* no answer, the client stays behind until one comes */
+        if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT)) {
+                destination->n_timeouts++;
+                if (destination->abandoned) {
+                        schedule_retry (destination);
+                } else if (destination->n_timeouts >= MAX_PING_TIMEOUTS) {
+                        abandon (outbox, destination);
+                } else {
+                        maybe_ping (outbox, destination);
+                }
+                goto out;
+        }
+
+        if (destination->abandoned) {
+                g_debug ("%s is answering again", destination->name);
+                destination->abandoned = FALSE;
+        }
+        destination->n_timeouts = 0;
+        destination->n_acked = data->mark;
+
+        while (! g_queue_is_empty (destination->held) && ! is_behind (destination)) {
+                HeldSignal *held;
+
+                held = g_queue_pop_head (destination->held);
+                g_hash_table_remove (destination->held_index, held);
+                send_signal (outbox, destination, held->signal_name, held->body);
+                held_signal_free (held);
+        }
+
+        /* forget clients that are fully caught up */
+        if (destination->n_sent == destination->n_acked
+            && g_queue_is_empty (destination->held)) {
+                g_hash_table_remove (outbox->priv->destinations, data->destination);
+                goto out;
+        }
+
+        maybe_ping (outbox, destination);
+
+ out:
+        if (error != NULL) {
+                g_error_free (error);
+        }
+        g_object_unref (data->outbox);
+        g_free (data->destination);
+        g_slice_free (PingData, data);
+}
+
+static void
+maybe_ping (NdOutbox    *outbox,
+            Destination *destination)
+{
+        if (destination->ping_pending || destination->abandoned)
+                return;
+
+        if (destination->n_sent == destination->n_acked
+            && g_queue_is_empty (destination->held))
+                return;
+
+        send_ping (outbox, destination);
+}
+
+static void
+send_ping (NdOutbox    *outbox,
+           Destination *destination)
+{
+        PingData *data;
+
+        destination->ping_pending = TRUE;
+        destination->ping_mark = destination->n_sent;
+
+        data = g_slice_new (PingData);
+        data->outbox = g_object_ref (outbox);
+        data->destination = g_strdup (destination->name);
+        data->mark = destination->ping_mark;
+
+        g_dbus_connection_call (outbox->priv->connection,
+                                destination->name,
+                                "/",
+                                "org.freedesktop.DBus.Peer",
+                                "Ping",
+                                NULL,
+                                NULL,
+                                G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                                PING_TIMEOUT_MSEC,
+                                NULL,
+                                (GAsyncReadyCallback) on_ping_finished,
+                                data);
+}
+
+static void
+hold_signal (Destination    *destination,
+             const char     *signal_name,
+             GVariant       *body,
+             guint           key)
+{
+        HeldSignal *held;
+        HeldSignal  lookup;
+
+        /* a newer signal for the same thing replaces the held one */
+        if (key != 0) {
+                lookup.signal_name = (char *) signal_name;
+                lookup.key = key;
+                held = g_hash_table_lookup (destination->held_index, &lookup);
+                if (held != NULL) {
+                        g_variant_unref (held->body);
+                        held->body = g_variant_ref_sink (body);
+                        return;
+                }
+        }
+
+        held = g_slice_new (HeldSignal);
+        held->signal_name = g_strdup (signal_name);
+        held->body = g_variant_ref_sink (body);
+        held->key = key;
+        g_queue_push_tail (destination->held, held);
+        if (key != 0) {
+                g_hash_table_add (destination->held_index, held);
+        }
+}
+
+/* what is kept for a client goes when it leaves the bus */
+static void
+on_name_owner_changed (GDBusConnection *connection,
+                       const char      *sender_name,
+                       const char      *object_path,
+                       const char      *interface_name,
+                       const char      *signal_name,
+                       GVariant        *parameters,
+                       NdOutbox        *outbox)
+{
+        const char *name;
+        const char *old_owner;
+        const char *new_owner;
+
+        g_variant_get (parameters, "(&s&s&s)", &name, &old_owner, &new_owner);
+        if (*new_owner == '\0') {
+                g_hash_table_remove (outbox->priv->destinations, name);
+        }
+}
+
+/* Clients that keep up are forgotten after each ping, or when it
+ * fails because they left, so only those that hold something are
+ * watched. */
+static void
+watch_destination (NdOutbox    *outbox,
+                   Destination *destination)
+{
+        if (destination->name_owner_id > 0)
+                return;
+
+        destination->name_owner_id = g_dbus_connection_signal_subscribe (outbox->priv->connection,
+                                                                         "org.freedesktop.DBus",
+                                                                         "org.freedesktop.DBus",
+                                                                         "NameOwnerChanged",
+                                                                         "/org/freedesktop/DBus",
+                                                                         destination->name,
+                                                                         G_DBUS_SIGNAL_FLAGS_NONE,
+                                                                         (GDBusSignalCallback) on_name_owner_changed,
+                                                                         outbox,
+                                                                         NULL);
+}
+
+NdOutbox *
+nd_outbox_new (GDBusConnection *connection,
+               const char      *object_path,
+               const char      *interface_name)
+{
+        NdOutbox *outbox;
+
+        g_return_val_if_fail (G_IS_DBUS_CONNECTION (connection), NULL);
+
+        outbox = g_object_new (ND_TYPE_OUTBOX, NULL);
+        outbox->priv->connection = g_object_ref (connection);
+        outbox->priv->object_path = g_strdup (object_path);
+        outbox->priv->interface_name = g_strdup (interface_name);
+
+        return outbox;
+}
+
+/* Sends @signal_name with @body to @destination, unless the client is
+ * behind.  Then @policy decides whether it is held or dropped; @key,
+ * if not 0, lets a held signal be replaced by a newer one.  @body may
+ * be shared between destinations. */
+void
+nd_outbox_send (NdOutbox       *outbox,
+                const char     *destination_name,
+                const char     *signal_name,
+                GVariant       *body,
+                NdOutboxPolicy  policy,
+                guint           key)
+{
+        Destination *destination;
+        guint        n_dropped;
+
+        g_return_if_fail (ND_IS_OUTBOX (outbox));
+        g_return_if_fail (destination_name != NULL);
+        g_return_if_fail (signal_name != NULL);
+
+        destination = g_hash_table_lookup (outbox->priv->destinations, destination_name);
+        if (destination == NULL) {
+                destination = g_slice_new0 (Destination);
+                destination->outbox = outbox;
+                destination->name = g_strdup (destination_name);
+                destination->held = g_queue_new ();
+                destination->held_index = g_hash_table_new ((GHashFunc) held_signal_hash,
+                                                            (GEqualFunc) held_signal_equal);
+                g_hash_table_insert (outbox->priv->destinations, destination->name, destination);
+        }
+
+        g_variant_ref_sink (body);
+        n_dropped = destination->n_dropped;
+
+        if (destination->abandoned) {
+                destination->n_dropped++;
+        } else if (! is_behind (destination) && g_queue_is_empty (destination->held)) {
+                send_signal (outbox, destination, signal_name, body);
+        } else if (policy == ND_OUTBOX_COALESCE) {
+                watch_destination (outbox, destination);
+                hold_signal (destination, signal_name, body, key);
+        } else {
+                watch_destination (outbox, destination);
+                destination->n_dropped++;
+        }
+
+        if (destination->n_dropped != n_dropped) {
+                if (n_dropped == 0) {
+                        g_debug ("%s is not keeping up, dropping signals", destination->name);
+                }
+                outbox->priv->n_dropped += destination->n_dropped - n_dropped;
+        }
+
+        maybe_ping (outbox, destination);
+
+        g_variant_unref (body);
+}
+
+/* signals dropped so far for clients that fell behind */
+guint
+nd_outbox_get_n_dropped (NdOutbox *outbox)
+{
+        g_return_val_if_fail (ND_IS_OUTBOX (outbox), 0);
+
+        return outbox->priv->n_dropped;
+}
@@ -0,0 +1,74 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+
+#ifndef __ND_OUTBOX_H
+#define __ND_OUTBOX_H
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+#define ND_TYPE_OUTBOX         (nd_outbox_get_type ())
+#define ND_OUTBOX(o)           (G_TYPE_CHECK_INSTANCE_CAST ((o), ND_TYPE_OUTBOX, NdOutbox))
+#define ND_OUTBOX_CLASS(k)     (G_TYPE_CHECK_CLASS_CAST((k), ND_TYPE_OUTBOX, NdOutboxClass))
+#define ND_IS_OUTBOX(o)        (G_TYPE_CHECK_INSTANCE_TYPE ((o), ND_TYPE_OUTBOX))
+#define ND_IS_OUTBOX_CLASS(k)  (G_TYPE_CHECK_CLASS_TYPE ((k), ND_TYPE_OUTBOX))
+#define ND_OUTBOX_GET_CLASS(o) (G_TYPE_INSTANCE_GET_CLASS ((o), ND_TYPE_OUTBOX, NdOutboxClass))
+
+typedef struct NdOutboxPrivate NdOutboxPrivate;
+
+typedef struct
+{
+        GObject          parent;
+        NdOutboxPrivate *priv;
+} NdOutbox;
+
+typedef struct
+{
+        GObjectClass     parent_class;
+} NdOutboxClass;
+
+/* What happens to a signal for a client that is behind. */
+typedef enum
+{
+        /* held until the client catches up, replacing a held signal
+         * with the same key; only lost if the client stops answering */
+        ND_OUTBOX_COALESCE,
+        /* dropped, for streams where only the present matters */
+        ND_OUTBOX_DROP
+} NdOutboxPolicy;
+
+GType               nd_outbox_get_type                      (void);
+
+NdOutbox *          nd_outbox_new                           (GDBusConnection *connection,
+                                                             const char      *object_path,
+                                                             const char      *interface_name);
+
+void                nd_outbox_send                          (NdOutbox        *outbox,
+                                                             const char      *destination,
+                                                             const char      *signal_name,
+                                                             GVariant        *body,
+                                                             NdOutboxPolicy   policy,
+                                                             guint            key);
+
+guint               nd_outbox_get_n_dropped                 (NdOutbox        *outbox);
+
+G_END_DECLS
+
+#endif /* __ND_OUTBOX_H */
@@ -0,0 +1,110 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <glib-unix.h>
+
+#include "nd-pressure.h"
+
+/* A PSI trigger on the system memory pressure file: wake up when
+ * tasks were stalled on memory for 150ms within any 2s window.  The
+ * kernel wakes pollers with POLLPRI and rate-limits to one event per
+ * window. */
+#define PSI_MEMORY_PATH "/proc/pressure/memory"
+#define PSI_TRIGGER     "some 150000 2000000"
+
+struct NdPressure
+{
+        int            fd;
+        guint          watch_id;
+        NdPressureFunc func;
+        gpointer       data;
+};
+
+static gboolean
+on_pressure (int           fd,
+             GIOCondition  condition,
+             NdPressure   *pressure)
+{
+        if (condition & G_IO_ERR) {
+                /* the monitored cgroup went away */
+                g_debug ("Memory pressure trigger removed");
+                pressure->watch_id = 0;
+                return FALSE;
+        }
+
+        pressure->func (pressure->data);
+
+        return TRUE;
+}
+
+/* Returns NULL when the kernel has no PSI support or does not let us
+ * install a trigger. */
+NdPressure *
+nd_pressure_new (NdPressureFunc func,
+                 gpointer       data)
+{
+        NdPressure *pressure;
+        int         fd;
+
+        g_return_val_if_fail (func != NULL, NULL);
+
+        fd = open (PSI_MEMORY_PATH, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+        if (fd < 0) {
+                g_debug ("Unable to open %s: %s", PSI_MEMORY_PATH, g_strerror (errno));
+                return NULL;
+        }
+
+        /* the trigger string includes its nul terminator */
+        if (write (fd, PSI_TRIGGER, strlen (PSI_TRIGGER) + 1) < 0) {
+                g_debug ("Unable to set memory pressure trigger: %s", g_strerror (errno));
+                close (fd);
+                return NULL;
+        }
+
+        pressure = g_new0 (NdPressure, 1);
+        pressure->fd = fd;
+        pressure->func = func;
+        pressure->data = data;
+        pressure->watch_id = g_unix_fd_add (fd,
+                                            G_IO_PRI | G_IO_ERR,
+                                            (GUnixFDSourceFunc) on_pressure,
+                                            pressure);
+
+        return pressure;
+}
+
+void
+nd_pressure_free (NdPressure *pressure)
+{
+        g_return_if_fail (pressure != NULL);
+
+        if (pressure->watch_id > 0) {
+                g_source_remove (pressure->watch_id);
+        }
+        close (pressure->fd);
+        g_free (pressure);
+}
@@ -0,0 +1,39 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+
+#ifndef __ND_PRESSURE_H
+#define __ND_PRESSURE_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct NdPressure NdPressure;
+
+/* Called from the main loop each time the kernel reports memory
+ * stalls above the threshold. */
+typedef void (* NdPressureFunc) (gpointer data);
+
+NdPressure *        nd_pressure_new                         (NdPressureFunc  func,
+                                                             gpointer        data);
+void                nd_pressure_free                        (NdPressure     *pressure);
+
+G_END_DECLS
+
+#endif /* __ND_PRESSURE_H */
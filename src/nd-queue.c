@@ -20,6 +20,7 @@
 
 #include "config.h"
 
+#include <string.h>
 #include <glib/gi18n.h>
 #include <gtk/gtk.h>
 
@@ -27,6 +28,7 @@
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
 #include <X11/Xatom.h>
+#include <X11/extensions/XInput2.h>
 #include <gdk/gdkx.h>
 
 #include "nd-queue.h"
@@ -34,16 +36,103 @@
 #include "nd-notification.h"
 #include "nd-notification-box.h"
 #include "nd-stack.h"
+#include "nd-clock.h"
+#include "nd-timer-wheel.h"
+#include "nd-memory.h"
+#include "sound.h"
 
 #define ND_QUEUE_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), ND_TYPE_QUEUE, NdQueuePrivate))
 
 #define WIDTH         400
 
+#define DWELL_TIMEOUT_MSEC 5000
+
+/* updates are batched to at most one per frame */
+#define FRAME_INTERVAL_USEC (G_USEC_PER_SEC / 60)
+/* dock rows created per frame, the rest is carried over */
+#define DOCK_ROWS_PER_FRAME 16
+
+/* more than DIGEST_THRESHOLD notifications from one app within
+   DIGEST_WINDOW_USEC are shown as a single digest bubble */
+#define DIGEST_THRESHOLD    4
+#define DIGEST_WINDOW_USEC  (10 * G_USEC_PER_SEC)
+#define DIGEST_SUMMARIES    3
+
+/* hotplugging sends monitors-changed in bursts, act once it settles */
+#define MONITORS_CHANGED_DELAY_MSEC 250
+
+/* pointer and focused window moves are picked up at most this often */
+#define PLACEMENT_REFRESH_MSEC 100
+
+typedef struct
+{
+        char           *scope;
+        gint64          window_start;
+        guint           n_in_window;
+
+        /* the aggregate, only while the app is flooding */
+        NdNotification *notification;
+        /* ids of the stored notifications it stands for, newest first */
+        GList          *members;
+} Digest;
+
+/* the groups a stored notification is filed under */
+enum {
+        GROUP_APP,
+        GROUP_TAG,
+        GROUP_CATEGORY,
+        N_GROUPS
+};
+
+typedef struct
+{
+        char           *keys[N_GROUPS];
+} TagEntry;
+
+/* what the first bubble would otherwise pay for, cheapest first */
+typedef enum
+{
+        WARMUP_SCREENS,
+        WARMUP_ICONS,
+        WARMUP_SOUND,
+        WARMUP_BUBBLE,
+        N_WARMUP_STAGES
+} WarmupStage;
+
+/* position of a stored notification in the history */
+typedef struct
+{
+        gint64          update_time;
+        guint           id;
+} HistoryEntry;
+
+typedef enum
+{
+        UPDATE_STATUS_ICON = 1 << 0,
+        UPDATE_DOCK        = 1 << 1,
+        UPDATE_BUBBLES     = 1 << 2,
+        UPDATE_ALL         = UPDATE_STATUS_ICON | UPDATE_DOCK | UPDATE_BUBBLES
+} UpdateFlags;
+
+/* The work area and the active window are read from the root window
+ * when the window manager changes them, so laying out and placing
+ * bubbles costs no round trips. */
 typedef struct
 {
-        NdStack   **stacks;
-        int         n_stacks;
-        Atom        workarea_atom;
+        NdQueue      *queue;
+        GdkScreen    *screen;
+        NdStack     **stacks;
+        int           n_stacks;
+        Atom          workarea_atom;
+        Atom          current_desktop_atom;
+        GdkRectangle  workarea;
+        guint         monitors_changed_id;
+
+        Atom          active_window_atom;
+        Window        active_window;
+        /* -1 when nothing is focused */
+        int           focus_monitor;
+        gboolean      focus_dirty;
 } NotifyScreen;
 
 struct NdQueuePrivate
@@ -52,15 +141,70 @@ struct NdQueuePrivate
         GHashTable    *bubbles;
         GQueue        *queue;
 
+        /* content key -> newest notification with that content */
+        GHashTable    *duplicates;
+        GHashTable    *duplicate_keys;
+        guint          duplicate_window;
+
+        /* stacks render into one window per monitor */
+        gboolean       single_surface;
+
+        /* where new bubbles go, followed from X events */
+        NdQueuePlacement placement;
+        int            xi_opcode;
+        gboolean       tracking_pointer;
+        /* only while something is queued or showing */
+        gboolean       motion_selected;
+        gboolean       tracking_focus;
+        int            pointer_screen;
+        int            pointer_x;
+        int            pointer_y;
+        gboolean       pointer_dirty;
+        int            focus_screen;
+        guint          placement_refresh_id;
+
+        /* app + tag -> id, and group key -> set of ids */
+        GHashTable    *tags;
+        GHashTable    *groups;
+        GHashTable    *tag_entries;
+
+        GHashTable    *digests;
+        GHashTable    *digest_ids;
+        GHashTable    *digest_members;
+        guint          digest_prune_id;
+
+        /* stored notifications by update time, and id -> iter */
+        GSequence     *history;
+        GHashTable    *history_iters;
+
+        NdClock       *clock;
+        NdTimerWheel  *wheel;
+        GHashTable    *expiry_timers;
+        /* ids added with nd_queue_add_to_history(), they never expire */
+        GHashTable    *history_only;
+        GHashTable    *dwell_timers;
+
         GtkStatusIcon *status_icon;
         GIcon         *numerable_icon;
         GtkWidget     *dock;
         GtkWidget     *dock_scrolled_window;
+        GtkWidget     *dock_box;
+        GHashTable    *dock_rows;
 
         NotifyScreen **screens;
         int            n_screens;
 
+        guint          changed_freeze_count;
+        gboolean       changed_pending;
+
+        guint          dirty;
         guint          update_id;
+        guint          tick_id;
+        gint64         last_update;
+
+        guint          warmup_id;
+        WarmupStage    warmup_stage;
+        gboolean       shown_bubble;
 };
 
 enum {
@@ -73,15 +217,93 @@ static guint signals [LAST_SIGNAL] = { 0, };
 static void     nd_queue_class_init     (NdQueueClass   *klass);
 static void     nd_queue_init           (NdQueue        *queue);
 static void     nd_queue_finalize       (GObject        *object);
-static void     queue_update            (NdQueue        *queue);
+static void     queue_update            (NdQueue        *queue,
+                                         guint           flags);
+static void     schedule_update         (NdQueue        *queue);
+static void     show_dock               (NdQueue        *queue);
+static void     emit_changed            (NdQueue        *queue);
+static void     dissolve_digest         (NdQueue        *queue,
+                                         Digest         *digest);
 static void     on_notification_close   (NdNotification *notification,
                                          int             reason,
                                          NdQueue        *queue);
+static void     on_notification_changed (NdNotification *notification,
+                                         NdQueue        *queue);
+static void     add_notification        (NdQueue        *queue,
+                                         NdNotification *notification,
+                                         gboolean        show);
+static void     schedule_placement_refresh (NdQueue        *queue);
+static void     read_active_window      (NotifyScreen   *nscreen);
 
 static gpointer queue_object = NULL;
 
 G_DEFINE_TYPE (NdQueue, nd_queue, G_TYPE_OBJECT)
 
+static void
+read_work_area (NotifyScreen *nscreen)
+{
+        Display *display;
+        Window   root;
+        Atom     type;
+        int      format;
+        gulong   n_items;
+        gulong   bytes_after;
+        guchar  *data;
+        long     desktop;
+
+        /* Defaults in case of error */
+        nscreen->workarea.x = 0;
+        nscreen->workarea.y = 0;
+        nscreen->workarea.width = gdk_screen_get_width (nscreen->screen);
+        nscreen->workarea.height = gdk_screen_get_height (nscreen->screen);
+
+        display = GDK_SCREEN_XDISPLAY (nscreen->screen);
+        root = GDK_WINDOW_XID (gdk_screen_get_root_window (nscreen->screen));
+
+        gdk_error_trap_push ();
+
+        desktop = 0;
+        data = NULL;
+        if (XGetWindowProperty (display, root, nscreen->current_desktop_atom,
+                                0, 1, False, XA_CARDINAL,
+                                &type, &format, &n_items, &bytes_after,
+                                &data) == Success
+            && type == XA_CARDINAL && format == 32 && n_items > 0) {
+                desktop = ((long *) data)[0];
+        }
+        if (data != NULL)
+                XFree (data);
+
+        data = NULL;
+        if (XGetWindowProperty (display, root, nscreen->workarea_atom,
+                                0, G_MAXLONG, False, XA_CARDINAL,
+                                &type, &format, &n_items, &bytes_after,
+                                &data) == Success
+            && type == XA_CARDINAL && format == 32
+            && desktop >= 0 && n_items >= (gulong) (desktop + 1) * 4) {
+                long *workareas = (long *) data;
+
+                nscreen->workarea.x = workareas[desktop * 4];
+                nscreen->workarea.y = workareas[desktop * 4 + 1];
+                nscreen->workarea.width = workareas[desktop * 4 + 2];
+                nscreen->workarea.height = workareas[desktop * 4 + 3];
+        }
+        if (data != NULL)
+                XFree (data);
+
+        gdk_error_trap_pop_ignored ();
+}
+
+static void
+update_stack_geometry (NotifyScreen *nscreen,
+                       int           monitor_num)
+{
+        GdkRectangle monitor;
+
+        gdk_screen_get_monitor_geometry (nscreen->screen, monitor_num, &monitor);
+        nd_stack_set_geometry (nscreen->stacks[monitor_num], &monitor, &nscreen->workarea);
+}
+
 static void
 create_stack_for_monitor (NdQueue    *queue,
                           GdkScreen  *screen,
@@ -95,19 +317,23 @@ create_stack_for_monitor (NdQueue    *queue,
 
         nscreen->stacks[monitor_num] = nd_stack_new (screen,
                                                      monitor_num);
+        nd_stack_set_single_surface (nscreen->stacks[monitor_num],
+                                     queue->priv->single_surface);
+        update_stack_geometry (nscreen, monitor_num);
 }
 
-static void
-on_screen_monitors_changed (GdkScreen *screen,
-                            NdQueue   *queue)
+static gboolean
+on_monitors_changed_timeout (NotifyScreen *nscreen)
 {
-        NotifyScreen *nscreen;
-        int           screen_num;
+        NdQueue      *queue;
+        GdkScreen    *screen;
         int           n_monitors;
         int           i;
 
-        screen_num = gdk_screen_get_number (screen);
-        nscreen = queue->priv->screens[screen_num];
+        nscreen->monitors_changed_id = 0;
+
+        queue = nscreen->queue;
+        screen = nscreen->screen;
 
         n_monitors = gdk_screen_get_n_monitors (screen);
 
@@ -154,6 +380,34 @@ on_screen_monitors_changed (GdkScreen *screen,
                                            n_monitors);
                 nscreen->n_stacks = n_monitors;
         }
+
+        for (i = 0; i < nscreen->n_stacks; i++) {
+                update_stack_geometry (nscreen, i);
+        }
+
+        if (queue->priv->tracking_focus) {
+                nscreen->focus_dirty = TRUE;
+                schedule_placement_refresh (queue);
+        }
+
+        return FALSE;
+}
+
+static void
+on_screen_monitors_changed (GdkScreen *screen,
+                            NdQueue   *queue)
+{
+        NotifyScreen *nscreen;
+
+        nscreen = queue->priv->screens[gdk_screen_get_number (screen)];
+
+        if (nscreen->monitors_changed_id > 0) {
+                nd_clock_source_remove (queue->priv->clock, nscreen->monitors_changed_id);
+        }
+        nscreen->monitors_changed_id = nd_clock_timeout_add (queue->priv->clock,
+                                                             MONITORS_CHANGED_DELAY_MSEC,
+                                                             (GSourceFunc) on_monitors_changed_timeout,
+                                                             nscreen);
 }
 
 static void
@@ -188,17 +442,352 @@ screen_xevent_filter (GdkXEvent    *xevent,
         xev = (XEvent *) xevent;
 
         if (xev->type == PropertyNotify &&
-            xev->xproperty.atom == nscreen->workarea_atom) {
+            (xev->xproperty.atom == nscreen->workarea_atom
+             || xev->xproperty.atom == nscreen->current_desktop_atom)) {
                 int i;
 
+                read_work_area (nscreen);
                 for (i = 0; i < nscreen->n_stacks; i++) {
-                        nd_stack_queue_update_position (nscreen->stacks[i]);
+                        update_stack_geometry (nscreen, i);
+                }
+        } else if (xev->type == PropertyNotify
+                   && xev->xproperty.atom == nscreen->active_window_atom
+                   && nscreen->queue->priv->tracking_focus) {
+                read_active_window (nscreen);
+        }
+
+        return GDK_FILTER_CONTINUE;
+}
+
+static void
+refresh_pointer (NdQueue *queue)
+{
+        GdkDisplay *display;
+        GdkDevice  *pointer;
+        GdkScreen  *screen;
+        int         x;
+        int         y;
+
+        display = gdk_display_get_default ();
+        pointer = gdk_device_manager_get_client_pointer (gdk_display_get_device_manager (display));
+        gdk_device_get_position (pointer, &screen, &x, &y);
+
+        queue->priv->pointer_screen = gdk_screen_get_number (screen);
+        queue->priv->pointer_x = x;
+        queue->priv->pointer_y = y;
+        queue->priv->pointer_dirty = FALSE;
+}
+
+static void
+refresh_focus_monitor (NotifyScreen *nscreen)
+{
+        Display     *display;
+        Window       root;
+        Window       child;
+        int          x;
+        int          y;
+        unsigned int width;
+        unsigned int height;
+        unsigned int border;
+        unsigned int depth;
+
+        nscreen->focus_dirty = FALSE;
+        nscreen->focus_monitor = -1;
+
+        if (nscreen->active_window == None) {
+                return;
+        }
+
+        display = GDK_SCREEN_XDISPLAY (nscreen->screen);
+
+        /* the window may be gone already */
+        gdk_error_trap_push ();
+        if (XGetGeometry (display, nscreen->active_window, &root,
+                          &x, &y, &width, &height, &border, &depth)
+            && XTranslateCoordinates (display, nscreen->active_window, root,
+                                      0, 0, &x, &y, &child)) {
+                nscreen->focus_monitor = gdk_screen_get_monitor_at_point (nscreen->screen,
+                                                                          x + width / 2,
+                                                                          y + height / 2);
+        }
+        gdk_error_trap_pop_ignored ();
+}
+
+/* Moves of the focused window come in as ConfigureNotify. */
+static void
+watch_window (NotifyScreen *nscreen,
+              Window        window,
+              gboolean      watch)
+{
+        GdkDisplay *display;
+
+        display = gdk_screen_get_display (nscreen->screen);
+
+        /* our own windows select their events through GDK */
+        if (window == None
+            || gdk_x11_window_lookup_for_display (display, window) != NULL) {
+                return;
+        }
+
+        gdk_error_trap_push ();
+        XSelectInput (GDK_DISPLAY_XDISPLAY (display),
+                      window,
+                      watch ? StructureNotifyMask : NoEventMask);
+        gdk_error_trap_pop_ignored ();
+}
+
+static void
+read_active_window (NotifyScreen *nscreen)
+{
+        Display *display;
+        Window   root;
+        Window   window;
+        Atom     type;
+        int      format;
+        gulong   n_items;
+        gulong   bytes_after;
+        guchar  *data;
+
+        display = GDK_SCREEN_XDISPLAY (nscreen->screen);
+        root = GDK_WINDOW_XID (gdk_screen_get_root_window (nscreen->screen));
+
+        gdk_error_trap_push ();
+
+        window = None;
+        data = NULL;
+        if (XGetWindowProperty (display, root, nscreen->active_window_atom,
+                                0, 1, False, XA_WINDOW,
+                                &type, &format, &n_items, &bytes_after,
+                                &data) == Success
+            && type == XA_WINDOW && format == 32 && n_items > 0) {
+                window = ((Window *) data)[0];
+        }
+        if (data != NULL)
+                XFree (data);
+
+        gdk_error_trap_pop_ignored ();
+
+        if (window != nscreen->active_window) {
+                watch_window (nscreen, nscreen->active_window, FALSE);
+                watch_window (nscreen, window, TRUE);
+                nscreen->active_window = window;
+        }
+
+        if (window != None) {
+                nscreen->queue->priv->focus_screen = gdk_screen_get_number (nscreen->screen);
+        }
+
+        refresh_focus_monitor (nscreen);
+}
+
+static gboolean
+on_placement_refresh_timeout (NdQueue *queue)
+{
+        int i;
+
+        queue->priv->placement_refresh_id = 0;
+
+        if (queue->priv->pointer_dirty) {
+                refresh_pointer (queue);
+        }
+
+        for (i = 0; i < queue->priv->n_screens; i++) {
+                if (queue->priv->screens[i]->focus_dirty) {
+                        refresh_focus_monitor (queue->priv->screens[i]);
+                }
+        }
+
+        return FALSE;
+}
+
+/* Motion is only noted, the position is asked for once per
+ * PLACEMENT_REFRESH_MSEC while things move and never when a bubble
+ * is shown, see update_raw_motion() for the one exception. */
+static void
+schedule_placement_refresh (NdQueue *queue)
+{
+        if (queue->priv->placement_refresh_id != 0) {
+                return;
+        }
+
+        queue->priv->placement_refresh_id = nd_clock_timeout_add (queue->priv->clock,
+                                                                  PLACEMENT_REFRESH_MSEC,
+                                                                  (GSourceFunc) on_placement_refresh_timeout,
+                                                                  queue);
+}
+
+/* Raw events reach the root window whoever has the pointer, but carry
+ * no position, hence the refresh. */
+static GdkFilterReturn
+display_xevent_filter (GdkXEvent *xevent,
+                       GdkEvent  *event,
+                       NdQueue   *queue)
+{
+        XEvent *xev;
+        int     i;
+
+        xev = (XEvent *) xevent;
+
+        if (xev->type == GenericEvent) {
+                if (queue->priv->tracking_pointer
+                    && xev->xcookie.extension == queue->priv->xi_opcode
+                    && xev->xcookie.evtype == XI_RawMotion) {
+                        queue->priv->pointer_dirty = TRUE;
+                        schedule_placement_refresh (queue);
+                }
+        } else if (xev->type == ConfigureNotify && queue->priv->tracking_focus) {
+                for (i = 0; i < queue->priv->n_screens; i++) {
+                        NotifyScreen *nscreen;
+                        nscreen = queue->priv->screens[i];
+                        if (nscreen->active_window != None
+                            && xev->xconfigure.window == nscreen->active_window) {
+                                nscreen->focus_dirty = TRUE;
+                                schedule_placement_refresh (queue);
+                        }
                 }
         }
 
         return GDK_FILTER_CONTINUE;
 }
 
+static void
+select_raw_motion (NdQueue *queue,
+                   gboolean select)
+{
+        GdkDisplay   *display;
+        XIEventMask   mask;
+        unsigned char bits[XIMaskLen (XI_LASTEVENT)];
+        int           i;
+
+        memset (bits, 0, sizeof (bits));
+        if (select) {
+                XISetMask (bits, XI_RawMotion);
+        }
+
+        /* XIAllDevices leaves the masks GDK selects for the master
+         * devices alone */
+        mask.deviceid = XIAllDevices;
+        mask.mask_len = sizeof (bits);
+        mask.mask = bits;
+
+        display = gdk_display_get_default ();
+        for (i = 0; i < queue->priv->n_screens; i++) {
+                GdkWindow *root;
+
+                root = gdk_screen_get_root_window (queue->priv->screens[i]->screen);
+                XISelectEvents (GDK_DISPLAY_XDISPLAY (display),
+                                GDK_WINDOW_XID (root),
+                                &mask,
+                                1);
+        }
+}
+
+/* With nothing to place there is no reason to hear about every move
+ * of the pointer.  The position is asked for once when the first
+ * notification comes in, and followed from then on until the last
+ * one is gone. */
+static void
+update_raw_motion (NdQueue *queue)
+{
+        gboolean active;
+
+        if (! queue->priv->tracking_pointer) {
+                return;
+        }
+
+        active = nd_queue_length_active (queue) > 0;
+        if (active == queue->priv->motion_selected) {
+                return;
+        }
+
+        select_raw_motion (queue, active);
+        queue->priv->motion_selected = active;
+        if (active) {
+                refresh_pointer (queue);
+        } else {
+                queue->priv->pointer_dirty = FALSE;
+        }
+}
+
+static void
+start_placement_tracking (NdQueue *queue)
+{
+        int i;
+
+        switch (queue->priv->placement) {
+        case ND_QUEUE_PLACEMENT_POINTER:
+                if (queue->priv->xi_opcode >= 0) {
+                        queue->priv->tracking_pointer = TRUE;
+                        update_raw_motion (queue);
+                        break;
+                }
+                /* without XInput 2 follow the focus instead, fall through */
+
+        case ND_QUEUE_PLACEMENT_FOCUS:
+                queue->priv->tracking_focus = TRUE;
+                for (i = 0; i < queue->priv->n_screens; i++) {
+                        read_active_window (queue->priv->screens[i]);
+                }
+                break;
+
+        case ND_QUEUE_PLACEMENT_PRIMARY:
+                break;
+
+        default:
+                g_assert_not_reached ();
+        }
+}
+
+static void
+stop_placement_tracking (NdQueue *queue)
+{
+        int i;
+
+        if (queue->priv->tracking_pointer) {
+                if (queue->priv->motion_selected) {
+                        select_raw_motion (queue, FALSE);
+                        queue->priv->motion_selected = FALSE;
+                }
+                queue->priv->tracking_pointer = FALSE;
+                queue->priv->pointer_dirty = FALSE;
+        }
+
+        if (queue->priv->tracking_focus) {
+                for (i = 0; i < queue->priv->n_screens; i++) {
+                        NotifyScreen *nscreen;
+                        nscreen = queue->priv->screens[i];
+                        watch_window (nscreen, nscreen->active_window, FALSE);
+                        nscreen->active_window = None;
+                        nscreen->focus_monitor = -1;
+                        nscreen->focus_dirty = FALSE;
+                }
+                queue->priv->tracking_focus = FALSE;
+        }
+
+        if (queue->priv->placement_refresh_id != 0) {
+                nd_clock_source_remove (queue->priv->clock, queue->priv->placement_refresh_id);
+                queue->priv->placement_refresh_id = 0;
+        }
+}
+
+static int
+get_xi_opcode (GdkDisplay *display)
+{
+        int opcode;
+        int event;
+        int error;
+
+        /* GDK has negotiated XInput 2 already if it uses it */
+        if (! GDK_IS_X11_DEVICE_MANAGER_XI2 (gdk_display_get_device_manager (display))
+            || ! XQueryExtension (GDK_DISPLAY_XDISPLAY (display),
+                                  "XInputExtension",
+                                  &opcode, &event, &error)) {
+                return -1;
+        }
+
+        return opcode;
+}
+
 static void
 create_screens (NdQueue *queue)
 {
@@ -223,14 +812,24 @@ create_screens (NdQueue *queue)
                                   queue);
 
                 queue->priv->screens[i] = g_new0 (NotifyScreen, 1);
+                queue->priv->screens[i]->queue = queue;
+                queue->priv->screens[i]->screen = screen;
 
-                queue->priv->screens[i]->workarea_atom = XInternAtom (GDK_DISPLAY_XDISPLAY (gdk_display_get_default ()), "_NET_WORKAREA", True);
+                queue->priv->screens[i]->workarea_atom = gdk_x11_get_xatom_by_name_for_display (display, "_NET_WORKAREA");
+                queue->priv->screens[i]->current_desktop_atom = gdk_x11_get_xatom_by_name_for_display (display, "_NET_CURRENT_DESKTOP");
+                queue->priv->screens[i]->active_window_atom = gdk_x11_get_xatom_by_name_for_display (display, "_NET_ACTIVE_WINDOW");
+                queue->priv->screens[i]->focus_monitor = -1;
                 gdkwindow = gdk_screen_get_root_window (screen);
                 gdk_window_add_filter (gdkwindow, (GdkFilterFunc) screen_xevent_filter, queue->priv->screens[i]);
                 gdk_window_set_events (gdkwindow, gdk_window_get_events (gdkwindow) | GDK_PROPERTY_CHANGE_MASK);
+                read_work_area (queue->priv->screens[i]);
 
                 create_stacks_for_screen (queue, gdk_display_get_screen (display, i));
         }
+
+        gdk_window_add_filter (NULL, (GdkFilterFunc) display_xevent_filter, queue);
+        queue->priv->xi_opcode = get_xi_opcode (display);
+        start_placement_tracking (queue);
 }
 
 static void
@@ -267,8 +866,6 @@ popdown_dock (NdQueue *queue)
 
         /* hide again */
         gtk_widget_hide (queue->priv->dock);
-
-        queue_update (queue);
 }
 
 static void
@@ -360,72 +957,443 @@ clear_stacks (NdQueue *queue)
         }
 }
 
-static void
-_nd_queue_remove_all (NdQueue *queue)
+static const char *
+get_app_scope (const char *sender,
+               const char *app_name)
 {
-        GHashTableIter iter;
-        gpointer       key, value;
-        gboolean       changed;
+        /* fold per application, fall back to the connection */
+        if (app_name != NULL && *app_name != '\0')
+                return app_name;
 
-        changed = FALSE;
+        return sender;
+}
 
-        clear_stacks (queue);
+static char *
+get_group_key (const char *scope,
+               const char *value)
+{
+        if (value == NULL)
+                return g_strdup (scope);
 
-        g_queue_clear (queue->priv->queue);
-        g_hash_table_iter_init (&iter, queue->priv->notifications);
-        while (g_hash_table_iter_next (&iter, &key, &value)) {
-                NdNotification *n = ND_NOTIFICATION (value);
+        return g_strconcat (scope, "\037", value, NULL);
+}
 
-                g_signal_handlers_disconnect_by_func (n, G_CALLBACK (on_notification_close), queue);
-                nd_notification_close (n, ND_NOTIFICATION_CLOSED_USER);
-                g_hash_table_iter_remove (&iter);
-                changed = TRUE;
-        }
-        popdown_dock (queue);
-        queue_update (queue);
+static gsize
+tag_entry_size (TagEntry *entry)
+{
+        gsize size;
+        int   i;
 
-        if (changed) {
-                g_signal_emit (queue, signals[CHANGED], 0);
+        size = sizeof (TagEntry);
+        for (i = 0; i < N_GROUPS; i++) {
+                if (entry->keys[i] != NULL) {
+                        size += strlen (entry->keys[i]) + 1;
+                }
         }
+
+        return size;
 }
 
 static void
-on_clear_all_clicked (GtkButton *button,
-                      NdQueue   *queue)
+tag_entry_free (TagEntry *entry)
 {
-        _nd_queue_remove_all (queue);
+        int i;
+
+        nd_memory_remove (ND_MEMORY_CACHES, tag_entry_size (entry));
+
+        for (i = 0; i < N_GROUPS; i++) {
+                g_free (entry->keys[i]);
+        }
+        g_slice_free (TagEntry, entry);
 }
 
-static gboolean
-on_dock_button_press (GtkWidget      *widget,
-                      GdkEventButton *event,
-                      NdQueue        *queue)
+static void
+index_tags (NdQueue        *queue,
+            NdNotification *notification)
 {
-        GtkWidget *event_widget;
+        TagEntry   *entry;
+        const char *scope;
+        const char *tag;
+        const char *category;
+        gpointer    id;
+        int         i;
+
+        scope = get_app_scope (nd_notification_get_sender (notification),
+                               nd_notification_get_app_name (notification));
+        if (scope == NULL)
+                return;
 
-        if (event->type != GDK_BUTTON_PRESS) {
-                return FALSE;
+        id = GUINT_TO_POINTER (nd_notification_get_id (notification));
+        tag = nd_notification_get_tag (notification);
+        category = nd_notification_get_category (notification);
+
+        entry = g_slice_new0 (TagEntry);
+        entry->keys[GROUP_APP] = get_group_key (scope, NULL);
+        if (tag != NULL) {
+                entry->keys[GROUP_TAG] = get_group_key (scope, tag);
+                g_hash_table_insert (queue->priv->tags, g_strdup (entry->keys[GROUP_TAG]), id);
         }
-        event_widget = gtk_get_event_widget ((GdkEvent *)event);
-        g_debug ("Button press: %p dock=%p", event_widget, widget);
-        if (event_widget == widget) {
-                release_grab (widget, event);
-                return TRUE;
+        if (category != NULL && g_strcmp0 (category, tag) != 0) {
+                entry->keys[GROUP_CATEGORY] = get_group_key (scope, category);
         }
 
-        return FALSE;
+        for (i = 0; i < N_GROUPS; i++) {
+                GHashTable *group;
+
+                if (entry->keys[i] == NULL)
+                        continue;
+
+                group = g_hash_table_lookup (queue->priv->groups, entry->keys[i]);
+                if (group == NULL) {
+                        group = g_hash_table_new (NULL, NULL);
+                        g_hash_table_insert (queue->priv->groups, g_strdup (entry->keys[i]), group);
+                }
+                g_hash_table_insert (group, id, id);
+        }
+
+        nd_memory_add (ND_MEMORY_CACHES, tag_entry_size (entry));
+        g_hash_table_insert (queue->priv->tag_entries, id, entry);
 }
 
 static void
-create_dock (NdQueue *queue)
+unindex_tags (NdQueue        *queue,
+              NdNotification *notification)
 {
-        GtkWidget *frame;
-        GtkWidget *box;
-        GtkWidget *button;
+        TagEntry *entry;
+        gpointer  id;
+        int       i;
 
-        queue->priv->dock = gtk_window_new (GTK_WINDOW_POPUP);
-        gtk_widget_add_events (queue->priv->dock,
-                               GDK_BUTTON_PRESS_MASK | GDK_BUTTON_RELEASE_MASK);
+        id = GUINT_TO_POINTER (nd_notification_get_id (notification));
+        entry = g_hash_table_lookup (queue->priv->tag_entries, id);
+        if (entry == NULL)
+                return;
+
+        if (entry->keys[GROUP_TAG] != NULL
+            && g_hash_table_lookup (queue->priv->tags, entry->keys[GROUP_TAG]) == id) {
+                g_hash_table_remove (queue->priv->tags, entry->keys[GROUP_TAG]);
+        }
+
+        for (i = 0; i < N_GROUPS; i++) {
+                GHashTable *group;
+
+                if (entry->keys[i] == NULL)
+                        continue;
+
+                group = g_hash_table_lookup (queue->priv->groups, entry->keys[i]);
+                if (group == NULL)
+                        continue;
+
+                g_hash_table_remove (group, id);
+                if (g_hash_table_size (group) == 0)
+                        g_hash_table_remove (queue->priv->groups, entry->keys[i]);
+        }
+
+        g_hash_table_remove (queue->priv->tag_entries, id);
+}
+
+static guint
+close_group (NdQueue    *queue,
+             const char *key)
+{
+        GHashTable *group;
+        GList      *ids;
+        GList      *l;
+        guint       n_closed;
+
+        group = g_hash_table_lookup (queue->priv->groups, key);
+        if (group == NULL)
+                return 0;
+
+        /* closing removes them from the group as we go */
+        ids = g_hash_table_get_keys (group);
+
+        nd_queue_freeze_changed (queue);
+
+        n_closed = 0;
+        for (l = ids; l != NULL; l = l->next) {
+                NdNotification *notification;
+
+                notification = g_hash_table_lookup (queue->priv->notifications, l->data);
+                if (notification != NULL) {
+                        nd_notification_close (notification, ND_NOTIFICATION_CLOSED_API);
+                        n_closed++;
+                }
+        }
+        g_list_free (ids);
+
+        nd_queue_thaw_changed (queue);
+
+        return n_closed;
+}
+
+static void
+digest_free (Digest *digest)
+{
+        g_assert (digest->notification == NULL);
+
+        g_free (digest->scope);
+        g_slice_free (Digest, digest);
+}
+
+static guint
+get_duplicate_key (const char *sender,
+                   const char *app_name,
+                   const char *icon,
+                   const char *summary,
+                   const char *body)
+{
+        const char *scope;
+        guint       key;
+
+        scope = get_app_scope (sender, app_name);
+
+        key = g_str_hash (scope ? scope : "");
+        key = key * 31 + g_str_hash (icon ? icon : "");
+        key = key * 31 + g_str_hash (summary ? summary : "");
+        key = key * 31 + g_str_hash (body ? body : "");
+
+        return key;
+}
+
+static void
+index_duplicate (NdQueue        *queue,
+                 NdNotification *notification)
+{
+        guint key;
+
+        key = get_duplicate_key (nd_notification_get_sender (notification),
+                                 nd_notification_get_app_name (notification),
+                                 nd_notification_get_icon (notification),
+                                 nd_notification_get_summary (notification),
+                                 nd_notification_get_body (notification));
+
+        g_hash_table_insert (queue->priv->duplicates, GUINT_TO_POINTER (key), notification);
+        g_hash_table_insert (queue->priv->duplicate_keys,
+                             GUINT_TO_POINTER (nd_notification_get_id (notification)),
+                             GUINT_TO_POINTER (key));
+}
+
+static void
+unindex_duplicate (NdQueue        *queue,
+                   NdNotification *notification)
+{
+        gpointer id;
+        gpointer key;
+
+        id = GUINT_TO_POINTER (nd_notification_get_id (notification));
+        if (!g_hash_table_lookup_extended (queue->priv->duplicate_keys, id, NULL, &key))
+                return;
+
+        if (g_hash_table_lookup (queue->priv->duplicates, key) == notification)
+                g_hash_table_remove (queue->priv->duplicates, key);
+        g_hash_table_remove (queue->priv->duplicate_keys, id);
+}
+
+static void
+history_entry_free (HistoryEntry *entry)
+{
+        nd_memory_remove (ND_MEMORY_CACHES, sizeof (HistoryEntry));
+        g_slice_free (HistoryEntry, entry);
+}
+
+static int
+compare_history_entries (gconstpointer a,
+                         gconstpointer b,
+                         gpointer      data)
+{
+        const HistoryEntry *entry_a = a;
+        const HistoryEntry *entry_b = b;
+
+        if (entry_a->update_time != entry_b->update_time)
+                return entry_a->update_time < entry_b->update_time ? -1 : 1;
+        if (entry_a->id != entry_b->id)
+                return entry_a->id < entry_b->id ? -1 : 1;
+        return 0;
+}
+
+static void
+unindex_history (NdQueue *queue,
+                 guint    id)
+{
+        GSequenceIter *iter;
+
+        iter = g_hash_table_lookup (queue->priv->history_iters, GUINT_TO_POINTER (id));
+        if (iter != NULL) {
+                g_hash_table_remove (queue->priv->history_iters, GUINT_TO_POINTER (id));
+                g_sequence_remove (iter);
+        }
+}
+
+static void
+index_history (NdQueue        *queue,
+               NdNotification *notification)
+{
+        HistoryEntry  *entry;
+        GSequenceIter *iter;
+        GTimeVal       tv;
+
+        unindex_history (queue, nd_notification_get_id (notification));
+
+        nd_notification_get_update_time (notification, &tv);
+
+        entry = g_slice_new (HistoryEntry);
+        entry->update_time = (gint64) tv.tv_sec * G_USEC_PER_SEC + tv.tv_usec;
+        entry->id = nd_notification_get_id (notification);
+        nd_memory_add (ND_MEMORY_CACHES, sizeof (HistoryEntry));
+
+        iter = g_sequence_insert_sorted (queue->priv->history,
+                                         entry,
+                                         compare_history_entries,
+                                         NULL);
+        g_hash_table_insert (queue->priv->history_iters, GUINT_TO_POINTER (entry->id), iter);
+}
+
+static void
+cancel_expiry (NdQueue *queue,
+               guint    id)
+{
+        NdTimer *timer;
+
+        timer = g_hash_table_lookup (queue->priv->expiry_timers, GUINT_TO_POINTER (id));
+        if (timer != NULL) {
+                g_hash_table_remove (queue->priv->expiry_timers, GUINT_TO_POINTER (id));
+                nd_timer_wheel_remove (queue->priv->wheel, timer);
+        }
+}
+
+static void
+on_expiry_timeout (NdNotification *notification)
+{
+        g_debug ("Notification %u expired", nd_notification_get_id (notification));
+        nd_notification_close (notification, ND_NOTIFICATION_CLOSED_EXPIRED);
+}
+
+static void
+schedule_expiry_in (NdQueue        *queue,
+                    NdNotification *notification,
+                    guint           msec)
+{
+        NdTimer *timer;
+        guint    id;
+
+        id = nd_notification_get_id (notification);
+        cancel_expiry (queue, id);
+
+        timer = nd_timer_wheel_add (queue->priv->wheel,
+                                    msec,
+                                    (NdTimerFunc) on_expiry_timeout,
+                                    notification);
+        g_hash_table_insert (queue->priv->expiry_timers, GUINT_TO_POINTER (id), timer);
+}
+
+static void
+schedule_expiry (NdQueue        *queue,
+                 NdNotification *notification)
+{
+        int timeout;
+
+        /* -1 leaves it up to us and we keep those until the user
+           dismisses them, 0 means never */
+        timeout = nd_notification_get_timeout (notification);
+        if (timeout <= 0) {
+                cancel_expiry (queue, nd_notification_get_id (notification));
+                return;
+        }
+
+        schedule_expiry_in (queue, notification, timeout);
+}
+
+static void
+_nd_queue_remove_all (NdQueue *queue)
+{
+        GHashTableIter iter;
+        gpointer       key, value;
+        gboolean       changed;
+
+        changed = FALSE;
+
+        g_hash_table_iter_init (&iter, queue->priv->digests);
+        while (g_hash_table_iter_next (&iter, NULL, &value)) {
+                dissolve_digest (queue, value);
+        }
+
+        clear_stacks (queue);
+
+        g_queue_clear (queue->priv->queue);
+        g_hash_table_iter_init (&iter, queue->priv->notifications);
+        while (g_hash_table_iter_next (&iter, &key, &value)) {
+                NdNotification *n = ND_NOTIFICATION (value);
+
+                cancel_expiry (queue, nd_notification_get_id (n));
+                unindex_duplicate (queue, n);
+                unindex_tags (queue, n);
+                unindex_history (queue, nd_notification_get_id (n));
+                g_signal_handlers_disconnect_by_func (n, G_CALLBACK (on_notification_close), queue);
+                g_signal_handlers_disconnect_by_func (n, G_CALLBACK (on_notification_changed), queue);
+                nd_notification_close (n, ND_NOTIFICATION_CLOSED_USER);
+                g_hash_table_iter_remove (&iter);
+                changed = TRUE;
+        }
+        popdown_dock (queue);
+        queue_update (queue, UPDATE_ALL);
+
+        if (changed) {
+                emit_changed (queue);
+        }
+}
+
+static void
+on_clear_all_clicked (GtkButton *button,
+                      NdQueue   *queue)
+{
+        _nd_queue_remove_all (queue);
+}
+
+static gboolean
+on_dock_button_press (GtkWidget      *widget,
+                      GdkEventButton *event,
+                      NdQueue        *queue)
+{
+        GtkWidget *event_widget;
+
+        if (event->type != GDK_BUTTON_PRESS) {
+                return FALSE;
+        }
+        event_widget = gtk_get_event_widget ((GdkEvent *)event);
+        g_debug ("Button press: %p dock=%p", event_widget, widget);
+        if (event_widget == widget) {
+                release_grab (widget, event);
+                return TRUE;
+        }
+
+        return FALSE;
+}
+
+static void
+on_dock_unmap (GtkWidget *widget,
+               NdQueue   *queue)
+{
+        /* a hidden dock gets no frames, move a pending update off its
+           frame clock and let it drop its rows */
+        if (queue->priv->tick_id != 0) {
+                gtk_widget_remove_tick_callback (queue->priv->dock,
+                                                 queue->priv->tick_id);
+                queue->priv->tick_id = 0;
+        }
+
+        queue_update (queue, UPDATE_DOCK | UPDATE_BUBBLES);
+}
+
+static void
+create_dock (NdQueue *queue)
+{
+        GtkWidget *frame;
+        GtkWidget *box;
+        GtkWidget *button;
+
+        queue->priv->dock = gtk_window_new (GTK_WINDOW_POPUP);
+        gtk_widget_add_events (queue->priv->dock,
+                               GDK_BUTTON_PRESS_MASK | GDK_BUTTON_RELEASE_MASK);
 
         gtk_widget_set_name (queue->priv->dock, "notification-popup-window");
         g_signal_connect (queue->priv->dock,
@@ -444,6 +1412,10 @@ create_dock (NdQueue *queue)
                           "button-press-event",
                           G_CALLBACK (on_dock_button_press),
                           queue);
+        g_signal_connect (queue->priv->dock,
+                          "unmap",
+                          G_CALLBACK (on_dock_unmap),
+                          queue);
 #if 0
         g_signal_connect (queue->priv->dock,
                           "scroll-event",
@@ -469,141 +1441,1065 @@ create_dock (NdQueue *queue)
                                      -1);
         gtk_box_pack_start (GTK_BOX (box), queue->priv->dock_scrolled_window, TRUE, TRUE, 0);
 
-        button = gtk_button_new_with_label (_("Clear all notifications"));
-        g_signal_connect (button, "clicked", G_CALLBACK (on_clear_all_clicked), queue);
-        gtk_box_pack_end (GTK_BOX (box), button, FALSE, FALSE, 0);
+        button = gtk_button_new_with_label (_("Clear all notifications"));
+        g_signal_connect (button, "clicked", G_CALLBACK (on_clear_all_clicked), queue);
+        gtk_box_pack_end (GTK_BOX (box), button, FALSE, FALSE, 0);
+}
+
+static gboolean
+dock_is_visible (NdQueue *queue)
+{
+        return queue->priv->dock != NULL && gtk_widget_get_visible (queue->priv->dock);
+}
+
+static void
+nd_queue_init (NdQueue *queue)
+{
+        queue->priv = ND_QUEUE_GET_PRIVATE (queue);
+        queue->priv->notifications = g_hash_table_new_full (NULL, NULL, NULL, g_object_unref);
+        queue->priv->bubbles = g_hash_table_new_full (NULL, NULL, NULL, g_object_unref);
+        queue->priv->queue = g_queue_new ();
+        queue->priv->status_icon = NULL;
+
+        queue->priv->clock = g_object_ref (nd_clock_get_default ());
+        queue->priv->xi_opcode = -1;
+        queue->priv->wheel = nd_timer_wheel_new (queue->priv->clock);
+        queue->priv->expiry_timers = g_hash_table_new (NULL, NULL);
+        queue->priv->history_only = g_hash_table_new (NULL, NULL);
+        queue->priv->dwell_timers = g_hash_table_new (NULL, NULL);
+        queue->priv->dock_rows = g_hash_table_new (NULL, NULL);
+        queue->priv->duplicates = g_hash_table_new (NULL, NULL);
+        queue->priv->duplicate_keys = g_hash_table_new (NULL, NULL);
+        queue->priv->tags = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+        queue->priv->groups = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_hash_table_destroy);
+        queue->priv->tag_entries = g_hash_table_new_full (NULL, NULL, NULL, (GDestroyNotify) tag_entry_free);
+        queue->priv->digests = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, (GDestroyNotify) digest_free);
+        queue->priv->digest_ids = g_hash_table_new (NULL, NULL);
+        queue->priv->digest_members = g_hash_table_new (NULL, NULL);
+        queue->priv->history = g_sequence_new ((GDestroyNotify) history_entry_free);
+        queue->priv->history_iters = g_hash_table_new (NULL, NULL);
+
+        /* the dock and the stacks are created on first use, so the
+         * daemon can answer before it has talked to the X server */
+}
+
+static void
+destroy_screens (NdQueue *queue)
+{
+        GdkDisplay  *display;
+        int          i;
+        int          j;
+
+        display = gdk_display_get_default ();
+
+        if (queue->priv->screens != NULL) {
+                stop_placement_tracking (queue);
+                gdk_window_remove_filter (NULL, (GdkFilterFunc) display_xevent_filter, queue);
+        }
+
+        for (i = 0; i < queue->priv->n_screens; i++) {
+                GdkScreen *screen;
+                GdkWindow *gdkwindow;
+
+                screen = gdk_display_get_screen (display, i);
+                g_signal_handlers_disconnect_by_func (screen,
+                                                      G_CALLBACK (on_screen_monitors_changed),
+                                                      queue);
+
+                gdkwindow = gdk_screen_get_root_window (screen);
+                gdk_window_remove_filter (gdkwindow, (GdkFilterFunc) screen_xevent_filter, queue->priv->screens[i]);
+                for (j = 0; j < queue->priv->screens[i]->n_stacks; j++) {
+                        g_object_unref (queue->priv->screens[i]->stacks[j]);
+                        queue->priv->screens[i]->stacks[j] = NULL;
+                }
+
+                g_free (queue->priv->screens[i]->stacks);
+
+                if (queue->priv->screens[i]->monitors_changed_id > 0) {
+                        nd_clock_source_remove (queue->priv->clock,
+                                                queue->priv->screens[i]->monitors_changed_id);
+                }
+                g_free (queue->priv->screens[i]);
+        }
+
+        g_free (queue->priv->screens);
+        queue->priv->screens = NULL;
+        queue->priv->n_screens = 0;
+}
+
+
+static void
+nd_queue_finalize (GObject *object)
+{
+        NdQueue       *queue;
+        GHashTableIter iter;
+        gpointer       value;
+
+        g_return_if_fail (object != NULL);
+        g_return_if_fail (ND_IS_QUEUE (object));
+
+        queue = ND_QUEUE (object);
+
+        g_return_if_fail (queue->priv != NULL);
+
+        g_hash_table_iter_init (&iter, queue->priv->digests);
+        while (g_hash_table_iter_next (&iter, NULL, &value)) {
+                dissolve_digest (queue, value);
+        }
+        g_hash_table_destroy (queue->priv->tag_entries);
+        g_hash_table_destroy (queue->priv->groups);
+        g_hash_table_destroy (queue->priv->tags);
+        g_hash_table_destroy (queue->priv->digests);
+        g_hash_table_destroy (queue->priv->digest_ids);
+        g_hash_table_destroy (queue->priv->digest_members);
+        g_hash_table_destroy (queue->priv->history_iters);
+        g_sequence_free (queue->priv->history);
+
+        g_hash_table_destroy (queue->priv->notifications);
+        g_hash_table_destroy (queue->priv->bubbles);
+        g_queue_free (queue->priv->queue);
+
+        g_hash_table_destroy (queue->priv->expiry_timers);
+        g_hash_table_destroy (queue->priv->history_only);
+        g_hash_table_destroy (queue->priv->dwell_timers);
+        nd_timer_wheel_free (queue->priv->wheel);
+
+        if (queue->priv->update_id > 0) {
+                nd_clock_source_remove (queue->priv->clock, queue->priv->update_id);
+        }
+        if (queue->priv->digest_prune_id > 0) {
+                nd_clock_source_remove (queue->priv->clock, queue->priv->digest_prune_id);
+        }
+        if (queue->priv->warmup_id > 0) {
+                nd_clock_source_remove (queue->priv->clock, queue->priv->warmup_id);
+        }
+        if (queue->priv->tick_id > 0) {
+                gtk_widget_remove_tick_callback (queue->priv->dock, queue->priv->tick_id);
+        }
+        destroy_screens (queue);
+        g_object_unref (queue->priv->clock);
+
+        g_hash_table_destroy (queue->priv->dock_rows);
+        g_hash_table_destroy (queue->priv->duplicates);
+        g_hash_table_destroy (queue->priv->duplicate_keys);
+
+        if (queue->priv->numerable_icon != NULL) {
+                g_object_unref (queue->priv->numerable_icon);
+        }
+
+        G_OBJECT_CLASS (nd_queue_parent_class)->finalize (object);
+}
+
+NdNotification *
+nd_queue_lookup (NdQueue *queue,
+                 guint    id)
+{
+        NdNotification *notification;
+
+        g_return_val_if_fail (ND_IS_QUEUE (queue), NULL);
+
+        notification = g_hash_table_lookup (queue->priv->notifications, GUINT_TO_POINTER (id));
+
+        return notification;
+}
+
+guint
+nd_queue_length (NdQueue *queue)
+{
+        g_return_val_if_fail (ND_IS_QUEUE (queue), 0);
+
+        return g_hash_table_size (queue->priv->notifications);
+}
+
+/* Only what is waiting to be shown or showing, without the entries
+ * that live in the history alone. */
+guint
+nd_queue_length_active (NdQueue *queue)
+{
+        g_return_val_if_fail (ND_IS_QUEUE (queue), 0);
+
+        return g_hash_table_size (queue->priv->notifications)
+                - g_hash_table_size (queue->priv->history_only);
+}
+
+/* Returns the stored notification a new one with this content would
+ * repeat, or NULL.  Only notifications updated within the duplicate
+ * window count. */
+NdNotification *
+nd_queue_lookup_duplicate (NdQueue    *queue,
+                           const char *sender,
+                           const char *app_name,
+                           const char *icon,
+                           const char *summary,
+                           const char *body)
+{
+        NdNotification *notification;
+        GTimeVal        tv;
+        gint64          age;
+        guint           key;
+
+        g_return_val_if_fail (ND_IS_QUEUE (queue), NULL);
+
+        if (queue->priv->duplicate_window == 0)
+                return NULL;
+
+        key = get_duplicate_key (sender, app_name, icon, summary, body);
+        notification = g_hash_table_lookup (queue->priv->duplicates, GUINT_TO_POINTER (key));
+        if (notification == NULL)
+                return NULL;
+
+        /* the key is only a hash, make sure it is really the same */
+        if (g_strcmp0 (get_app_scope (sender, app_name),
+                       get_app_scope (nd_notification_get_sender (notification),
+                                      nd_notification_get_app_name (notification))) != 0
+            || g_strcmp0 (icon, nd_notification_get_icon (notification)) != 0
+            || g_strcmp0 (summary, nd_notification_get_summary (notification)) != 0
+            || g_strcmp0 (body, nd_notification_get_body (notification)) != 0)
+                return NULL;
+
+        nd_notification_get_update_time (notification, &tv);
+        age = nd_clock_get_real_time (queue->priv->clock)
+                - ((gint64) tv.tv_sec * G_USEC_PER_SEC + tv.tv_usec);
+        if (age > (gint64) queue->priv->duplicate_window * G_USEC_PER_SEC)
+                return NULL;
+
+        return notification;
+}
+
+/* The stored notification of this app that carries @tag, if any. */
+NdNotification *
+nd_queue_lookup_tag (NdQueue    *queue,
+                     const char *sender,
+                     const char *app_name,
+                     const char *tag)
+{
+        const char *scope;
+        char       *key;
+        gpointer    id;
+
+        g_return_val_if_fail (ND_IS_QUEUE (queue), NULL);
+        g_return_val_if_fail (tag != NULL, NULL);
+
+        scope = get_app_scope (sender, app_name);
+        if (scope == NULL)
+                return NULL;
+
+        key = get_group_key (scope, tag);
+        id = g_hash_table_lookup (queue->priv->tags, key);
+        g_free (key);
+
+        if (id == NULL)
+                return NULL;
+
+        return g_hash_table_lookup (queue->priv->notifications, id);
+}
+
+/* Closes every notification of the app whose tag or category is
+ * @tag, returns how many were closed. */
+guint
+nd_queue_close_by_tag (NdQueue    *queue,
+                       const char *sender,
+                       const char *app_name,
+                       const char *tag)
+{
+        const char *scope;
+        char       *key;
+        guint       n_closed;
+
+        g_return_val_if_fail (ND_IS_QUEUE (queue), 0);
+        g_return_val_if_fail (tag != NULL, 0);
+
+        scope = get_app_scope (sender, app_name);
+        if (scope == NULL)
+                return 0;
+
+        key = get_group_key (scope, tag);
+        n_closed = close_group (queue, key);
+        g_free (key);
+
+        return n_closed;
+}
+
+guint
+nd_queue_close_by_app (NdQueue    *queue,
+                       const char *sender,
+                       const char *app_name)
+{
+        const char *scope;
+
+        g_return_val_if_fail (ND_IS_QUEUE (queue), 0);
+
+        scope = get_app_scope (sender, app_name);
+        if (scope == NULL)
+                return 0;
+
+        return close_group (queue, scope);
+}
+
+/* Returns up to @limit stored notifications that @func accepts, in
+ * update time order and starting after the position given by
+ * @after_time and @after_id.  The notifications are not referenced.
+ * @more is set when there are further ones to page through. */
+GList *
+nd_queue_get_page (NdQueue          *queue,
+                   gint64            after_time,
+                   guint             after_id,
+                   guint             limit,
+                   NdQueueFilterFunc func,
+                   gpointer          data,
+                   gboolean         *more)
+{
+        HistoryEntry   position;
+        GSequenceIter *iter;
+        GList         *page;
+        guint          n;
+
+        g_return_val_if_fail (ND_IS_QUEUE (queue), NULL);
+
+        position.update_time = after_time;
+        position.id = after_id;
+
+        /* entries equal to the position sort before the iter */
+        iter = g_sequence_search (queue->priv->history,
+                                  &position,
+                                  compare_history_entries,
+                                  NULL);
+
+        page = NULL;
+        n = 0;
+        for (; ! g_sequence_iter_is_end (iter); iter = g_sequence_iter_next (iter)) {
+                HistoryEntry   *entry;
+                NdNotification *notification;
+
+                entry = g_sequence_get (iter);
+                notification = g_hash_table_lookup (queue->priv->notifications,
+                                                    GUINT_TO_POINTER (entry->id));
+                if (notification == NULL
+                    || (func != NULL && ! func (notification, data)))
+                        continue;
+
+                if (n == limit)
+                        break;
+
+                page = g_list_prepend (page, notification);
+                n++;
+        }
+
+        if (more != NULL)
+                *more = ! g_sequence_iter_is_end (iter);
+
+        return g_list_reverse (page);
+}
+
+/* Everything another instance needs to carry on where this one stops,
+ * as an ND_QUEUE_STATE_TYPE: each stored notification with the time
+ * left until it expires or -1, and the ids to show in the order they
+ * are to be shown, the visible ones first. */
+GVariant *
+nd_queue_save_state (NdQueue *queue)
+{
+        GVariantBuilder notifications;
+        GVariantBuilder order;
+        GHashTableIter  iter;
+        gpointer        key, value;
+        GList          *l;
+
+        g_return_val_if_fail (ND_IS_QUEUE (queue), NULL);
+
+        g_variant_builder_init (&notifications, G_VARIANT_TYPE ("a(uxi(sssssasa{sv}iu))"));
+        g_hash_table_iter_init (&iter, queue->priv->notifications);
+        while (g_hash_table_iter_next (&iter, &key, &value)) {
+                NdNotification *notification = value;
+                NdTimer        *timer;
+                GTimeVal        tv;
+                int             remaining;
+
+                timer = g_hash_table_lookup (queue->priv->expiry_timers, key);
+                remaining = timer ? (int) nd_timer_wheel_get_remaining (queue->priv->wheel, timer) : -1;
+
+                nd_notification_get_update_time (notification, &tv);
+                g_variant_builder_add (&notifications,
+                                       "(ux@(sssssasa{sv}iu))",
+                                       GPOINTER_TO_UINT (key),
+                                       (gint64) tv.tv_sec * G_USEC_PER_SEC + tv.tv_usec,
+                                       remaining,
+                                       nd_notification_to_record (notification));
+        }
+
+        g_variant_builder_init (&order, G_VARIANT_TYPE ("au"));
+        g_hash_table_iter_init (&iter, queue->priv->bubbles);
+        while (g_hash_table_iter_next (&iter, &key, NULL)) {
+                if (g_hash_table_contains (queue->priv->notifications, key)) {
+                        g_variant_builder_add (&order, "u", GPOINTER_TO_UINT (key));
+                }
+        }
+        /* shown from the tail */
+        for (l = queue->priv->queue->tail; l != NULL; l = l->prev) {
+                if (g_hash_table_contains (queue->priv->notifications, l->data)) {
+                        g_variant_builder_add (&order, "u", GPOINTER_TO_UINT (l->data));
+                }
+        }
+
+        return g_variant_new ("(a(uxi(sssssasa{sv}iu))au)", &notifications, &order);
+}
+
+/* Takes over the state saved by nd_queue_save_state() in another
+ * instance.  @func is called on each notification before it is
+ * stored.  Ids already stored are left alone. */
+void
+nd_queue_restore_state (NdQueue           *queue,
+                        GVariant          *state,
+                        NdQueueRestoreFunc func,
+                        gpointer           data)
+{
+        GVariantIter *notifications;
+        GVariantIter *order;
+        GVariant     *record;
+        guint         id;
+        gint64        update_time;
+        int           remaining;
+
+        g_return_if_fail (ND_IS_QUEUE (queue));
+        g_return_if_fail (g_variant_is_of_type (state, ND_QUEUE_STATE_TYPE));
+
+        g_variant_get (state, "(a(uxi(sssssasa{sv}iu))au)", &notifications, &order);
+
+        while (g_variant_iter_next (notifications,
+                                    "(ux@(sssssasa{sv}iu))",
+                                    &id,
+                                    &update_time,
+                                    &remaining,
+                                    &record)) {
+                NdNotification *notification;
+
+                if (g_hash_table_contains (queue->priv->notifications, GUINT_TO_POINTER (id))) {
+                        g_variant_unref (record);
+                        continue;
+                }
+
+                notification = nd_notification_new_from_record (record, id, update_time);
+                g_variant_unref (record);
+
+                if (func != NULL) {
+                        func (notification, data);
+                }
+
+                /* with a timeout but no timer it was history only */
+                if (remaining < 0 && nd_notification_get_timeout (notification) > 0) {
+                        g_hash_table_add (queue->priv->history_only, GUINT_TO_POINTER (id));
+                }
+
+                add_notification (queue, notification, FALSE);
+                if (remaining >= 0) {
+                        schedule_expiry_in (queue, notification, remaining);
+                }
+                g_object_unref (notification);
+        }
+
+        while (g_variant_iter_next (order, "u", &id)) {
+                if (g_hash_table_contains (queue->priv->notifications, GUINT_TO_POINTER (id))
+                    && g_queue_find (queue->priv->queue, GUINT_TO_POINTER (id)) == NULL) {
+                        g_queue_push_head (queue->priv->queue, GUINT_TO_POINTER (id));
+                }
+        }
+
+        g_variant_iter_free (notifications);
+        g_variant_iter_free (order);
+
+        queue_update (queue, UPDATE_ALL);
+}
+
+/* Seconds within which a repeat is folded into the original, 0 turns
+ * folding off. */
+void
+nd_queue_set_duplicate_window (NdQueue *queue,
+                               guint    seconds)
+{
+        g_return_if_fail (ND_IS_QUEUE (queue));
+
+        queue->priv->duplicate_window = seconds;
+}
+
+/* Has to be set before anything is shown, stacks only switch while
+ * they are empty. */
+void
+nd_queue_set_single_surface (NdQueue *queue,
+                             gboolean single_surface)
+{
+        int i;
+        int j;
+
+        g_return_if_fail (ND_IS_QUEUE (queue));
+
+        queue->priv->single_surface = single_surface;
+
+        for (i = 0; i < queue->priv->n_screens; i++) {
+                NotifyScreen *nscreen;
+                nscreen = queue->priv->screens[i];
+                for (j = 0; j < nscreen->n_stacks; j++) {
+                        if (nd_stack_get_bubbles (nscreen->stacks[j]) == NULL) {
+                                nd_stack_set_single_surface (nscreen->stacks[j],
+                                                             single_surface);
+                        }
+                }
+        }
+}
+
+/* Where new bubbles go.  Must be set before the queue shows
+ * anything to take effect for the first bubble. */
+void
+nd_queue_set_placement (NdQueue         *queue,
+                        NdQueuePlacement placement)
+{
+        g_return_if_fail (ND_IS_QUEUE (queue));
+
+        if (queue->priv->placement == placement) {
+                return;
+        }
+
+        stop_placement_tracking (queue);
+        queue->priv->placement = placement;
+        if (queue->priv->screens != NULL) {
+                start_placement_tracking (queue);
+        }
+}
+
+/* Only looks at what the X event filters cached, and at the monitor
+ * layout GDK keeps, so it never waits on the X server. */
+static NdStack *
+get_stack_for_placement (NdQueue *queue)
+{
+        NotifyScreen *nscreen;
+        int           monitor_num;
+
+        if (queue->priv->screens == NULL) {
+                create_screens (queue);
+        }
+
+        if (queue->priv->tracking_pointer) {
+                nscreen = queue->priv->screens[queue->priv->pointer_screen];
+                monitor_num = gdk_screen_get_monitor_at_point (nscreen->screen,
+                                                               queue->priv->pointer_x,
+                                                               queue->priv->pointer_y);
+        } else if (queue->priv->tracking_focus) {
+                nscreen = queue->priv->screens[queue->priv->focus_screen];
+                monitor_num = nscreen->focus_monitor;
+        } else {
+                nscreen = queue->priv->screens[gdk_screen_get_number (gdk_screen_get_default ())];
+                monitor_num = -1;
+        }
+
+        if (monitor_num < 0) {
+                monitor_num = gdk_screen_get_primary_monitor (nscreen->screen);
+        }
+
+        if (monitor_num >= nscreen->n_stacks) {
+                /* screw it - dump it on the last one we'll get
+                   a monitors-changed signal soon enough*/
+                monitor_num = nscreen->n_stacks - 1;
+        }
+
+        return nscreen->stacks[monitor_num];
+}
+
+static void
+warm_up_icons (void)
+{
+        GtkIconTheme *theme;
+        GdkPixbuf    *pixbuf;
+
+        /* loads the theme index and the pixbuf loaders */
+        theme = gtk_icon_theme_get_default ();
+        gtk_icon_theme_has_icon (theme, "dialog-warning");
+        gtk_icon_theme_has_icon (theme, "dialog-error");
+        gtk_icon_theme_has_icon (theme, "mail-message-new");
+        pixbuf = gtk_icon_theme_load_icon (theme, "dialog-information", 48, 0, NULL);
+        if (pixbuf != NULL) {
+                g_object_unref (pixbuf);
+        }
+}
+
+/* Lays out and realizes a bubble that is never shown, which resolves
+ * the CSS and loads the fonts a real one uses. */
+static void
+warm_up_bubble (void)
+{
+        NdNotification *notification;
+        NdBubble       *bubble;
+        GVariant       *hints;
+        GVariantIter    iter;
+        const char     *actions[] = { NULL };
+
+        hints = g_variant_ref_sink (g_variant_new_array (G_VARIANT_TYPE ("{sv}"), NULL, 0));
+        g_variant_iter_init (&iter, hints);
+
+        notification = nd_notification_new ("");
+        nd_notification_update (notification,
+                                "",
+                                "dialog-information",
+                                "Notification",
+                                "Some <b>body</b> text",
+                                actions,
+                                &iter,
+                                -1);
+
+        bubble = nd_bubble_new_for_notification (notification);
+        gtk_widget_get_preferred_size (GTK_WIDGET (bubble), NULL, NULL);
+        gtk_widget_realize (GTK_WIDGET (bubble));
+        gtk_widget_destroy (GTK_WIDGET (bubble));
+
+        g_object_unref (notification);
+        g_variant_unref (hints);
+}
+
+static gboolean
+warm_up_step (NdQueue *queue)
+{
+        switch (queue->priv->warmup_stage) {
+        case WARMUP_SCREENS:
+                if (queue->priv->screens == NULL) {
+                        create_screens (queue);
+                }
+                break;
+        case WARMUP_ICONS:
+                warm_up_icons ();
+                break;
+        case WARMUP_SOUND:
+                sound_warm_up ();
+                break;
+        case WARMUP_BUBBLE:
+                warm_up_bubble ();
+                break;
+        default:
+                g_assert_not_reached ();
+        }
+
+        queue->priv->warmup_stage++;
+        if (queue->priv->warmup_stage < N_WARMUP_STAGES) {
+                return TRUE;
+        }
+
+        g_debug ("Warmup done");
+        queue->priv->warmup_id = 0;
+
+        return FALSE;
+}
+
+static void
+cancel_warm_up (NdQueue *queue)
+{
+        if (queue->priv->warmup_id == 0) {
+                return;
+        }
+
+        g_debug ("Warmup cancelled after %u of %u stages",
+                 queue->priv->warmup_stage,
+                 N_WARMUP_STAGES);
+        nd_clock_source_remove (queue->priv->clock, queue->priv->warmup_id);
+        queue->priv->warmup_id = 0;
+}
+
+/* Pays the one-off costs of the first bubble in idle time, one stage
+ * per idle.  Adding a notification to show stops it. */
+void
+nd_queue_warm_up (NdQueue *queue)
+{
+        g_return_if_fail (ND_IS_QUEUE (queue));
+
+        if (queue->priv->warmup_id > 0
+            || queue->priv->warmup_stage == N_WARMUP_STAGES
+            || queue->priv->shown_bubble) {
+                return;
+        }
+
+        queue->priv->warmup_id = nd_clock_idle_add (queue->priv->clock,
+                                                    (GSourceFunc) warm_up_step,
+                                                    queue);
+}
+
+/* Gives back what can be rebuilt on demand: the hidden dock window
+ * and the images decoded for stored notifications. */
+void
+nd_queue_trim (NdQueue *queue)
+{
+        GHashTableIter iter;
+        gpointer       value;
+
+        g_return_if_fail (ND_IS_QUEUE (queue));
+
+        if (queue->priv->dock != NULL && ! dock_is_visible (queue)) {
+                clear_dock (queue);
+                gtk_widget_destroy (queue->priv->dock);
+                queue->priv->dock = NULL;
+                queue->priv->dock_scrolled_window = NULL;
+        }
+
+        g_hash_table_iter_init (&iter, queue->priv->notifications);
+        while (g_hash_table_iter_next (&iter, NULL, &value)) {
+                nd_notification_drop_image (ND_NOTIFICATION (value));
+        }
+}
+
+static void
+on_bubble_destroyed (NdBubble *bubble,
+                     NdQueue  *queue)
+{
+        NdNotification *notification;
+        NdTimer        *timer;
+        Digest         *digest;
+        guint           id;
+
+        g_debug ("Bubble destroyed");
+        notification = g_object_ref (nd_bubble_get_notification (bubble));
+        id = nd_notification_get_id (notification);
+
+        timer = g_hash_table_lookup (queue->priv->dwell_timers, bubble);
+        if (timer != NULL) {
+                g_hash_table_remove (queue->priv->dwell_timers, bubble);
+                nd_timer_wheel_remove (queue->priv->wheel, timer);
+        }
+        g_hash_table_remove (queue->priv->bubbles, GUINT_TO_POINTER (id));
+
+        /* skip it if the notification itself is what went away */
+        if (nd_notification_get_is_transient (notification)
+            && g_hash_table_lookup (queue->priv->notifications, GUINT_TO_POINTER (id)) == notification) {
+                g_debug ("Bubble is transient");
+                nd_notification_close (notification, ND_NOTIFICATION_CLOSED_EXPIRED);
+        }
+        g_object_unref (notification);
+
+        /* a digest outlives its bubble only while the flood goes on */
+        digest = g_hash_table_lookup (queue->priv->digest_ids, GUINT_TO_POINTER (id));
+        if (digest != NULL
+            && nd_clock_get_monotonic_time (queue->priv->clock) - digest->window_start > DIGEST_WINDOW_USEC) {
+                dissolve_digest (queue, digest);
+        }
+
+        queue_update (queue, UPDATE_BUBBLES);
+}
+
+static void
+on_dwell_timeout (NdBubble *bubble)
+{
+        gtk_widget_destroy (GTK_WIDGET (bubble));
+}
+
+static gboolean
+on_bubble_enter_notify_event (NdBubble         *bubble,
+                              GdkEventCrossing *event,
+                              NdQueue          *queue)
+{
+        NdTimer *timer;
+
+        timer = g_hash_table_lookup (queue->priv->dwell_timers, bubble);
+        if (timer != NULL) {
+                nd_timer_wheel_pause (queue->priv->wheel, timer);
+        }
+
+        return FALSE;
+}
+
+static gboolean
+on_bubble_leave_notify_event (NdBubble         *bubble,
+                              GdkEventCrossing *event,
+                              NdQueue          *queue)
+{
+        NdTimer *timer;
+
+        timer = g_hash_table_lookup (queue->priv->dwell_timers, bubble);
+        if (timer != NULL) {
+                nd_timer_wheel_resume (queue->priv->wheel, timer);
+        }
+
+        return FALSE;
+}
+
+static void
+withdraw_bubble (NdQueue *queue,
+                 guint    id)
+{
+        NdBubble *bubble;
+
+        bubble = g_hash_table_lookup (queue->priv->bubbles, GUINT_TO_POINTER (id));
+        if (bubble != NULL) {
+                gtk_widget_destroy (GTK_WIDGET (bubble));
+        }
 }
 
 static void
-nd_queue_init (NdQueue *queue)
+on_digest_closed (NdNotification *notification,
+                  int             reason,
+                  NdQueue        *queue)
 {
-        queue->priv = ND_QUEUE_GET_PRIVATE (queue);
-        queue->priv->notifications = g_hash_table_new_full (NULL, NULL, NULL, g_object_unref);
-        queue->priv->bubbles = g_hash_table_new_full (NULL, NULL, NULL, g_object_unref);
-        queue->priv->queue = g_queue_new ();
-        queue->priv->status_icon = NULL;
+        Digest *digest;
 
-        create_dock (queue);
-        create_screens (queue);
+        /* dismissed, the entries it stood for stay in the dock */
+        digest = g_hash_table_lookup (queue->priv->digest_ids,
+                                      GUINT_TO_POINTER (nd_notification_get_id (notification)));
+        if (digest != NULL) {
+                dissolve_digest (queue, digest);
+        }
 }
 
 static void
-destroy_screens (NdQueue *queue)
+on_digest_action_invoked (NdNotification *notification,
+                          const char     *action,
+                          NdQueue        *queue)
 {
-        GdkDisplay  *display;
-        int          i;
-        int          j;
+        show_dock (queue);
+}
 
-        display = gdk_display_get_default ();
+static void
+dissolve_digest (NdQueue *queue,
+                 Digest  *digest)
+{
+        NdNotification *notification;
+        GList          *l;
+        guint           id;
 
-        for (i = 0; i < queue->priv->n_screens; i++) {
-                GdkScreen *screen;
-                GdkWindow *gdkwindow;
+        for (l = digest->members; l != NULL; l = l->next) {
+                g_hash_table_remove (queue->priv->digest_members, l->data);
+        }
+        g_list_free (digest->members);
+        digest->members = NULL;
 
-                screen = gdk_display_get_screen (display, i);
-                g_signal_handlers_disconnect_by_func (screen,
-                                                      G_CALLBACK (on_screen_monitors_changed),
-                                                      queue);
+        notification = digest->notification;
+        if (notification == NULL)
+                return;
 
-                gdkwindow = gdk_screen_get_root_window (screen);
-                gdk_window_remove_filter (gdkwindow, (GdkFilterFunc) screen_xevent_filter, queue->priv->screens[i]);
-                for (j = 0; j < queue->priv->screens[i]->n_stacks; j++) {
-                        g_object_unref (queue->priv->screens[i]->stacks[j]);
-                        queue->priv->screens[i]->stacks[j] = NULL;
-                }
+        /* unhook it first, withdrawing the bubble comes back here */
+        digest->notification = NULL;
+        id = nd_notification_get_id (notification);
+        g_hash_table_remove (queue->priv->digest_ids, GUINT_TO_POINTER (id));
+        g_signal_handlers_disconnect_by_func (notification, G_CALLBACK (on_digest_closed), queue);
+        g_signal_handlers_disconnect_by_func (notification, G_CALLBACK (on_digest_action_invoked), queue);
 
-                g_free (queue->priv->screens[i]->stacks);
+        if (queue->priv->queue != NULL) {
+                g_queue_remove (queue->priv->queue, GUINT_TO_POINTER (id));
         }
+        withdraw_bubble (queue, id);
 
-        g_free (queue->priv->screens);
-        queue->priv->screens = NULL;
+        g_object_unref (notification);
 }
 
-
 static void
-nd_queue_finalize (GObject *object)
+update_digest (NdQueue *queue,
+               Digest  *digest)
 {
-        NdQueue *queue;
+        NdNotification *latest;
+        GVariant       *hints;
+        GVariantIter    hints_iter;
+        GString        *body;
+        GList          *l;
+        char           *summary;
+        guint           n;
+        int             i;
+
+        n = g_list_length (digest->members);
+        latest = g_hash_table_lookup (queue->priv->notifications, digest->members->data);
+
+        summary = g_strdup_printf (ngettext ("%u new notification from %s",
+                                             "%u new notifications from %s",
+                                             n),
+                                   n,
+                                   digest->scope);
+
+        body = g_string_new (NULL);
+        for (l = digest->members, i = 0; l != NULL && i < DIGEST_SUMMARIES; l = l->next, i++) {
+                NdNotification *member;
+                char           *quoted;
+
+                member = g_hash_table_lookup (queue->priv->notifications, l->data);
+                quoted = g_markup_escape_text (nd_notification_get_summary (member), -1);
+                if (body->len > 0)
+                        g_string_append_c (body, '\n');
+                g_string_append (body, quoted);
+                g_free (quoted);
+        }
 
-        g_return_if_fail (object != NULL);
-        g_return_if_fail (ND_IS_QUEUE (object));
+        hints = g_variant_ref_sink (g_variant_new_array (G_VARIANT_TYPE ("{sv}"), NULL, 0));
+        g_variant_iter_init (&hints_iter, hints);
+
+        nd_notification_update (digest->notification,
+                                nd_notification_get_app_name (latest),
+                                nd_notification_get_icon (latest),
+                                summary,
+                                body->str,
+                                NULL,
+                                &hints_iter,
+                                -1);
+
+        g_variant_unref (hints);
+        g_string_free (body, TRUE);
+        g_free (summary);
+}
 
-        queue = ND_QUEUE (object);
+static void
+start_digest (NdQueue        *queue,
+              Digest         *digest,
+              NdNotification *notification)
+{
+        GList *l;
+        GList *next;
+        guint  id;
+
+        digest->notification = nd_notification_new (nd_notification_get_sender (notification));
+        g_signal_connect (digest->notification, "closed", G_CALLBACK (on_digest_closed), queue);
+        g_signal_connect (digest->notification, "action-invoked", G_CALLBACK (on_digest_action_invoked), queue);
+
+        id = nd_notification_get_id (digest->notification);
+        g_hash_table_insert (queue->priv->digest_ids, GUINT_TO_POINTER (id), digest);
+
+        /* take over what this app still has waiting to be shown */
+        for (l = queue->priv->queue->head; l != NULL; l = next) {
+                NdNotification *n;
+
+                next = l->next;
+                n = g_hash_table_lookup (queue->priv->notifications, l->data);
+                if (g_strcmp0 (digest->scope,
+                               get_app_scope (nd_notification_get_sender (n),
+                                              nd_notification_get_app_name (n))) != 0)
+                        continue;
+
+                digest->members = g_list_append (digest->members, l->data);
+                g_hash_table_insert (queue->priv->digest_members, l->data, digest);
+                g_queue_delete_link (queue->priv->queue, l);
+        }
+}
 
-        g_return_if_fail (queue->priv != NULL);
+/* Scopes can be unique bus names, so an entry that only counts and
+ * whose window has passed is forgotten. */
+static gboolean
+prune_digests (NdQueue *queue)
+{
+        GHashTableIter iter;
+        gpointer       value;
+        gint64         now;
 
-        g_hash_table_destroy (queue->priv->notifications);
-        g_queue_free (queue->priv->queue);
+        now = nd_clock_get_monotonic_time (queue->priv->clock);
 
-        destroy_screens (queue);
+        g_hash_table_iter_init (&iter, queue->priv->digests);
+        while (g_hash_table_iter_next (&iter, NULL, &value)) {
+                Digest *digest = value;
 
-        if (queue->priv->numerable_icon != NULL) {
-                g_object_unref (queue->priv->numerable_icon);
+                if (digest->notification == NULL
+                    && digest->members == NULL
+                    && now - digest->window_start > DIGEST_WINDOW_USEC) {
+                        g_hash_table_iter_remove (&iter);
+                }
         }
 
-        G_OBJECT_CLASS (nd_queue_parent_class)->finalize (object);
+        if (g_hash_table_size (queue->priv->digests) > 0) {
+                return TRUE;
+        }
+
+        queue->priv->digest_prune_id = 0;
+        return FALSE;
 }
 
-NdNotification *
-nd_queue_lookup (NdQueue *queue,
-                 guint    id)
+/* Counts @notification against its app's rate and, when the app is
+ * flooding, files it under the app's digest instead of giving it a
+ * bubble of its own.  Returns TRUE if it went to the digest. */
+static gboolean
+add_to_digest (NdQueue        *queue,
+               NdNotification *notification)
 {
-        NdNotification *notification;
+        const char *scope;
+        Digest     *digest;
+        gint64      now;
+        gpointer    id;
+
+        scope = get_app_scope (nd_notification_get_sender (notification),
+                               nd_notification_get_app_name (notification));
+        if (scope == NULL)
+                return FALSE;
 
-        g_return_val_if_fail (ND_IS_QUEUE (queue), NULL);
+        digest = g_hash_table_lookup (queue->priv->digests, scope);
+        if (digest == NULL) {
+                digest = g_slice_new0 (Digest);
+                digest->scope = g_strdup (scope);
+                g_hash_table_insert (queue->priv->digests, digest->scope, digest);
+
+                if (queue->priv->digest_prune_id == 0) {
+                        queue->priv->digest_prune_id = nd_clock_timeout_add (queue->priv->clock,
+                                                                             DIGEST_WINDOW_USEC / 1000,
+                                                                             (GSourceFunc) prune_digests,
+                                                                             queue);
+                }
+        }
 
-        notification = g_hash_table_lookup (queue->priv->notifications, GUINT_TO_POINTER (id));
+        now = nd_clock_get_monotonic_time (queue->priv->clock);
+        if (now - digest->window_start > DIGEST_WINDOW_USEC) {
+                digest->window_start = now;
+                digest->n_in_window = 0;
 
-        return notification;
-}
+                /* the flood is over unless its bubble is still up */
+                if (digest->notification != NULL
+                    && g_hash_table_lookup (queue->priv->bubbles,
+                                            GUINT_TO_POINTER (nd_notification_get_id (digest->notification))) == NULL) {
+                        dissolve_digest (queue, digest);
+                }
+        }
+        digest->n_in_window++;
 
-guint
-nd_queue_length (NdQueue *queue)
-{
-        g_return_val_if_fail (ND_IS_QUEUE (queue), 0);
+        if (digest->notification == NULL) {
+                if (digest->n_in_window <= DIGEST_THRESHOLD)
+                        return FALSE;
 
-        return g_hash_table_size (queue->priv->notifications);
-}
+                start_digest (queue, digest, notification);
+        }
 
-static NdStack *
-get_stack_with_pointer (NdQueue *queue)
-{
-        GdkScreen *screen;
-        int        x, y;
-        int        screen_num;
-        int        monitor_num;
-
-        gdk_display_get_pointer (gdk_display_get_default (),
-                                 &screen,
-                                 &x,
-                                 &y,
-                                 NULL);
-        screen_num = gdk_screen_get_number (screen);
-        monitor_num = gdk_screen_get_monitor_at_point (screen, x, y);
+        id = GUINT_TO_POINTER (nd_notification_get_id (notification));
+        digest->members = g_list_prepend (digest->members, id);
+        g_hash_table_insert (queue->priv->digest_members, id, digest);
 
-        if (monitor_num >= queue->priv->screens[screen_num]->n_stacks) {
-                /* screw it - dump it on the last one we'll get
-                   a monitors-changed signal soon enough*/
-                monitor_num = queue->priv->screens[screen_num]->n_stacks - 1;
+        update_digest (queue, digest);
+
+        /* show it again unless it is up or waiting already */
+        id = GUINT_TO_POINTER (nd_notification_get_id (digest->notification));
+        if (g_hash_table_lookup (queue->priv->bubbles, id) == NULL
+            && g_queue_find (queue->priv->queue, id) == NULL) {
+                g_queue_push_head (queue->priv->queue, id);
         }
 
-        return queue->priv->screens[screen_num]->stacks[monitor_num];
+        return TRUE;
 }
 
 static void
-on_bubble_destroyed (NdBubble *bubble,
-                     NdQueue  *queue)
+remove_from_digest (NdQueue *queue,
+                    guint    id)
+{
+        Digest *digest;
+
+        digest = g_hash_table_lookup (queue->priv->digest_members, GUINT_TO_POINTER (id));
+        if (digest == NULL)
+                return;
+
+        digest->members = g_list_remove (digest->members, GUINT_TO_POINTER (id));
+        g_hash_table_remove (queue->priv->digest_members, GUINT_TO_POINTER (id));
+
+        if (digest->members == NULL) {
+                dissolve_digest (queue, digest);
+        } else {
+                update_digest (queue, digest);
+        }
+}
+
+static NdNotification *
+lookup_shown (NdQueue *queue,
+              gpointer id)
 {
         NdNotification *notification;
+        Digest         *digest;
 
-        g_debug ("Bubble destroyed");
-        notification = nd_bubble_get_notification (bubble);
-        if (nd_notification_get_is_transient (notification)) {
-                g_debug ("Bubble is transient");
-                nd_notification_close (notification, ND_NOTIFICATION_CLOSED_EXPIRED);
+        notification = g_hash_table_lookup (queue->priv->notifications, id);
+        if (notification == NULL) {
+                digest = g_hash_table_lookup (queue->priv->digest_ids, id);
+                if (digest != NULL)
+                        notification = digest->notification;
         }
 
-        queue_update (queue);
+        return notification;
 }
 
 static void
@@ -613,17 +2509,19 @@ maybe_show_notification (NdQueue *queue)
         NdNotification *notification;
         NdBubble       *bubble;
         NdStack        *stack;
+        NdTimer        *timer;
         GList          *list;
+        gint64          start;
 
         /* FIXME: show one at a time if not busy or away */
 
         /* don't show bubbles when dock is showing */
-        if (gtk_widget_get_visible (queue->priv->dock)) {
+        if (dock_is_visible (queue)) {
                 g_debug ("Dock is showing");
                 return;
         }
 
-        stack = get_stack_with_pointer (queue);
+        stack = get_stack_for_placement (queue);
         list = nd_stack_get_bubbles (stack);
         if (g_list_length (list) > 0) {
                 /* already showing bubbles */
@@ -638,13 +2536,31 @@ maybe_show_notification (NdQueue *queue)
                 return;
         }
 
-        notification = g_hash_table_lookup (queue->priv->notifications, id);
+        notification = lookup_shown (queue, id);
         g_assert (notification != NULL);
 
+        start = g_get_monotonic_time ();
+
         bubble = nd_bubble_new_for_notification (notification);
         g_signal_connect (bubble, "destroy", G_CALLBACK (on_bubble_destroyed), queue);
+        g_signal_connect (bubble, "enter-notify-event", G_CALLBACK (on_bubble_enter_notify_event), queue);
+        g_signal_connect (bubble, "leave-notify-event", G_CALLBACK (on_bubble_leave_notify_event), queue);
+        g_hash_table_insert (queue->priv->bubbles, id, g_object_ref (bubble));
 
         nd_stack_add_bubble (stack, bubble, TRUE);
+
+        if (! queue->priv->shown_bubble) {
+                queue->priv->shown_bubble = TRUE;
+                g_debug ("First bubble up in %" G_GINT64_FORMAT " usec, %s",
+                         g_get_monotonic_time () - start,
+                         queue->priv->warmup_stage == N_WARMUP_STAGES ? "warm" : "cold");
+        }
+
+        timer = nd_timer_wheel_add (queue->priv->wheel,
+                                    DWELL_TIMEOUT_MSEC,
+                                    (NdTimerFunc) on_dwell_timeout,
+                                    bubble);
+        g_hash_table_insert (queue->priv->dwell_timers, bubble, timer);
 }
 
 static int
@@ -664,48 +2580,113 @@ collate_notifications (NdNotification *a,
 }
 
 static void
-update_dock (NdQueue *queue)
+clear_dock (NdQueue *queue)
 {
-        GtkWidget   *child;
-        GList       *list;
-        GList       *l;
-        int          min_height;
-        int          height;
-        int          monitor_num;
-        GdkScreen   *screen;
-        GdkRectangle area;
+        GtkWidget *child;
 
-        g_return_if_fail (queue);
+        if (queue->priv->dock == NULL)
+                return;
 
         child = gtk_bin_get_child (GTK_BIN (queue->priv->dock_scrolled_window));
         if (child != NULL)
                 gtk_container_remove (GTK_CONTAINER (queue->priv->dock_scrolled_window), child);
 
-        child = gtk_vbox_new (FALSE, 6);
-        gtk_scrolled_window_add_with_viewport (GTK_SCROLLED_WINDOW (queue->priv->dock_scrolled_window),
-                                               child);
-        gtk_container_set_focus_hadjustment (GTK_CONTAINER (child),
-                                             gtk_scrolled_window_get_hadjustment (GTK_SCROLLED_WINDOW (queue->priv->dock_scrolled_window)));
-        gtk_container_set_focus_vadjustment (GTK_CONTAINER (child),
-                                             gtk_scrolled_window_get_vadjustment (GTK_SCROLLED_WINDOW (queue->priv->dock_scrolled_window)));
+        g_hash_table_remove_all (queue->priv->dock_rows);
+        queue->priv->dock_box = NULL;
+}
+
+static GtkWidget *
+create_dock_row (NdNotification *notification)
+{
+        NdNotificationBox *box;
+        GtkWidget         *row;
+        GtkWidget         *sep;
+
+        row = gtk_vbox_new (FALSE, 6);
+
+        box = nd_notification_box_new_for_notification (notification);
+        gtk_widget_show (GTK_WIDGET (box));
+        gtk_box_pack_start (GTK_BOX (row), GTK_WIDGET (box), FALSE, FALSE, 0);
+
+        sep = gtk_hseparator_new ();
+        gtk_widget_show (sep);
+        gtk_box_pack_start (GTK_BOX (row), sep, FALSE, FALSE, 0);
+
+        gtk_widget_show (row);
+
+        return row;
+}
+
+/* Brings the dock rows in line with the stored notifications, creating
+ * at most @budget new rows.  Returns FALSE if rows are still missing. */
+static gboolean
+update_dock (NdQueue *queue,
+             guint    budget)
+{
+        GtkWidget     *child;
+        GHashTableIter iter;
+        gpointer       key;
+        gpointer       value;
+        GList         *list;
+        GList         *l;
+        gboolean       complete;
+        int            position;
+        int            min_height;
+        int            height;
+        int            monitor_num;
+        GdkScreen     *screen;
+        GdkRectangle   area;
+
+        g_return_val_if_fail (queue, TRUE);
+
+        if (queue->priv->dock_box == NULL) {
+                child = gtk_vbox_new (FALSE, 6);
+                gtk_scrolled_window_add_with_viewport (GTK_SCROLLED_WINDOW (queue->priv->dock_scrolled_window),
+                                                       child);
+                gtk_container_set_focus_hadjustment (GTK_CONTAINER (child),
+                                                     gtk_scrolled_window_get_hadjustment (GTK_SCROLLED_WINDOW (queue->priv->dock_scrolled_window)));
+                gtk_container_set_focus_vadjustment (GTK_CONTAINER (child),
+                                                     gtk_scrolled_window_get_vadjustment (GTK_SCROLLED_WINDOW (queue->priv->dock_scrolled_window)));
+                gtk_widget_show (child);
+                queue->priv->dock_box = child;
+        }
+        child = queue->priv->dock_box;
+
+        /* drop the rows of notifications that went away */
+        g_hash_table_iter_init (&iter, queue->priv->dock_rows);
+        while (g_hash_table_iter_next (&iter, &key, &value)) {
+                if (g_hash_table_lookup (queue->priv->notifications, key) == NULL) {
+                        gtk_widget_destroy (GTK_WIDGET (value));
+                        g_hash_table_iter_remove (&iter);
+                }
+        }
 
         list = g_hash_table_get_values (queue->priv->notifications);
         list = g_list_sort (list, (GCompareFunc)collate_notifications);
 
+        complete = TRUE;
+        position = 0;
         for (l = list; l != NULL; l = l->next) {
-                NdNotification    *n = l->data;
-                NdNotificationBox *box;
-                GtkWidget         *sep;
+                NdNotification *n = l->data;
+                gpointer        id;
+                GtkWidget      *row;
+
+                id = GUINT_TO_POINTER (nd_notification_get_id (n));
+                row = g_hash_table_lookup (queue->priv->dock_rows, id);
+                if (row == NULL) {
+                        if (budget == 0) {
+                                complete = FALSE;
+                                continue;
+                        }
 
-                box = nd_notification_box_new_for_notification (n);
-                gtk_widget_show (GTK_WIDGET (box));
-                gtk_box_pack_start (GTK_BOX (child), GTK_WIDGET (box), FALSE, FALSE, 0);
+                        row = create_dock_row (n);
+                        gtk_box_pack_start (GTK_BOX (child), row, FALSE, FALSE, 0);
+                        g_hash_table_insert (queue->priv->dock_rows, id, row);
+                        budget--;
+                }
 
-                sep = gtk_hseparator_new ();
-                gtk_widget_show (sep);
-                gtk_box_pack_start (GTK_BOX (child), sep, FALSE, FALSE, 0);
+                gtk_box_reorder_child (GTK_BOX (child), row, position++);
         }
-        gtk_widget_show (child);
 
         if (queue->priv->status_icon != NULL
             && gtk_status_icon_get_visible (GTK_STATUS_ICON (queue->priv->status_icon))) {
@@ -725,6 +2706,8 @@ update_dock (NdQueue *queue)
         }
 
         g_list_free (list);
+
+        return complete;
 }
 
 static gboolean
@@ -742,7 +2725,12 @@ popup_dock (NdQueue *queue,
         GdkRectangle   monitor;
         GtkRequisition dock_req;
 
-        update_dock (queue);
+        if (queue->priv->dock == NULL) {
+                create_dock (queue);
+        }
+
+        /* it has to be complete before it can be sized */
+        update_dock (queue, G_MAXUINT);
 
         res = gtk_status_icon_get_geometry (GTK_STATUS_ICON (queue->priv->status_icon),
                                             &screen,
@@ -864,52 +2852,79 @@ on_status_icon_visible_notify (GtkStatusIcon *icon,
         }
 }
 
-static gboolean
-update_idle (NdQueue *queue)
+static void
+update_status_icon (NdQueue *queue,
+                    int      num)
+{
+        if (queue->priv->status_icon == NULL) {
+                queue->priv->status_icon = gtk_status_icon_new ();
+                gtk_status_icon_set_title (GTK_STATUS_ICON (queue->priv->status_icon),
+                                           _("Notifications"));
+                g_signal_connect (queue->priv->status_icon,
+                                  "activate",
+                                  G_CALLBACK (on_status_icon_activate),
+                                  queue);
+                g_signal_connect (queue->priv->status_icon,
+                                  "popup-menu",
+                                  G_CALLBACK (on_status_icon_popup_menu),
+                                  queue);
+                g_signal_connect (queue->priv->status_icon,
+                                  "notify::visible",
+                                  G_CALLBACK (on_status_icon_visible_notify),
+                                  queue);
+        }
+
+        if (queue->priv->numerable_icon == NULL) {
+                GIcon *icon;
+                /* FIXME: use a more appropriate icon here */
+                icon = g_themed_icon_new ("mail-message-new");
+                queue->priv->numerable_icon = gtk_numerable_icon_new (icon);
+                g_object_unref (icon);
+        }
+        gtk_numerable_icon_set_count (GTK_NUMERABLE_ICON (queue->priv->numerable_icon), num);
+        gtk_status_icon_set_from_gicon (queue->priv->status_icon,
+                                        queue->priv->numerable_icon);
+        gtk_status_icon_set_visible (queue->priv->status_icon, TRUE);
+}
+
+/* One consolidated pass over everything that was marked dirty since
+ * the last frame. */
+static void
+run_update (NdQueue *queue)
 {
-        int num;
+        guint dirty;
+        int   num;
+
+        dirty = queue->priv->dirty;
+        queue->priv->dirty = 0;
+        queue->priv->last_update = nd_clock_get_monotonic_time (queue->priv->clock);
+
+        /* rows are only kept while the dock is showing */
+        if ((dirty & UPDATE_DOCK) && !dock_is_visible (queue)) {
+                clear_dock (queue);
+                dirty &= ~UPDATE_DOCK;
+        }
 
         num = g_hash_table_size (queue->priv->notifications);
 
         /* Show the status icon when their are stored notifications */
         if (num > 0) {
-                if (gtk_widget_get_visible (queue->priv->dock)) {
-                        update_dock (queue);
-                }
-
-                if (queue->priv->status_icon == NULL) {
-                        queue->priv->status_icon = gtk_status_icon_new ();
-                        gtk_status_icon_set_title (GTK_STATUS_ICON (queue->priv->status_icon),
-                                                   _("Notifications"));
-                        g_signal_connect (queue->priv->status_icon,
-                                          "activate",
-                                          G_CALLBACK (on_status_icon_activate),
-                                          queue);
-                        g_signal_connect (queue->priv->status_icon,
-                                          "popup-menu",
-                                          G_CALLBACK (on_status_icon_popup_menu),
-                                          queue);
-                        g_signal_connect (queue->priv->status_icon,
-                                          "notify::visible",
-                                          G_CALLBACK (on_status_icon_visible_notify),
-                                          queue);
-                }
-
-                if (queue->priv->numerable_icon == NULL) {
-                        GIcon *icon;
-                        /* FIXME: use a more appropriate icon here */
-                        icon = g_themed_icon_new ("mail-message-new");
-                        queue->priv->numerable_icon = gtk_numerable_icon_new (icon);
-                        g_object_unref (icon);
-                }
-                gtk_numerable_icon_set_count (GTK_NUMERABLE_ICON (queue->priv->numerable_icon), num);
-                gtk_status_icon_set_from_gicon (queue->priv->status_icon,
-                                                queue->priv->numerable_icon);
-                gtk_status_icon_set_visible (queue->priv->status_icon, TRUE);
-
-                maybe_show_notification (queue);
+                if (dirty & UPDATE_DOCK) {
+                        if (!update_dock (queue, DOCK_ROWS_PER_FRAME)) {
+                                /* carry the rest over to the next frame */
+                                queue->priv->dirty |= UPDATE_DOCK;
+                        }
+                }
+
+                if (dirty & UPDATE_STATUS_ICON) {
+                        update_status_icon (queue, num);
+                }
+
+                if (dirty & UPDATE_BUBBLES) {
+                        maybe_show_notification (queue);
+                }
         } else {
-                if (gtk_widget_get_visible (queue->priv->dock)) {
+                if (dock_is_visible (queue)) {
                         popdown_dock (queue);
                 }
 
@@ -918,18 +2933,106 @@ update_idle (NdQueue *queue)
                         queue->priv->status_icon = NULL;
                 }
         }
+}
+
+static gboolean
+update_tick (GtkWidget     *widget,
+             GdkFrameClock *frame_clock,
+             NdQueue       *queue)
+{
+        queue->priv->tick_id = 0;
+
+        run_update (queue);
+        if (queue->priv->dirty != 0) {
+                schedule_update (queue);
+        }
+
+        return FALSE;
+}
+
+static gboolean
+update_timeout (NdQueue *queue)
+{
+        queue->priv->update_id = 0;
+
+        run_update (queue);
+        if (queue->priv->dirty != 0) {
+                schedule_update (queue);
+        }
 
         return FALSE;
 }
 
 static void
-queue_update (NdQueue *queue)
+schedule_update (NdQueue *queue)
 {
-        if (queue->priv->update_id > 0) {
-                g_source_remove (queue->priv->update_id);
+        gint64 delay;
+
+        if (queue->priv->update_id != 0 || queue->priv->tick_id != 0) {
+                return;
+        }
+
+        /* follow the dock's frame clock while it is on screen */
+        if (queue->priv->dock != NULL && gtk_widget_get_mapped (queue->priv->dock)) {
+                queue->priv->tick_id = gtk_widget_add_tick_callback (queue->priv->dock,
+                                                                     (GtkTickCallback) update_tick,
+                                                                     queue,
+                                                                     NULL);
+                return;
+        }
+
+        /* otherwise pace ourselves, a lone event is handled right away */
+        delay = queue->priv->last_update + FRAME_INTERVAL_USEC
+                - nd_clock_get_monotonic_time (queue->priv->clock);
+        delay = CLAMP (delay, 0, FRAME_INTERVAL_USEC);
+
+        queue->priv->update_id = nd_clock_timeout_add (queue->priv->clock,
+                                                       delay / G_TIME_SPAN_MILLISECOND,
+                                                       (GSourceFunc) update_timeout,
+                                                       queue);
+}
+
+static void
+queue_update (NdQueue *queue,
+              guint    flags)
+{
+        queue->priv->dirty |= flags;
+        schedule_update (queue);
+}
+
+static void
+emit_changed (NdQueue *queue)
+{
+        if (queue->priv->changed_freeze_count > 0) {
+                queue->priv->changed_pending = TRUE;
+                return;
         }
 
-        queue->priv->update_id = g_idle_add ((GSourceFunc)update_idle, queue);
+        g_signal_emit (queue, signals[CHANGED], 0);
+}
+
+/* Holds back ::changed until the matching thaw, which emits it once
+ * if anything changed in between.  Calls nest. */
+void
+nd_queue_freeze_changed (NdQueue *queue)
+{
+        g_return_if_fail (ND_IS_QUEUE (queue));
+
+        queue->priv->changed_freeze_count++;
+}
+
+void
+nd_queue_thaw_changed (NdQueue *queue)
+{
+        g_return_if_fail (ND_IS_QUEUE (queue));
+        g_return_if_fail (queue->priv->changed_freeze_count > 0);
+
+        queue->priv->changed_freeze_count--;
+        if (queue->priv->changed_freeze_count == 0
+            && queue->priv->changed_pending) {
+                queue->priv->changed_pending = FALSE;
+                g_signal_emit (queue, signals[CHANGED], 0);
+        }
 }
 
 static void
@@ -941,19 +3044,28 @@ _nd_queue_remove (NdQueue        *queue,
         id = nd_notification_get_id (notification);
         g_debug ("Removing id %u", id);
 
-        /* FIXME: withdraw currently showing bubbles */
+        cancel_expiry (queue, id);
+        g_hash_table_remove (queue->priv->history_only, GUINT_TO_POINTER (id));
+        unindex_duplicate (queue, notification);
+        unindex_tags (queue, notification);
+        unindex_history (queue, id);
+        remove_from_digest (queue, id);
 
         g_signal_handlers_disconnect_by_func (notification, G_CALLBACK (on_notification_close), queue);
+        g_signal_handlers_disconnect_by_func (notification, G_CALLBACK (on_notification_changed), queue);
 
         if (queue->priv->queue != NULL) {
                 g_queue_remove (queue->priv->queue, GUINT_TO_POINTER (id));
         }
         g_hash_table_remove (queue->priv->notifications, GUINT_TO_POINTER (id));
 
+        withdraw_bubble (queue, id);
+        update_raw_motion (queue);
+
         /* FIXME: should probably only emit this when it really removes something */
-        g_signal_emit (queue, signals[CHANGED], 0);
+        emit_changed (queue);
 
-        queue_update (queue);
+        queue_update (queue, UPDATE_ALL);
 }
 
 static void
@@ -965,6 +3077,35 @@ on_notification_close (NdNotification *notification,
         _nd_queue_remove (queue, notification);
 }
 
+static void
+on_notification_changed (NdNotification *notification,
+                         NdQueue        *queue)
+{
+        Digest *digest;
+
+        /* a replaced notification starts its timeout over, unless
+         * it only ever lives in the history */
+        if (! g_hash_table_contains (queue->priv->history_only,
+                                     GUINT_TO_POINTER (nd_notification_get_id (notification)))) {
+                schedule_expiry (queue, notification);
+        }
+
+        unindex_duplicate (queue, notification);
+        index_duplicate (queue, notification);
+        unindex_tags (queue, notification);
+        index_tags (queue, notification);
+        index_history (queue, notification);
+
+        digest = g_hash_table_lookup (queue->priv->digest_members,
+                                      GUINT_TO_POINTER (nd_notification_get_id (notification)));
+        if (digest != NULL) {
+                update_digest (queue, digest);
+        }
+
+        /* and moves to the end of the dock */
+        queue_update (queue, UPDATE_DOCK);
+}
+
 void
 nd_queue_remove_for_id (NdQueue *queue,
                         guint    id)
@@ -979,25 +3120,64 @@ nd_queue_remove_for_id (NdQueue *queue,
         }
 }
 
-void
-nd_queue_add (NdQueue        *queue,
-              NdNotification *notification)
+static void
+add_notification (NdQueue        *queue,
+                  NdNotification *notification,
+                  gboolean        show)
 {
         guint id;
 
-        g_return_if_fail (ND_IS_QUEUE (queue));
-
         id = nd_notification_get_id (notification);
         g_debug ("Adding id %u", id);
         g_hash_table_insert (queue->priv->notifications, GUINT_TO_POINTER (id), g_object_ref (notification));
-        g_queue_push_head (queue->priv->queue, GUINT_TO_POINTER (id));
+
+        /* the real thing is about to pay for whatever is left */
+        if (show) {
+                cancel_warm_up (queue);
+        }
+
+        if (show && ! add_to_digest (queue, notification)) {
+                g_queue_push_head (queue->priv->queue, GUINT_TO_POINTER (id));
+        }
 
         g_signal_connect (notification, "closed", G_CALLBACK (on_notification_close), queue);
+        g_signal_connect (notification, "changed", G_CALLBACK (on_notification_changed), queue);
+
+        /* history only entries stay until they are dismissed */
+        if (show) {
+                schedule_expiry (queue, notification);
+        }
+        index_duplicate (queue, notification);
+        index_tags (queue, notification);
+        index_history (queue, notification);
+        update_raw_motion (queue);
 
         /* FIXME: should probably only emit this when it really adds something */
-        g_signal_emit (queue, signals[CHANGED], 0);
+        emit_changed (queue);
+
+        queue_update (queue, UPDATE_ALL);
+}
+
+void
+nd_queue_add (NdQueue        *queue,
+              NdNotification *notification)
+{
+        g_return_if_fail (ND_IS_QUEUE (queue));
+
+        add_notification (queue, notification, TRUE);
+}
+
+/* Stores the notification for the dock and the history without ever
+ * showing it as a bubble. */
+void
+nd_queue_add_to_history (NdQueue        *queue,
+                         NdNotification *notification)
+{
+        g_return_if_fail (ND_IS_QUEUE (queue));
 
-        queue_update (queue);
+        g_hash_table_add (queue->priv->history_only,
+                          GUINT_TO_POINTER (nd_notification_get_id (notification)));
+        add_notification (queue, notification, FALSE);
 }
 
 NdQueue *
@@ -49,20 +49,80 @@ typedef struct
         void          (* changed) (NdQueue      *queue);
 } NdQueueClass;
 
+typedef gboolean  (* NdQueueFilterFunc) (NdNotification *notification,
+                                         gpointer        data);
+typedef void      (* NdQueueRestoreFunc) (NdNotification *notification,
+                                          gpointer        data);
+
+/* which monitor new bubbles go to */
+typedef enum
+{
+        ND_QUEUE_PLACEMENT_POINTER,
+        ND_QUEUE_PLACEMENT_FOCUS,
+        ND_QUEUE_PLACEMENT_PRIMARY
+} NdQueuePlacement;
+
+#define ND_QUEUE_STATE_TYPE G_VARIANT_TYPE ("(a(uxi(sssssasa{sv}iu))au)")
+
 GType               nd_queue_get_type                       (void);
 
 NdQueue *           nd_queue_new                            (void);
 
 guint               nd_queue_length                         (NdQueue        *queue);
+guint               nd_queue_length_active                  (NdQueue        *queue);
 
 NdNotification *    nd_queue_lookup                         (NdQueue        *queue,
                                                              guint           id);
+NdNotification *    nd_queue_lookup_duplicate               (NdQueue        *queue,
+                                                             const char     *sender,
+                                                             const char     *app_name,
+                                                             const char     *icon,
+                                                             const char     *summary,
+                                                             const char     *body);
+NdNotification *    nd_queue_lookup_tag                     (NdQueue        *queue,
+                                                             const char     *sender,
+                                                             const char     *app_name,
+                                                             const char     *tag);
+guint               nd_queue_close_by_tag                   (NdQueue        *queue,
+                                                             const char     *sender,
+                                                             const char     *app_name,
+                                                             const char     *tag);
+guint               nd_queue_close_by_app                   (NdQueue        *queue,
+                                                             const char     *sender,
+                                                             const char     *app_name);
+void                nd_queue_set_duplicate_window           (NdQueue        *queue,
+                                                             guint           seconds);
+void                nd_queue_set_single_surface             (NdQueue        *queue,
+                                                             gboolean        single_surface);
+void                nd_queue_set_placement                  (NdQueue        *queue,
+                                                             NdQueuePlacement placement);
+GList *             nd_queue_get_page                       (NdQueue        *queue,
+                                                             gint64          after_time,
+                                                             guint           after_id,
+                                                             guint           limit,
+                                                             NdQueueFilterFunc func,
+                                                             gpointer        data,
+                                                             gboolean       *more);
 
 void                nd_queue_add                            (NdQueue        *queue,
                                                              NdNotification *notification);
+void                nd_queue_add_to_history                 (NdQueue        *queue,
+                                                             NdNotification *notification);
 void                nd_queue_remove_for_id                  (NdQueue        *queue,
                                                              guint           id);
 
+GVariant *          nd_queue_save_state                     (NdQueue        *queue);
+void                nd_queue_restore_state                  (NdQueue        *queue,
+                                                             GVariant       *state,
+                                                             NdQueueRestoreFunc func,
+                                                             gpointer        data);
+
+void                nd_queue_trim                           (NdQueue        *queue);
+void                nd_queue_warm_up                        (NdQueue        *queue);
+
+void                nd_queue_freeze_changed                 (NdQueue        *queue);
+void                nd_queue_thaw_changed                   (NdQueue        *queue);
+
 G_END_DECLS
 
 #endif /* __ND_QUEUE_H */
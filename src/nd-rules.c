@@ -0,0 +1,529 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+
+#include "config.h"
+
+#include <string.h>
+#include <gio/gio.h>
+
+#include "nd-rules.h"
+
+#define ND_RULES_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), ND_TYPE_RULES, NdRulesPrivate))
+
+/* Site wide rules, one group per rule and the first rule that matches
+ * wins:
+ *
+ *   [quiet-debug]
+ *   app-name=foo
+ *   category=debug
+ *   match=^DEBUG
+ *   action=drop|history|rewrite
+ *   urgency=0
+ *   icon=dialog-information
+ *
+ * Every key but action is optional; match is a regular expression
+ * tried against the summary and the body.
+ *
+ * The rules are compiled so a Notify only looks at rules that can
+ * match: rules naming an app are found through a hash on the app
+ * name, rules naming only a category through a hash on the category,
+ * and the rest are always tried.  All the patterns are also combined
+ * into one expression that is run once, so the common case of no
+ * text rule matching costs a single pass over the text. */
+
+typedef struct
+{
+        guint           index;
+        char           *name;
+
+        char           *app_name;
+        char           *category;
+        GRegex         *regex;
+
+        NdRuleAction    action;
+        int             urgency;
+        char           *icon;
+
+        guint64         hits;
+} Rule;
+
+typedef struct
+{
+        GPtrArray      *rules;
+
+        /* app name -> rules, category -> rules, in file order */
+        GHashTable     *by_app;
+        GHashTable     *by_category;
+        GSList         *wildcard;
+
+        /* all the patterns in one, NULL if they could not be combined */
+        GRegex         *prefilter;
+} RuleSet;
+
+struct NdRulesPrivate
+{
+        char           *path;
+        GFileMonitor   *monitor;
+        RuleSet        *set;
+
+        guint64         n_evaluations;
+        guint64         evaluation_usec;
+};
+
+static void     nd_rules_class_init  (NdRulesClass *klass);
+static void     nd_rules_init        (NdRules      *rules);
+static void     nd_rules_finalize    (GObject      *object);
+
+G_DEFINE_TYPE (NdRules, nd_rules, G_TYPE_OBJECT)
+
+static void
+rule_free (Rule *rule)
+{
+        g_free (rule->name);
+        g_free (rule->app_name);
+        g_free (rule->category);
+        if (rule->regex != NULL) {
+                g_regex_unref (rule->regex);
+        }
+        g_free (rule->icon);
+        g_slice_free (Rule, rule);
+}
+
+static void
+rule_set_free (RuleSet *set)
+{
+        g_hash_table_destroy (set->by_app);
+        g_hash_table_destroy (set->by_category);
+        g_slist_free (set->wildcard);
+        if (set->prefilter != NULL) {
+                g_regex_unref (set->prefilter);
+        }
+        g_ptr_array_free (set->rules, TRUE);
+        g_slice_free (RuleSet, set);
+}
+
+static void
+index_rule (GHashTable *table,
+            const char *key,
+            Rule       *rule)
+{
+        GSList *list;
+
+        /* appending keeps the head, so the table needs no update */
+        list = g_hash_table_lookup (table, key);
+        if (list == NULL) {
+                g_hash_table_insert (table, (char *) key, g_slist_append (NULL, rule));
+        } else {
+                g_slist_append (list, rule);
+        }
+}
+
+static gboolean
+parse_action (const char   *string,
+              NdRuleAction *action)
+{
+        if (g_strcmp0 (string, "drop") == 0) {
+                *action = ND_RULE_DROP;
+        } else if (g_strcmp0 (string, "history") == 0) {
+                *action = ND_RULE_HISTORY;
+        } else if (g_strcmp0 (string, "rewrite") == 0) {
+                *action = ND_RULE_REWRITE;
+        } else if (g_strcmp0 (string, "accept") == 0) {
+                *action = ND_RULE_ACCEPT;
+        } else {
+                return FALSE;
+        }
+
+        return TRUE;
+}
+
+static Rule *
+parse_rule (GKeyFile   *key_file,
+            const char *group,
+            GError    **error)
+{
+        Rule *rule;
+        char *action;
+        char *pattern;
+
+        rule = g_slice_new0 (Rule);
+        rule->name = g_strdup (group);
+        rule->urgency = -1;
+
+        action = g_key_file_get_string (key_file, group, "action", error);
+        if (action == NULL) {
+                rule_free (rule);
+                return NULL;
+        }
+        if (! parse_action (action, &rule->action)) {
+                g_set_error (error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                             "Unknown action '%s' in rule '%s'", action, group);
+                g_free (action);
+                rule_free (rule);
+                return NULL;
+        }
+        g_free (action);
+
+        rule->app_name = g_key_file_get_string (key_file, group, "app-name", NULL);
+        rule->category = g_key_file_get_string (key_file, group, "category", NULL);
+        rule->icon = g_key_file_get_string (key_file, group, "icon", NULL);
+
+        if (g_key_file_has_key (key_file, group, "urgency", NULL)) {
+                rule->urgency = CLAMP (g_key_file_get_integer (key_file, group, "urgency", NULL), 0, 2);
+        }
+
+        pattern = g_key_file_get_string (key_file, group, "match", NULL);
+        if (pattern != NULL) {
+                rule->regex = g_regex_new (pattern, G_REGEX_OPTIMIZE, 0, error);
+                g_free (pattern);
+                if (rule->regex == NULL) {
+                        g_prefix_error (error, "In rule '%s': ", group);
+                        rule_free (rule);
+                        return NULL;
+                }
+        }
+
+        return rule;
+}
+
+/* Only patterns without back references keep their meaning when
+ * joined into one alternation. */
+static GRegex *
+combine_patterns (GPtrArray *rules)
+{
+        GString *combined;
+        GRegex  *regex;
+        guint    i;
+
+        combined = g_string_new (NULL);
+        for (i = 0; i < rules->len; i++) {
+                Rule *rule = g_ptr_array_index (rules, i);
+
+                if (rule->regex == NULL)
+                        continue;
+
+                if (g_regex_get_max_backref (rule->regex) > 0) {
+                        g_string_free (combined, TRUE);
+                        return NULL;
+                }
+
+                if (combined->len > 0)
+                        g_string_append_c (combined, '|');
+                g_string_append_printf (combined, "(?:%s)", g_regex_get_pattern (rule->regex));
+        }
+
+        regex = NULL;
+        if (combined->len > 0) {
+                regex = g_regex_new (combined->str, G_REGEX_OPTIMIZE, 0, NULL);
+        }
+        g_string_free (combined, TRUE);
+
+        return regex;
+}
+
+static RuleSet *
+rule_set_load (const char *path,
+               GError    **error)
+{
+        GKeyFile *key_file;
+        RuleSet  *set;
+        char    **groups;
+        guint     i;
+
+        key_file = g_key_file_new ();
+        if (! g_key_file_load_from_file (key_file, path, G_KEY_FILE_NONE, error)) {
+                g_key_file_free (key_file);
+                return NULL;
+        }
+
+        set = g_slice_new0 (RuleSet);
+        set->rules = g_ptr_array_new_with_free_func ((GDestroyNotify) rule_free);
+        set->by_app = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, (GDestroyNotify) g_slist_free);
+        set->by_category = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, (GDestroyNotify) g_slist_free);
+
+        groups = g_key_file_get_groups (key_file, NULL);
+        for (i = 0; groups[i] != NULL; i++) {
+                Rule *rule;
+
+                rule = parse_rule (key_file, groups[i], error);
+                if (rule == NULL) {
+                        g_strfreev (groups);
+                        g_key_file_free (key_file);
+                        rule_set_free (set);
+                        return NULL;
+                }
+
+                rule->index = set->rules->len;
+                g_ptr_array_add (set->rules, rule);
+
+                if (rule->app_name != NULL) {
+                        index_rule (set->by_app, rule->app_name, rule);
+                } else if (rule->category != NULL) {
+                        index_rule (set->by_category, rule->category, rule);
+                } else {
+                        set->wildcard = g_slist_prepend (set->wildcard, rule);
+                }
+        }
+        g_strfreev (groups);
+        g_key_file_free (key_file);
+
+        set->wildcard = g_slist_reverse (set->wildcard);
+
+        set->prefilter = combine_patterns (set->rules);
+
+        return set;
+}
+
+static void
+nd_rules_reload (NdRules *rules)
+{
+        RuleSet *set;
+        GError  *error;
+
+        error = NULL;
+        set = rule_set_load (rules->priv->path, &error);
+        if (set == NULL) {
+                /* no rules file is the normal case */
+                if (! g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+                        g_warning ("Unable to load rules from %s: %s", rules->priv->path, error->message);
+                        g_error_free (error);
+                        return;
+                }
+                g_error_free (error);
+        }
+
+        if (rules->priv->set != NULL) {
+                rule_set_free (rules->priv->set);
+        }
+        rules->priv->set = set;
+
+        g_debug ("Loaded %u rules from %s", set ? set->rules->len : 0, rules->priv->path);
+}
+
+static void
+on_rules_file_changed (GFileMonitor     *monitor,
+                       GFile            *file,
+                       GFile            *other_file,
+                       GFileMonitorEvent event,
+                       NdRules          *rules)
+{
+        if (event == G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT
+            || event == G_FILE_MONITOR_EVENT_CREATED
+            || event == G_FILE_MONITOR_EVENT_DELETED) {
+                nd_rules_reload (rules);
+        }
+}
+
+static void
+nd_rules_class_init (NdRulesClass *klass)
+{
+        GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+        object_class->finalize = nd_rules_finalize;
+
+        g_type_class_add_private (klass, sizeof (NdRulesPrivate));
+}
+
+static void
+nd_rules_init (NdRules *rules)
+{
+        rules->priv = ND_RULES_GET_PRIVATE (rules);
+}
+
+static void
+nd_rules_finalize (GObject *object)
+{
+        NdRules *rules;
+
+        g_return_if_fail (object != NULL);
+        g_return_if_fail (ND_IS_RULES (object));
+
+        rules = ND_RULES (object);
+
+        g_return_if_fail (rules->priv != NULL);
+
+        if (rules->priv->monitor != NULL) {
+                g_signal_handlers_disconnect_by_func (rules->priv->monitor,
+                                                      G_CALLBACK (on_rules_file_changed),
+                                                      rules);
+                g_object_unref (rules->priv->monitor);
+        }
+        if (rules->priv->set != NULL) {
+                rule_set_free (rules->priv->set);
+        }
+        g_free (rules->priv->path);
+
+        G_OBJECT_CLASS (nd_rules_parent_class)->finalize (object);
+}
+
+/* Loads the rules in @path and reloads them whenever it changes.  A
+ * missing file means no rules. */
+NdRules *
+nd_rules_new (const char *path)
+{
+        NdRules *rules;
+        GFile   *file;
+
+        g_return_val_if_fail (path != NULL, NULL);
+
+        rules = g_object_new (ND_TYPE_RULES, NULL);
+        rules->priv->path = g_strdup (path);
+
+        file = g_file_new_for_path (path);
+        rules->priv->monitor = g_file_monitor_file (file, G_FILE_MONITOR_NONE, NULL, NULL);
+        if (rules->priv->monitor != NULL) {
+                g_signal_connect (rules->priv->monitor,
+                                  "changed",
+                                  G_CALLBACK (on_rules_file_changed),
+                                  rules);
+        }
+        g_object_unref (file);
+
+        nd_rules_reload (rules);
+
+        return rules;
+}
+
+static gboolean
+regex_matches (GRegex     *regex,
+               const char *summary,
+               const char *body)
+{
+        return (summary != NULL && g_regex_match (regex, summary, 0, NULL))
+                || (body != NULL && g_regex_match (regex, body, 0, NULL));
+}
+
+static Rule *
+next_candidate (GSList **lists,
+                int      n_lists)
+{
+        Rule *best;
+        int   best_list;
+        int   i;
+
+        best = NULL;
+        best_list = -1;
+        for (i = 0; i < n_lists; i++) {
+                Rule *rule;
+
+                if (lists[i] == NULL)
+                        continue;
+
+                rule = lists[i]->data;
+                if (best == NULL || rule->index < best->index) {
+                        best = rule;
+                        best_list = i;
+                }
+        }
+
+        if (best != NULL) {
+                lists[best_list] = lists[best_list]->next;
+        }
+
+        return best;
+}
+
+/* Finds the first rule matching the notification and fills in
+ * @result.  Without a match the notification is accepted as is. */
+NdRuleAction
+nd_rules_evaluate (NdRules      *rules,
+                   const char   *app_name,
+                   const char   *category,
+                   const char   *summary,
+                   const char   *body,
+                   NdRuleResult *result)
+{
+        RuleSet  *set;
+        GSList   *lists[3];
+        Rule     *rule;
+        gint64    start;
+        int       text_matches;
+
+        g_return_val_if_fail (ND_IS_RULES (rules), ND_RULE_ACCEPT);
+        g_return_val_if_fail (result != NULL, ND_RULE_ACCEPT);
+
+        result->action = ND_RULE_ACCEPT;
+        result->urgency = -1;
+        result->icon = NULL;
+
+        set = rules->priv->set;
+        if (set == NULL || set->rules->len == 0)
+                return ND_RULE_ACCEPT;
+
+        start = g_get_monotonic_time ();
+
+        lists[0] = app_name ? g_hash_table_lookup (set->by_app, app_name) : NULL;
+        lists[1] = category ? g_hash_table_lookup (set->by_category, category) : NULL;
+        lists[2] = set->wildcard;
+
+        /* -1 until the combined pattern has been tried */
+        text_matches = -1;
+
+        while ((rule = next_candidate (lists, G_N_ELEMENTS (lists))) != NULL) {
+                if (rule->category != NULL && g_strcmp0 (rule->category, category) != 0)
+                        continue;
+
+                if (rule->regex != NULL) {
+                        if (text_matches < 0) {
+                                text_matches = set->prefilter == NULL
+                                        || regex_matches (set->prefilter, summary, body);
+                        }
+                        if (! text_matches
+                            || ! regex_matches (rule->regex, summary, body))
+                                continue;
+                }
+
+                rule->hits++;
+                result->action = rule->action;
+                result->urgency = rule->urgency;
+                result->icon = rule->icon;
+                break;
+        }
+
+        rules->priv->n_evaluations++;
+        rules->priv->evaluation_usec += g_get_monotonic_time () - start;
+
+        return result->action;
+}
+
+/* (a(st)tt): the hits of each rule by name, the number of evaluations
+ * and the total time they took in microseconds.  Hits start over when
+ * the rules are reloaded. */
+GVariant *
+nd_rules_get_stats (NdRules *rules)
+{
+        GVariantBuilder builder;
+        guint           i;
+
+        g_return_val_if_fail (ND_IS_RULES (rules), NULL);
+
+        g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(st)"));
+        if (rules->priv->set != NULL) {
+                for (i = 0; i < rules->priv->set->rules->len; i++) {
+                        Rule *rule = g_ptr_array_index (rules->priv->set->rules, i);
+
+                        g_variant_builder_add (&builder, "(st)", rule->name, rule->hits);
+                }
+        }
+
+        return g_variant_new ("(a(st)tt)",
+                              &builder,
+                              rules->priv->n_evaluations,
+                              rules->priv->evaluation_usec);
+}
@@ -0,0 +1,80 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+
+#ifndef __ND_RULES_H
+#define __ND_RULES_H
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define ND_TYPE_RULES         (nd_rules_get_type ())
+#define ND_RULES(o)           (G_TYPE_CHECK_INSTANCE_CAST ((o), ND_TYPE_RULES, NdRules))
+#define ND_RULES_CLASS(k)     (G_TYPE_CHECK_CLASS_CAST((k), ND_TYPE_RULES, NdRulesClass))
+#define ND_IS_RULES(o)        (G_TYPE_CHECK_INSTANCE_TYPE ((o), ND_TYPE_RULES))
+#define ND_IS_RULES_CLASS(k)  (G_TYPE_CHECK_CLASS_TYPE ((k), ND_TYPE_RULES))
+#define ND_RULES_GET_CLASS(o) (G_TYPE_INSTANCE_GET_CLASS ((o), ND_TYPE_RULES, NdRulesClass))
+
+typedef struct NdRulesPrivate NdRulesPrivate;
+
+typedef struct
+{
+        GObject         parent;
+        NdRulesPrivate *priv;
+} NdRules;
+
+typedef struct
+{
+        GObjectClass    parent_class;
+} NdRulesClass;
+
+typedef enum
+{
+        ND_RULE_ACCEPT,
+        ND_RULE_DROP,
+        /* stored but never shown as a bubble */
+        ND_RULE_HISTORY,
+        /* shown with the urgency and/or icon replaced */
+        ND_RULE_REWRITE
+} NdRuleAction;
+
+typedef struct
+{
+        NdRuleAction    action;
+        /* for ND_RULE_REWRITE, -1 and NULL leave it alone */
+        int             urgency;
+        const char     *icon;
+} NdRuleResult;
+
+GType               nd_rules_get_type                       (void);
+
+NdRules *           nd_rules_new                            (const char     *path);
+
+NdRuleAction        nd_rules_evaluate                       (NdRules        *rules,
+                                                             const char     *app_name,
+                                                             const char     *category,
+                                                             const char     *summary,
+                                                             const char     *body,
+                                                             NdRuleResult   *result);
+
+GVariant *          nd_rules_get_stats                      (NdRules        *rules);
+
+G_END_DECLS
+
+#endif /* __ND_RULES_H */
@@ -24,13 +24,9 @@
 #include <strings.h>
 #include <glib.h>
 
-#include <X11/Xproto.h>
-#include <X11/Xlib.h>
-#include <X11/Xutil.h>
-#include <X11/Xatom.h>
-#include <gdk/gdkx.h>
-
 #include "nd-stack.h"
+#include "nd-surface.h"
+#include "nd-clock.h"
 
 #define ND_STACK_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), ND_TYPE_STACK, NdStackPrivate))
 
@@ -43,9 +39,41 @@ struct NdStackPrivate
         guint           monitor;
         NdStackLocation location;
         GList          *bubbles;
+        NdClock        *clock;
         guint           update_id;
+
+        /* kept up to date by the queue, layout never asks X */
+        GdkRectangle    monitor_geometry;
+        GdkRectangle    workarea;
+
+        /* bubble -> StackEntry */
+        GHashTable     *entries;
+
+        /* one window for all bubbles instead of one each */
+        gboolean        single_surface;
+        GtkWidget      *surface;
+        gboolean        surface_placed;
+        int             surface_x;
+        int             surface_y;
 };
 
+typedef struct
+{
+        NdStack        *stack;
+        NdBubble       *bubble;
+        gulong          destroy_id;
+        gulong          changed_id;
+
+        /* size with spacing, height -1 until measured */
+        int             width;
+        int             height;
+
+        /* where the bubble was last moved to */
+        gboolean        placed;
+        int             x;
+        int             y;
+} StackEntry;
+
 static void     nd_stack_class_init  (NdStackClass *klass);
 static void     nd_stack_init        (NdStack      *stack);
 static void     nd_stack_finalize    (GObject       *object);
@@ -58,179 +86,27 @@ nd_stack_get_bubbles (NdStack *stack)
         return stack->priv->bubbles;
 }
 
-static int
-get_current_desktop (GdkScreen *screen)
-{
-        Display *display;
-        Window win;
-        Atom current_desktop, type;
-        int format;
-        unsigned long n_items, bytes_after;
-        unsigned char *data_return = NULL;
-        int workspace = 0;
-
-        display = GDK_DISPLAY_XDISPLAY (gdk_screen_get_display (screen));
-        win = XRootWindow (display, GDK_SCREEN_XNUMBER (screen));
-
-        current_desktop = XInternAtom (display, "_NET_CURRENT_DESKTOP", True);
-
-        XGetWindowProperty (display,
-                            win,
-                            current_desktop,
-                            0, G_MAXLONG,
-                            False, XA_CARDINAL,
-                            &type, &format, &n_items, &bytes_after,
-                            &data_return);
-
-        if (type == XA_CARDINAL && format == 32 && n_items > 0)
-                workspace = (int) data_return[0];
-        if (data_return)
-                XFree (data_return);
-
-        return workspace;
-}
-
-static gboolean
-get_work_area (NdStack      *stack,
-               GdkRectangle *rect)
-{
-        Atom            workarea;
-        Atom            type;
-        Window          win;
-        int             format;
-        gulong          num;
-        gulong          leftovers;
-        gulong          max_len = 4 * 32;
-        guchar         *ret_workarea;
-        long           *workareas;
-        int             result;
-        int             disp_screen;
-        int             desktop;
-        Display        *display;
-
-        display = GDK_DISPLAY_XDISPLAY (gdk_screen_get_display (stack->priv->screen));
-        workarea = XInternAtom (display, "_NET_WORKAREA", True);
-
-        disp_screen = GDK_SCREEN_XNUMBER (stack->priv->screen);
-
-        /* Defaults in case of error */
-        rect->x = 0;
-        rect->y = 0;
-        rect->width = gdk_screen_get_width (stack->priv->screen);
-        rect->height = gdk_screen_get_height (stack->priv->screen);
-
-        if (workarea == None)
-                return FALSE;
-
-        win = XRootWindow (display, disp_screen);
-        result = XGetWindowProperty (display,
-                                     win,
-                                     workarea,
-                                     0,
-                                     max_len,
-                                     False,
-                                     AnyPropertyType,
-                                     &type,
-                                     &format,
-                                     &num,
-                                     &leftovers,
-                                     &ret_workarea);
-
-        if (result != Success
-            || type == None
-            || format == 0
-            || leftovers
-            || num % 4) {
-                return FALSE;
-        }
-
-        desktop = get_current_desktop (stack->priv->screen);
-
-        workareas = (long *) ret_workarea;
-        rect->x = workareas[desktop * 4];
-        rect->y = workareas[desktop * 4 + 1];
-        rect->width = workareas[desktop * 4 + 2];
-        rect->height = workareas[desktop * 4 + 3];
-
-        XFree (ret_workarea);
-
-        return TRUE;
-}
-
 static void
-get_origin_coordinates (NdStackLocation stack_location,
-                        GdkRectangle       *workarea,
-                        gint               *x,
-                        gint               *y,
-                        gint               *shiftx,
-                        gint               *shifty,
-                        gint                width,
-                        gint                height)
+stack_entry_free (StackEntry *entry)
 {
-        switch (stack_location) {
-        case ND_STACK_LOCATION_TOP_LEFT:
-                *x = workarea->x;
-                *y = workarea->y;
-                *shifty = height;
-                break;
-
-        case ND_STACK_LOCATION_TOP_RIGHT:
-                *x = workarea->x + workarea->width - width;
-                *y = workarea->y;
-                *shifty = height;
-                break;
-
-        case ND_STACK_LOCATION_BOTTOM_LEFT:
-                *x = workarea->x;
-                *y = workarea->y + workarea->height - height;
-                break;
-
-        case ND_STACK_LOCATION_BOTTOM_RIGHT:
-                *x = workarea->x + workarea->width - width;
-                *y = workarea->y + workarea->height - height;
-                break;
-
-        default:
-                g_assert_not_reached ();
-        }
+        g_signal_handler_disconnect (entry->bubble, entry->destroy_id);
+        g_signal_handler_disconnect (nd_bubble_get_notification (entry->bubble),
+                                     entry->changed_id);
+        g_slice_free (StackEntry, entry);
 }
 
 static void
-translate_coordinates (NdStackLocation stack_location,
-                       GdkRectangle       *workarea,
-                       gint               *x,
-                       gint               *y,
-                       gint               *shiftx,
-                       gint               *shifty,
-                       gint                width,
-                       gint                height)
+measure_entry (StackEntry *entry)
 {
-        switch (stack_location) {
-        case ND_STACK_LOCATION_TOP_LEFT:
-                *x = workarea->x;
-                *y += *shifty;
-                *shifty = height;
-                break;
-
-        case ND_STACK_LOCATION_TOP_RIGHT:
-                *x = workarea->x + workarea->width - width;
-                *y += *shifty;
-                *shifty = height;
-                break;
+        GtkRequisition req;
 
-        case ND_STACK_LOCATION_BOTTOM_LEFT:
-                *x = workarea->x;
-                *y -= height;
-                break;
-
-        case ND_STACK_LOCATION_BOTTOM_RIGHT:
-                *x = workarea->x + workarea->width - width;
-                *y -= height;
-                break;
-
-        default:
-                g_assert_not_reached ();
+        if (entry->height >= 0) {
+                return;
         }
+
+        gtk_widget_get_preferred_size (GTK_WIDGET (entry->bubble), &req, NULL);
+        entry->width = req.width;
+        entry->height = req.height + NOTIFY_STACK_SPACING;
 }
 
 static void
@@ -248,6 +124,11 @@ nd_stack_init (NdStack *stack)
 {
         stack->priv = ND_STACK_GET_PRIVATE (stack);
         stack->priv->location = ND_STACK_LOCATION_DEFAULT;
+        stack->priv->clock = g_object_ref (nd_clock_get_default ());
+        stack->priv->entries = g_hash_table_new_full (NULL,
+                                                      NULL,
+                                                      NULL,
+                                                      (GDestroyNotify) stack_entry_free);
 }
 
 static void
@@ -263,21 +144,48 @@ nd_stack_finalize (GObject *object)
         g_return_if_fail (stack->priv != NULL);
 
         if (stack->priv->update_id != 0) {
-                g_source_remove (stack->priv->update_id);
+                nd_clock_source_remove (stack->priv->clock, stack->priv->update_id);
         }
+        g_object_unref (stack->priv->clock);
 
+        /* bubbles handed to another stack outlive this one */
+        g_hash_table_destroy (stack->priv->entries);
         g_list_free (stack->priv->bubbles);
 
+        if (stack->priv->surface != NULL) {
+                gtk_widget_destroy (stack->priv->surface);
+        }
+
         G_OBJECT_CLASS (nd_stack_parent_class)->finalize (object);
 }
 
+static gboolean
+location_is_top (NdStackLocation location)
+{
+        return location == ND_STACK_LOCATION_TOP_LEFT
+                || location == ND_STACK_LOCATION_TOP_RIGHT;
+}
+
 void
 nd_stack_set_location (NdStack        *stack,
                        NdStackLocation location)
 {
         g_return_if_fail (ND_IS_STACK (stack));
 
+        if (stack->priv->location == location) {
+                return;
+        }
+
+        /* the newest bubble is always next to the corner */
+        if (stack->priv->surface != NULL
+            && location_is_top (location) != location_is_top (stack->priv->location)) {
+                nd_surface_reverse (ND_SURFACE (stack->priv->surface));
+        }
+
         stack->priv->location = location;
+        if (stack->priv->bubbles != NULL) {
+                nd_stack_queue_update_position (stack);
+        }
 }
 
 NdStack *
@@ -293,9 +201,56 @@ nd_stack_new (GdkScreen *screen,
         stack->priv->screen = screen;
         stack->priv->monitor = monitor;
 
+        /* until told about the work area, use all of the monitor */
+        gdk_screen_get_monitor_geometry (screen,
+                                         monitor,
+                                         &stack->priv->monitor_geometry);
+        stack->priv->workarea = stack->priv->monitor_geometry;
+
         return stack;
 }
 
+/* Renders the whole stack into one window, see NdSurface.  This can
+ * only be switched while the stack is empty. */
+void
+nd_stack_set_single_surface (NdStack  *stack,
+                             gboolean  single_surface)
+{
+        g_return_if_fail (ND_IS_STACK (stack));
+        g_return_if_fail (stack->priv->bubbles == NULL);
+
+        stack->priv->single_surface = single_surface;
+        if (! single_surface && stack->priv->surface != NULL) {
+                gtk_widget_destroy (stack->priv->surface);
+                stack->priv->surface = NULL;
+                stack->priv->surface_placed = FALSE;
+        }
+}
+
+/* @workarea is the screen's work area on the current desktop, which
+ * the stack clips to its monitor. */
+void
+nd_stack_set_geometry (NdStack            *stack,
+                       const GdkRectangle *monitor_geometry,
+                       const GdkRectangle *workarea)
+{
+        g_return_if_fail (ND_IS_STACK (stack));
+        g_return_if_fail (monitor_geometry != NULL);
+        g_return_if_fail (workarea != NULL);
+
+        if (memcmp (&stack->priv->monitor_geometry, monitor_geometry, sizeof (GdkRectangle)) == 0
+            && memcmp (&stack->priv->workarea, workarea, sizeof (GdkRectangle)) == 0) {
+                return;
+        }
+
+        stack->priv->monitor_geometry = *monitor_geometry;
+        stack->priv->workarea = *workarea;
+
+        if (stack->priv->bubbles != NULL) {
+                nd_stack_queue_update_position (stack);
+        }
+}
+
 
 static void
 add_padding_to_rect (GdkRectangle *rect)
@@ -312,107 +267,118 @@ add_padding_to_rect (GdkRectangle *rect)
 }
 
 static void
-nd_stack_shift_notifications (NdStack     *stack,
-                              NdBubble    *bubble,
-                              GList      **nw_l,
-                              gint         init_width,
-                              gint         init_height,
-                              gint        *nw_x,
-                              gint        *nw_y)
+get_position (NdStack            *stack,
+              const GdkRectangle *workarea,
+              int                 width,
+              int                 height,
+              int                 offset,
+              int                *x,
+              int                *y)
 {
-        GdkRectangle    workarea;
-        GdkRectangle    monitor;
-        GdkRectangle   *positions;
-        GList          *l;
-        gint            x, y;
-        gint            shiftx = 0;
-        gint            shifty = 0;
-        int             i;
-        int             n_wins;
-
-        get_work_area (stack, &workarea);
-        gdk_screen_get_monitor_geometry (stack->priv->screen,
-                                         stack->priv->monitor,
-                                         &monitor);
-        gdk_rectangle_intersect (&monitor, &workarea, &workarea);
+        switch (stack->priv->location) {
+        case ND_STACK_LOCATION_TOP_LEFT:
+                *x = workarea->x;
+                *y = workarea->y + offset;
+                break;
 
-        add_padding_to_rect (&workarea);
+        case ND_STACK_LOCATION_TOP_RIGHT:
+                *x = workarea->x + workarea->width - width;
+                *y = workarea->y + offset;
+                break;
 
-        n_wins = g_list_length (stack->priv->bubbles);
-        positions = g_new0 (GdkRectangle, n_wins);
-
-        get_origin_coordinates (stack->priv->location,
-                                &workarea,
-                                &x, &y,
-                                &shiftx,
-                                &shifty,
-                                init_width,
-                                init_height);
-
-        if (nw_x != NULL)
-                *nw_x = x;
-
-        if (nw_y != NULL)
-                *nw_y = y;
-
-        for (i = 0, l = stack->priv->bubbles; l != NULL; i++, l = l->next) {
-                NdBubble       *nw2 = ND_BUBBLE (l->data);
-                GtkRequisition  req;
-
-                if (bubble == NULL || nw2 != bubble) {
-                        gtk_widget_size_request (GTK_WIDGET (nw2), &req);
-
-                        translate_coordinates (stack->priv->location,
-                                               &workarea,
-                                               &x,
-                                               &y,
-                                               &shiftx,
-                                               &shifty,
-                                               req.width,
-                                               req.height + NOTIFY_STACK_SPACING);
-                        positions[i].x = x;
-                        positions[i].y = y;
-                } else if (nw_l != NULL) {
-                        *nw_l = l;
-                        positions[i].x = -1;
-                        positions[i].y = -1;
-                }
-        }
+        case ND_STACK_LOCATION_BOTTOM_LEFT:
+                *x = workarea->x;
+                *y = workarea->y + workarea->height - offset - height;
+                break;
 
-        /* move bubbles at the bottom of the stack first
-           to avoid overlapping */
-        for (i = n_wins - 1, l = g_list_last (stack->priv->bubbles); l != NULL; i--, l = l->prev) {
-                NdBubble *nw2 = ND_BUBBLE (l->data);
+        case ND_STACK_LOCATION_BOTTOM_RIGHT:
+                *x = workarea->x + workarea->width - width;
+                *y = workarea->y + workarea->height - offset - height;
+                break;
 
-                if (bubble == NULL || nw2 != bubble) {
-                        gtk_window_move (GTK_WINDOW (nw2), positions[i].x, positions[i].y);
-                }
+        default:
+                g_assert_not_reached ();
         }
+}
 
-        g_free (positions);
+/* The surface sizes itself to its rows, so only its corner needs
+ * placing. */
+static void
+layout_surface (NdStack            *stack,
+                const GdkRectangle *workarea)
+{
+        GtkRequisition req;
+        int            x;
+        int            y;
+
+        gtk_widget_get_preferred_size (stack->priv->surface, &req, NULL);
+        get_position (stack, workarea, req.width, req.height, 0, &x, &y);
+
+        if (! stack->priv->surface_placed
+            || stack->priv->surface_x != x
+            || stack->priv->surface_y != y) {
+                gtk_window_move (GTK_WINDOW (stack->priv->surface), x, y);
+                stack->priv->surface_x = x;
+                stack->priv->surface_y = y;
+                stack->priv->surface_placed = TRUE;
+        }
 }
 
+/* Bubble k sits after the bubbles in front of it, so its offset from
+ * the corner is the sum of their heights.  Sizes are measured once
+ * and again only when the notification changes, and a bubble is only
+ * moved when its position actually changed. */
 static void
-update_position (NdStack *stack)
+layout_bubbles (NdStack *stack)
 {
-        nd_stack_shift_notifications (stack,
-                                      NULL, /* window */
-                                      NULL, /* list pointer */
-                                      0, /* init width */
-                                      0, /* init height */
-                                      NULL, /* out window x */
-                                      NULL); /* out window y */
+        GdkRectangle workarea;
+        GList       *l;
+        int          offset;
+
+        gdk_rectangle_intersect (&stack->priv->monitor_geometry,
+                                 &stack->priv->workarea,
+                                 &workarea);
+        add_padding_to_rect (&workarea);
+
+        if (stack->priv->surface != NULL) {
+                layout_surface (stack, &workarea);
+                return;
+        }
+
+        offset = 0;
+        for (l = stack->priv->bubbles; l != NULL; l = l->next) {
+                StackEntry *entry;
+                int         x;
+                int         y;
+
+                entry = g_hash_table_lookup (stack->priv->entries, l->data);
+                measure_entry (entry);
+
+                get_position (stack, &workarea, entry->width, entry->height, offset, &x, &y);
+
+                if (! entry->placed || entry->x != x || entry->y != y) {
+                        gtk_window_move (GTK_WINDOW (entry->bubble), x, y);
+                        entry->x = x;
+                        entry->y = y;
+                        entry->placed = TRUE;
+                }
+
+                offset += entry->height;
+        }
 }
 
 static gboolean
 update_position_idle (NdStack *stack)
 {
-        update_position (stack);
-
         stack->priv->update_id = 0;
+        layout_bubbles (stack);
+
         return FALSE;
 }
 
+/* Removals and content changes lay out from an idle, so everything
+ * that happened in one main loop iteration costs one pass and the
+ * moves leave in one flush. */
 void
 nd_stack_queue_update_position (NdStack *stack)
 {
@@ -420,7 +386,17 @@ nd_stack_queue_update_position (NdStack *stack)
                 return;
         }
 
-        stack->priv->update_id = g_idle_add ((GSourceFunc) update_position_idle, stack);
+        stack->priv->update_id = nd_clock_idle_add (stack->priv->clock,
+                                                    (GSourceFunc) update_position_idle,
+                                                    stack);
+}
+
+static void
+on_notification_changed (NdNotification *notification,
+                         StackEntry     *entry)
+{
+        entry->height = -1;
+        nd_stack_queue_update_position (entry->stack);
 }
 
 void
@@ -428,45 +404,65 @@ nd_stack_add_bubble (NdStack  *stack,
                      NdBubble *bubble,
                      gboolean  new_notification)
 {
-        GtkRequisition  req;
-        int             x, y;
-
-        gtk_widget_size_request (GTK_WIDGET (bubble), &req);
-        nd_stack_shift_notifications (stack,
-                                      bubble,
-                                      NULL,
-                                      req.width,
-                                      req.height + NOTIFY_STACK_SPACING,
-                                      &x,
-                                      &y);
-        gtk_widget_show (GTK_WIDGET (bubble));
-        gtk_window_move (GTK_WINDOW (bubble), x, y);
+        StackEntry *entry;
 
         if (new_notification) {
-                g_signal_connect_swapped (G_OBJECT (bubble),
-                                          "destroy",
-                                          G_CALLBACK (nd_stack_remove_bubble),
-                                          stack);
+                entry = g_slice_new0 (StackEntry);
+                entry->stack = stack;
+                entry->bubble = bubble;
+                entry->height = -1;
+                entry->destroy_id = g_signal_connect_swapped (G_OBJECT (bubble),
+                                                              "destroy",
+                                                              G_CALLBACK (nd_stack_remove_bubble),
+                                                              stack);
+                entry->changed_id = g_signal_connect (nd_bubble_get_notification (bubble),
+                                                      "changed",
+                                                      G_CALLBACK (on_notification_changed),
+                                                      entry);
+                g_hash_table_insert (stack->priv->entries, bubble, entry);
                 stack->priv->bubbles = g_list_prepend (stack->priv->bubbles, bubble);
         }
+
+        if (stack->priv->single_surface) {
+                if (stack->priv->surface == NULL) {
+                        stack->priv->surface = nd_surface_new (stack->priv->screen,
+                                                               NOTIFY_STACK_SPACING);
+                }
+                nd_surface_add_bubble (ND_SURFACE (stack->priv->surface),
+                                       bubble,
+                                       location_is_top (stack->priv->location));
+
+                layout_bubbles (stack);
+                gtk_widget_show (stack->priv->surface);
+                return;
+        }
+
+        /* the new bubble has to be in place before it is mapped */
+        layout_bubbles (stack);
+        gtk_widget_show (GTK_WIDGET (bubble));
 }
 
 void
 nd_stack_remove_bubble (NdStack  *stack,
                         NdBubble *bubble)
 {
-        GList *remove_l = NULL;
-
-        nd_stack_shift_notifications (stack,
-                                      bubble,
-                                      &remove_l,
-                                      0,
-                                      0,
-                                      NULL,
-                                      NULL);
-
-        if (remove_l != NULL)
-                stack->priv->bubbles = g_list_delete_link (stack->priv->bubbles, remove_l);
+        if (! g_hash_table_remove (stack->priv->entries, bubble)) {
+                return;
+        }
+
+        stack->priv->bubbles = g_list_remove (stack->priv->bubbles, bubble);
+
+        if (stack->priv->surface != NULL) {
+                nd_surface_remove_bubble (ND_SURFACE (stack->priv->surface), bubble);
+                if (stack->priv->bubbles == NULL) {
+                        gtk_widget_hide (stack->priv->surface);
+                } else {
+                        nd_stack_queue_update_position (stack);
+                }
+                return;
+        }
+
+        nd_stack_queue_update_position (stack);
 
         if (gtk_widget_get_realized (GTK_WIDGET (bubble)))
                 gtk_widget_unrealize (GTK_WIDGET (bubble));
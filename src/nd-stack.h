@@ -64,6 +64,11 @@ NdStack *       nd_stack_new                   (GdkScreen      *screen,
 
 void            nd_stack_set_location          (NdStack        *stack,
                                                 NdStackLocation location);
+void            nd_stack_set_single_surface    (NdStack        *stack,
+                                                gboolean        single_surface);
+void            nd_stack_set_geometry          (NdStack            *stack,
+                                                const GdkRectangle *monitor_geometry,
+                                                const GdkRectangle *workarea);
 void            nd_stack_add_bubble            (NdStack        *stack,
                                                 NdBubble       *bubble,
                                                 gboolean        new_notification);
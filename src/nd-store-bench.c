@@ -0,0 +1,233 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib/gi18n.h>
+#include <glib.h>
+
+#include "nd-notification.h"
+#include "nd-intern.h"
+#include "nd-memory.h"
+
+/* Fills a store with notifications from a dozen clients, the way a
+ * long session does, and reports what each one costs: resident
+ * memory, what the daemon accounts for it, and what the interned
+ * sender, app name, icon and hint keys would cost again as private
+ * copies, which is how they were kept before they were interned.
+ * The store cannot be grown this far over D-Bus, the daemon only
+ * keeps a handful of bubbles queued. */
+
+#define N_CLIENTS 12
+
+static const char *hint_keys[] = {
+        "category",
+        "urgency",
+        "desktop-entry",
+        "suppress-sound",
+        NULL
+};
+
+static int n_notifications = 50000;
+
+static GOptionEntry entries[] = {
+        { "notifications", 'n', 0, G_OPTION_ARG_INT, &n_notifications,
+          N_("Number of notifications to store"), N_("N") },
+        { NULL }
+};
+
+static gsize
+get_resident (void)
+{
+        char  *contents;
+        gsize  size;
+        gsize  resident;
+
+        /* the second field is the resident set in pages */
+        if (! g_file_get_contents ("/proc/self/statm", &contents, NULL, NULL))
+                return 0;
+
+        size = 0;
+        resident = 0;
+        if (sscanf (contents, "%" G_GSIZE_FORMAT " %" G_GSIZE_FORMAT, &size, &resident) != 2)
+                resident = 0;
+        g_free (contents);
+
+        return resident * sysconf (_SC_PAGESIZE);
+}
+
+static GVariant *
+build_hints (int client)
+{
+        GVariantBuilder builder;
+
+        g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
+        g_variant_builder_add (&builder, "{sv}", hint_keys[0],
+                               g_variant_new_string (client % 2 ? "im.received" : "email.arrived"));
+        g_variant_builder_add (&builder, "{sv}", hint_keys[1],
+                               g_variant_new_byte (1));
+        g_variant_builder_add (&builder, "{sv}", hint_keys[2],
+                               g_variant_new_printf ("client-%d", client));
+        g_variant_builder_add (&builder, "{sv}", hint_keys[3],
+                               g_variant_new_boolean (FALSE));
+
+        return g_variant_ref_sink (g_variant_builder_end (&builder));
+}
+
+static void
+print_row (const char *what,
+           gssize      bytes)
+{
+        g_print ("  %-32s %10.1f bytes per notification\n",
+                 what,
+                 (double) bytes / n_notifications);
+}
+
+int
+main (int argc, char **argv)
+{
+        GOptionContext  *context;
+        GError          *error;
+        GPtrArray       *store;
+        GVariant        *hints[N_CLIENTS];
+        char           **copies;
+        int              n_copies;
+        gsize            resident;
+        gsize            accounted;
+        gsize            store_resident;
+        gsize            store_accounted;
+        gsize            copies_resident;
+        guint            n_strings;
+        guint            n_refs;
+        gsize            n_bytes;
+        int              i;
+        int              j;
+
+        context = g_option_context_new (NULL);
+        g_option_context_set_summary (context, _("Measure the memory each stored notification costs."));
+        g_option_context_add_main_entries (context, entries, GETTEXT_PACKAGE);
+
+        error = NULL;
+        if (! g_option_context_parse (context, &argc, &argv, &error)) {
+                g_printerr ("%s\n", error->message);
+                g_error_free (error);
+                g_option_context_free (context);
+                return 1;
+        }
+        g_option_context_free (context);
+
+        if (n_notifications <= 0)
+                return 0;
+
+        for (i = 0; i < N_CLIENTS; i++) {
+                hints[i] = build_hints (i);
+        }
+
+        /* sized and touched up front, so the pointers themselves are
+           not counted, the notifications hold them either way */
+        n_copies = n_notifications * (3 + (int) G_N_ELEMENTS (hint_keys) - 1);
+        copies = g_new (char *, n_copies);
+        memset (copies, 0, n_copies * sizeof (char *));
+        store = g_ptr_array_sized_new (n_notifications);
+        memset (store->pdata, 0, n_notifications * sizeof (gpointer));
+
+        resident = get_resident ();
+        accounted = nd_memory_get_total ();
+
+        for (i = 0; i < n_notifications; i++) {
+                NdNotification *notification;
+                GVariantIter    hints_iter;
+                const char     *actions[] = { "default", "Open", NULL };
+                char           *sender;
+                char           *app_name;
+                char           *icon;
+                char           *summary;
+                char           *body;
+                int             client;
+
+                client = i % N_CLIENTS;
+                sender = g_strdup_printf (":1.%d", 100 + client);
+                app_name = g_strdup_printf ("Application %d", client);
+                icon = g_strdup_printf ("application-%d-symbolic", client);
+                summary = g_strdup_printf ("Message %d", i);
+                body = g_strdup_printf ("Body of message %d from application %d", i, client);
+
+                g_variant_iter_init (&hints_iter, hints[client]);
+
+                notification = nd_notification_new (sender);
+                nd_notification_update (notification,
+                                        app_name,
+                                        icon,
+                                        summary,
+                                        body,
+                                        actions,
+                                        &hints_iter,
+                                        -1);
+                g_ptr_array_add (store, notification);
+
+                g_free (body);
+                g_free (summary);
+                g_free (icon);
+                g_free (app_name);
+                g_free (sender);
+        }
+
+        store_resident = get_resident () - resident;
+        store_accounted = nd_memory_get_total () - accounted;
+        nd_intern_get_stats (&n_strings, &n_refs, &n_bytes);
+
+        /* the same strings again, one private copy per notification */
+        resident = get_resident ();
+        for (i = 0, j = 0; i < n_notifications; i++) {
+                NdNotification *notification = g_ptr_array_index (store, i);
+                int             k;
+
+                copies[j++] = g_strdup (nd_notification_get_sender (notification));
+                copies[j++] = g_strdup (nd_notification_get_app_name (notification));
+                copies[j++] = g_strdup (nd_notification_get_icon (notification));
+                for (k = 0; hint_keys[k] != NULL; k++) {
+                        copies[j++] = g_strdup (hint_keys[k]);
+                }
+        }
+        copies_resident = get_resident () - resident;
+
+        g_print ("%d stored notifications from %d clients\n", n_notifications, N_CLIENTS);
+        print_row ("resident, interned", store_resident);
+        print_row ("accounted by the daemon", store_accounted);
+        print_row ("resident, private copies", store_resident + copies_resident);
+        g_print ("  %u interned strings, %u references, %" G_GSIZE_FORMAT " bytes\n",
+                 n_strings, n_refs, n_bytes);
+
+        for (i = 0; i < n_copies; i++) {
+                g_free (copies[i]);
+        }
+        g_free (copies);
+        g_ptr_array_foreach (store, (GFunc) g_object_unref, NULL);
+        g_ptr_array_free (store, TRUE);
+        for (i = 0; i < N_CLIENTS; i++) {
+                g_variant_unref (hints[i]);
+        }
+
+        return 0;
+}
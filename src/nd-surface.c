@@ -0,0 +1,363 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+
+
+#include "config.h"
+
+#include <glib.h>
+
+#include "nd-surface.h"
+#include "nd-usage.h"
+
+#define ND_SURFACE_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), ND_TYPE_SURFACE, NdSurfacePrivate))
+
+/* One window showing the content of every bubble of a stack.  Each
+ * bubble's content is reparented into a row of its own, which paints
+ * the bubble background and hands crossing and button events back to
+ * the bubble, so the queue and the bubble behave as if the bubble's
+ * own window had been shown.  Buttons and links inside the content
+ * get their events from GTK directly. */
+
+struct NdSurfacePrivate
+{
+        GtkWidget      *box;
+        gboolean        composited;
+
+        /* bubble -> row */
+        GHashTable     *rows;
+};
+
+static void     nd_surface_class_init  (NdSurfaceClass *klass);
+static void     nd_surface_init        (NdSurface      *surface);
+static void     nd_surface_finalize    (GObject        *object);
+
+G_DEFINE_TYPE (NdSurface, nd_surface, GTK_TYPE_WINDOW)
+
+static void
+add_row_to_region (GtkWidget      *row,
+                   cairo_region_t *region)
+{
+        GtkAllocation allocation;
+
+        gtk_widget_get_allocation (row, &allocation);
+        cairo_region_union_rectangle (region, (cairo_rectangle_int_t *) &allocation);
+}
+
+/* Without a compositor the gaps between rows would show whatever was
+ * below the window when it was mapped, so cut them out. */
+static void
+update_shape (NdSurface *surface)
+{
+        cairo_region_t *region;
+
+        if (surface->priv->composited) {
+                gtk_widget_shape_combine_region (GTK_WIDGET (surface), NULL);
+                return;
+        }
+
+        region = cairo_region_create ();
+        gtk_container_foreach (GTK_CONTAINER (surface->priv->box),
+                               (GtkCallback) add_row_to_region,
+                               region);
+        gtk_widget_shape_combine_region (GTK_WIDGET (surface), region);
+        cairo_region_destroy (region);
+}
+
+static void
+nd_surface_size_allocate (GtkWidget     *widget,
+                          GtkAllocation *allocation)
+{
+        GTK_WIDGET_CLASS (nd_surface_parent_class)->size_allocate (widget, allocation);
+
+        update_shape (ND_SURFACE (widget));
+}
+
+static void
+nd_surface_composited_changed (GtkWidget *widget)
+{
+        NdSurface *surface = ND_SURFACE (widget);
+
+        surface->priv->composited = gdk_screen_is_composited (gtk_widget_get_screen (widget));
+        update_shape (surface);
+        gtk_widget_queue_draw (widget);
+}
+
+static gboolean
+nd_surface_draw (GtkWidget *widget,
+                 cairo_t   *cr)
+{
+        NdSurface *surface = ND_SURFACE (widget);
+
+        cairo_save (cr);
+        if (surface->priv->composited) {
+                cairo_set_source_rgba (cr, 1.0, 1.0, 1.0, 0.0);
+        } else {
+                /* the rounded corners of the rows are not shaped out */
+                gdk_cairo_set_source_color (cr, &gtk_widget_get_style (widget)->bg[GTK_STATE_NORMAL]);
+        }
+        cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
+        cairo_paint (cr);
+        cairo_restore (cr);
+
+        return GTK_WIDGET_CLASS (nd_surface_parent_class)->draw (widget, cr);
+}
+
+static void
+nd_surface_class_init (NdSurfaceClass *klass)
+{
+        GObjectClass   *object_class = G_OBJECT_CLASS (klass);
+        GtkWidgetClass *widget_class = GTK_WIDGET_CLASS (klass);
+
+        object_class->finalize = nd_surface_finalize;
+
+        widget_class->draw = nd_surface_draw;
+        widget_class->size_allocate = nd_surface_size_allocate;
+        widget_class->composited_changed = nd_surface_composited_changed;
+
+        g_type_class_add_private (klass, sizeof (NdSurfacePrivate));
+}
+
+static void
+nd_surface_init (NdSurface *surface)
+{
+        surface->priv = ND_SURFACE_GET_PRIVATE (surface);
+
+        /* rows belong to the box, they are not destroyed from here */
+        surface->priv->rows = g_hash_table_new (NULL, NULL);
+}
+
+static void
+nd_surface_finalize (GObject *object)
+{
+        NdSurface *surface;
+
+        g_return_if_fail (object != NULL);
+        g_return_if_fail (ND_IS_SURFACE (object));
+
+        surface = ND_SURFACE (object);
+
+        g_return_if_fail (surface->priv != NULL);
+
+        g_hash_table_destroy (surface->priv->rows);
+
+        G_OBJECT_CLASS (nd_surface_parent_class)->finalize (object);
+}
+
+GtkWidget *
+nd_surface_new (GdkScreen *screen,
+                int        spacing)
+{
+        NdSurface *surface;
+        GdkVisual *visual;
+
+        g_return_val_if_fail (GDK_IS_SCREEN (screen), NULL);
+
+        surface = g_object_new (ND_TYPE_SURFACE,
+                                "app-paintable", TRUE,
+                                "type", GTK_WINDOW_POPUP,
+                                "title", "Notifications",
+                                "resizable", FALSE,
+                                "type-hint", GDK_WINDOW_TYPE_HINT_NOTIFICATION,
+                                "screen", screen,
+                                NULL);
+
+        visual = gdk_screen_get_rgba_visual (screen);
+        if (visual == NULL) {
+                visual = gdk_screen_get_system_visual (screen);
+        }
+        gtk_widget_set_visual (GTK_WIDGET (surface), visual);
+        surface->priv->composited = gdk_screen_is_composited (screen);
+
+        surface->priv->box = gtk_vbox_new (FALSE, spacing);
+        gtk_widget_show (surface->priv->box);
+        gtk_container_add (GTK_CONTAINER (surface), surface->priv->box);
+
+        return GTK_WIDGET (surface);
+}
+
+static gboolean
+on_row_draw (GtkWidget *row,
+             cairo_t   *cr,
+             NdBubble  *bubble)
+{
+        GtkWidget *child;
+        gint64     start;
+
+        /* the content has moved to another surface */
+        child = gtk_bin_get_child (GTK_BIN (row));
+        if (child == NULL) {
+                return TRUE;
+        }
+
+        start = nd_usage_get_cpu_time ();
+
+        nd_bubble_paint_background (bubble,
+                                    cr,
+                                    gtk_widget_get_allocated_width (row),
+                                    gtk_widget_get_allocated_height (row));
+        gtk_container_propagate_draw (GTK_CONTAINER (row), child, cr);
+
+        nd_usage_charge (nd_bubble_get_notification (bubble), ND_USAGE_RENDER, start);
+
+        return TRUE;
+}
+
+static gboolean
+on_row_enter_notify_event (GtkWidget        *row,
+                           GdkEventCrossing *event,
+                           NdBubble         *bubble)
+{
+        gboolean handled = FALSE;
+
+        g_signal_emit_by_name (bubble, "enter-notify-event", event, &handled);
+
+        return handled;
+}
+
+static gboolean
+on_row_leave_notify_event (GtkWidget        *row,
+                           GdkEventCrossing *event,
+                           NdBubble         *bubble)
+{
+        gboolean handled = FALSE;
+
+        /* the input window of the row sits below the content, moving
+         * onto a button leaves it without leaving the bubble */
+        if (event->detail == GDK_NOTIFY_INFERIOR
+            || (event->x >= 0 && event->x < gtk_widget_get_allocated_width (row)
+                && event->y >= 0 && event->y < gtk_widget_get_allocated_height (row))) {
+                return FALSE;
+        }
+
+        g_signal_emit_by_name (bubble, "leave-notify-event", event, &handled);
+
+        return handled;
+}
+
+static gboolean
+on_row_button_release_event (GtkWidget      *row,
+                             GdkEventButton *event,
+                             NdBubble       *bubble)
+{
+        gboolean handled = FALSE;
+
+        /* may destroy the bubble, and with it this row */
+        g_signal_emit_by_name (bubble, "button-release-event", event, &handled);
+
+        return handled;
+}
+
+static void
+reparent (GtkWidget *widget,
+          GtkWidget *new_parent)
+{
+        GtkWidget *parent;
+
+        g_object_ref (widget);
+        parent = gtk_widget_get_parent (widget);
+        if (parent != NULL) {
+                gtk_container_remove (GTK_CONTAINER (parent), widget);
+        }
+        gtk_container_add (GTK_CONTAINER (new_parent), widget);
+        g_object_unref (widget);
+}
+
+/* Takes the content out of @bubble, or out of the surface it was
+ * shown in before.  The bubble itself must not be shown. */
+void
+nd_surface_add_bubble (NdSurface *surface,
+                       NdBubble  *bubble,
+                       gboolean   at_start)
+{
+        GtkWidget *row;
+
+        g_return_if_fail (ND_IS_SURFACE (surface));
+        g_return_if_fail (ND_IS_BUBBLE (bubble));
+
+        if (g_hash_table_lookup (surface->priv->rows, bubble) != NULL) {
+                return;
+        }
+
+        row = gtk_event_box_new ();
+        gtk_event_box_set_visible_window (GTK_EVENT_BOX (row), FALSE);
+        gtk_widget_add_events (row,
+                               GDK_ENTER_NOTIFY_MASK
+                               | GDK_LEAVE_NOTIFY_MASK
+                               | GDK_BUTTON_PRESS_MASK
+                               | GDK_BUTTON_RELEASE_MASK);
+        atk_object_set_role (gtk_widget_get_accessible (row), ATK_ROLE_ALERT);
+
+        g_signal_connect (row, "draw", G_CALLBACK (on_row_draw), bubble);
+        g_signal_connect (row, "enter-notify-event", G_CALLBACK (on_row_enter_notify_event), bubble);
+        g_signal_connect (row, "leave-notify-event", G_CALLBACK (on_row_leave_notify_event), bubble);
+        g_signal_connect (row, "button-release-event", G_CALLBACK (on_row_button_release_event), bubble);
+
+        reparent (nd_bubble_get_content (bubble), row);
+
+        gtk_box_pack_start (GTK_BOX (surface->priv->box), row, FALSE, FALSE, 0);
+        if (at_start) {
+                gtk_box_reorder_child (GTK_BOX (surface->priv->box), row, 0);
+        }
+        gtk_widget_show (row);
+
+        g_hash_table_insert (surface->priv->rows, bubble, row);
+}
+
+/* Gives the content back to @bubble unless it is being destroyed,
+ * in which case the content goes with the row. */
+void
+nd_surface_remove_bubble (NdSurface *surface,
+                          NdBubble  *bubble)
+{
+        GtkWidget *row;
+        GtkWidget *content;
+
+        g_return_if_fail (ND_IS_SURFACE (surface));
+        g_return_if_fail (ND_IS_BUBBLE (bubble));
+
+        row = g_hash_table_lookup (surface->priv->rows, bubble);
+        if (row == NULL) {
+                return;
+        }
+        g_hash_table_remove (surface->priv->rows, bubble);
+
+        content = nd_bubble_get_content (bubble);
+        if (! gtk_widget_in_destruction (GTK_WIDGET (bubble))
+            && gtk_widget_get_parent (content) == row) {
+                reparent (content, GTK_WIDGET (bubble));
+        }
+
+        gtk_widget_destroy (row);
+}
+
+/* for when the stack moves between the top and the bottom */
+void
+nd_surface_reverse (NdSurface *surface)
+{
+        GList *children;
+        GList *l;
+
+        g_return_if_fail (ND_IS_SURFACE (surface));
+
+        children = gtk_container_get_children (GTK_CONTAINER (surface->priv->box));
+        for (l = children; l != NULL; l = l->next) {
+                gtk_box_reorder_child (GTK_BOX (surface->priv->box), l->data, 0);
+        }
+        g_list_free (children);
+}
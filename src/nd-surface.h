@@ -0,0 +1,63 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+
+
+#ifndef __ND_SURFACE_H
+#define __ND_SURFACE_H
+
+#include <gtk/gtk.h>
+#include "nd-bubble.h"
+
+G_BEGIN_DECLS
+
+#define ND_TYPE_SURFACE         (nd_surface_get_type ())
+#define ND_SURFACE(o)           (G_TYPE_CHECK_INSTANCE_CAST ((o), ND_TYPE_SURFACE, NdSurface))
+#define ND_SURFACE_CLASS(k)     (G_TYPE_CHECK_CLASS_CAST((k), ND_TYPE_SURFACE, NdSurfaceClass))
+#define ND_IS_SURFACE(o)        (G_TYPE_CHECK_INSTANCE_TYPE ((o), ND_TYPE_SURFACE))
+#define ND_IS_SURFACE_CLASS(k)  (G_TYPE_CHECK_CLASS_TYPE ((k), ND_TYPE_SURFACE))
+#define ND_SURFACE_GET_CLASS(o) (G_TYPE_INSTANCE_GET_CLASS ((o), ND_TYPE_SURFACE, NdSurfaceClass))
+
+typedef struct NdSurfacePrivate NdSurfacePrivate;
+
+typedef struct
+{
+        GtkWindow         parent;
+        NdSurfacePrivate *priv;
+} NdSurface;
+
+typedef struct
+{
+        GtkWindowClass    parent_class;
+} NdSurfaceClass;
+
+GType               nd_surface_get_type                     (void);
+
+GtkWidget *         nd_surface_new                          (GdkScreen      *screen,
+                                                             int             spacing);
+
+void                nd_surface_add_bubble                   (NdSurface      *surface,
+                                                             NdBubble       *bubble,
+                                                             gboolean        at_start);
+void                nd_surface_remove_bubble                (NdSurface      *surface,
+                                                             NdBubble       *bubble);
+void                nd_surface_reverse                      (NdSurface      *surface);
+
+G_END_DECLS
+
+#endif /* __ND_SURFACE_H */
@@ -0,0 +1,475 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include "config.h"
+
+#include <glib.h>
+
+#include "nd-timer-wheel.h"
+
+/* A hierarchical timing wheel: WHEEL_LEVELS rings of WHEEL_SIZE
+ * slots each.  Level 0 has one slot per tick, every higher level
+ * covers a whole rotation of the level below and is cascaded down
+ * when that level wraps.  A single clock wakeup is armed for the
+ * next tick that has work, so the number of wakeups does not depend
+ * on how many timers are live. */
+
+#define TICK_USEC     (100 * G_TIME_SPAN_MILLISECOND)
+#define WHEEL_BITS    6
+#define WHEEL_SIZE    (1 << WHEEL_BITS)
+#define WHEEL_MASK    (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS  4
+#define MAX_TICKS     (((guint64) 1 << (WHEEL_BITS * WHEEL_LEVELS)) - 1)
+
+struct NdTimer
+{
+        NdTimer      *prev;
+        NdTimer      *next;
+        NdTimer     **head;
+
+        gint64        deadline;
+        gint64        remaining;
+        gboolean      paused;
+        gboolean      firing;
+
+        NdTimerFunc   func;
+        gpointer      data;
+};
+
+struct NdTimerWheel
+{
+        NdTimer       *slots[WHEEL_LEVELS][WHEEL_SIZE];
+        NdTimer       *expired;
+
+        /* next tick that has not been processed yet */
+        guint64        base;
+        gint64         start_time;
+
+        guint          n_timers;
+        guint          n_slotted;
+
+        NdClock       *clock;
+        NdClockWakeup *wakeup;
+};
+
+static void
+timer_link (NdTimer **head,
+            NdTimer  *timer)
+{
+        timer->prev = NULL;
+        timer->next = *head;
+        if (*head != NULL)
+                (*head)->prev = timer;
+        *head = timer;
+        timer->head = head;
+}
+
+static void
+timer_unlink (NdTimer *timer)
+{
+        if (timer->prev != NULL)
+                timer->prev->next = timer->next;
+        else
+                *timer->head = timer->next;
+
+        if (timer->next != NULL)
+                timer->next->prev = timer->prev;
+
+        timer->prev = NULL;
+        timer->next = NULL;
+        timer->head = NULL;
+}
+
+static guint64
+get_current_tick (NdTimerWheel *wheel)
+{
+        return (nd_clock_get_monotonic_time (wheel->clock) - wheel->start_time) / TICK_USEC;
+}
+
+static guint64
+get_deadline_tick (NdTimerWheel *wheel,
+                   gint64        deadline)
+{
+        if (deadline <= wheel->start_time)
+                return 0;
+
+        /* round up, a timer must never fire early */
+        return (deadline - wheel->start_time + TICK_USEC - 1) / TICK_USEC;
+}
+
+static void
+slot_timer (NdTimerWheel *wheel,
+            NdTimer      *timer)
+{
+        guint64 expires;
+        guint64 delta;
+        int     level;
+
+        expires = MAX (get_deadline_tick (wheel, timer->deadline), wheel->base);
+        delta = expires - wheel->base;
+        if (delta > MAX_TICKS) {
+                /* beyond the outermost ring, park it as far out as
+                   possible and re-slot it when it comes around */
+                delta = MAX_TICKS;
+                expires = wheel->base + MAX_TICKS;
+        }
+
+        for (level = 0; level < WHEEL_LEVELS - 1; level++) {
+                if (delta < ((guint64) 1 << (WHEEL_BITS * (level + 1))))
+                        break;
+        }
+
+        timer_link (&wheel->slots[level][(expires >> (WHEEL_BITS * level)) & WHEEL_MASK],
+                    timer);
+}
+
+static void
+cascade (NdTimerWheel *wheel,
+         int           level,
+         guint         index)
+{
+        NdTimer *list;
+
+        list = wheel->slots[level][index];
+        wheel->slots[level][index] = NULL;
+
+        while (list != NULL) {
+                NdTimer *timer = list;
+
+                list = list->next;
+                timer->prev = NULL;
+                timer->next = NULL;
+                timer->head = NULL;
+                slot_timer (wheel, timer);
+        }
+}
+
+static void
+run_tick (NdTimerWheel *wheel)
+{
+        NdTimer *list;
+        guint    index;
+        int      level;
+
+        /* pull the higher levels down every time the one below wraps */
+        if ((wheel->base & WHEEL_MASK) == 0) {
+                for (level = 1; level < WHEEL_LEVELS; level++) {
+                        index = (wheel->base >> (WHEEL_BITS * level)) & WHEEL_MASK;
+                        cascade (wheel, level, index);
+                        if (index != 0)
+                                break;
+                }
+        }
+
+        index = wheel->base & WHEEL_MASK;
+        list = wheel->slots[0][index];
+        wheel->slots[0][index] = NULL;
+
+        while (list != NULL) {
+                NdTimer *timer = list;
+
+                list = list->next;
+                timer->prev = NULL;
+                timer->next = NULL;
+                timer->head = NULL;
+
+                if (get_deadline_tick (wheel, timer->deadline) > wheel->base) {
+                        slot_timer (wheel, timer);
+                } else {
+                        wheel->n_slotted--;
+                        timer_link (&wheel->expired, timer);
+                }
+        }
+
+        wheel->base++;
+}
+
+/* The earliest tick at which the wheel has something to do, either
+ * firing a level 0 slot or cascading a higher one. */
+static guint64
+get_next_tick (NdTimerWheel *wheel)
+{
+        guint64 next;
+        int     level;
+        guint   i;
+
+        next = G_MAXUINT64;
+        if (wheel->n_slotted == 0)
+                return next;
+
+        for (level = 0; level < WHEEL_LEVELS; level++) {
+                int     shift = WHEEL_BITS * level;
+                guint64 current = wheel->base >> shift;
+
+                for (i = 0; i < WHEEL_SIZE; i++) {
+                        guint64 tick;
+                        guint   offset;
+
+                        if (wheel->slots[level][i] == NULL)
+                                continue;
+
+                        offset = (i - (guint) (current & WHEEL_MASK)) & WHEEL_MASK;
+                        if (level == 0) {
+                                tick = wheel->base + offset;
+                        } else {
+                                /* the current slot was already cascaded
+                                   unless we sit right on its boundary */
+                                if (offset == 0
+                                    && (wheel->base & (((guint64) 1 << shift) - 1)) != 0)
+                                        offset = WHEEL_SIZE;
+                                tick = (current + offset) << shift;
+                        }
+
+                        next = MIN (next, tick);
+                }
+        }
+
+        return next;
+}
+
+static void
+update_wakeup (NdTimerWheel *wheel)
+{
+        guint64 next;
+
+        next = get_next_tick (wheel);
+        if (next == G_MAXUINT64) {
+                nd_clock_wakeup_set (wheel->clock, wheel->wakeup, -1);
+        } else {
+                nd_clock_wakeup_set (wheel->clock,
+                                     wheel->wakeup,
+                                     wheel->start_time + (gint64) next * TICK_USEC);
+        }
+}
+
+/* Nothing is slotted, so the processed position can simply jump to
+ * the present.  Keeps new timers in the lowest level they fit. */
+static void
+catch_up (NdTimerWheel *wheel)
+{
+        if (wheel->n_slotted == 0)
+                wheel->base = MAX (wheel->base, get_current_tick (wheel) + 1);
+}
+
+static void
+fire_expired (NdTimerWheel *wheel)
+{
+        while (wheel->expired != NULL) {
+                NdTimer *timer = wheel->expired;
+
+                timer_unlink (timer);
+                wheel->n_timers--;
+
+                timer->firing = TRUE;
+                timer->func (timer->data);
+                g_slice_free (NdTimer, timer);
+        }
+}
+
+static void
+nd_timer_wheel_run (gpointer data)
+{
+        NdTimerWheel *wheel = data;
+        guint64 now;
+
+        now = get_current_tick (wheel);
+        for (;;) {
+                guint64 next;
+
+                next = get_next_tick (wheel);
+                if (next > now) {
+                        wheel->base = MAX (wheel->base, now + 1);
+                        break;
+                }
+
+                /* nothing lives between base and next */
+                wheel->base = next;
+                run_tick (wheel);
+        }
+
+        /* expire everything that came due in one batch */
+        fire_expired (wheel);
+
+        update_wakeup (wheel);
+}
+
+NdTimerWheel *
+nd_timer_wheel_new (NdClock *clock)
+{
+        NdTimerWheel *wheel;
+
+        g_return_val_if_fail (ND_IS_CLOCK (clock), NULL);
+
+        wheel = g_new0 (NdTimerWheel, 1);
+        wheel->clock = g_object_ref (clock);
+        wheel->start_time = nd_clock_get_monotonic_time (clock);
+        wheel->wakeup = nd_clock_wakeup_new (clock, nd_timer_wheel_run, wheel);
+
+        return wheel;
+}
+
+static void
+free_list (NdTimer *list)
+{
+        while (list != NULL) {
+                NdTimer *timer = list;
+
+                list = list->next;
+                g_slice_free (NdTimer, timer);
+        }
+}
+
+void
+nd_timer_wheel_free (NdTimerWheel *wheel)
+{
+        int level;
+        int i;
+
+        g_return_if_fail (wheel != NULL);
+
+        for (level = 0; level < WHEEL_LEVELS; level++) {
+                for (i = 0; i < WHEEL_SIZE; i++) {
+                        free_list (wheel->slots[level][i]);
+                }
+        }
+        free_list (wheel->expired);
+
+        nd_clock_wakeup_free (wheel->clock, wheel->wakeup);
+        g_object_unref (wheel->clock);
+
+        g_free (wheel);
+}
+
+NdTimer *
+nd_timer_wheel_add (NdTimerWheel *wheel,
+                    guint         msec,
+                    NdTimerFunc   func,
+                    gpointer      data)
+{
+        NdTimer *timer;
+
+        g_return_val_if_fail (wheel != NULL, NULL);
+        g_return_val_if_fail (func != NULL, NULL);
+
+        catch_up (wheel);
+
+        timer = g_slice_new0 (NdTimer);
+        timer->deadline = nd_clock_get_monotonic_time (wheel->clock)
+                + (gint64) msec * G_TIME_SPAN_MILLISECOND;
+        timer->func = func;
+        timer->data = data;
+
+        slot_timer (wheel, timer);
+        wheel->n_timers++;
+        wheel->n_slotted++;
+
+        update_wakeup (wheel);
+
+        return timer;
+}
+
+void
+nd_timer_wheel_remove (NdTimerWheel *wheel,
+                       NdTimer      *timer)
+{
+        g_return_if_fail (wheel != NULL);
+        g_return_if_fail (timer != NULL);
+
+        /* it is freed once its callback returns */
+        if (timer->firing)
+                return;
+
+        if (timer->head != NULL) {
+                if (timer->head != &wheel->expired)
+                        wheel->n_slotted--;
+                timer_unlink (timer);
+        }
+        wheel->n_timers--;
+
+        g_slice_free (NdTimer, timer);
+
+        update_wakeup (wheel);
+}
+
+void
+nd_timer_wheel_pause (NdTimerWheel *wheel,
+                      NdTimer      *timer)
+{
+        g_return_if_fail (wheel != NULL);
+        g_return_if_fail (timer != NULL);
+
+        if (timer->paused || timer->firing)
+                return;
+
+        timer->remaining = MAX (timer->deadline - nd_clock_get_monotonic_time (wheel->clock), 0);
+        timer->paused = TRUE;
+
+        if (timer->head != NULL) {
+                if (timer->head != &wheel->expired)
+                        wheel->n_slotted--;
+                timer_unlink (timer);
+        }
+
+        update_wakeup (wheel);
+}
+
+void
+nd_timer_wheel_resume (NdTimerWheel *wheel,
+                       NdTimer      *timer)
+{
+        g_return_if_fail (wheel != NULL);
+        g_return_if_fail (timer != NULL);
+
+        if (!timer->paused)
+                return;
+
+        catch_up (wheel);
+
+        timer->paused = FALSE;
+        timer->deadline = nd_clock_get_monotonic_time (wheel->clock) + timer->remaining;
+        slot_timer (wheel, timer);
+        wheel->n_slotted++;
+
+        update_wakeup (wheel);
+}
+
+guint
+nd_timer_wheel_get_remaining (NdTimerWheel *wheel,
+                              NdTimer      *timer)
+{
+        gint64 remaining;
+
+        g_return_val_if_fail (wheel != NULL, 0);
+        g_return_val_if_fail (timer != NULL, 0);
+
+        if (timer->paused) {
+                remaining = timer->remaining;
+        } else {
+                remaining = MAX (timer->deadline - nd_clock_get_monotonic_time (wheel->clock), 0);
+        }
+
+        return remaining / G_TIME_SPAN_MILLISECOND;
+}
+
+guint
+nd_timer_wheel_get_n_timers (NdTimerWheel *wheel)
+{
+        g_return_val_if_fail (wheel != NULL, 0);
+
+        return wheel->n_timers;
+}
@@ -0,0 +1,55 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef __ND_TIMER_WHEEL_H
+#define __ND_TIMER_WHEEL_H
+
+#include <glib.h>
+
+#include "nd-clock.h"
+
+G_BEGIN_DECLS
+
+typedef struct NdTimerWheel NdTimerWheel;
+typedef struct NdTimer      NdTimer;
+
+/* Called once when a timer expires.  The timer is freed by the wheel
+ * after the callback returns, so the callback must forget any pointer
+ * it kept to it. */
+typedef void (* NdTimerFunc) (gpointer data);
+
+NdTimerWheel *      nd_timer_wheel_new                      (NdClock        *clock);
+void                nd_timer_wheel_free                     (NdTimerWheel   *wheel);
+
+NdTimer *           nd_timer_wheel_add                      (NdTimerWheel   *wheel,
+                                                             guint           msec,
+                                                             NdTimerFunc     func,
+                                                             gpointer        data);
+void                nd_timer_wheel_remove                   (NdTimerWheel   *wheel,
+                                                             NdTimer        *timer);
+void                nd_timer_wheel_pause                    (NdTimerWheel   *wheel,
+                                                             NdTimer        *timer);
+void                nd_timer_wheel_resume                   (NdTimerWheel   *wheel,
+                                                             NdTimer        *timer);
+guint               nd_timer_wheel_get_remaining            (NdTimerWheel   *wheel,
+                                                             NdTimer        *timer);
+guint               nd_timer_wheel_get_n_timers             (NdTimerWheel   *wheel);
+
+G_END_DECLS
+
+#endif /* __ND_TIMER_WHEEL_H */
@@ -0,0 +1,247 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+
+#include "config.h"
+
+#include <string.h>
+#include <time.h>
+
+#include <glib.h>
+
+#include "nd-usage.h"
+#include "nd-memory.h"
+
+/* What each producer of notifications costs the daemon, per sender
+ * and application name.  Senders come and go with their connections,
+ * so the table is bounded and forgets whoever was heard from least
+ * recently. */
+
+#define MAX_USAGES 256
+
+typedef struct
+{
+        char           *sender;
+        char           *app_name;
+
+        guint64         received;
+        guint64         replaced;
+        guint64         text_bytes;
+        guint64         hint_bytes;
+        guint64         image_bytes;
+        guint64         usec[ND_USAGE_N_PHASES];
+        guint64         windows;
+
+        guint64         last_used;
+} Usage;
+
+static GHashTable *usages = NULL;
+static guint64     serial = 0;
+
+static guint
+usage_hash (gconstpointer key)
+{
+        const Usage *usage = key;
+
+        return g_str_hash (usage->sender) * 31 + g_str_hash (usage->app_name);
+}
+
+static gboolean
+usage_equal (gconstpointer a,
+             gconstpointer b)
+{
+        const Usage *usage_a = a;
+        const Usage *usage_b = b;
+
+        return strcmp (usage_a->sender, usage_b->sender) == 0
+                && strcmp (usage_a->app_name, usage_b->app_name) == 0;
+}
+
+static gsize
+usage_size (Usage *usage)
+{
+        return sizeof (Usage) + strlen (usage->sender) + strlen (usage->app_name) + 2;
+}
+
+static void
+usage_free (Usage *usage)
+{
+        nd_memory_remove (ND_MEMORY_CACHES, usage_size (usage));
+        g_free (usage->sender);
+        g_free (usage->app_name);
+        g_slice_free (Usage, usage);
+}
+
+static void
+evict_least_recent (void)
+{
+        GHashTableIter iter;
+        Usage         *usage;
+        Usage         *oldest;
+
+        oldest = NULL;
+        g_hash_table_iter_init (&iter, usages);
+        while (g_hash_table_iter_next (&iter, (gpointer *) &usage, NULL)) {
+                if (oldest == NULL || usage->last_used < oldest->last_used) {
+                        oldest = usage;
+                }
+        }
+
+        if (oldest != NULL) {
+                g_hash_table_remove (usages, oldest);
+        }
+}
+
+static Usage *
+lookup_usage (const char *sender,
+              const char *app_name)
+{
+        Usage  key;
+        Usage *usage;
+
+        if (usages == NULL) {
+                usages = g_hash_table_new_full (usage_hash,
+                                                usage_equal,
+                                                (GDestroyNotify) usage_free,
+                                                NULL);
+        }
+
+        key.sender = (char *) (sender != NULL ? sender : "");
+        key.app_name = (char *) (app_name != NULL ? app_name : "");
+
+        usage = g_hash_table_lookup (usages, &key);
+        if (usage == NULL) {
+                if (g_hash_table_size (usages) >= MAX_USAGES) {
+                        evict_least_recent ();
+                }
+
+                usage = g_slice_new0 (Usage);
+                usage->sender = g_strdup (key.sender);
+                usage->app_name = g_strdup (key.app_name);
+                g_hash_table_add (usages, usage);
+                nd_memory_add (ND_MEMORY_CACHES, usage_size (usage));
+        }
+
+        usage->last_used = ++serial;
+
+        return usage;
+}
+
+/* CPU time of the calling thread in microseconds.  The daemon does
+ * its work on the main thread, so the difference between two calls
+ * is what the code in between cost, without time spent waiting. */
+gint64
+nd_usage_get_cpu_time (void)
+{
+#ifdef CLOCK_THREAD_CPUTIME_ID
+        struct timespec ts;
+
+        if (clock_gettime (CLOCK_THREAD_CPUTIME_ID, &ts) == 0) {
+                return (gint64) ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000;
+        }
+#endif
+
+        return 0;
+}
+
+void
+nd_usage_add_received (const char *sender,
+                       const char *app_name,
+                       gboolean    replaced,
+                       gsize       text_bytes,
+                       gsize       hint_bytes,
+                       gsize       image_bytes,
+                       gint64      parse_usec)
+{
+        Usage *usage;
+
+        usage = lookup_usage (sender, app_name);
+        usage->received++;
+        if (replaced) {
+                usage->replaced++;
+        }
+        usage->text_bytes += text_bytes;
+        usage->hint_bytes += hint_bytes;
+        usage->image_bytes += image_bytes;
+        usage->usec[ND_USAGE_PARSE] += MAX (parse_usec, 0);
+}
+
+/* Charges the CPU time since @start, from nd_usage_get_cpu_time(),
+ * to whoever sent @notification. */
+void
+nd_usage_charge (NdNotification *notification,
+                 NdUsagePhase    phase,
+                 gint64          start)
+{
+        Usage *usage;
+        gint64 elapsed;
+
+        g_return_if_fail (ND_IS_NOTIFICATION (notification));
+        g_return_if_fail (phase < ND_USAGE_N_PHASES);
+
+        elapsed = nd_usage_get_cpu_time () - start;
+        if (elapsed <= 0) {
+                return;
+        }
+
+        usage = lookup_usage (nd_notification_get_sender (notification),
+                              nd_notification_get_app_name (notification));
+        usage->usec[phase] += elapsed;
+}
+
+void
+nd_usage_add_window (NdNotification *notification)
+{
+        Usage *usage;
+
+        g_return_if_fail (ND_IS_NOTIFICATION (notification));
+
+        usage = lookup_usage (nd_notification_get_sender (notification),
+                              nd_notification_get_app_name (notification));
+        usage->windows++;
+}
+
+GVariant *
+nd_usage_get_stats (void)
+{
+        GVariantBuilder builder;
+        GHashTableIter  iter;
+        Usage          *usage;
+
+        g_variant_builder_init (&builder, ND_USAGE_STATS_TYPE);
+        if (usages != NULL) {
+                g_hash_table_iter_init (&iter, usages);
+                while (g_hash_table_iter_next (&iter, (gpointer *) &usage, NULL)) {
+                        g_variant_builder_add (&builder,
+                                               "(ssttttttttt)",
+                                               usage->sender,
+                                               usage->app_name,
+                                               usage->received,
+                                               usage->replaced,
+                                               usage->text_bytes,
+                                               usage->hint_bytes,
+                                               usage->image_bytes,
+                                               usage->usec[ND_USAGE_PARSE],
+                                               usage->usec[ND_USAGE_DECODE],
+                                               usage->usec[ND_USAGE_RENDER],
+                                               usage->windows);
+                }
+        }
+
+        return g_variant_builder_end (&builder);
+}
@@ -0,0 +1,59 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+
+#ifndef __ND_USAGE_H
+#define __ND_USAGE_H
+
+#include <glib.h>
+
+#include "nd-notification.h"
+
+G_BEGIN_DECLS
+
+typedef enum
+{
+        ND_USAGE_PARSE,
+        ND_USAGE_DECODE,
+        ND_USAGE_RENDER,
+        ND_USAGE_N_PHASES
+} NdUsagePhase;
+
+/* sender, app name, received, replaced, text, hint and image bytes,
+ * parse, decode and render CPU microseconds, windows created */
+#define ND_USAGE_STATS_TYPE G_VARIANT_TYPE ("a(ssttttttttt)")
+
+gint64              nd_usage_get_cpu_time                   (void);
+
+void                nd_usage_add_received                   (const char     *sender,
+                                                             const char     *app_name,
+                                                             gboolean        replaced,
+                                                             gsize           text_bytes,
+                                                             gsize           hint_bytes,
+                                                             gsize           image_bytes,
+                                                             gint64          parse_usec);
+void                nd_usage_charge                         (NdNotification *notification,
+                                                             NdUsagePhase    phase,
+                                                             gint64          start);
+void                nd_usage_add_window                     (NdNotification *notification);
+
+GVariant *          nd_usage_get_stats                      (void);
+
+G_END_DECLS
+
+#endif /* __ND_USAGE_H */
@@ -0,0 +1,431 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include "config.h"
+
+#include <glib.h>
+
+#include "nd-virtual-clock.h"
+
+#define ND_VIRTUAL_CLOCK_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), ND_TYPE_VIRTUAL_CLOCK, NdVirtualClockPrivate))
+
+/* A clock that only moves when it is told to.  Timeouts, idles and
+ * wakeups scheduled on it are kept in a sequence sorted by deadline
+ * and dispatched in that order by nd_virtual_clock_advance(), with
+ * the clock set to each deadline as it is reached, so hours of timer
+ * traffic can be replayed in milliseconds and always the same way.
+ * Entries with the same deadline run in the order they were made. */
+
+typedef enum
+{
+        ENTRY_TIMEOUT,
+        ENTRY_IDLE,
+        ENTRY_WAKEUP
+} EntryKind;
+
+typedef struct
+{
+        EntryKind         kind;
+        guint             id;
+        guint             serial;
+        gint64            ready_time;
+        guint             interval;
+        guint             pass;
+        gboolean          dispatching;
+        gboolean          removed;
+
+        /* position in the deadline order, NULL while disarmed */
+        GSequenceIter    *iter;
+
+        GSourceFunc       func;
+        NdClockWakeupFunc wakeup_func;
+        gpointer          data;
+} Entry;
+
+struct NdVirtualClockPrivate
+{
+        gint64      monotonic_time;
+        gint64      real_offset;
+
+        GHashTable *entries;
+        GSequence  *schedule;
+        GHashTable *sources;
+        guint       next_id;
+        guint       next_serial;
+
+        /* bumped on every advance */
+        guint       pass;
+};
+
+static void     nd_virtual_clock_class_init  (NdVirtualClockClass *klass);
+static void     nd_virtual_clock_init        (NdVirtualClock      *clock);
+static void     nd_virtual_clock_finalize    (GObject             *object);
+
+G_DEFINE_TYPE (NdVirtualClock, nd_virtual_clock, ND_TYPE_CLOCK)
+
+static int
+compare_entries (gconstpointer a,
+                 gconstpointer b,
+                 gpointer      data)
+{
+        const Entry *entry_a = a;
+        const Entry *entry_b = b;
+
+        if (entry_a->ready_time != entry_b->ready_time)
+                return entry_a->ready_time < entry_b->ready_time ? -1 : 1;
+
+        if (entry_a->serial != entry_b->serial)
+                return entry_a->serial < entry_b->serial ? -1 : 1;
+
+        return 0;
+}
+
+static void
+entry_set_ready_time (NdVirtualClock *clock,
+                      Entry          *entry,
+                      gint64          ready_time)
+{
+        if (entry->iter != NULL) {
+                g_sequence_remove (entry->iter);
+                entry->iter = NULL;
+        }
+
+        entry->ready_time = ready_time;
+
+        if (!entry->removed && ready_time >= 0) {
+                entry->iter = g_sequence_insert_sorted (clock->priv->schedule,
+                                                        entry,
+                                                        compare_entries,
+                                                        NULL);
+        }
+}
+
+static Entry *
+entry_new (NdVirtualClock *clock,
+           EntryKind       kind,
+           gint64          ready_time)
+{
+        Entry *entry;
+
+        entry = g_slice_new0 (Entry);
+        entry->kind = kind;
+        entry->serial = clock->priv->next_serial++;
+
+        if (kind != ENTRY_WAKEUP) {
+                entry->id = ++clock->priv->next_id;
+                g_hash_table_insert (clock->priv->sources,
+                                     GUINT_TO_POINTER (entry->id),
+                                     entry);
+        }
+
+        g_hash_table_insert (clock->priv->entries, entry, entry);
+        entry_set_ready_time (clock, entry, ready_time);
+
+        return entry;
+}
+
+static void
+entry_free (NdVirtualClock *clock,
+            Entry          *entry)
+{
+        entry->removed = TRUE;
+        entry_set_ready_time (clock, entry, -1);
+
+        /* dropped by its owner while it runs, freed once it returns */
+        if (entry->dispatching)
+                return;
+
+        if (entry->id != 0) {
+                g_hash_table_remove (clock->priv->sources,
+                                     GUINT_TO_POINTER (entry->id));
+        }
+
+        g_hash_table_remove (clock->priv->entries, entry);
+        g_slice_free (Entry, entry);
+}
+
+static Entry *
+find_due (NdVirtualClock *clock,
+          gint64          target)
+{
+        GSequenceIter *iter;
+
+        for (iter = g_sequence_get_begin_iter (clock->priv->schedule);
+             !g_sequence_iter_is_end (iter);
+             iter = g_sequence_iter_next (iter)) {
+                Entry *entry = g_sequence_get (iter);
+
+                if (entry->ready_time > target)
+                        break;
+
+                /* something that re-armed itself for the present runs
+                   again on the next pass, not in a loop on this one;
+                   only the few that did so this pass are stepped over */
+                if (entry->pass == clock->priv->pass
+                    && entry->ready_time <= clock->priv->monotonic_time)
+                        continue;
+
+                return entry;
+        }
+
+        return NULL;
+}
+
+static void
+dispatch_entry (NdVirtualClock *clock,
+                Entry          *entry)
+{
+        gboolean again;
+
+        entry->dispatching = TRUE;
+        entry->pass = clock->priv->pass;
+
+        switch (entry->kind) {
+        case ENTRY_WAKEUP:
+                entry_set_ready_time (clock, entry, -1);
+                entry->wakeup_func (entry->data);
+                break;
+        case ENTRY_IDLE:
+                again = entry->func (entry->data);
+                if (!again)
+                        entry->removed = TRUE;
+                break;
+        case ENTRY_TIMEOUT:
+                entry_set_ready_time (clock, entry,
+                                      clock->priv->monotonic_time
+                                      + (gint64) entry->interval * G_TIME_SPAN_MILLISECOND);
+                again = entry->func (entry->data);
+                if (!again)
+                        entry->removed = TRUE;
+                break;
+        default:
+                g_assert_not_reached ();
+        }
+
+        entry->dispatching = FALSE;
+
+        if (entry->removed)
+                entry_free (clock, entry);
+}
+
+static gint64
+nd_virtual_clock_get_monotonic_time (NdClock *clock)
+{
+        return ND_VIRTUAL_CLOCK (clock)->priv->monotonic_time;
+}
+
+static gint64
+nd_virtual_clock_get_real_time (NdClock *clock)
+{
+        NdVirtualClockPrivate *priv = ND_VIRTUAL_CLOCK (clock)->priv;
+
+        return priv->monotonic_time + priv->real_offset;
+}
+
+static guint
+nd_virtual_clock_timeout_add (NdClock    *clock,
+                              guint       interval,
+                              GSourceFunc func,
+                              gpointer    data)
+{
+        NdVirtualClock *vclock = ND_VIRTUAL_CLOCK (clock);
+        Entry          *entry;
+
+        entry = entry_new (vclock,
+                           ENTRY_TIMEOUT,
+                           vclock->priv->monotonic_time
+                           + (gint64) interval * G_TIME_SPAN_MILLISECOND);
+        entry->interval = interval;
+        entry->func = func;
+        entry->data = data;
+
+        return entry->id;
+}
+
+static guint
+nd_virtual_clock_idle_add (NdClock    *clock,
+                           GSourceFunc func,
+                           gpointer    data)
+{
+        NdVirtualClock *vclock = ND_VIRTUAL_CLOCK (clock);
+        Entry          *entry;
+
+        entry = entry_new (vclock, ENTRY_IDLE, vclock->priv->monotonic_time);
+        entry->func = func;
+        entry->data = data;
+
+        return entry->id;
+}
+
+static void
+nd_virtual_clock_source_remove (NdClock *clock,
+                                guint    id)
+{
+        NdVirtualClock *vclock = ND_VIRTUAL_CLOCK (clock);
+        Entry          *entry;
+
+        entry = g_hash_table_lookup (vclock->priv->sources, GUINT_TO_POINTER (id));
+        if (entry == NULL) {
+                g_warning ("Source ID %u was not found when attempting to remove it", id);
+                return;
+        }
+
+        entry_free (vclock, entry);
+}
+
+static NdClockWakeup *
+nd_virtual_clock_wakeup_new (NdClock          *clock,
+                             NdClockWakeupFunc func,
+                             gpointer          data)
+{
+        Entry *entry;
+
+        entry = entry_new (ND_VIRTUAL_CLOCK (clock), ENTRY_WAKEUP, -1);
+        entry->wakeup_func = func;
+        entry->data = data;
+
+        return (NdClockWakeup *) entry;
+}
+
+static void
+nd_virtual_clock_wakeup_set (NdClock       *clock,
+                             NdClockWakeup *wakeup,
+                             gint64         ready_time)
+{
+        entry_set_ready_time (ND_VIRTUAL_CLOCK (clock), (Entry *) wakeup, ready_time);
+}
+
+static void
+nd_virtual_clock_wakeup_free (NdClock       *clock,
+                              NdClockWakeup *wakeup)
+{
+        entry_free (ND_VIRTUAL_CLOCK (clock), (Entry *) wakeup);
+}
+
+static void
+nd_virtual_clock_class_init (NdVirtualClockClass *klass)
+{
+        GObjectClass *object_class = G_OBJECT_CLASS (klass);
+        NdClockClass *clock_class = ND_CLOCK_CLASS (klass);
+
+        object_class->finalize = nd_virtual_clock_finalize;
+
+        clock_class->get_monotonic_time = nd_virtual_clock_get_monotonic_time;
+        clock_class->get_real_time = nd_virtual_clock_get_real_time;
+        clock_class->timeout_add = nd_virtual_clock_timeout_add;
+        clock_class->idle_add = nd_virtual_clock_idle_add;
+        clock_class->source_remove = nd_virtual_clock_source_remove;
+        clock_class->wakeup_new = nd_virtual_clock_wakeup_new;
+        clock_class->wakeup_set = nd_virtual_clock_wakeup_set;
+        clock_class->wakeup_free = nd_virtual_clock_wakeup_free;
+
+        g_type_class_add_private (klass, sizeof (NdVirtualClockPrivate));
+}
+
+static void
+nd_virtual_clock_init (NdVirtualClock *clock)
+{
+        clock->priv = ND_VIRTUAL_CLOCK_GET_PRIVATE (clock);
+
+        /* start out at the present so time stamps look sane */
+        clock->priv->monotonic_time = g_get_monotonic_time ();
+        clock->priv->real_offset = g_get_real_time () - clock->priv->monotonic_time;
+
+        clock->priv->entries = g_hash_table_new (NULL, NULL);
+        clock->priv->schedule = g_sequence_new (NULL);
+        clock->priv->sources = g_hash_table_new (NULL, NULL);
+}
+
+static void
+free_entry (gpointer key,
+            gpointer value,
+            gpointer data)
+{
+        g_slice_free (Entry, value);
+}
+
+static void
+nd_virtual_clock_finalize (GObject *object)
+{
+        NdVirtualClock *clock;
+
+        g_return_if_fail (object != NULL);
+        g_return_if_fail (ND_IS_VIRTUAL_CLOCK (object));
+
+        clock = ND_VIRTUAL_CLOCK (object);
+
+        g_return_if_fail (clock->priv != NULL);
+
+        g_sequence_free (clock->priv->schedule);
+        g_hash_table_foreach (clock->priv->entries, free_entry, NULL);
+        g_hash_table_destroy (clock->priv->entries);
+        g_hash_table_destroy (clock->priv->sources);
+
+        G_OBJECT_CLASS (nd_virtual_clock_parent_class)->finalize (object);
+}
+
+NdClock *
+nd_virtual_clock_new (void)
+{
+        return g_object_new (ND_TYPE_VIRTUAL_CLOCK, NULL);
+}
+
+/* Moves the clock @usec microseconds forward, dispatching everything
+ * that comes due on the way in deadline order.  Returns the number of
+ * callbacks that ran. */
+guint
+nd_virtual_clock_advance (NdVirtualClock *clock,
+                          gint64          usec)
+{
+        gint64 target;
+        guint  n_dispatched;
+        Entry *entry;
+
+        g_return_val_if_fail (ND_IS_VIRTUAL_CLOCK (clock), 0);
+        g_return_val_if_fail (usec >= 0, 0);
+
+        target = clock->priv->monotonic_time + usec;
+        clock->priv->pass++;
+
+        n_dispatched = 0;
+        while ((entry = find_due (clock, target)) != NULL) {
+                clock->priv->monotonic_time = MAX (clock->priv->monotonic_time,
+                                                   entry->ready_time);
+                dispatch_entry (clock, entry);
+                n_dispatched++;
+        }
+
+        clock->priv->monotonic_time = target;
+
+        return n_dispatched;
+}
+
+/* Runs idles and anything already due without moving the clock. */
+guint
+nd_virtual_clock_run_pending (NdVirtualClock *clock)
+{
+        return nd_virtual_clock_advance (clock, 0);
+}
+
+guint
+nd_virtual_clock_get_n_pending (NdVirtualClock *clock)
+{
+        g_return_val_if_fail (ND_IS_VIRTUAL_CLOCK (clock), 0);
+
+        return g_sequence_get_length (clock->priv->schedule);
+}
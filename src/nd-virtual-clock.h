@@ -0,0 +1,57 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef __ND_VIRTUAL_CLOCK_H
+#define __ND_VIRTUAL_CLOCK_H
+
+#include "nd-clock.h"
+
+G_BEGIN_DECLS
+
+#define ND_TYPE_VIRTUAL_CLOCK         (nd_virtual_clock_get_type ())
+#define ND_VIRTUAL_CLOCK(o)           (G_TYPE_CHECK_INSTANCE_CAST ((o), ND_TYPE_VIRTUAL_CLOCK, NdVirtualClock))
+#define ND_VIRTUAL_CLOCK_CLASS(k)     (G_TYPE_CHECK_CLASS_CAST((k), ND_TYPE_VIRTUAL_CLOCK, NdVirtualClockClass))
+#define ND_IS_VIRTUAL_CLOCK(o)        (G_TYPE_CHECK_INSTANCE_TYPE ((o), ND_TYPE_VIRTUAL_CLOCK))
+#define ND_IS_VIRTUAL_CLOCK_CLASS(k)  (G_TYPE_CHECK_CLASS_TYPE ((k), ND_TYPE_VIRTUAL_CLOCK))
+#define ND_VIRTUAL_CLOCK_GET_CLASS(o) (G_TYPE_INSTANCE_GET_CLASS ((o), ND_TYPE_VIRTUAL_CLOCK, NdVirtualClockClass))
+
+typedef struct NdVirtualClockPrivate NdVirtualClockPrivate;
+
+typedef struct
+{
+        NdClock                parent;
+        NdVirtualClockPrivate *priv;
+} NdVirtualClock;
+
+typedef struct
+{
+        NdClockClass           parent_class;
+} NdVirtualClockClass;
+
+GType               nd_virtual_clock_get_type               (void);
+
+NdClock *           nd_virtual_clock_new                    (void);
+
+guint               nd_virtual_clock_advance                (NdVirtualClock *clock,
+                                                             gint64          usec);
+guint               nd_virtual_clock_run_pending            (NdVirtualClock *clock);
+guint               nd_virtual_clock_get_n_pending          (NdVirtualClock *clock);
+
+G_END_DECLS
+
+#endif /* __ND_VIRTUAL_CLOCK_H */
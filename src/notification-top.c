@@ -0,0 +1,271 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib/gi18n.h>
+#include <glib.h>
+#include <gio/gio.h>
+
+/* Lists what each producer of notifications costs the running
+ * daemon, most expensive first, from its GetUsageStats method. */
+
+#define NOTIFICATION_BUS_NAME      "org.freedesktop.Notifications"
+#define NOTIFICATION_BUS_PATH      "/org/freedesktop/Notifications"
+#define NOTIFICATION_INTERFACE     "org.freedesktop.Notifications"
+
+#define DEFAULT_ROWS 10
+
+typedef struct
+{
+        char           *sender;
+        char           *app_name;
+        guint64         received;
+        guint64         replaced;
+        guint64         text_bytes;
+        guint64         hint_bytes;
+        guint64         image_bytes;
+        guint64         parse_usec;
+        guint64         decode_usec;
+        guint64         render_usec;
+        guint64         windows;
+} Row;
+
+static char    *group_by = NULL;
+static char    *sort_by = NULL;
+static int      n_rows = DEFAULT_ROWS;
+
+static GOptionEntry entries[] = {
+        { "by", 'b', 0, G_OPTION_ARG_STRING, &group_by,
+          N_("Add up per \"sender\" or per \"app\" instead of per both"), N_("KEY") },
+        { "sort", 's', 0, G_OPTION_ARG_STRING, &sort_by,
+          N_("Order by \"cpu\", \"received\", \"bytes\" or \"windows\""), N_("KEY") },
+        { "lines", 'n', 0, G_OPTION_ARG_INT, &n_rows,
+          N_("Show the first N producers, 0 for all"), N_("N") },
+        { NULL }
+};
+
+static void
+row_free (Row *row)
+{
+        g_free (row->sender);
+        g_free (row->app_name);
+        g_free (row);
+}
+
+static guint64
+row_cpu (const Row *row)
+{
+        return row->parse_usec + row->decode_usec + row->render_usec;
+}
+
+static guint64
+row_bytes (const Row *row)
+{
+        return row->text_bytes + row->hint_bytes + row->image_bytes;
+}
+
+static guint64
+row_key (const Row *row)
+{
+        if (g_strcmp0 (sort_by, "received") == 0) {
+                return row->received;
+        } else if (g_strcmp0 (sort_by, "bytes") == 0) {
+                return row_bytes (row);
+        } else if (g_strcmp0 (sort_by, "windows") == 0) {
+                return row->windows;
+        }
+
+        return row_cpu (row);
+}
+
+static int
+compare_rows (gconstpointer a,
+              gconstpointer b)
+{
+        guint64 key_a;
+        guint64 key_b;
+
+        key_a = row_key (*(Row **) a);
+        key_b = row_key (*(Row **) b);
+
+        return key_a < key_b ? 1 : key_a > key_b ? -1 : 0;
+}
+
+static GPtrArray *
+collect_rows (GVariant *stats)
+{
+        GHashTable   *groups;
+        GPtrArray    *rows;
+        GVariantIter  iter;
+        Row           entry;
+        const char   *sender;
+        const char   *app_name;
+
+        groups = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+        rows = g_ptr_array_new_with_free_func ((GDestroyNotify) row_free);
+
+        g_variant_iter_init (&iter, stats);
+        while (g_variant_iter_next (&iter,
+                                    "(&s&sttttttttt)",
+                                    &sender,
+                                    &app_name,
+                                    &entry.received,
+                                    &entry.replaced,
+                                    &entry.text_bytes,
+                                    &entry.hint_bytes,
+                                    &entry.image_bytes,
+                                    &entry.parse_usec,
+                                    &entry.decode_usec,
+                                    &entry.render_usec,
+                                    &entry.windows)) {
+                Row  *row;
+                char *key;
+
+                if (g_strcmp0 (group_by, "sender") == 0) {
+                        app_name = "*";
+                } else if (g_strcmp0 (group_by, "app") == 0) {
+                        sender = "*";
+                }
+
+                key = g_strconcat (sender, "\n", app_name, NULL);
+                row = g_hash_table_lookup (groups, key);
+                if (row == NULL) {
+                        row = g_new0 (Row, 1);
+                        row->sender = g_strdup (sender);
+                        row->app_name = g_strdup (app_name);
+                        g_ptr_array_add (rows, row);
+                        g_hash_table_insert (groups, key, row);
+                } else {
+                        g_free (key);
+                }
+
+                row->received += entry.received;
+                row->replaced += entry.replaced;
+                row->text_bytes += entry.text_bytes;
+                row->hint_bytes += entry.hint_bytes;
+                row->image_bytes += entry.image_bytes;
+                row->parse_usec += entry.parse_usec;
+                row->decode_usec += entry.decode_usec;
+                row->render_usec += entry.render_usec;
+                row->windows += entry.windows;
+        }
+
+        g_hash_table_destroy (groups);
+
+        g_ptr_array_sort (rows, compare_rows);
+
+        return rows;
+}
+
+static void
+print_rows (GPtrArray *rows)
+{
+        guint i;
+
+        g_print ("%-16s %-20s %8s %8s %10s %10s %9s %9s %9s %7s\n",
+                 "SENDER", "APP", "RECEIVED", "REPLACED", "BYTES", "IMAGES",
+                 "PARSE ms", "DECODE ms", "RENDER ms", "WINDOWS");
+
+        for (i = 0; i < rows->len; i++) {
+                Row *row = g_ptr_array_index (rows, i);
+
+                if (n_rows > 0 && i >= (guint) n_rows) {
+                        break;
+                }
+
+                g_print ("%-16s %-20s %8" G_GUINT64_FORMAT " %8" G_GUINT64_FORMAT
+                         " %10" G_GUINT64_FORMAT " %10" G_GUINT64_FORMAT
+                         " %9.1f %9.1f %9.1f %7" G_GUINT64_FORMAT "\n",
+                         *row->sender != '\0' ? row->sender : "-",
+                         *row->app_name != '\0' ? row->app_name : "-",
+                         row->received,
+                         row->replaced,
+                         row_bytes (row),
+                         row->image_bytes,
+                         row->parse_usec / 1000.0,
+                         row->decode_usec / 1000.0,
+                         row->render_usec / 1000.0,
+                         row->windows);
+        }
+}
+
+int
+main (int argc, char **argv)
+{
+        GOptionContext  *context;
+        GDBusConnection *connection;
+        GVariant        *result;
+        GVariant        *stats;
+        GPtrArray       *rows;
+        GError          *error;
+
+        context = g_option_context_new (NULL);
+        g_option_context_set_summary (context, _("Show which programs cost the notification daemon the most."));
+        g_option_context_add_main_entries (context, entries, GETTEXT_PACKAGE);
+
+        error = NULL;
+        if (! g_option_context_parse (context, &argc, &argv, &error)) {
+                g_printerr ("%s\n", error->message);
+                g_error_free (error);
+                g_option_context_free (context);
+                return 1;
+        }
+        g_option_context_free (context);
+
+        connection = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, &error);
+        if (connection == NULL) {
+                g_printerr ("%s\n", error->message);
+                g_error_free (error);
+                return 1;
+        }
+
+        /* a daemon started only to be asked would have nothing to say */
+        result = g_dbus_connection_call_sync (connection,
+                                              NOTIFICATION_BUS_NAME,
+                                              NOTIFICATION_BUS_PATH,
+                                              NOTIFICATION_INTERFACE,
+                                              "GetUsageStats",
+                                              NULL,
+                                              G_VARIANT_TYPE ("(a(ssttttttttt))"),
+                                              G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                                              -1,
+                                              NULL,
+                                              &error);
+        if (result == NULL) {
+                g_printerr ("%s\n", error->message);
+                g_error_free (error);
+                g_object_unref (connection);
+                return 1;
+        }
+
+        stats = g_variant_get_child_value (result, 0);
+        rows = collect_rows (stats);
+        print_rows (rows);
+
+        g_ptr_array_unref (rows);
+        g_variant_unref (stats);
+        g_variant_unref (result);
+        g_object_unref (connection);
+
+        return 0;
+}
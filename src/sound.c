@@ -36,3 +36,9 @@ sound_play_file (GtkWidget *widget,
                                 NULL);
 }
 
+/* Opens the sound backend ahead of the first event sound. */
+void
+sound_warm_up (void)
+{
+        ca_context_open (ca_gtk_context_get ());
+}
@@ -25,5 +25,6 @@
 
 void sound_play_file (GtkWidget *widget,
                       const char *filename);
+void sound_warm_up (void);
 
 #endif /* _SOUND_H */
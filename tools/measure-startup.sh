@@ -0,0 +1,146 @@
+#!/bin/sh
+# Measures how long the daemon takes to start on a private session bus.
+#
+#   activation  time from a GetServerInformation call that has to
+#               activate the daemon until its reply
+#   name        time from starting the daemon until it owns its bus
+#               name, as seen by gdbus wait, which is an upper bound,
+#               and as the daemon reports it from main()
+#
+# Usage: tools/measure-startup.sh [MODE] [RUNS] [DAEMON]
+#
+# MODE defaults to activation, RUNS to 20 and DAEMON to the one in the
+# build tree.  Each run gets a fresh bus, so every start is a cold one
+# as far as D-Bus is concerned.  Prints one line with the minimum,
+# median and maximum in milliseconds, and the median of the second
+# figure: a plain call to the bus for what gdbus itself costs, or the
+# daemon's own count.  Needs dbus-run-session, gdbus 2.52 and GNU
+# date.
+
+# nanoseconds
+now () {
+        date +%s%N
+}
+
+call () {
+        gdbus call --session \
+                   --dest "$1" \
+                   --object-path "$2" \
+                   --method "$3" > /dev/null
+}
+
+measure_activation () {
+        start=`now`
+        call org.freedesktop.DBus /org/freedesktop/DBus \
+             org.freedesktop.DBus.GetId || return 1
+        base=`now`
+        call org.freedesktop.Notifications /org/freedesktop/Notifications \
+             org.freedesktop.Notifications.GetServerInformation || return 1
+        end=`now`
+
+        echo "$start $base $end" | awk '{ printf "%.1f %.1f\n", ($3 - $2) / 1000000, ($2 - $1) / 1000000 }'
+}
+
+measure_name () {
+        log=`mktemp` || return 1
+
+        start=`now`
+        G_MESSAGES_DEBUG=all "$daemon" 2> "$log" &
+        pid=$!
+        gdbus wait --session --timeout 10 org.freedesktop.Notifications || {
+                kill $pid
+                rm -f "$log"
+                return 1
+        }
+        end=`now`
+
+        # the debug line is written just after the name is granted
+        tries=0
+        until grep -q "Name acquired" "$log" || [ $tries -ge 50 ]; do
+                sleep 0.02
+                tries=`expr $tries + 1`
+        done
+        self=`sed -n 's/.*Name acquired \([0-9]*\) ms after startup.*/\1/p' "$log"`
+
+        kill $pid
+        wait $pid 2> /dev/null
+        rm -f "$log"
+
+        echo "$start $end ${self:-nan}" | awk '{ printf "%.1f %s\n", ($2 - $1) / 1000000, $3 }'
+}
+
+# one measurement, run by ourselves inside a fresh bus
+if [ "$1" = "--run" ]; then
+        daemon=$3
+        measure_$2
+        exit $?
+fi
+
+mode=${1:-activation}
+runs=${2:-20}
+daemon=${3:-`dirname $0`/../src/notification-daemon}
+
+case "$mode" in
+    activation) second=bus-call ;;
+    name) second=self-reported ;;
+    *)
+        echo "Unknown mode $mode" >&2
+        exit 1
+        ;;
+esac
+
+case "$daemon" in
+    /*) ;;
+    *) daemon=`pwd`/$daemon ;;
+esac
+
+test -x "$daemon" || {
+        echo "$daemon is not built" >&2
+        exit 1
+}
+
+tmpdir=`mktemp -d` || exit 1
+trap 'rm -rf "$tmpdir"' EXIT
+
+mkdir "$tmpdir/services"
+cat > "$tmpdir/services/org.freedesktop.Notifications.service" <<EOF
+[D-BUS Service]
+Name=org.freedesktop.Notifications
+Exec=$daemon
+EOF
+
+cat > "$tmpdir/bus.conf" <<EOF
+<!DOCTYPE busconfig PUBLIC "-//freedesktop//DTD D-Bus Bus Configuration 1.0//EN"
+ "http://www.freedesktop.org/standards/dbus/1.0/busconfig.dtd">
+<busconfig>
+  <type>session</type>
+  <listen>unix:tmpdir=$tmpdir</listen>
+  <servicedir>$tmpdir/services</servicedir>
+  <policy context="default">
+    <allow send_destination="*" eavesdrop="true"/>
+    <allow eavesdrop="true"/>
+    <allow own="*"/>
+  </policy>
+</busconfig>
+EOF
+
+: > "$tmpdir/times"
+i=0
+while [ $i -lt $runs ]; do
+        dbus-run-session --config-file="$tmpdir/bus.conf" -- \
+                sh "$0" --run "$mode" "$daemon" >> "$tmpdir/times" 2> "$tmpdir/log" || {
+                cat "$tmpdir/log" >&2
+                echo "Run $i failed" >&2
+                exit 1
+        }
+        i=`expr $i + 1`
+done
+
+median=`cut -d' ' -f2 "$tmpdir/times" | sort -n | awk '{ t[NR] = $1 } END { print t[int ((NR + 1) / 2)] }'`
+
+cut -d' ' -f1 "$tmpdir/times" | sort -n | awk -v mode="$mode" -v second="$second" -v median="$median" '
+        { t[NR] = $1 }
+        END {
+                printf "%s-ms runs=%d min=%.1f median=%.1f max=%.1f %s-median=%s\n",
+                       mode, NR, t[1], t[int ((NR + 1) / 2)], t[NR], second, median
+        }'